@@ -21,6 +21,7 @@ namespace DDD
 	const ID INVALID_ID = 0;
 
 	class Entity;
+	class LightEntity;
 	class Aggregate;
 	class Service;
 	class IPersistence;
@@ -32,6 +33,9 @@ namespace DDD
 	template <typename T>
 	concept DerivedFromEntity = std::is_base_of_v<Entity, T>;
 
+	template <typename T>
+	concept DerivedFromLightEntity = std::is_base_of_v<LightEntity, T>;
+
 	template <typename T>
 	concept DerivedFromService = std::is_base_of_v<Service, T>;
 
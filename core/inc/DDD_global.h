@@ -27,7 +27,22 @@
 #endif
 
 /// USER_SECTION_START 2
+// Storage backend of the repositories and aggregates.
+// 1: open addressing DDD::FlatHashMap, 0: std::unordered_map
+#ifndef DDD_USE_FLAT_HASH_MAP
+	#define DDD_USE_FLAT_HASH_MAP 1
+#endif
 
+// Lowest level of the repository and model hot path log messages that gets compiled in,
+// see utilities/HotPathLog.h
+// 0: trace, 1: debug, 2: info, 3: warning, 4: error, 5: off
+#ifndef DDD_HOT_PATH_LOG_LEVEL
+	#ifdef NDEBUG
+		#define DDD_HOT_PATH_LOG_LEVEL 3
+	#else
+		#define DDD_HOT_PATH_LOG_LEVEL 1
+	#endif
+#endif
 /// USER_SECTION_END
 
 #ifdef QT_ENABLED
@@ -1,6 +1,10 @@
 #pragma once
 #include "DDD_base.h"
 #include "model/Entity.h"
+#include "model/LightEntity.h"
+#include "model/AggregateView.h"
+#include "utilities/SmallIDMap.h"
+#include <atomic>
 
 namespace DDD
 {
@@ -14,10 +18,11 @@ namespace DDD
 	 * 
 	 * 
 	 */
-	class DDD_API Aggregate : public Entity
+	class DDD_API Aggregate : public Entity, public EntityObserver
 	{
 		Q_OBJECT
 			friend class IRepository;
+			friend class LightEntity;
 	public:
 		explicit Aggregate()
 			: Entity(INVALID_ID)
@@ -27,6 +32,7 @@ namespace DDD
 			: Entity(id)
 			, m_isInRepository(false)
 		{}
+		~Aggregate() override;
 
 		bool operator==(const Aggregate& other) const;
 		bool operator!=(const Aggregate& other) const;
@@ -81,6 +87,65 @@ namespace DDD
 		 */
 		template <DerivedFromEntity ET> [[nodiscard]] std::vector<std::shared_ptr<ET>> getEntities() const;
 
+		/**
+		 * @brief
+		 * Gets the entity with the id as ET, without touching its reference count.
+		 * @return Entity pointer if the entity exists and is of the given type, nullptr otherwise.
+		 */
+		template <DerivedFromEntity ET> [[nodiscard]] ET* findEntity(const ID id);
+		template <DerivedFromEntity ET> [[nodiscard]] const ET* findEntity(const ID id) const;
+
+		[[nodiscard]] size_t getEntityCount() const
+		{
+			return m_entities.size();
+		}
+
+		/**
+		 * @brief
+		 * Calls func(Entity&) for each child entity, without allocating a list
+		 * and without copying shared_ptr's.
+		 * The typed version only visits the entities of type ET and passes ET&.
+		 * If func returns bool, returning false stops the iteration.
+		 * Entities must not be added or removed from inside func.
+		 */
+		template <typename F> void forEachEntity(F&& func);
+		template <typename F> void forEachEntity(F&& func) const;
+		template <DerivedFromEntity ET, typename F> void forEachEntity(F&& func);
+		template <DerivedFromEntity ET, typename F> void forEachEntity(F&& func) const;
+
+		/**
+		 * @brief
+		 * Adds a child entity without QObject base, see LightEntity.
+		 * The entity ID must not be used by an Entity child of this aggregate.
+		 * The "entityAdded" signal is emitted after the entity is added.
+		 * @return true if the entity was added, false otherwise.
+		 */
+		bool addLightEntity(const std::shared_ptr<LightEntity>& entity);
+
+		/**
+		 * @brief
+		 * Removes a LightEntity child.
+		 * The "entityRemoved" signal is emitted after the entity is removed.
+		 * @return true if the entity was removed, false otherwise.
+		 */
+		bool removeLightEntity(const ID id);
+
+		[[nodiscard]] std::shared_ptr<LightEntity> getLightEntity(const ID id) const;
+		template <DerivedFromLightEntity ET> [[nodiscard]] ET* findLightEntity(const ID id);
+		template <DerivedFromLightEntity ET> [[nodiscard]] const ET* findLightEntity(const ID id) const;
+
+		[[nodiscard]] size_t getLightEntityCount() const
+		{
+			return m_lightEntities ? m_lightEntities->size() : 0;
+		}
+
+		/**
+		 * @brief
+		 * Calls func(LightEntity&) for each LightEntity child, see forEachEntity().
+		 */
+		template <typename F> void forEachLightEntity(F&& func);
+		template <typename F> void forEachLightEntity(F&& func) const;
+
 		/**
 		 * @return true, if the Aggregate is contained in a repository of a model.
 		 */
@@ -89,6 +154,29 @@ namespace DDD
 			return m_isInRepository;
 		}
 
+		/**
+		 * @brief
+		 * Approximate memory in bytes that the aggregate owns outside of its own object,
+		 * used for the memory limit of the deleted cache, see DeletedCachePolicy.
+		 * The default counts the child entities by the size of their base class.
+		 * Override it to add the memory of further owned data.
+		 */
+		[[nodiscard]] virtual size_t getApproximateHeapSize() const;
+
+		/**
+		 * @brief
+		 * Tick of the last lookup of the aggregate by its ID, see Model::setEvictionPolicy().
+		 * Lookups from multiple threads may set it at the same time.
+		 */
+		[[nodiscard]] uint64_t getLastAccess() const
+		{
+			return m_lastAccess.load(std::memory_order_relaxed);
+		}
+		void setLastAccess(uint64_t tick) const
+		{
+			m_lastAccess.store(tick, std::memory_order_relaxed);
+		}
+
 		QJsonObject toDebugJsonObject() const override;
 
 
@@ -105,30 +193,155 @@ namespace DDD
 			emit entityDeleted(entityID);
 		}
 
+	private:
+		// Child entity events, the aggregate is the owner of its entities
+		void onEntityDeleteMarked(Entity& entity) override
+		{
+			onEntityDeleteMarketd(entity.getID());
+		}
+		void onEntityDataChanged(Entity& entity) override
+		{
+			emit entityChanged(entity.getID());
+			notifyOwnerDataChanged();
+		}
+		void onLightEntityDeleteMarked(LightEntity& entity)
+		{
+			const ID id = entity.getID();
+			removeLightEntity(id);
+			emit entityDeleted(id);
+		}
+		void onLightEntityDataChanged(LightEntity& entity)
+		{
+			emit entityChanged(entity.getID());
+			notifyOwnerDataChanged();
+		}
+
+		// A change of the child entities is a change of the aggregate for its owner, see Repository::getDirtyIDs()
+		void notifyOwnerDataChanged()
+		{
+			if (m_owner)
+				m_owner->onEntityDataChanged(*this);
+		}
+		// Sets or clears the parent/owner pointers of all child entities
+		void unlinkEntities();
+		void linkEntities();
+
 
 	private:
-		std::unordered_map<ID, std::shared_ptr<Entity>> m_entities;
+		// Entity IDs are usually small, they get stored inline without hashing
+		SmallIDMap<std::shared_ptr<Entity>> m_entities;
+
+		// Only allocated when the first LightEntity gets added
+		std::unique_ptr<SmallIDMap<std::shared_ptr<LightEntity>>> m_lightEntities;
 
 		bool m_isInRepository;
+
+		// Only the latest lookup matters, it needs no ordering
+		mutable std::atomic<uint64_t> m_lastAccess{ 0 };
 	};
 
 
 	template <DerivedFromEntity ET>
 	[[nodiscard]] std::shared_ptr<ET> Aggregate::getEntity(const ID id) const
 	{
-		return std::dynamic_pointer_cast<ET>(getEntity(id));
+		const std::shared_ptr<Entity>* entity = m_entities.find(id);
+		if (!entity)
+			return nullptr;
+		ET* casted = dynamic_cast<ET*>(entity->get());
+		if (!casted)
+			return nullptr;
+		return std::shared_ptr<ET>(*entity, casted);
 	}
 	template <DerivedFromEntity ET>
 	[[nodiscard]] std::vector<std::shared_ptr<ET>> Aggregate::getEntities() const
 	{
 		std::vector<std::shared_ptr<ET>> entities;
 		entities.reserve(m_entities.size());
-		for (const auto& it : m_entities)
-		{
-			std::shared_ptr<ET> entity = std::dynamic_pointer_cast<ET>(it.second);
-			if (entity)
-				entities.push_back(entity);
-		}
+		m_entities.forEach([&entities](ID, const std::shared_ptr<Entity>& entity)
+			{
+				if (ET* casted = dynamic_cast<ET*>(entity.get()))
+					entities.push_back(std::shared_ptr<ET>(entity, casted));
+			});
 		return entities;
 	}
-}
\ No newline at end of file
+	template <DerivedFromEntity ET>
+	[[nodiscard]] ET* Aggregate::findEntity(const ID id)
+	{
+		const std::shared_ptr<Entity>* entity = m_entities.find(id);
+		return entity ? dynamic_cast<ET*>(entity->get()) : nullptr;
+	}
+	template <DerivedFromEntity ET>
+	[[nodiscard]] const ET* Aggregate::findEntity(const ID id) const
+	{
+		const std::shared_ptr<Entity>* entity = m_entities.find(id);
+		return entity ? dynamic_cast<const ET*>(entity->get()) : nullptr;
+	}
+
+	template <typename F>
+	void Aggregate::forEachEntity(F&& func)
+	{
+		m_entities.forEach([&func](ID, const std::shared_ptr<Entity>& entity)
+			{
+				return invokeAggregateVisitor(func, *entity);
+			});
+	}
+	template <typename F>
+	void Aggregate::forEachEntity(F&& func) const
+	{
+		m_entities.forEach([&func](ID, const std::shared_ptr<Entity>& entity)
+			{
+				return invokeAggregateVisitor(func, std::as_const(*entity));
+			});
+	}
+	template <DerivedFromEntity ET, typename F>
+	void Aggregate::forEachEntity(F&& func)
+	{
+		m_entities.forEach([&func](ID, const std::shared_ptr<Entity>& entity)
+			{
+				ET* casted = dynamic_cast<ET*>(entity.get());
+				return !casted || invokeAggregateVisitor(func, *casted);
+			});
+	}
+	template <DerivedFromEntity ET, typename F>
+	void Aggregate::forEachEntity(F&& func) const
+	{
+		m_entities.forEach([&func](ID, const std::shared_ptr<Entity>& entity)
+			{
+				const ET* casted = dynamic_cast<const ET*>(entity.get());
+				return !casted || invokeAggregateVisitor(func, *casted);
+			});
+	}
+
+	template <DerivedFromLightEntity ET>
+	[[nodiscard]] ET* Aggregate::findLightEntity(const ID id)
+	{
+		const std::shared_ptr<LightEntity>* entity = m_lightEntities ? m_lightEntities->find(id) : nullptr;
+		return entity ? dynamic_cast<ET*>(entity->get()) : nullptr;
+	}
+	template <DerivedFromLightEntity ET>
+	[[nodiscard]] const ET* Aggregate::findLightEntity(const ID id) const
+	{
+		const std::shared_ptr<LightEntity>* entity = m_lightEntities ? m_lightEntities->find(id) : nullptr;
+		return entity ? dynamic_cast<const ET*>(entity->get()) : nullptr;
+	}
+	template <typename F>
+	void Aggregate::forEachLightEntity(F&& func)
+	{
+		if (!m_lightEntities)
+			return;
+		m_lightEntities->forEach([&func](ID, const std::shared_ptr<LightEntity>& entity)
+			{
+				return invokeAggregateVisitor(func, *entity);
+			});
+	}
+	template <typename F>
+	void Aggregate::forEachLightEntity(F&& func) const
+	{
+		if (!m_lightEntities)
+			return;
+		m_lightEntities->forEach([&func](ID, const std::shared_ptr<LightEntity>& entity)
+			{
+				return invokeAggregateVisitor(func, std::as_const(*entity));
+			});
+	}
+}
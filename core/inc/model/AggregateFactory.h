@@ -1,6 +1,8 @@
 #pragma once
 #include "DDD_base.h"
 #include "utilities/UniqueIDDomain.h"
+#include "utilities/ObjectPool.h"
+#include "utilities/BinarySnapshot.h"
 
 namespace DDD
 {
@@ -43,6 +45,13 @@ namespace DDD
 	*  The factory can be used to create new instances of the aggregate:
 	*  animalFactory->createAggregate();
 	*
+	*  Factories with high creation rates can use createPooledAggregate() instead of std::make_shared,
+	*  entities created in the aggregate constructor can use DDD::makePooled<ENTITY>().
+	*  The memory of deleted aggregates gets reused for new ones, getPoolStats() shows the allocation counters.
+	*
+	*  Override serialize() and deserialize() to store the aggregates in a binary snapshot,
+	*  see Model::saveBinarySnapshot() and Model::loadBinarySnapshot().
+	*
 	*
 	*
 	*/
@@ -57,12 +66,58 @@ namespace DDD
 			: m_logger(getAggregateName() + "Factory")
 #endif
 		{}
+		virtual ~AggregateFactory() = default;
+
 		void unregister()
 		{
 #if LOGGER_LIBRARY_AVAILABLE == 1
 			setLoggerParentID(0);
 #endif
 		}
+		/**
+		 * @brief Gets the allocation counters of the aggregates created by createPooledAggregate().
+		 */
+		[[nodiscard]] static ObjectPoolStats getPoolStats()
+		{
+			return DDD::getPoolStats<AGG>();
+		}
+
+		/**
+		 * @brief
+		 * Writes the data of the aggregate to a binary snapshot, see Model::saveBinarySnapshot().
+		 * The ID is stored by the snapshot, it does not have to be written.
+		 * @return false if the aggregate can't be written, the default implementation does not support snapshots.
+		 */
+		virtual bool serialize(const AGG& aggregate, BinarySnapshotOutput& output) const
+		{
+			DDD_UNUSED(aggregate);
+			DDD_UNUSED(output);
+			return false;
+		}
+
+		/**
+		 * @brief
+		 * Creates an aggregate from the data that serialize() has written, see Model::loadBinarySnapshot().
+		 * The model sets the ID and adds the aggregate, it must not be added here.
+		 * Gets called from multiple threads at once when a snapshot is loaded in parallel.
+		 * @return nullptr if the data is invalid.
+		 */
+		virtual std::shared_ptr<AGG> deserialize(BinarySnapshotInput& input) const
+		{
+			DDD_UNUSED(input);
+			return nullptr;
+		}
+
+		/**
+		 * @brief
+		 * Version of the data that serialize() writes. It is stored in the snapshot,
+		 * deserialize() gets the stored version from BinarySnapshotInput::getTypeVersion().
+		 */
+		virtual uint32_t getSnapshotVersion() const
+		{
+			return 0;
+		}
+
 		static std::string getAggregateName()
 		{
 			std::string raw = typeid(AGG).name();
@@ -100,6 +155,17 @@ namespace DDD
 #endif
 	protected:
 
+		/**
+		 * @brief
+		 * Creates a new aggregate in the memory pool of AGG.
+		 * @see makePooled
+		 */
+		template <typename... Args>
+		[[nodiscard]] static std::shared_ptr<AGG> createPooledAggregate(Args&&... args)
+		{
+			return makePooled<AGG>(std::forward<Args>(args)...);
+		}
+
 		/**
 		 * @brief Helper function to log messages.
 		 * @param msg
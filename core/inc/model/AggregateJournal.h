@@ -0,0 +1,187 @@
+#pragma once
+#include "DDD_base.h"
+#include "utilities/BinarySnapshot.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class QFile;
+
+namespace DDD
+{
+	/**
+	 * @brief Controls the group commit and the checkpoints of the journal, see Model::openJournal().
+	 */
+	struct JournalPolicy
+	{
+		// true: saveDirty() and save(ids) return after their records are synced to disk
+		bool waitForSync = true;
+
+		// The writer waits this long for more records before it syncs.
+		// Records that arrive while a sync runs are synced together in any case.
+		std::chrono::milliseconds groupCommitDelay{ 0 };
+
+		// A checkpoint gets written when the journal grows beyond this size in bytes, 0 disables automatic checkpoints
+		uint64_t checkpointSize = uint64_t(256) << 20;
+	};
+
+	struct JournalStats
+	{
+		// Records appended since the journal was created or truncated
+		uint64_t records = 0;
+
+		// Syncs to disk, each one makes all records durable that arrived before it
+		uint64_t syncs = 0;
+
+		// Size of the journal file, including the records that are not written yet
+		uint64_t size = 0;
+
+		// Number of truncate() calls, one per checkpoint
+		uint64_t checkpoints = 0;
+	};
+
+	/**
+	 * @brief
+	 * Append-only journal of aggregate changes, with group commit.
+	 *
+	 * @details
+	 * Each record holds the state of one aggregate (Put) or the ID of a removed aggregate (Remove),
+	 * protected by a checksum. append...() only copies the record into a buffer, a background thread
+	 * writes the buffer and syncs the file. All records that arrive while a sync runs are
+	 * written and synced together with the next one, so the number of syncs does not grow with the
+	 * number of saving threads. awaitDurable() blocks until the record of a sequence number is synced.
+	 *
+	 * A crash can leave a torn record at the end of the file, read() ends the journal in front of it.
+	 * The header gets written to a temporary file that replaces the journal, so that a crash
+	 * can't leave a journal without a complete header.
+	 * The header holds a generation that truncate() increments, so that a checkpoint can
+	 * tell which journal it already contains.
+	 * A failed write or sync is not retried, the journal stays failed until it gets truncated or created again.
+	 */
+	class DDD_API AggregateJournal
+	{
+	public:
+		using Sequence = uint64_t;
+		using Generation = JournalGeneration;
+
+		enum class RecordType : uint8_t
+		{
+			Put = 1,
+			Remove = 2
+		};
+		struct TypeInfo
+		{
+			// AggregateFactory::getAggregateName()
+			std::string name;
+
+			// AggregateFactory::getSnapshotVersion(), passed to the records of the type
+			uint32_t version = 0;
+		};
+		struct Record
+		{
+			RecordType type = RecordType::Put;
+			ID id = INVALID_ID;
+
+			// Index into the types of the journal header
+			uint32_t typeIndex = 0;
+
+			// Data written by AggregateFactory::serialize(), empty for Remove
+			BinarySnapshotInput data;
+		};
+
+		explicit AggregateJournal(const JournalPolicy& policy = JournalPolicy());
+		AggregateJournal(const AggregateJournal&) = delete;
+		AggregateJournal& operator=(const AggregateJournal&) = delete;
+		~AggregateJournal();
+
+		/**
+		 * @brief
+		 * Creates an empty journal, an existing file gets replaced.
+		 * The types are stored in the header, the records refer to them by index.
+		 * @param generation is stored in the header, see readGeneration().
+		 */
+		bool create(const std::string& path, const std::vector<TypeInfo>& types, Generation generation = 0);
+
+		/**
+		 * @brief Syncs the appended records and closes the file.
+		 */
+		void close();
+		[[nodiscard]] bool isOpen() const;
+
+		/**
+		 * @brief
+		 * Reads the records of a journal file in the order they were appended.
+		 * A torn or corrupted record ends the journal, a file that ends inside the header has no records.
+		 * @return false if the file is not a journal or func returned false.
+		 */
+		static bool read(const std::string& path, std::vector<TypeInfo>& types, const std::function<bool(const Record&)>& func);
+
+		/**
+		 * @brief Reads only the generation from the header of a journal file.
+		 * A file that ends inside the header has generation 0.
+		 * @return false if the file is not a journal.
+		 */
+		static bool readGeneration(const std::string& path, Generation& generation);
+
+		/**
+		 * @return the sequence number of the record, 0 if the journal is closed or failed.
+		 */
+		Sequence appendPut(ID id, uint32_t typeIndex, const BinarySnapshotOutput& data);
+		Sequence appendRemove(ID id);
+
+		/**
+		 * @brief Blocks until the record with the sequence number and all records before it are synced.
+		 * @return false if writing or syncing failed.
+		 */
+		bool awaitDurable(Sequence sequence);
+		bool flush();
+
+		/**
+		 * @brief
+		 * Starts the journal over, after a checkpoint has made its records obsolete.
+		 * The buffered records are dropped, no records may be appended while it runs.
+		 * The new journal gets the next generation.
+		 */
+		bool truncate();
+
+		void setPolicy(const JournalPolicy& policy);
+		[[nodiscard]] JournalPolicy getPolicy() const;
+		[[nodiscard]] Sequence getLastSequence() const;
+		[[nodiscard]] Sequence getDurableSequence() const;
+		[[nodiscard]] Generation getGeneration() const;
+		[[nodiscard]] JournalStats getStats() const;
+
+	private:
+		Sequence append(RecordType type, ID id, uint32_t typeIndex, const char* data, size_t size);
+		bool openFile();
+		void run();
+
+		JournalPolicy m_policy;
+		std::string m_path;
+		std::vector<TypeInfo> m_types;
+		Generation m_generation = 0;
+		std::unique_ptr<QFile> m_file;
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_wakeUp;
+		std::condition_variable m_synced;
+
+		// Records that are not written yet
+		std::vector<char> m_buffer;
+		Sequence m_lastSequence = 0;
+		Sequence m_durableSequence = 0;
+		size_t m_waiters = 0;
+		bool m_writing = false;
+		bool m_failed = false;
+		bool m_stopping = false;
+		JournalStats m_stats;
+
+		std::thread m_thread;
+	};
+}
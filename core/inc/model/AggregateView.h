@@ -0,0 +1,126 @@
+#pragma once
+#include "DDD_base.h"
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+namespace DDD
+{
+	/**
+	 * @brief
+	 * Non owning range over the aggregates of a repository.
+	 *
+	 * @details
+	 * Iterating the view does not allocate and does not touch the reference count of the aggregates,
+	 * the iterators dereference to AGG&. The view and its iterators are invalidated
+	 * when the repository gets modified.
+	 * If an aggregate has to outlive the scan, take a shared_ptr with Repository::get().
+	 *
+	 * @code
+	 * for (const Cat& cat : model.view<Cat>())
+	 *     std::cout << cat.getInfo() << "\n";
+	 * @endcode
+	 *
+	 * @tparam AGG Aggregate type, const qualified for read only views
+	 * @tparam StorageIterator Iterator of the repository storage, the value must be a pair of ID and shared_ptr
+	 */
+	template <typename AGG, typename StorageIterator>
+	class AggregateView
+	{
+	public:
+		class Iterator
+		{
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = std::remove_const_t<AGG>;
+			using difference_type = std::ptrdiff_t;
+			using pointer = AGG*;
+			using reference = AGG&;
+
+			Iterator() = default;
+			explicit Iterator(StorageIterator it)
+				: m_it(it)
+			{}
+
+			reference operator*() const
+			{
+				return *m_it->second;
+			}
+			pointer operator->() const
+			{
+				return m_it->second.get();
+			}
+			ID getID() const
+			{
+				return m_it->first;
+			}
+
+			Iterator& operator++()
+			{
+				++m_it;
+				return *this;
+			}
+			Iterator operator++(int)
+			{
+				Iterator tmp = *this;
+				++m_it;
+				return tmp;
+			}
+			bool operator==(const Iterator& other) const
+			{
+				return m_it == other.m_it;
+			}
+			bool operator!=(const Iterator& other) const
+			{
+				return m_it != other.m_it;
+			}
+		private:
+			StorageIterator m_it{};
+		};
+
+		AggregateView(StorageIterator begin, StorageIterator end, size_t size)
+			: m_begin(begin)
+			, m_end(end)
+			, m_size(size)
+		{}
+
+		[[nodiscard]] Iterator begin() const
+		{
+			return Iterator(m_begin);
+		}
+		[[nodiscard]] Iterator end() const
+		{
+			return Iterator(m_end);
+		}
+		[[nodiscard]] size_t size() const
+		{
+			return m_size;
+		}
+		[[nodiscard]] bool empty() const
+		{
+			return m_size == 0;
+		}
+	private:
+		StorageIterator m_begin;
+		StorageIterator m_end;
+		size_t m_size;
+	};
+
+	/**
+	 * @brief
+	 * Calls a forEach visitor and tells if the iteration shall continue.
+	 * Visitors may return void or bool, returning false stops the iteration.
+	 */
+	template <typename F, typename T>
+	inline bool invokeAggregateVisitor(F& func, T& aggregate)
+	{
+		if constexpr (std::is_same_v<std::invoke_result_t<F&, T&>, bool>)
+			return func(aggregate);
+		else
+		{
+			func(aggregate);
+			return true;
+		}
+	}
+}
@@ -7,9 +7,28 @@
 #include "utilities/IStringifyable.h"
 #include "utilities/IDebugJsonObject.h"
 #include "ValueObject.h"
+#include <memory>
+#include <vector>
 
 namespace DDD
 {
+	class Entity;
+
+	/**
+	 * @brief
+	 * Receives the lifecycle events of entities through a plain virtual call, without Qt connections.
+	 * The owner of an entity (the aggregate of a child entity, the repository of an aggregate)
+	 * gets linked by a back-pointer, additional observers can be attached with Entity::addObserver().
+	 */
+	class DDD_API EntityObserver
+	{
+	public:
+		virtual ~EntityObserver() = default;
+
+		virtual void onEntityDeleteMarked(Entity& entity) = 0;
+		virtual void onEntityDataChanged(Entity& entity) = 0;
+	};
+
 	/**
 	 * @brief
 	 * Entity class to represent an entity in the domain.
@@ -26,10 +45,14 @@ namespace DDD
 	 *   When the object is not alive, the entity should not be used anymore.
 	 *
 	 *   When the entity is marked for deletion, the entity gets removed automatically from the aggregate.
+	 *
+	 *   The events are delivered in this order: Qt signals, observers, owner.
+	 *   The owner is notified last, because it may release the entity.
 	 */
 	class DDD_API Entity : public QObject, public IID, public IDebugJsonObject, public IStringifyable
 	{
 		friend class Aggregate; // Allow Aggregate to access private members
+		friend class IRepository;
 		Q_OBJECT
 	public:
 		Entity(const ID id);
@@ -47,16 +70,21 @@ namespace DDD
 			return *this;
 		}
 
-		void markDeleted()
-		{
-			m_alive = false;
-			emit deleteMarked(getID());
-		}
+		void markDeleted();
 		bool isAlive() const
 		{
 			return m_alive;
 		}
 
+		/**
+		 * @brief
+		 * Attaches an observer that gets the lifecycle events of this entity.
+		 * The observer must be removed before it gets destroyed.
+		 * The observer list is only allocated while observers are attached.
+		 */
+		void addObserver(EntityObserver* observer);
+		bool removeObserver(EntityObserver* observer);
+
 		/**
 		 * @brief
 		 * Converts the entity to a JSON object.
@@ -72,10 +100,7 @@ namespace DDD
 		void dataChanged(ID entityID);
 
 	protected:
-		void emitDataChanged()
-		{
-			emit dataChanged(getID());
-		}
+		void emitDataChanged();
 
 		void setEntityParent(const Entity* parent)
 		{
@@ -86,9 +111,15 @@ namespace DDD
 		}
 
 	private:
+		template <typename F> void notifyObservers(F&& notify);
+
 		bool m_alive;
 		const Entity* m_parent;
-		
+
+		// Container that holds this entity, set by Aggregate and IRepository
+		EntityObserver* m_owner = nullptr;
+		std::unique_ptr<std::vector<EntityObserver*>> m_observers;
+
 	};
 	
 }
\ No newline at end of file
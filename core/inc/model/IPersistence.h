@@ -1,5 +1,7 @@
 #pragma once
 #include "DDD_base.h"
+#include <cstdint>
+#include <string>
 #include <vector>
 #include "model/Aggregate.h"
 #include "model/MetadataContainer.h"
@@ -8,7 +10,42 @@
 namespace DDD
 {
 	class AggregateLock;
+	struct AggregateLockChanges;
 	class User;
+
+	/**
+	 * @brief
+	 * Point-in-time copy of the data of one aggregate, created by IPersistence::createSnapshot().
+	 * Persistence layers derive from it and store the data they need for writing.
+	 */
+	class AggregateSnapshot
+	{
+	public:
+		explicit AggregateSnapshot(ID id)
+			: m_id(id)
+		{}
+		virtual ~AggregateSnapshot() = default;
+
+		[[nodiscard]] ID getID() const
+		{
+			return m_id;
+		}
+
+	private:
+		ID m_id;
+	};
+
+	/**
+	 * @brief Entry of IPersistence::loadCatalog(), a stored aggregate that does not have to be loaded yet.
+	 */
+	struct AggregateCatalogEntry
+	{
+		ID id = INVALID_ID;
+
+		// AggregateFactory::getAggregateName() of the aggregate type
+		std::string typeName;
+	};
+
 	class IPersistence
 	{
 	public:
@@ -26,11 +63,60 @@ namespace DDD
 
 		/**
 		 * @brief Save the given aggregates to the persistence layer
+		 * @details Only aggregates that are in the model are passed, removed ones are passed to remove(ids).
 		 * @param ids 
 		 * @return true if the operation was successful, false otherwise
 		 */
 		virtual bool save(const std::vector<ID>& ids) = 0;
 
+		/**
+		 * @brief Removes the given aggregates from the persistence layer
+		 * @details Called by Model::saveDirty() and Model::save(ids) for aggregates that were
+		 *          removed from the model since they were saved the last time.
+		 *          The default implementation can't remove anything and fails.
+		 * @param ids
+		 * @return true if the operation was successful, false otherwise
+		 */
+		virtual bool remove(const std::vector<ID>& ids)
+		{
+			DDD_UNUSED(ids);
+			return false;
+		}
+
+		/**
+		 * @brief
+		 * Returns true if the persistence implements createSnapshot() and saveSnapshots().
+		 * Model::enableWriteBehind() needs it, the writer thread only gets the captured data.
+		 */
+		virtual bool supportsSnapshots() const { return false; }
+
+		/**
+		 * @brief
+		 * Copies the data of the aggregate for a write-behind save, see Model::enableWriteBehind().
+		 * Called on the thread that saves, the snapshot gets written later by saveSnapshots()
+		 * on the writer thread, so it must not reference the aggregate.
+		 * @return nullptr if the aggregate can't be captured, the model then flushes the queue
+		 *         and writes the aggregates with save(ids) on the saving thread.
+		 */
+		virtual std::shared_ptr<AggregateSnapshot> createSnapshot(const Aggregate& aggregate)
+		{
+			DDD_UNUSED(aggregate);
+			return nullptr;
+		}
+
+		/**
+		 * @brief
+		 * Writes the snapshots of createSnapshot() and removes the aggregates with the removedIDs.
+		 * Called on the writer thread of the write-behind stage.
+		 * @return true if the operation was successful, false otherwise
+		 */
+		virtual bool saveSnapshots(const std::vector<std::shared_ptr<AggregateSnapshot>>& snapshots, const std::vector<ID>& removedIDs)
+		{
+			DDD_UNUSED(snapshots);
+			DDD_UNUSED(removedIDs);
+			return false;
+		}
+
 		/**
 		 * @brief Save the given metadata to the persistence layer
 		 * @param metadata
@@ -61,6 +147,18 @@ namespace DDD
 		 */
 		virtual bool load(const std::vector<ID>& ids) = 0;
 
+		/**
+		 * @brief
+		 * Gets the IDs and types of all stored aggregates without loading the aggregates,
+		 * see Model::enableLazyLoading(). The aggregates get loaded later with load(ids).
+		 * @return false if the persistence does not provide a catalog, which is the default.
+		 */
+		virtual bool loadCatalog(std::vector<AggregateCatalogEntry>& entries)
+		{
+			DDD_UNUSED(entries);
+			return false;
+		}
+
 		/**
 		 * @brief Load the metadata from the persistence layer
 		 *
@@ -125,6 +223,31 @@ namespace DDD
 		 */
 		virtual std::shared_ptr<AggregateLock> getLock(const ID& id) = 0;
 
+		/**
+		 * @brief
+		 * Gets the current lock version. The version must grow with each change of the locks,
+		 * by this or any other client of the database. Versions start at 1.
+		 * @return 0 if the persistence does not support lock versions, which is the default.
+		 */
+		virtual uint64_t getLockVersion() { return 0; }
+
+		/**
+		 * @brief
+		 * Gets the lock changes since the given lock version, so that the model
+		 * does not have to reload all locks with getLocks() after each change.
+		 * An aggregate that changed multiple times may be listed once with its last state.
+		 * @param sinceVersion is a version returned by getLockVersion() or by an earlier call.
+		 * @param changes receives the changes and the version they lead to.
+		 * @return false if the changes are not available, for example because the version is
+		 *         too old or deltas are not supported (default), the model then loads all locks.
+		 */
+		virtual bool getLockChanges(uint64_t sinceVersion, AggregateLockChanges& changes)
+		{
+			DDD_UNUSED(sinceVersion);
+			DDD_UNUSED(changes);
+			return false;
+		}
+
 		/**
 		 * @brief Registers a user to the current session.
 		 * @param user 
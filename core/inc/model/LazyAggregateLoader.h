@@ -0,0 +1,143 @@
+#pragma once
+#include "DDD_base.h"
+#include "utilities/FlatHashMap.h"
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace DDD
+{
+	struct LazyLoadStats
+	{
+		// Stored aggregates that are not loaded yet
+		size_t catalogued = 0;
+
+		// Aggregates that were requested by a miss
+		size_t faults = 0;
+
+		// Calls of the load function, each one loads all misses that were waiting for it
+		size_t loads = 0;
+
+		size_t failedLoads = 0;
+	};
+
+	/**
+	 * @brief Memory budget of the loaded aggregates, see Model::setEvictionPolicy().
+	 */
+	struct EvictionPolicy
+	{
+		// Maximum number of loaded aggregates, 0 disables the limit
+		size_t maxCount = 0;
+
+		// Maximum approximate memory of the loaded aggregates, 0 disables the limit.
+		// See Aggregate::getApproximateHeapSize()
+		size_t maxBytes = 0;
+
+		// An exceeded budget gets evicted down to this part of it, so that not every load evicts
+		double targetRatio = 0.9;
+
+		// true: dirty aggregates are saved and evicted, false: they stay loaded
+		bool saveDirty = true;
+	};
+
+	struct EvictionStats
+	{
+		// Eviction runs that sorted the loaded aggregates by their last access
+		size_t passes = 0;
+
+		size_t evicted = 0;
+
+		// Dirty aggregates that were saved before they got evicted
+		size_t saved = 0;
+
+		// Aggregates that had to stay loaded because they are locked, dirty or referenced outside of the model
+		size_t skipped = 0;
+	};
+
+	/**
+	 * @brief
+	 * Catalog of the stored aggregates that are not loaded yet, and the batching of their loads.
+	 *
+	 * @details
+	 * load() blocks until the requested aggregates are loaded. Only one load runs at a time,
+	 * the misses that arrive while it runs are collected and loaded together by the next one,
+	 * so concurrent misses cost one call of the load function instead of one per aggregate.
+	 * The load function runs on the thread of one of the waiting callers, with no lock held.
+	 * It has to remove the loaded aggregates and the ones that are not stored from the catalog.
+	 * A failed load is not retried, the aggregates stay in the catalog and the next miss tries again.
+	 */
+	class DDD_API LazyAggregateLoader
+	{
+	public:
+		using LoadFunction = std::function<bool(const std::vector<ID>&)>;
+
+		explicit LazyAggregateLoader(LoadFunction load);
+		LazyAggregateLoader(const LazyAggregateLoader&) = delete;
+		LazyAggregateLoader& operator=(const LazyAggregateLoader&) = delete;
+
+		/**
+		 * @brief Adds a stored aggregate with the type slot of its model repository.
+		 */
+		void addToCatalog(ID id, size_t typeSlot);
+		void addToCatalog(const std::vector<ID>& ids, size_t typeSlot);
+
+		/**
+		 * @brief Removes an aggregate that got loaded, added or removed.
+		 * @return false if the aggregate was not in the catalog.
+		 */
+		bool removeFromCatalog(ID id);
+
+		/**
+		 * @brief
+		 * Removes an aggregate that gets removed from the model before it is loaded.
+		 * Waits for a requested load of the aggregate first, so that the load does not add it afterwards.
+		 * Must not be called from within the load function.
+		 * @return false if the aggregate is not in the catalog, it may have been loaded while waiting.
+		 */
+		bool withdraw(ID id, size_t& typeSlot);
+		[[nodiscard]] bool findInCatalog(ID id, size_t& typeSlot) const;
+
+		/**
+		 * @brief
+		 * Loads the catalogued aggregates of the IDs, other IDs are ignored.
+		 * Must not be called from within the load function.
+		 * @return false if one of the catalogued aggregates could not be loaded.
+		 */
+		bool load(const std::vector<ID>& ids);
+		bool load(ID id)
+		{
+			return load(std::vector<ID>{ id });
+		}
+
+		[[nodiscard]] LazyLoadStats getStats() const;
+
+	private:
+		// The misses that get loaded by one call of the load function
+		struct Batch
+		{
+			std::vector<ID> ids;
+			bool done = false;
+			bool success = false;
+		};
+
+		LoadFunction m_load;
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_loaded;
+
+		// ID -> type slot
+		HashMap<ID, size_t> m_catalog;
+
+		// Requested IDs, until the batch that contains them is loaded
+		HashMap<ID, std::shared_ptr<Batch>> m_requested;
+
+		// Collects the misses while a load runs, nullptr if there are none
+		std::shared_ptr<Batch> m_pending;
+		bool m_loading = false;
+		std::thread::id m_loadingThread;
+		LazyLoadStats m_stats;
+	};
+}
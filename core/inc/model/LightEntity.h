@@ -0,0 +1,109 @@
+#pragma once
+#include "DDD_base.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <QJsonObject>
+
+namespace DDD
+{
+	class Aggregate;
+	class LightEntity;
+
+	/**
+	 * @brief Receives the lifecycle events of a LightEntity.
+	 */
+	class DDD_API LightEntityObserver
+	{
+	public:
+		virtual ~LightEntityObserver() = default;
+
+		virtual void onEntityDeleteMarked(LightEntity& entity) = 0;
+		virtual void onEntityDataChanged(LightEntity& entity) = 0;
+	};
+
+	/**
+	 * @brief
+	 * Entity without QObject base, for aggregates with many small child entities.
+	 *
+	 * @details
+	 * Has the same ID, alive and parent semantics as Entity, but only one vtable pointer
+	 * and no QObject private data. Instead of Qt signals, the parent aggregate gets the
+	 * events directly and re-emits them as its entityDeleted/entityChanged signals.
+	 * Other listeners can be attached with addObserver().
+	 *
+	 * Add it to an aggregate with Aggregate::addLightEntity().
+	 * The entity ID shares the ID space of the Entity children of the aggregate.
+	 *
+	 * Implementation info:
+	 *   When a variable changes, emitDataChanged() should be called.
+	 *   When the entity is marked for deletion, it gets removed automatically from the aggregate.
+	 */
+	class DDD_API LightEntity
+	{
+		friend class Aggregate;
+	public:
+		explicit LightEntity(const ID id)
+			: m_id(id)
+		{}
+		LightEntity(const LightEntity&) = delete;
+		LightEntity& operator=(const LightEntity&) = delete;
+		virtual ~LightEntity() = default;
+
+		bool operator==(const LightEntity& other) const
+		{
+			return m_alive == other.m_alive;
+		}
+		bool operator!=(const LightEntity& other) const
+		{
+			return !(*this == other);
+		}
+
+		[[nodiscard]] ID getID() const
+		{
+			return m_id;
+		}
+		[[nodiscard]] std::string getIDString() const
+		{
+			return std::to_string(m_id);
+		}
+
+		void markDeleted();
+		[[nodiscard]] bool isAlive() const
+		{
+			return m_alive;
+		}
+
+		/**
+		 * @brief
+		 * Attaches an observer that gets the lifecycle events of this entity.
+		 * The observer must be removed before it gets destroyed.
+		 */
+		void addObserver(LightEntityObserver* observer);
+		bool removeObserver(LightEntityObserver* observer);
+
+		/**
+		 * @brief
+		 * Converts the entity to a JSON object.
+		 * This function should be overridden in derived classes to include additional data.
+		 */
+		virtual QJsonObject toDebugJsonObject() const;
+		std::string toString() const;
+
+	protected:
+		void emitDataChanged();
+
+		[[nodiscard]] const Aggregate* getEntityParent() const
+		{
+			return m_parent;
+		}
+
+	private:
+		template <typename F> void notifyObservers(F&& notify);
+
+		ID m_id;
+		Aggregate* m_parent = nullptr;
+		std::unique_ptr<std::vector<LightEntityObserver*>> m_observers;
+		bool m_alive = true;
+	};
+}
@@ -4,10 +4,22 @@
 #include "Service.h"
 #include "AggregateFactory.h"
 #include "utilities/UniqueIDDomain.h"
-#include "utilities/AggregateLock.h"
+#include "utilities/AggregateLockTable.h"
 #include "IPersistence.h"
-#include <variant>
+#include "WriteBehindQueue.h"
+#include "AggregateJournal.h"
+#include "LazyAggregateLoader.h"
+#include "utilities/NotificationBatch.h"
+#include "utilities/OptionalSharedMutex.h"
+#include "utilities/Sharding.h"
+#include <tuple>
 #include <array>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <QThread>
+#include <typeindex>
 #include <utility> // for std::move
 
 namespace DDD
@@ -23,10 +35,12 @@ namespace DDD
 		{
 		public:
 			AggregateContainer(UniqueIDDomain& domain,
+				NotificationBatchState& batchState,
 				const std::function<void(const std::vector<ID>&)>& aggregateAddedSignal,
 				const std::function<void(const std::vector<ID>&)>& aggregateReplacedSignal,
 				const std::function<void(const std::vector<ID>&)>& aggregateRemovedSignal)
 				: m_repository(domain)
+				, m_batchState(batchState)
 				, m_aggregateAddedSignal(aggregateAddedSignal)
 				, m_aggregateReplacedSignal(aggregateReplacedSignal)
 				, m_aggregateRemovedSignal(aggregateRemovedSignal)
@@ -93,48 +107,35 @@ namespace DDD
 			}
 
 
-			bool isAggregateTypeForThis(std::shared_ptr<Aggregate> agg)
+			// The caller must have resolved the type slot of agg to this container,
+			// which guarantees that agg is an AGG. No RTTI cast is needed.
+			bool add(const std::shared_ptr<Aggregate>& agg)
 			{
-				return dynamic_pointer_cast<AGG>(agg) != nullptr;
-			}
-			bool add(std::shared_ptr<Aggregate> agg)
-			{
-				std::shared_ptr<AGG> casted = dynamic_pointer_cast<AGG>(agg);
-				if (casted)
+				std::shared_ptr<AGG> casted = std::static_pointer_cast<AGG>(agg);
+				if (m_repository.add(casted))
 				{
-					if (m_repository.add(casted))
-					{
-						if (m_aggregateAddedSignal)
-							m_aggregateAddedSignal({ casted->getID() });
-						return true;
-					}
+					notify(AggregateChange::Added, casted->getID());
+					return true;
 				}
 				return false;
 			}
-			bool replace(std::shared_ptr<Aggregate> agg)
+			bool replace(const std::shared_ptr<Aggregate>& agg)
 			{
-				std::shared_ptr<AGG> casted = dynamic_pointer_cast<AGG>(agg);
-				if (casted)
+				std::shared_ptr<AGG> casted = std::static_pointer_cast<AGG>(agg);
+				if (m_repository.replace(casted))
 				{
-					if (m_repository.remove(casted->getID()))
-					{
-						if (m_repository.add(casted))
-						{
-							if (m_aggregateReplacedSignal)
-								m_aggregateReplacedSignal({ casted->getID() });
-							return true;
-						}
-					}
+					notify(AggregateChange::Replaced, casted->getID());
+					return true;
 				}
 				return false;
 			}
 
+			bool evict(ID id) { return m_repository.evict(id); }
 			bool remove(ID id)
 			{
 				if (m_repository.remove(id))
 				{
-					if (m_aggregateRemovedSignal)
-						m_aggregateRemovedSignal({ id });
+					notify(AggregateChange::Removed, id);
 					return true;
 				}
 				return false;
@@ -142,10 +143,22 @@ namespace DDD
 
 			[[nodiscard]] std::shared_ptr<AGG> get(ID id) { return m_repository.get(id); }
 			[[nodiscard]] std::shared_ptr<const AGG> get(ID id) const { return m_repository.get(id); }
+			[[nodiscard]] std::shared_ptr<AGG> tryGet(ID id) { return m_repository.tryGet(id); }
+			[[nodiscard]] std::shared_ptr<const AGG> tryGet(ID id) const { return m_repository.tryGet(id); }
 
 			[[nodiscard]] std::vector<std::shared_ptr<AGG>> getAll() { return m_repository.getAll(); }
 			[[nodiscard]] std::vector<std::shared_ptr<const AGG>> getAll() const { return m_repository.getAll(); }
 			[[nodiscard]] std::vector<ID> getIDs() const { return m_repository.getIDs(); }
+			[[nodiscard]] std::vector<ID> filterIDs(const std::vector<ID>& toFilter) const { return m_repository.filterIDs(toFilter); }
+			void setThreadSafe(bool enabled) { m_repository.setThreadSafe(enabled); }
+			void setShardCount(size_t count) { m_repository.setShardCount(count); }
+			[[nodiscard]] size_t getShardCount() const { return m_repository.getShardCount(); }
+			[[nodiscard]] typename Repository<AGG>::View view() { return m_repository.view(); }
+			[[nodiscard]] typename Repository<AGG>::ConstView view() const { return m_repository.view(); }
+			template <typename F> void forEach(F&& func) { m_repository.forEach(std::forward<F>(func)); }
+			template <typename F> void forEach(F&& func) const { m_repository.forEach(std::forward<F>(func)); }
+			template <typename F> void forEachInRange(ID first, ID last, F&& func) { m_repository.forEachInRange(first, last, std::forward<F>(func)); }
+			template <typename F> void forEachInRange(ID first, ID last, F&& func) const { m_repository.forEachInRange(first, last, std::forward<F>(func)); }
 			void clear() { m_repository.clear(); }
 
 			[[nodiscard]] size_t size() const
@@ -185,11 +198,63 @@ namespace DDD
 			{
 				m_repository.clearDeletedCache();
 			}
+			[[nodiscard]] std::vector<ID> getDeletedIDs() const { return m_repository.getDeletedIDs(); }
+			void setDeletedCachePolicy(const DeletedCachePolicy& policy) { m_repository.setDeletedCachePolicy(policy); }
+			[[nodiscard]] DeletedCachePolicy getDeletedCachePolicy() const { return m_repository.getDeletedCachePolicy(); }
+			void trimDeletedCache() { m_repository.trimDeletedCache(); }
+			[[nodiscard]] DeletedCacheStats getDeletedCacheStats() const { return m_repository.getDeletedCacheStats(); }
+
+			[[nodiscard]] std::vector<ID> getDirtyIDs() const { return m_repository.getDirtyIDs(); }
+			[[nodiscard]] size_t getDirtyCount() const { return m_repository.getDirtyCount(); }
+			[[nodiscard]] bool isDirty(ID id) const { return m_repository.isDirty(id); }
+			[[nodiscard]] std::vector<ID> takeDirtyIDs() const { return m_repository.takeDirtyIDs(); }
+			void markDirty(const std::vector<ID>& ids) const { m_repository.markDirty(ids); }
+			void clearDirty(const std::vector<ID>& ids) const { m_repository.clearDirty(ids); }
+			void clearDirty() const { m_repository.clearDirty(); }
+
+			void setStorageCallbacks(const std::function<void(ID)>& onStored, const std::function<void(ID)>& onRemoved)
+			{
+				m_repository.setStorageCallbacks(onStored, onRemoved);
+			}
+
+			/**
+			 * @brief Delivers the buffered changes with one callback per change kind.
+			 */
+			void flushNotifications()
+			{
+				std::vector<ID> added;
+				std::vector<ID> replaced;
+				std::vector<ID> removed;
+				m_batchState.take(m_changes, added, replaced, removed);
+				if (!added.empty() && m_aggregateAddedSignal)
+					m_aggregateAddedSignal(added);
+				if (!replaced.empty() && m_aggregateReplacedSignal)
+					m_aggregateReplacedSignal(replaced);
+				if (!removed.empty() && m_aggregateRemovedSignal)
+					m_aggregateRemovedSignal(removed);
+			}
 
 		private:
+			void notify(AggregateChange change, ID id)
+			{
+				if (m_batchState.tryRecord(m_changes, change, id))
+					return;
+				const std::function<void(const std::vector<ID>&)>* signal = nullptr;
+				switch (change)
+				{
+					case AggregateChange::Added:	signal = &m_aggregateAddedSignal;		break;
+					case AggregateChange::Replaced: signal = &m_aggregateReplacedSignal;	break;
+					case AggregateChange::Removed:	signal = &m_aggregateRemovedSignal;		break;
+				}
+				if (signal && *signal)
+					(*signal)({ id });
+			}
+
 			Repository<AGG> m_repository;
 			std::shared_ptr<AggregateFactory<AGG>> m_factory;
 			std::vector<std::shared_ptr<AggregateService<AGG>>> m_services;
+			NotificationBatchState& m_batchState;
+			AggregateChangeSet m_changes;
 			const std::function<void(const std::vector<ID>&)>& m_aggregateAddedSignal;
 			const std::function<void(const std::vector<ID>&)>& m_aggregateReplacedSignal;
 			const std::function<void(const std::vector<ID>&)>& m_aggregateRemovedSignal;
@@ -200,10 +265,24 @@ namespace DDD
 
 		// Default constructor initializes each instance
 		Model()
-			: m_idDomain(std::bind(&Model::tryReserveNextID, this, std::placeholders::_1, std::placeholders::_2))
+			: m_idDomain(std::bind(&Model::tryReserveNextID, this, std::placeholders::_1, std::placeholders::_2),
+				std::bind(&Model::tryReleaseIDs, this, std::placeholders::_1, std::placeholders::_2),
+				std::bind(&Model::getHighestReservedID, this))
 			, m_metadata(std::make_shared<MetadataContainer>())
+			, m_typeSlots{ { std::type_index(typeid(Ts)), getTypeSlot<Ts>() }... }
 		{
+			// Keep the global ID index in sync with every repository, 
+			// including removals that are triggered by Aggregate::markDeleted()
+			setupStorageCallbacks(std::index_sequence_for<Ts...>{});
+			m_indexShards.push_back(std::make_unique<IndexShard>());
+		}
+		~Model()
+		{
+			// The persistence may still read the model while it writes the queued saves
+			m_writeBehind.reset();
 
+			// Unused IDs of the leased block can be handed out by the next session
+			m_idDomain.releaseLease();
 		}
 
 		void setCallback_aggregateAdded(const std::function<void(const std::vector<ID>&)>& callback)
@@ -219,6 +298,78 @@ namespace DDD
 			m_aggregateRemovedSignal = callback;
 		}
 
+		/**
+		 * @brief
+		 * Enables the concurrent mode of the model.
+		 *
+		 * @details
+		 * Each repository gets its own reader-writer lock, lookups like getAggregate(), contains(),
+		 * getIDs() and filterIDs() run in parallel, writers are serialized per aggregate type,
+		 * or per shard if setShardCount() is used.
+		 * The global ID index, the type routing cache and the ID domain are guarded separately.
+		 * Setting up factories, services, callbacks and the persistence is not synchronized
+		 * and has to be done before the model is shared between threads.
+		 * This function itself must be called while no other thread uses the model.
+		 *
+		 * The aggregates themselves are not synchronized, concurrent modifications
+		 * of the same aggregate have to be coordinated by the caller.
+		 * Notification batches are shared by all threads.
+		 */
+		void setThreadSafe(bool enabled)
+		{
+			m_threadSafe = enabled;
+			m_idDomain.setThreadSafe(enabled);
+			for (auto& shard : m_indexShards)
+				shard->mutex.setEnabled(enabled);
+			m_typeSlotsMutex.setEnabled(enabled);
+			m_checkpointMutex.setEnabled(enabled);
+			m_lockTableMutex.setEnabled(enabled);
+			forEachContainer([enabled](auto& obj) { obj.setThreadSafe(enabled); });
+		}
+		[[nodiscard]] bool isThreadSafe() const
+		{
+			return m_threadSafe;
+		}
+
+		/**
+		 * @brief
+		 * Partitions the storage of the repositories and the global ID index by ID hash
+		 * into independently locked shards, so that concurrent adds and removes of the same
+		 * aggregate type scale across cores in thread safe mode.
+		 * The count gets rounded up to a power of two, 1 disables sharding (default).
+		 * Must be called while no other thread uses the model.
+		 * @see Repository::setShardCount
+		 */
+		void setShardCount(size_t count);
+		template <DerivedFromAggregate AGG> void setShardCount(size_t count)
+		{
+			getAggregateContainer<AGG>().setShardCount(count);
+		}
+		template <DerivedFromAggregate AGG> [[nodiscard]] size_t getShardCount() const
+		{
+			return getAggregateContainer<AGG>().getShardCount();
+		}
+
+		/**
+		 * @brief
+		 * Starts collecting the aggregate added/replaced/removed notifications.
+		 * Batches can be nested, the collected changes get delivered when the outermost batch ends,
+		 * with one callback per aggregate type and change kind.
+		 * @see NotificationBatchScope
+		 */
+		void beginNotificationBatch();
+		void endNotificationBatch();
+
+		/**
+		 * @brief Delivers all buffered aggregate change notifications now.
+		 */
+		void flushNotifications();
+		void setNotificationFlushPolicy(const NotificationFlushPolicy& policy);
+		NotificationFlushPolicy getNotificationFlushPolicy() const
+		{
+			return m_notificationState.getPolicy();
+		}
+
 		template <typename FAC> std::shared_ptr<FAC> createFactory();
 		template <typename FAC> void removeFactory();
 
@@ -244,6 +395,22 @@ namespace DDD
 		template <DerivedFromAggregate AGG> [[nodiscard]] std::shared_ptr<const AGG> getAggregate(const ID id) const;
 		[[nodiscard]] std::shared_ptr<Aggregate> getAggregate(const ID id);
 		[[nodiscard]] std::shared_ptr<const Aggregate> getAggregate(const ID id) const;
+
+		/**
+		 * @brief Like getAggregate<AGG>(), for lookups where a miss is expected, misses are not logged.
+		 */
+		template <DerivedFromAggregate AGG> [[nodiscard]] std::shared_ptr<AGG> tryGetAggregate(const ID id)
+		{
+			std::shared_ptr<AGG> aggregate = getAggregateContainer<AGG>().tryGet(id);
+			recordAccess(aggregate.get());
+			return aggregate;
+		}
+		template <DerivedFromAggregate AGG> [[nodiscard]] std::shared_ptr<const AGG> tryGetAggregate(const ID id) const
+		{
+			std::shared_ptr<const AGG> aggregate = getAggregateContainer<AGG>().tryGet(id);
+			recordAccess(aggregate.get());
+			return aggregate;
+		}
 		bool removeAggregate(const ID id);
 		template <DerivedFromAggregate AGG> void removeAggregates();
 		void clear();
@@ -257,6 +424,46 @@ namespace DDD
 		[[nodiscard]] std::vector<std::shared_ptr<const Aggregate>> getAggregates() const;
 		template <DerivedFromAggregate AGG> [[nodiscard]] std::vector<std::shared_ptr<const AGG>> getAggregates() const;
 
+		/**
+		 * @brief
+		 * Non owning access to the aggregates, without allocating a list and without
+		 * copying shared_ptr's. Prefer these over getAggregates() for scans.
+		 * The callback gets AGG& (Aggregate& for forEachAggregate), if it returns bool,
+		 * returning false stops the iteration.
+		 * The model must not be modified while iterating.
+		 */
+		template <DerivedFromAggregate AGG> [[nodiscard]] typename Repository<AGG>::View view()
+		{
+			return getAggregateContainer<AGG>().view();
+		}
+		template <DerivedFromAggregate AGG> [[nodiscard]] typename Repository<AGG>::ConstView view() const
+		{
+			return getAggregateContainer<AGG>().view();
+		}
+		template <DerivedFromAggregate AGG, typename F> void forEach(F&& func)
+		{
+			getAggregateContainer<AGG>().forEach(std::forward<F>(func));
+		}
+		template <DerivedFromAggregate AGG, typename F> void forEach(F&& func) const
+		{
+			getAggregateContainer<AGG>().forEach(std::forward<F>(func));
+		}
+
+		/**
+		 * @brief Visits the aggregates of type AGG with first <= ID <= last.
+		 * @see Repository::forEachInRange
+		 */
+		template <DerivedFromAggregate AGG, typename F> void forEachInRange(ID first, ID last, F&& func)
+		{
+			getAggregateContainer<AGG>().forEachInRange(first, last, std::forward<F>(func));
+		}
+		template <DerivedFromAggregate AGG, typename F> void forEachInRange(ID first, ID last, F&& func) const
+		{
+			getAggregateContainer<AGG>().forEachInRange(first, last, std::forward<F>(func));
+		}
+		template <typename F> void forEachAggregate(F&& func);
+		template <typename F> void forEachAggregate(F&& func) const;
+
 		[[nodiscard]] std::vector<std::shared_ptr<Aggregate>> getDeletedAggregates();
 		template <DerivedFromAggregate AGG> [[nodiscard]] std::vector<std::shared_ptr<AGG>> getDeletedAggregates();
 		[[nodiscard]] std::vector<std::shared_ptr<const Aggregate>> getDeletedAggregates() const;
@@ -264,6 +471,54 @@ namespace DDD
 		void clearDeletedAggregates();
 		template <DerivedFromAggregate AGG> void clearDeletedAggregates();
 
+		/**
+		 * @brief Gets the IDs of the removed aggregates of type AGG, including tombstones.
+		 */
+		template <DerivedFromAggregate AGG> [[nodiscard]] std::vector<ID> getDeletedIDs() const
+		{
+			return getAggregateContainer<AGG>().getDeletedIDs();
+		}
+
+		/**
+		 * @brief
+		 * Limits the deleted cache of all aggregate types, or of AGG only.
+		 * @see DeletedCachePolicy
+		 */
+		void setDeletedCachePolicy(const DeletedCachePolicy& policy)
+		{
+			forEachContainer([&policy](auto& obj) { obj.setDeletedCachePolicy(policy); });
+		}
+		template <DerivedFromAggregate AGG> void setDeletedCachePolicy(const DeletedCachePolicy& policy)
+		{
+			getAggregateContainer<AGG>().setDeletedCachePolicy(policy);
+		}
+		template <DerivedFromAggregate AGG> [[nodiscard]] DeletedCachePolicy getDeletedCachePolicy() const
+		{
+			return getAggregateContainer<AGG>().getDeletedCachePolicy();
+		}
+
+		/**
+		 * @brief Drops the deleted cache entries that exceed DeletedCachePolicy::maxAge, call it periodically.
+		 */
+		void trimDeletedAggregates()
+		{
+			forEachContainer([](auto& obj) { obj.trimDeletedCache(); });
+		}
+
+		/**
+		 * @brief Gets the size of the deleted cache of AGG, or the sum over all aggregate types.
+		 */
+		template <DerivedFromAggregate AGG> [[nodiscard]] DeletedCacheStats getDeletedCacheStats() const
+		{
+			return getAggregateContainer<AGG>().getDeletedCacheStats();
+		}
+		[[nodiscard]] DeletedCacheStats getDeletedCacheStats() const
+		{
+			DeletedCacheStats stats;
+			forEachContainer([&stats](const auto& obj) { stats += obj.getDeletedCacheStats(); });
+			return stats;
+		}
+
 		bool addAggregate(std::shared_ptr<Aggregate> aggregate);
 		bool replaceAggregate(std::shared_ptr<Aggregate> aggregate);
 		std::vector<bool> addAggregate(std::vector<std::shared_ptr<Aggregate>> aggregates);
@@ -283,6 +538,22 @@ namespace DDD
 			return m_idDomain;
 		}
 
+		/**
+		 * @brief
+		 * Hands out new aggregate IDs from an atomic counter, see UniqueIDDomain::enableAtomicAllocation().
+		 * Factories and addAggregate() can get IDs from any thread without locking the ID domain.
+		 * With a sharedCounterKey, processes on the same host that use the same key and database
+		 * share one counter, and the database is only locked once per reserved block.
+		 * The counter continues behind the highest ID stored in the metadata of the persistence.
+		 * Must be called before the model is shared between threads.
+		 * @return false if the shared counter could not be attached.
+		 */
+		bool enableAtomicIDAllocation(const std::string& sharedCounterKey = std::string());
+		void disableAtomicIDAllocation()
+		{
+			m_idDomain.disableAtomicAllocation();
+		}
+
 		template <DerivedFromIPersistance PER> std::shared_ptr<PER>  attachPersistence();
 		std::shared_ptr<IPersistence> getPersistance() {
 			return m_persistence;
@@ -293,17 +564,314 @@ namespace DDD
 		}
 		void removePersistance()
 		{
+			disableWriteBehind();
+			disableLazyLoading();
+			m_idDomain.releaseLease();
 			m_persistence = nullptr;
+			ExclusiveWriteLock lock(m_lockTableMutex);
+			m_lockTable.clear();
+			m_lockVersion = 0;
 		}
 
+		/**
+		 * @brief
+		 * Saves all aggregates, or the given ones.
+		 * On success, the saved aggregates are no longer dirty.
+		 * save(ids) passes the IDs of removed aggregates to IPersistence::remove(ids).
+		 * IDs that are neither in the model nor removed from it since the last save are skipped,
+		 * e.g. stored aggregates that are not loaded.
+		 * With write-behind enabled, the aggregates are only captured and queued, see enableWriteBehind().
+		 * With a journal open, save() writes a checkpoint and save(ids) appends to the journal, see openJournal().
+		 */
 		bool save() const;
 		bool save(const std::vector<ID>& ids) const;
+
+		/**
+		 * @brief
+		 * Moves the writes of save(), save(ids) and saveDirty() to a background thread.
+		 *
+		 * @details
+		 * The saving thread captures the aggregates with IPersistence::createSnapshot() and
+		 * returns after queueing them, see WriteBehindQueue. The queued aggregates are no longer
+		 * dirty, a failed write is tried again by the writer thread.
+		 * An aggregate that can't be captured is written on the saving thread, after the queue is flushed.
+		 * Use flushWrites() or awaitDurable(getLastSaveTicket()) to wait until the data is written.
+		 * The queue is flushed when the persistence gets replaced or removed,
+		 * and write-behind stays enabled if the new persistence supports snapshots.
+		 * @return false if no persistence is attached or it does not support snapshots.
+		 */
+		bool enableWriteBehind(const WriteBehindPolicy& policy = WriteBehindPolicy());
+
+		/**
+		 * @brief Writes the queued saves and returns to synchronous saving.
+		 */
+		void disableWriteBehind()
+		{
+			m_writeBehind.reset();
+		}
+		[[nodiscard]] bool isWriteBehindEnabled() const
+		{
+			return m_writeBehind != nullptr;
+		}
+
+		/**
+		 * @brief Blocks until all queued saves are written.
+		 * @return false if a write failed, true if write-behind is not enabled.
+		 */
+		bool flushWrites() const
+		{
+			return !m_writeBehind || m_writeBehind->flush();
+		}
+
+		/**
+		 * @brief Blocks until the saves up to the ticket are written.
+		 * @return false if a write failed or on timeout.
+		 */
+		bool awaitDurable(WriteBehindQueue::Ticket ticket, std::chrono::milliseconds timeout = std::chrono::milliseconds::max()) const
+		{
+			return !m_writeBehind || m_writeBehind->awaitDurable(ticket, timeout);
+		}
+
+		/**
+		 * @return the ticket of the last queued save, 0 if write-behind is not enabled.
+		 */
+		[[nodiscard]] WriteBehindQueue::Ticket getLastSaveTicket() const
+		{
+			return m_writeBehind ? m_writeBehind->getLastTicket() : 0;
+		}
+		[[nodiscard]] WriteBehindStats getWriteBehindStats() const
+		{
+			return m_writeBehind ? m_writeBehind->getStats() : WriteBehindStats();
+		}
+
+		/**
+		 * @brief
+		 * Saves only the aggregates that were added, replaced, removed or changed since
+		 * they were saved the last time, see getDirtyIDs().
+		 * The IDs of removed aggregates are passed to IPersistence::remove(ids).
+		 * If saving fails, the aggregates stay dirty.
+		 * With a journal open, the aggregates are appended to the journal, see openJournal().
+		 * @return true if nothing was dirty or saving succeeded.
+		 */
+		bool saveDirty() const;
+
+		/**
+		 * @brief
+		 * Makes saves durable through an append-only journal instead of the persistence.
+		 *
+		 * @details
+		 * Loads the last checkpoint from snapshotPath, if it exists, and replays the journal
+		 * at journalPath on top of it, then starts a new journal. Call it on startup,
+		 * before the model gets changed. The replayed aggregates are not dirty.
+		 *
+		 * While the journal is open, saveDirty() and save(ids) append the state of the changed
+		 * aggregates and the IDs of the removed ones, written by AggregateFactory::serialize().
+		 * Concurrent saves are synced to disk together, see AggregateJournal.
+		 * checkpoint() and save() write all aggregates to the snapshot, see saveBinarySnapshot(),
+		 * and start the journal over. A checkpoint is also written when the journal grows beyond
+		 * JournalPolicy::checkpointSize. The snapshot stores the generation of the journal it contains,
+		 * a journal that is left over by a crash after the checkpoint is not replayed.
+		 * @return false if the checkpoint or the journal could not be read or written.
+		 */
+		bool openJournal(const std::string& journalPath, const std::string& snapshotPath, const JournalPolicy& policy = JournalPolicy());
+
+		/**
+		 * @brief Syncs the journal and returns to saving through the persistence.
+		 */
+		void closeJournal()
+		{
+			m_journal.reset();
+		}
+		[[nodiscard]] bool isJournalEnabled() const
+		{
+			return m_journal != nullptr;
+		}
+
+		/**
+		 * @brief
+		 * Writes all aggregates to the snapshot of the journal and starts the journal over.
+		 * Aggregates that change while it runs stay dirty.
+		 * @return false if no journal is open or the snapshot could not be written.
+		 */
+		bool checkpoint() const;
+
+		/**
+		 * @brief Blocks until all journal records are synced to disk.
+		 * @return false if syncing failed, true if no journal is open.
+		 */
+		bool flushJournal() const
+		{
+			return !m_journal || m_journal->flush();
+		}
+		[[nodiscard]] JournalStats getJournalStats() const
+		{
+			return m_journal ? m_journal->getStats() : JournalStats();
+		}
+
+		/**
+		 * @brief
+		 * Gets the IDs of the dirty aggregates of type AGG, or of all types.
+		 * The cost is proportional to the number of dirty aggregates.
+		 * @see Repository::getDirtyIDs
+		 */
+		template <DerivedFromAggregate AGG> [[nodiscard]] std::vector<ID> getDirtyIDs() const
+		{
+			return getAggregateContainer<AGG>().getDirtyIDs();
+		}
+		[[nodiscard]] std::vector<ID> getDirtyIDs() const;
+		template <DerivedFromAggregate AGG> [[nodiscard]] bool isDirty(ID id) const
+		{
+			return getAggregateContainer<AGG>().isDirty(id);
+		}
+		[[nodiscard]] size_t getDirtyCount() const;
+		void clearDirty() const
+		{
+			forEachContainer([](const auto& obj) { obj.clearDirty(); });
+		}
+
 		bool saveMetadata(std::shared_ptr<MetadataContainer::MetaContext> context = nullptr) const;
+		/**
+		 * @brief
+		 * Loads all aggregates, or the given ones.
+		 * On success, the loaded aggregates are not dirty.
+		 */
 		bool load();
 		bool load(const std::vector<ID>& ids);
 		bool loadMetadata(std::shared_ptr<MetadataContainer::MetaContext> context = nullptr);
 
+		/**
+		 * @brief
+		 * Loads the aggregates when they are accessed, instead of all at once with load().
+		 *
+		 * @details
+		 * Only the catalog of the stored aggregates is read, see IPersistence::loadCatalog().
+		 * getAggregate() loads a catalogued aggregate that is not in the model yet with
+		 * IPersistence::load(ids), getAggregates(idList) loads all missing aggregates of the list at once.
+		 * Misses of concurrent threads are loaded by one call, see LazyAggregateLoader.
+		 * The loaded aggregates are not dirty.
+		 *
+		 * size(), contains(), getIDs() and the other scans only see the loaded aggregates.
+		 * removeAggregate() also removes catalogued aggregates, the next save removes them from the persistence.
+		 * It waits for a running load of the aggregate, so that the load does not add it again.
+		 * save() calls IPersistence::save(), which must keep the stored aggregates that are not loaded,
+		 * and passes the aggregates that were removed since the last save to IPersistence::remove(ids).
+		 * IPersistence::load(ids) must not call getAggregate() for aggregates that are not loaded.
+		 * Must be called while no other thread uses the model.
+		 * @return false if no persistence is attached or it has no catalog.
+		 */
+		bool enableLazyLoading();
+
+		/**
+		 * @brief
+		 * Forgets the catalog, the aggregates that are not loaded yet can still be loaded with load().
+		 * Eviction stops as well.
+		 */
+		void disableLazyLoading()
+		{
+			m_lazyLoader.reset();
+			m_evictionEnabled = false;
+		}
+		[[nodiscard]] bool isLazyLoadingEnabled() const
+		{
+			return m_lazyLoader != nullptr;
+		}
+		[[nodiscard]] LazyLoadStats getLazyLoadStats() const
+		{
+			return m_lazyLoader ? m_lazyLoader->getStats() : LazyLoadStats();
+		}
+
+		/**
+		 * @brief
+		 * Limits the loaded aggregates to a budget, the least recently used ones get evicted
+		 * and are loaded again when they are accessed.
+		 *
+		 * @details
+		 * Needs lazy loading, see enableLazyLoading(). Lookups by ID, like getAggregate(),
+		 * tryGetAggregate() and getAggregates(idList), record the access, scans don't.
+		 * The budget gets checked after each lazy load and by evict(). Evicted aggregates go back
+		 * to the catalog, they don't get dirty and no removal is notified.
+		 *
+		 * Locked aggregates, aggregates that are referenced outside of the model and aggregates
+		 * that were just loaded for a lookup stay loaded,
+		 * so that no second copy of them gets loaded. Dirty aggregates are saved with save(ids) first,
+		 * see EvictionPolicy::saveDirty. The write-behind queue is flushed before an eviction and before
+		 * a lazy load, a failed flush skips them. Nothing gets evicted while a journal is open, since lazy
+		 * loads read the persistence. A policy without limits disables the eviction.
+		 * Must be called while no other thread uses the model.
+		 * @return false if lazy loading is not enabled.
+		 */
+		bool setEvictionPolicy(const EvictionPolicy& policy);
+		[[nodiscard]] EvictionPolicy getEvictionPolicy() const
+		{
+			return m_evictionPolicy;
+		}
+		[[nodiscard]] bool isEvictionEnabled() const
+		{
+			return m_evictionEnabled;
+		}
+
+		/**
+		 * @brief Evicts the least recently used aggregates if the budget is exceeded.
+		 * @return the number of evicted aggregates.
+		 */
+		size_t evict()
+		{
+			return evictAggregates(false);
+		}
+		[[nodiscard]] EvictionStats getEvictionStats() const
+		{
+			std::lock_guard<std::mutex> lock(m_evictionMutex);
+			return m_evictionStats;
+		}
+
+		/**
+		 * @brief
+		 * Writes all aggregates to a binary snapshot file, with one section per aggregate type.
+		 *
+		 * @details
+		 * The aggregates are written by AggregateFactory::serialize() of the registered factories,
+		 * the sections are named after AggregateFactory::getAggregateName().
+		 * Aggregate types without aggregates need no factory.
+		 * The file gets replaced after all aggregates are written, see BinarySnapshotWriter.
+		 * @return false if an aggregate could not be written, the file is unchanged then.
+		 */
+		bool saveBinarySnapshot(const std::string& path) const;
+
+		/**
+		 * @brief
+		 * Loads all aggregates of a binary snapshot, see saveBinarySnapshot().
+		 *
+		 * @details
+		 * The file is memory mapped, AggregateFactory::deserialize() creates the aggregates
+		 * from the records on threadCount threads, 0 uses one thread per core.
+		 * The created aggregates and their entities are moved to the calling thread.
+		 * The aggregates are added after all of them are created, aggregates that are
+		 * already in the model get replaced. The loaded aggregates are not dirty.
+		 * Sections of aggregate types that are not part of this model are ignored.
+		 * @return false if the file is not a valid snapshot or a record could not be read,
+		 *         nothing gets added then.
+		 *         false as well if an aggregate could not be added, the other aggregates stay added.
+		 */
+		bool loadBinarySnapshot(const std::string& path, size_t threadCount = 0);
+		bool loadBinarySnapshot(const BinarySnapshotFile& snapshot, size_t threadCount = 0);
+
+		/**
+		 * @brief
+		 * Loads only the aggregates with the given IDs from an open snapshot,
+		 * so that the rest of the snapshot can be loaded when it is needed.
+		 * @return false if an ID is not in the snapshot or a record could not be read,
+		 *         nothing gets added then.
+		 *         false as well if an aggregate could not be added, the other aggregates stay added.
+		 */
+		bool loadBinarySnapshot(const BinarySnapshotFile& snapshot, const std::vector<ID>& ids);
+
 		bool onPersistenceDataChanged();
+
+		/**
+		 * @brief
+		 * Updates the local copy of the locks. Only the changes since the last update are loaded
+		 * if the persistence supports lock versions, see IPersistence::getLockChanges().
+		 */
 		bool loadLockedObjects();
 
 		bool manualLockDatabase();
@@ -318,6 +886,22 @@ namespace DDD
 		bool isAggregateLocked(const ID& id) const;
 		std::vector<std::shared_ptr<AggregateLock>> getLockedAggregates() const;
 		std::shared_ptr<AggregateLock> getLock(const ID& id) const;
+		[[nodiscard]] size_t getLockedAggregateCount() const
+		{
+			SharedReadLock lock(m_lockTableMutex);
+			return m_lockTable.size();
+		}
+
+		/**
+		 * @brief Gets the locks that are held by the owner, see AggregateLock::getOwner().
+		 */
+		std::vector<std::shared_ptr<AggregateLock>> getLocksOfOwner(const std::string& owner) const;
+
+		/**
+		 * @brief Unlocks all aggregates that are locked by the owner, for example when a user logs off.
+		 * @return true if all of them were unlocked.
+		 */
+		bool unlockAggregatesOfOwner(const std::string& owner);
 
 		bool logOnUser(std::shared_ptr<User> user);
 		bool logOffUser(std::shared_ptr<User> user);
@@ -346,60 +930,338 @@ namespace DDD
 				delete m_factoryLogger;
 				m_factoryLogger = nullptr;
 			}
-			for (auto& agg : m_domains)
-			{
-				std::visit([this](auto& obj) {
-					obj.attachLogger(m_factoryLogger);
-					}, agg);
-			}
+			forEachContainer([this](auto& obj) {
+				obj.attachLogger(m_factoryLogger);
+				});
 		}
 #endif
 
 	protected:
+		// Reserves the IDs [id, id + amount - 1] in the metadata of the persistence
 		bool tryReserveNextID(ID id, ID amount);
 
+		// Gives the unused IDs [id, id + amount - 1] back, if no one reserved IDs behind them
+		bool tryReleaseIDs(ID id, ID amount);
+
+		// Reads the highest reserved ID from the metadata of the persistence, INVALID_ID if it can't be read
+		ID getHighestReservedID();
+
 	private:
-		// Retrieve an instance of a specific type X
-		template <typename AGG> [[nodiscard]] AggregateContainer<AGG>& getAggregateContainer();
-		template <typename AGG> [[nodiscard]] const AggregateContainer<AGG>& getAggregateContainer() const;
+		// Adds a single lock to the local copy of the locks
+		bool insertLock(const std::shared_ptr<AggregateLock>& lock)
+		{
+			ExclusiveWriteLock tableLock(m_lockTableMutex);
+			return m_lockTable.insert(lock);
+		}
 
+		// Applies the lock changes since m_lockVersion, returns false if they are not available
+		bool loadLockChanges();
 
+		/**
+		 * @brief Gets the compile time slot of the aggregate type AGG in Ts...
+		 */
+		template <typename AGG> static constexpr size_t getTypeSlot()
+		{
+			constexpr bool matches[] = { std::is_same_v<AGG, Ts>... };
+			for (size_t i = 0; i < aggregateTypeCount; ++i)
+				if (matches[i])
+					return i;
+			return aggregateTypeCount;
+		}
 
+		/**
+		 * @brief Gets a mask over the type slots which is true for each type that derives from Base
+		 */
+		template <typename Base> static constexpr std::array<bool, aggregateTypeCount> getDerivedTypeMask()
+		{
+			return { std::is_base_of_v<Base, Ts>... };
+		}
 
-		using VariantType = std::variant<AggregateContainer<Ts>...>;
-		std::array<VariantType, aggregateTypeCount> m_domains{
-			VariantType{AggregateContainer<Ts>(m_idDomain, m_aggregateAddedSignal, m_aggregateReplacedSignal, m_aggregateRemovedSignal)}...
-		};
+		/**
+		 * @brief Calls func for each aggregate container, in the order of Ts...
+		 */
+		template <typename F> void forEachContainer(F&& func)
+		{
+			std::apply([&func](auto&... containers) { (func(containers), ...); }, m_containers);
+		}
+		template <typename F> void forEachContainer(F&& func) const
+		{
+			std::apply([&func](const auto&... containers) { (func(containers), ...); }, m_containers);
+		}
 
-		std::vector<std::shared_ptr<Service>> m_generalServices;
-		UniqueIDDomain m_idDomain;
-		std::shared_ptr<IPersistence> m_persistence;
-		std::shared_ptr<MetadataContainer> m_metadata;
+		// Hands the IDs taken for a failed save back to the dirty sets, in the order of Ts...
+		void restoreDirty(const std::array<std::vector<ID>, aggregateTypeCount>& taken) const;
 
+		// Keeps the IDs of the aggregates in the model and of the removed ones, a removal marks the ID dirty.
+		// The writers below treat every ID that is not in the model as removed.
+		std::vector<ID> getSavableIDs(const std::vector<ID>& ids) const;
 
-		std::function<void(const std::vector<ID>&)> m_aggregateAddedSignal;
-		std::function<void(const std::vector<ID>&)> m_aggregateReplacedSignal;
-		std::function<void(const std::vector<ID>&)> m_aggregateRemovedSignal;
+		// Captures the aggregates and queues them in the write-behind stage, removed aggregates are queued as removed
+		bool enqueueWrites(const std::vector<ID>& ids) const;
 
-		std::vector<std::shared_ptr<AggregateLock>> m_lockedAggregates;
+		// Saves the aggregates with IPersistence::save(ids) and passes the removed ones to IPersistence::remove(ids)
+		bool writeToPersistence(const std::vector<ID>& ids) const;
 
-#if LOGGER_LIBRARY_AVAILABLE == 1
-		Log::LogObject* m_logger = nullptr;
-		Log::LogObject* m_factoryLogger = nullptr;
-#endif
+		// Creates the aggregates of the container's type from the snapshot records with the given IDs,
+		// or from all records of the section if ids is nullptr
+		template <typename AGG> bool readBinarySnapshotSection(const AggregateContainer<AGG>& container, const BinarySnapshotFile& snapshot,
+			const std::vector<ID>* ids, size_t threadCount, std::vector<std::shared_ptr<Aggregate>>& aggregates) const;
 
-	};
+		// Adds or replaces the aggregates that were read from a snapshot, they are not dirty afterwards
+		bool addBinarySnapshotAggregates(std::vector<std::shared_ptr<Aggregate>> aggregates, ID highestID);
 
-	template <DerivedFromAggregate... Ts>
-	template <typename FAC>
-	std::shared_ptr<FAC> Model<Ts...>::createFactory()
-	{
-		static_assert((std::is_base_of_v<AggregateFactory<typename FAC::AggregateType>, FAC>), "FAC must be derived from AggregateFactory");
-		AggregateContainer<typename FAC::AggregateType>& domain = getAggregateContainer<typename FAC::AggregateType>();
-		if (domain.getFactory())
-		{
-#if LOGGER_LIBRARY_AVAILABLE == 1
-			if (m_logger) m_logger->debug("Unregistering factory for " + std::string(domain.getFactory()->getAggregateName()));
+		// saveBinarySnapshot() that marks the journal generation as contained in the snapshot
+		bool writeBinarySnapshot(const std::string& path, JournalGeneration journalGeneration) const;
+
+		// Appends the state of the aggregates to the journal, missing aggregates as removed
+		bool appendToJournal(const std::vector<ID>& ids) const;
+
+		// Writes the snapshot and truncates the journal, the caller must hold m_checkpointMutex exclusively
+		bool checkpointLocked() const;
+
+		// Applies the last record of each aggregate in the journal file
+		bool replayJournal(const std::string& path, size_t& recordCount);
+
+		// Loads the catalogued aggregates of the IDs that are not in the model, see enableLazyLoading()
+		void faultIn(const std::vector<ID>& ids) const;
+
+		// Loads the catalogued aggregate if it is stored in the repository of the type slot
+		bool faultIn(ID id, size_t slot) const;
+
+		// Gets the aggregate from the container of the type slot, a catalogued aggregate gets loaded
+		template <typename Container> auto lookupAggregate(Container& container, ID id, size_t slot) const
+		{
+			auto aggregate = container.tryGet(id);
+			if (!aggregate && m_lazyLoader)
+			{
+				// Other loads may evict, the aggregate stays until it is taken
+				pinAggregate(id);
+				if (faultIn(id, slot))
+					aggregate = container.tryGet(id);
+				unpinAggregate(id);
+			}
+			if (!aggregate)
+				return container.get(id);
+			recordAccess(aggregate.get());
+			return aggregate;
+		}
+
+		// Load function of the lazy loader, enforces the eviction budget afterwards
+		bool loadLazily(const std::vector<ID>& ids);
+
+		// Records a lookup by ID for the eviction, see setEvictionPolicy()
+		void recordAccess(const Aggregate* aggregate) const
+		{
+			if (m_evictionEnabled && aggregate)
+				aggregate->setLastAccess(m_accessClock.fetch_add(1, std::memory_order_relaxed) + 1);
+		}
+
+		// Pinned aggregates are not evicted, pins of the same ID are counted
+		void pinAggregate(ID id) const
+		{
+			if (!m_evictionEnabled)
+				return;
+			std::lock_guard<std::mutex> lock(m_pinMutex);
+			++m_pinnedIDs.try_emplace(id, 0).first->second;
+		}
+		void unpinAggregate(ID id) const
+		{
+			if (!m_evictionEnabled)
+				return;
+			std::lock_guard<std::mutex> lock(m_pinMutex);
+			auto it = m_pinnedIDs.find(id);
+			if (it != m_pinnedIDs.end() && --it->second == 0)
+				m_pinnedIDs.erase(it);
+		}
+		void pinAggregates(const std::vector<ID>& ids) const
+		{
+			if (!m_evictionEnabled)
+				return;
+			std::lock_guard<std::mutex> lock(m_pinMutex);
+			for (ID id : ids)
+				++m_pinnedIDs.try_emplace(id, 0).first->second;
+		}
+		void unpinAggregates(const std::vector<ID>& ids) const
+		{
+			if (!m_evictionEnabled)
+				return;
+			std::lock_guard<std::mutex> lock(m_pinMutex);
+			for (ID id : ids)
+			{
+				auto it = m_pinnedIDs.find(id);
+				if (it != m_pinnedIDs.end() && --it->second == 0)
+					m_pinnedIDs.erase(it);
+			}
+		}
+		[[nodiscard]] bool isPinned(ID id) const
+		{
+			std::lock_guard<std::mutex> lock(m_pinMutex);
+			return m_pinnedIDs.contains(id);
+		}
+
+		// Evicts the least recently used aggregates down to EvictionPolicy::targetRatio of the budget.
+		// Automatic runs skip the scan while the estimated size is within the budget.
+		size_t evictAggregates(bool automatic);
+		template <size_t... Is> void setupStorageCallbacks(std::index_sequence<Is...>)
+		{
+			// Called while the repository is locked, lock order is: repository -> index
+			(std::get<Is>(m_containers).setStorageCallbacks(
+				[this](ID id) {
+					{
+						IndexShard& shard = getIndexShard(id);
+						ExclusiveWriteLock lock(shard.mutex);
+						shard.entries[id] = Is;
+					}
+					// Added or loaded, the catalogued aggregate must not be loaded again
+					if (m_lazyLoader)
+						m_lazyLoader->removeFromCatalog(id);
+				},
+				[this](ID id) {
+					IndexShard& shard = getIndexShard(id);
+					ExclusiveWriteLock lock(shard.mutex);
+					shard.entries.erase(id);
+				}), ...);
+		}
+
+		/**
+		 * @brief Resolves the type slot of the concrete type of the given aggregate.
+		 * @details The exact types of Ts... are registered at construction.
+		 *          Types that derive from a registered type get resolved once to the most
+		 *          derived registered base and are cached afterwards.
+		 * @return true if the aggregate type can be stored in this model, false otherwise.
+		 */
+		[[nodiscard]] bool resolveTypeSlot(const Aggregate& aggregate, size_t& slot) const;
+
+		/**
+		 * @brief Calls func with the aggregate container that is stored at the given type slot.
+		 */
+		template <typename F> decltype(auto) visitContainer(size_t slot, F&& func);
+		template <typename F> decltype(auto) visitContainer(size_t slot, F&& func) const;
+
+		/**
+		 * @brief Gets the type slot of the repository that contains the aggregate with the given ID.
+		 * @return true if the ID is contained in the model, false otherwise.
+		 */
+		[[nodiscard]] bool findTypeSlot(ID id, size_t& slot) const;
+
+		/**
+		 * @brief Reserves the ID in the global index for an aggregate that is about to be added.
+		 * @return false if the ID is already used in this model.
+		 */
+		[[nodiscard]] bool claimID(ID id, size_t slot)
+		{
+			IndexShard& shard = getIndexShard(id);
+			ExclusiveWriteLock lock(shard.mutex);
+			return shard.entries.try_emplace(id, slot).second;
+		}
+		void releaseClaim(ID id)
+		{
+			IndexShard& shard = getIndexShard(id);
+			ExclusiveWriteLock lock(shard.mutex);
+			shard.entries.erase(id);
+		}
+
+		void flushNotificationsIfDue()
+		{
+			if (m_notificationState.isFlushDue())
+				flushNotifications();
+		}
+
+		// Retrieve an instance of a specific type X
+		template <typename AGG> [[nodiscard]] AggregateContainer<AGG>& getAggregateContainer();
+		template <typename AGG> [[nodiscard]] const AggregateContainer<AGG>& getAggregateContainer() const;
+
+
+
+
+		using ContainerTuple = std::tuple<AggregateContainer<Ts>...>;
+		ContainerTuple m_containers{
+			AggregateContainer<Ts>(m_idDomain, m_notificationState, m_aggregateAddedSignal, m_aggregateReplacedSignal, m_aggregateRemovedSignal)...
+		};
+
+		std::vector<std::shared_ptr<Service>> m_generalServices;
+		UniqueIDDomain m_idDomain;
+		std::shared_ptr<IPersistence> m_persistence;
+		std::unique_ptr<WriteBehindQueue> m_writeBehind;
+		std::unique_ptr<AggregateJournal> m_journal;
+		std::string m_snapshotPath;
+
+		// Stored aggregates that are not loaded yet, see enableLazyLoading()
+		std::unique_ptr<LazyAggregateLoader> m_lazyLoader;
+
+		// Budget of the loaded aggregates, see setEvictionPolicy()
+		EvictionPolicy m_evictionPolicy;
+		bool m_evictionEnabled = false;
+		mutable std::atomic<uint64_t> m_accessClock{ 0 };
+
+		// Serializes the eviction runs, guards the stats and the size estimate
+		mutable std::mutex m_evictionMutex;
+		EvictionStats m_evictionStats;
+		size_t m_averageAggregateBytes = 0;
+
+		// Lookups that wait for their lazy load
+		mutable std::mutex m_pinMutex;
+		mutable HashMap<ID, size_t> m_pinnedIDs;
+
+		// Journal appends hold it shared, checkpoints exclusive, so that the truncation drops no record
+		mutable OptionalSharedMutex m_checkpointMutex;
+		std::shared_ptr<MetadataContainer> m_metadata;
+
+
+		std::function<void(const std::vector<ID>&)> m_aggregateAddedSignal;
+		std::function<void(const std::vector<ID>&)> m_aggregateReplacedSignal;
+		std::function<void(const std::vector<ID>&)> m_aggregateRemovedSignal;
+		NotificationBatchState m_notificationState;
+
+		// Local copy of the locks in the persistence, indexed by aggregate ID and owner
+		AggregateLockTable m_lockTable;
+
+		// Lock version of the persistence that m_lockTable reflects, 0 if unknown
+		uint64_t m_lockVersion = 0;
+
+		// Guards m_lockTable and m_lockVersion, eviction reads the locks on the thread of a lazy load
+		mutable OptionalSharedMutex m_lockTableMutex;
+
+		// Global ID -> type slot index, used to route untyped lookups straight to the owning repository.
+		// Sharded the same way as the repositories, so that writers of different shards do not contend
+		struct IndexShard
+		{
+			HashMap<ID, size_t> entries;
+			mutable OptionalSharedMutex mutex;
+		};
+		IndexShard& getIndexShard(ID id)
+		{
+			return *m_indexShards[Sharding::getShardIndex(id, m_indexShardBits)];
+		}
+		const IndexShard& getIndexShard(ID id) const
+		{
+			return *m_indexShards[Sharding::getShardIndex(id, m_indexShardBits)];
+		}
+		std::vector<std::unique_ptr<IndexShard>> m_indexShards;
+		unsigned int m_indexShardBits = 0;
+		bool m_threadSafe = false;
+
+		// Concrete aggregate type -> type slot. aggregateTypeCount marks types that are not part of the model
+		mutable std::unordered_map<std::type_index, size_t> m_typeSlots;
+		mutable OptionalSharedMutex m_typeSlotsMutex;
+
+#if LOGGER_LIBRARY_AVAILABLE == 1
+		Log::LogObject* m_logger = nullptr;
+		Log::LogObject* m_factoryLogger = nullptr;
+#endif
+
+	};
+
+	template <DerivedFromAggregate... Ts>
+	template <typename FAC>
+	std::shared_ptr<FAC> Model<Ts...>::createFactory()
+	{
+		static_assert((std::is_base_of_v<AggregateFactory<typename FAC::AggregateType>, FAC>), "FAC must be derived from AggregateFactory");
+		AggregateContainer<typename FAC::AggregateType>& domain = getAggregateContainer<typename FAC::AggregateType>();
+		if (domain.getFactory())
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->debug("Unregistering factory for " + std::string(domain.getFactory()->getAggregateName()));
 #endif
 			domain.getFactory()->unregister();
 		}
@@ -609,15 +1471,9 @@ namespace DDD
 	template <DerivedFromAggregate... Ts>
 	[[nodiscard]] bool Model<Ts...>::contains(ID id) const
 	{
-		for (auto& agg : m_domains)
-		{
-			bool found = std::visit([id](auto& obj) {
-				return obj.contains(id);
-				}, agg);
-			if (found)
-				return true;
-		}
-		return false;
+		const IndexShard& shard = getIndexShard(id);
+		SharedReadLock lock(shard.mutex);
+		return shard.entries.contains(id);
 	}
 
 	template <DerivedFromAggregate... Ts>
@@ -653,7 +1509,7 @@ namespace DDD
 	{
 		static_assert((std::is_same_v<AGG, Ts> || ...), "Aggregate type <AGG> not found in this model");
 		AggregateContainer<AGG>& domain = getAggregateContainer<AGG>();
-		return domain.get(id);
+		return lookupAggregate(domain, id, getTypeSlot<AGG>());
 	}
 	template <DerivedFromAggregate... Ts>
 	template <DerivedFromAggregate AGG>
@@ -661,54 +1517,55 @@ namespace DDD
 	{
 		static_assert((std::is_same_v<AGG, Ts> || ...), "Aggregate type <AGG> not found in this model");
 		const AggregateContainer<AGG>& domain = getAggregateContainer<AGG>();
-		return domain.get(id);
+		return lookupAggregate(domain, id, getTypeSlot<AGG>());
 	}
 
 	template <DerivedFromAggregate... Ts>
 	[[nodiscard]] std::shared_ptr<Aggregate> Model<Ts...>::getAggregate(const ID id)
 	{
-		std::shared_ptr<Aggregate> objPtr = nullptr;
-		for (auto& agg : m_domains)
-		{
-			std::visit([&objPtr, id](auto& obj) {
-				if (!obj.contains(id))
-					return;
-				objPtr = obj.get(id);
-				}, agg);
-			if (objPtr)
-				return objPtr;
-		}
-		return nullptr;
+		size_t slot;
+		if (!findTypeSlot(id, slot) && (!m_lazyLoader || !m_lazyLoader->findInCatalog(id, slot)))
+			return nullptr;
+		return visitContainer(slot, [this, id, slot](auto& obj) -> std::shared_ptr<Aggregate> {
+			return lookupAggregate(obj, id, slot);
+			});
 	}
 	template <DerivedFromAggregate... Ts>
 	[[nodiscard]] std::shared_ptr<const Aggregate> Model<Ts...>::getAggregate(const ID id) const
 	{
-		std::shared_ptr<const Aggregate> objPtr = nullptr;
-		for (auto& agg : m_domains)
-		{
-			std::visit([&objPtr, id](auto& obj) {
-				if (!obj.contains(id))
-					return;
-				objPtr = obj.get(id);
-				}, agg);
-			if (objPtr)
-				return objPtr;
-		}
-		return nullptr;
+		size_t slot;
+		if (!findTypeSlot(id, slot) && (!m_lazyLoader || !m_lazyLoader->findInCatalog(id, slot)))
+			return nullptr;
+		return visitContainer(slot, [this, id, slot](const auto& obj) -> std::shared_ptr<const Aggregate> {
+			return lookupAggregate(obj, id, slot);
+			});
 	}
 
 	template <DerivedFromAggregate... Ts>
 	bool Model<Ts...>::removeAggregate(const ID id)
 	{
-		for (auto& agg : m_domains)
+		size_t slot;
+		if (!findTypeSlot(id, slot))
 		{
-			bool found = std::visit([id](auto& obj) {
-				return obj.remove(id);
-				}, agg);
-			if (found)
+			if (!m_lazyLoader)
+				return false;
+
+			// Not loaded yet, the next save removes it from the persistence
+			if (m_lazyLoader->withdraw(id, slot))
+			{
+				visitContainer(slot, [id](auto& obj) { obj.markDirty({ id }); });
 				return true;
+			}
+
+			// A running load added it meanwhile
+			if (!findTypeSlot(id, slot))
+				return false;
 		}
-		return false;
+		bool result = visitContainer(slot, [id](auto& obj) {
+			return obj.remove(id);
+			});
+		flushNotificationsIfDue();
+		return result;
 	}
 
 	template <DerivedFromAggregate... Ts>
@@ -723,12 +1580,10 @@ namespace DDD
 	template <DerivedFromAggregate... Ts>
 	void Model<Ts...>::clear()
 	{
-		for (auto& agg : m_domains)
-		{
-			std::visit([](auto& obj) {
-				obj.clear();
-				}, agg);
-		}
+		forEachContainer([](auto& obj) {
+			obj.clear();
+			obj.clearDirty();
+			});
 		m_idDomain.reset();
 	}
 
@@ -746,17 +1601,23 @@ namespace DDD
 	[[nodiscard]] std::vector<std::shared_ptr<AGG>> Model<Ts...>::getAggregates(const std::vector<ID>& idList)
 	{
 		static_assert((std::is_same_v<AGG, Ts> || ...), "Aggregate type <AGG> not found in this model");
+		// Other loads may evict, the aggregates stay until they are taken
+		pinAggregates(idList);
+		if (m_lazyLoader)
+			faultIn(idList);
 		std::vector<std::shared_ptr<AGG>> objs;
 		AggregateContainer<AGG>& domain = getAggregateContainer<AGG>();
 		objs.reserve(idList.size());
 		for (const ID& id : idList)
 		{
-			if (!domain.contains(id))
-				continue;
-			std::shared_ptr<AGG> obj = domain.get(id);
+			std::shared_ptr<AGG> obj = domain.tryGet(id);
 			if (obj)
+			{
+				recordAccess(obj.get());
 				objs.push_back(obj);
+			}
 		}
+		unpinAggregates(idList);
 		return objs;
 	}
 
@@ -765,57 +1626,59 @@ namespace DDD
 	[[nodiscard]] std::vector<std::shared_ptr<const AGG>> Model<Ts...>::getAggregates(const std::vector<ID>& idList) const
 	{
 		static_assert((std::is_same_v<AGG, Ts> || ...), "Aggregate type <AGG> not found in this model");
+		// Other loads may evict, the aggregates stay until they are taken
+		pinAggregates(idList);
+		if (m_lazyLoader)
+			faultIn(idList);
 		std::vector<std::shared_ptr<const AGG>> objs;
 		const AggregateContainer<AGG>& domain = getAggregateContainer<AGG>();
 		objs.reserve(idList.size());
 		for (const ID& id : idList)
 		{
-			if (!domain.contains(id))
-				continue;
-			std::shared_ptr<const AGG> obj = domain.get(id);
+			std::shared_ptr<const AGG> obj = domain.tryGet(id);
 			if (obj)
+			{
+				recordAccess(obj.get());
 				objs.push_back(obj);
+			}
 		}
+		unpinAggregates(idList);
 		return objs;
 	}
 
 	template <DerivedFromAggregate... Ts>
 	[[nodiscard]] std::vector<std::shared_ptr<Aggregate>> Model<Ts...>::getAggregates(const std::vector<ID>& idList)
 	{
+		pinAggregates(idList);
+		if (m_lazyLoader)
+			faultIn(idList);
 		std::vector<std::shared_ptr<Aggregate>> objs;
-		for (auto& agg : m_domains)
+		objs.reserve(idList.size());
+		for (const ID& id : idList)
 		{
-			std::visit([&objs, &idList](auto& obj) {
-				for (const ID& id : idList)
-				{
-					if (!obj.contains(id))
-						continue;
-					std::shared_ptr<Aggregate> ins = obj.get(id);
-					if (ins)
-						objs.push_back(ins);
-				}
-				}, agg);
+			std::shared_ptr<Aggregate> ins = getAggregate(id);
+			if (ins)
+				objs.push_back(ins);
 		}
+		unpinAggregates(idList);
 		return objs;
 	}
 
 	template <DerivedFromAggregate... Ts>
 	[[nodiscard]] std::vector<std::shared_ptr<const Aggregate>> Model<Ts...>::getAggregates(const std::vector<ID>& idList) const
 	{
+		pinAggregates(idList);
+		if (m_lazyLoader)
+			faultIn(idList);
 		std::vector<std::shared_ptr<const Aggregate>> objs;
-		for (auto& agg : m_domains)
+		objs.reserve(idList.size());
+		for (const ID& id : idList)
 		{
-			std::visit([&objs, &idList](auto& obj) {
-				for (const ID& id : idList)
-				{
-					if (!obj.contains(id))
-						continue;
-					std::shared_ptr<const Aggregate> ins = obj.get(id);
-					if (ins)
-						objs.push_back(ins);
-				}
-				}, agg);
+			std::shared_ptr<const Aggregate> ins = getAggregate(id);
+			if (ins)
+				objs.push_back(ins);
 		}
+		unpinAggregates(idList);
 		return objs;
 	}
 
@@ -831,13 +1694,13 @@ namespace DDD
 	[[nodiscard]] std::vector<std::shared_ptr<Aggregate>> Model<Ts...>::getAggregates()
 	{
 		std::vector<std::shared_ptr<Aggregate>> objs;
-		for (auto& agg : m_domains)
-		{
-			std::visit([&objs](auto& obj) {
-				for (auto& ins : obj.getAll())
-					objs.push_back(ins);
-				}, agg);
-		}
+		size_t count = 0;
+		forEachContainer([&count](const auto& obj) { count += obj.size(); });
+		objs.reserve(count);
+		forEachContainer([&objs](auto& obj) {
+			for (auto& ins : obj.getAll())
+				objs.push_back(ins);
+			});
 		return objs;
 	}
 
@@ -845,13 +1708,13 @@ namespace DDD
 	[[nodiscard]] std::vector<std::shared_ptr<const Aggregate>> Model<Ts...>::getAggregates() const
 	{
 		std::vector<std::shared_ptr<const Aggregate>> objs;
-		for (auto& agg : m_domains)
-		{
-			std::visit([&objs](auto& obj) {
-				for (auto& ins : obj.getAll())
-					objs.push_back(ins);
-				}, agg);
-		}
+		size_t count = 0;
+		forEachContainer([&count](const auto& obj) { count += obj.size(); });
+		objs.reserve(count);
+		forEachContainer([&objs](const auto& obj) {
+			for (auto& ins : obj.getAll())
+				objs.push_back(ins);
+			});
 		return objs;
 	}
 	template <DerivedFromAggregate... Ts>
@@ -859,29 +1722,50 @@ namespace DDD
 	[[nodiscard]] std::vector<std::shared_ptr<const AGG>> Model<Ts...>::getAggregates() const
 	{
 		const AggregateContainer<AGG>& domain = getAggregateContainer<AGG>();
-		std::vector<std::shared_ptr<const AGG>> objs;
-		objs.reserve(domain.size());
-		for (const auto& it : domain.getALL())
-		{
-			objs.push_back(it);
-		}
-		return objs;
+		return domain.getAll();
+	}
+
+	template <DerivedFromAggregate... Ts>
+	template <typename F>
+	void Model<Ts...>::forEachAggregate(F&& func)
+	{
+		bool proceed = true;
+		forEachContainer([&func, &proceed](auto& obj) {
+			if (!proceed)
+				return;
+			obj.forEach([&func, &proceed](Aggregate& aggregate) {
+				proceed = invokeAggregateVisitor(func, aggregate);
+				return proceed;
+				});
+			});
+	}
+
+	template <DerivedFromAggregate... Ts>
+	template <typename F>
+	void Model<Ts...>::forEachAggregate(F&& func) const
+	{
+		bool proceed = true;
+		forEachContainer([&func, &proceed](const auto& obj) {
+			if (!proceed)
+				return;
+			obj.forEach([&func, &proceed](const Aggregate& aggregate) {
+				proceed = invokeAggregateVisitor(func, aggregate);
+				return proceed;
+				});
+			});
 	}
 
 	template <DerivedFromAggregate... Ts>
 	[[nodiscard]] std::vector<std::shared_ptr<Aggregate>> Model<Ts...>::getDeletedAggregates()
 	{
 		std::vector<std::shared_ptr<Aggregate>> objs;
-		for (auto& agg : m_domains)
-		{
-			std::visit([&objs](auto& obj) {
-				auto deleted = obj.getDeleted();
-				for (auto& ins : deleted)
-				{
-					objs.push_back(ins);
-				}
-				}, agg);
-		}
+		forEachContainer([&objs](auto& obj) {
+			auto deleted = obj.getDeleted();
+			for (auto& ins : deleted)
+			{
+				objs.push_back(ins);
+			}
+			});
 		return objs;
 	}
 
@@ -897,16 +1781,13 @@ namespace DDD
 	[[nodiscard]] std::vector<std::shared_ptr<const Aggregate>> Model<Ts...>::getDeletedAggregates() const
 	{
 		std::vector<std::shared_ptr<const Aggregate>> objs;
-		for (auto& agg : m_domains)
-		{
-			std::visit([&objs](auto& obj) {
-				auto deleted = obj.getDeleted();
-				for (auto& ins : deleted)
-				{
-					objs.push_back(ins);
-				}
-				}, agg);
-		}
+		forEachContainer([&objs](const auto& obj) {
+			auto deleted = obj.getDeleted();
+			for (auto& ins : deleted)
+			{
+				objs.push_back(ins);
+			}
+			});
 		return objs;
 	}
 
@@ -914,19 +1795,16 @@ namespace DDD
 	template <DerivedFromAggregate AGG>
 	[[nodiscard]] std::vector<std::shared_ptr<const AGG>> Model<Ts...>::getDeletedAggregates() const
 	{
-		AggregateContainer<AGG>& domain = getAggregateContainer<AGG>();
+		const AggregateContainer<AGG>& domain = getAggregateContainer<AGG>();
 		return domain.getDeleted();
 	}
 
 	template <DerivedFromAggregate... Ts>
 	void Model<Ts...>::clearDeletedAggregates()
 	{
-		for (auto& agg : m_domains)
-		{
-			std::visit([](auto& obj) {
-				obj.clearDeletedCache();
-				}, agg);
-		}
+		forEachContainer([](auto& obj) {
+			obj.clearDeletedCache();
+			});
 	}
 
 	template <DerivedFromAggregate... Ts>
@@ -954,13 +1832,13 @@ namespace DDD
 	[[nodiscard]] std::vector<ID> Model<Ts...>::getIDs() const
 	{
 		std::vector<ID> ids;
-		for (auto& agg : m_domains)
-		{
-			std::visit([&ids](auto& obj) {
-				std::vector<ID> subIds = obj.getIDs();
-				ids.insert(ids.end(), subIds.begin(), subIds.end());
-				}, agg);
-		}
+		size_t count = 0;
+		forEachContainer([&count](const auto& obj) { count += obj.size(); });
+		ids.reserve(count);
+		forEachContainer([&ids](const auto& obj) {
+			std::vector<ID> subIds = obj.getIDs();
+			ids.insert(ids.end(), subIds.begin(), subIds.end());
+			});
 		return ids;
 	}
 
@@ -968,222 +1846,1176 @@ namespace DDD
 	template <DerivedFromAggregate AGG>
 	[[nodiscard]] std::vector<ID> Model<Ts...>::filterIDs(const std::vector<ID>& toFilter) const
 	{
-		std::vector<ID> filteredIDs;
-		filteredIDs.reserve(toFilter.size());
 		const AggregateContainer<AGG>& domain = getAggregateContainer<AGG>();
-		for (const ID& id : toFilter)
+		return domain.filterIDs(toFilter);
+	}
+
+
+	template <DerivedFromAggregate... Ts>
+	template <DerivedFromIPersistance PER>
+	std::shared_ptr<PER> Model<Ts...>::attachPersistence()
+	{
+		// The leased IDs were reserved in the old persistence layer or in none at all
+		m_idDomain.releaseLease();
+
+		// Queued saves belong to the old persistence layer
+		std::unique_ptr<WriteBehindPolicy> writeBehindPolicy;
+		if (m_writeBehind)
+		{
+			writeBehindPolicy = std::make_unique<WriteBehindPolicy>(m_writeBehind->getPolicy());
+			m_writeBehind.reset();
+		}
+		if (m_persistence)
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->debug("Detaching persistence layer");
+#endif
+			m_persistence = nullptr;
+		}
+#if LOGGER_LIBRARY_AVAILABLE == 1
+		if (m_logger) m_logger->debug("Attaching persistence layer");
+#endif
+		// The catalog belongs to the old persistence layer
+		disableLazyLoading();
+		std::shared_ptr<PER> persistence = std::make_shared<PER>();
+		m_persistence = persistence;
+		{
+			ExclusiveWriteLock lock(m_lockTableMutex);
+			m_lockTable.clear();
+			m_lockVersion = 0;
+		}
+		if (writeBehindPolicy)
+			enableWriteBehind(*writeBehindPolicy);
+		return persistence;
+	}
+
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::addAggregate(std::shared_ptr<Aggregate> aggregate)
+	{
+		if (!aggregate)
+			return false;
+		size_t slot;
+		if (!resolveTypeSlot(*aggregate, slot))
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error(std::string("Aggregate type: ") + typeid(*aggregate).name() + " is not part of this model");
+#endif
+			return false;
+		}
+		ID id = aggregate->getID();
+		if (id == INVALID_ID)
 		{
-			if (domain.contains(id))
+			m_idDomain.setUniqueIDFor(aggregate);
+			if (aggregate->getID() == INVALID_ID)
 			{
-				filteredIDs.push_back(id);
+#if LOGGER_LIBRARY_AVAILABLE == 1
+				if (m_logger) m_logger->error("No ID could be reserved for the new aggregate");
+#endif
+				return false;
 			}
 		}
-		return filteredIDs;
+		else if (!claimID(id, slot))
+			return false;
+
+		bool result = visitContainer(slot, [&aggregate](auto& obj) {
+			return obj.add(aggregate);
+			});
+		if (!result && id != INVALID_ID)
+			releaseClaim(id);
+		flushNotificationsIfDue();
+		return result;
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::replaceAggregate(std::shared_ptr<Aggregate> aggregate)
+	{
+		size_t slot;
+		if (!aggregate || !resolveTypeSlot(*aggregate, slot))
+			return false;
+		bool result = visitContainer(slot, [&aggregate](auto& obj) {
+			return obj.replace(aggregate);
+			});
+		flushNotificationsIfDue();
+		return result;
 	}
 
 
 	template <DerivedFromAggregate... Ts>
-	template <DerivedFromIPersistance PER>
-	std::shared_ptr<PER> Model<Ts...>::attachPersistence()
+	std::vector<bool> Model<Ts...>::addAggregate(std::vector<std::shared_ptr<Aggregate>> aggregates)
 	{
-		if (m_persistence)
+		// Resolve the type slot of each aggregate once and
+		// check if object with same ID already exists
+		std::vector<size_t> typeSlots(aggregates.size(), aggregateTypeCount);
+		size_t newIDsCount = 0;
+		for (size_t i = 0; i < aggregates.size(); ++i)
+		{
+			auto& aggregate = aggregates[i];
+			if (!aggregate)
+				continue;
+			if (!resolveTypeSlot(*aggregate, typeSlots[i]))
+			{
+				aggregate = nullptr;
+				continue;
+			}
+			ID id = aggregate->getID();
+			if (id == INVALID_ID)
+			{
+				++newIDsCount;
+			}
+			else if (!claimID(id, typeSlots[i]))
+			{
+				aggregate = nullptr;
+			}
+		}
+		if (newIDsCount > 0)
+		{
+			std::vector<std::shared_ptr<IID>> newIDAggregates;
+			newIDAggregates.reserve(newIDsCount);
+			for (auto& aggregate : aggregates)
+			{
+				if (!aggregate)
+					continue;
+				ID id = aggregate->getID();
+				if (id == INVALID_ID)
+				{
+					newIDAggregates.push_back(aggregate);
+				}
+			}
+			m_idDomain.setUniqueIDFor(newIDAggregates);
+			if (!newIDAggregates.empty() && newIDAggregates.front()->getID() == INVALID_ID)
+			{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+				if (m_logger) m_logger->error("No IDs could be reserved for " + std::to_string(newIDsCount) + " new aggregates");
+#endif
+				for (auto& aggregate : aggregates)
+					if (aggregate && aggregate->getID() == INVALID_ID)
+						aggregate = nullptr;
+			}
+		}
+
+		// Deliver one notification per type for the whole operation
+		std::vector<bool> results(aggregates.size(), false);
+		beginNotificationBatch();
+		for (size_t i = 0; i < aggregates.size(); ++i)
+		{
+			auto& aggregate = aggregates[i];
+			if (!aggregate)
+				continue;
+			results[i] = visitContainer(typeSlots[i], [&aggregate](auto& obj) {
+				return obj.add(aggregate);
+				});
+			if (!results[i])
+				releaseClaim(aggregate->getID());
+			flushNotificationsIfDue();
+		}
+		endNotificationBatch();
+		return results;
+	}
+
+	template <DerivedFromAggregate... Ts>
+	std::vector<bool> Model<Ts...>::replaceAggregate(const std::vector<std::shared_ptr<Aggregate>>& aggregates)
+	{
+		std::vector<bool> results(aggregates.size(), false);
+		beginNotificationBatch();
+		for (size_t i = 0; i < aggregates.size(); ++i)
+		{
+			const auto& aggregate = aggregates[i];
+			size_t slot;
+			if (!aggregate || !resolveTypeSlot(*aggregate, slot))
+				continue;
+			results[i] = visitContainer(slot, [&aggregate](auto& obj) {
+				return obj.replace(aggregate);
+				});
+			flushNotificationsIfDue();
+		}
+		endNotificationBatch();
+		return results;
+	}
+
+
+	template <DerivedFromAggregate... Ts>
+	void Model<Ts...>::setShardCount(size_t count)
+	{
+		count = Sharding::normalizeShardCount(count);
+		forEachContainer([count](auto& obj) { obj.setShardCount(count); });
+		if (count == m_indexShards.size())
+			return;
+
+		std::vector<std::unique_ptr<IndexShard>> oldShards = std::move(m_indexShards);
+		m_indexShards.clear();
+		m_indexShardBits = static_cast<unsigned int>(std::countr_zero(count));
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_indexShards.push_back(std::make_unique<IndexShard>());
+			m_indexShards.back()->mutex.setEnabled(m_threadSafe);
+		}
+		for (auto& oldShard : oldShards)
+		{
+			for (const auto& pair : oldShard->entries)
+				getIndexShard(pair.first).entries.insert(pair);
+		}
+	}
+
+	template <DerivedFromAggregate... Ts>
+	void Model<Ts...>::beginNotificationBatch()
+	{
+		m_notificationState.begin();
+	}
+
+	template <DerivedFromAggregate... Ts>
+	void Model<Ts...>::endNotificationBatch()
+	{
+		if (!m_notificationState.end())
+			return;
+		if (m_notificationState.getPolicy().bufferContinuously)
+			flushNotificationsIfDue();
+		else
+			flushNotifications();
+	}
+
+	template <DerivedFromAggregate... Ts>
+	void Model<Ts...>::flushNotifications()
+	{
+		m_notificationState.onFlushed();
+		forEachContainer([](auto& obj) {
+			obj.flushNotifications();
+			});
+	}
+
+	template <DerivedFromAggregate... Ts>
+	void Model<Ts...>::setNotificationFlushPolicy(const NotificationFlushPolicy& policy)
+	{
+		m_notificationState.setPolicy(policy);
+		if (!m_notificationState.isBuffering())
+			flushNotifications();
+	}
+
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::save() const
+	{
+		if (m_journal)
+			return checkpoint();
+		if (!m_persistence)
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("No persistence layer attached to the model");
+#endif
+			return false;
+		}
+		// Changes made while saving are tracked again
+		std::array<std::vector<ID>, aggregateTypeCount> taken;
+		size_t slot = 0;
+		forEachContainer([&taken, &slot](const auto& obj) { taken[slot++] = obj.takeDirtyIDs(); });
+		if (m_writeBehind)
+		{
+			// The dirty IDs include the removed aggregates
+			std::vector<ID> ids = getIDs();
+			for (const auto& typeIDs : taken)
+				ids.insert(ids.end(), typeIDs.begin(), typeIDs.end());
+			std::sort(ids.begin(), ids.end());
+			ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+			if (enqueueWrites(ids))
+				return true;
+		}
+		else if (m_persistence->save())
+		{
+			if (!m_lazyLoader)
+				return true;
+
+			// The persistence keeps the aggregates that are not loaded, so it can't tell which ones were removed
+			std::vector<ID> removedIDs;
+			for (const auto& typeIDs : taken)
+				for (ID id : typeIDs)
+					if (!contains(id) && !m_lazyLoader->findInCatalog(id, slot))
+						removedIDs.push_back(id);
+			if (removedIDs.empty() || m_persistence->remove(removedIDs))
+				return true;
+		}
+		restoreDirty(taken);
+		return false;
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::save(const std::vector<ID>& requestedIDs) const
+	{
+		const std::vector<ID> ids = getSavableIDs(requestedIDs);
+		if (m_journal)
+		{
+			if (ids.empty())
+				return true;
+			if (!appendToJournal(ids))
+				return false;
+		}
+		else if (!m_persistence)
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("No persistence layer attached to the model");
+#endif
+			return false;
+		}
+		else if (!ids.empty() && (m_writeBehind ? !enqueueWrites(ids) : !writeToPersistence(ids)))
+			return false;
+		forEachContainer([&ids](const auto& obj) { obj.clearDirty(ids); });
+		return true;
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::saveDirty() const
+	{
+		if (!m_persistence && !m_journal)
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("No persistence layer attached to the model");
+#endif
+			return false;
+		}
+		std::array<std::vector<ID>, aggregateTypeCount> taken;
+		std::vector<ID> ids;
+		size_t slot = 0;
+		forEachContainer([&taken, &ids, &slot](const auto& obj)
+			{
+				taken[slot] = obj.takeDirtyIDs();
+				ids.insert(ids.end(), taken[slot].begin(), taken[slot].end());
+				++slot;
+			});
+		if (ids.empty())
+			return true;
+		if (m_journal ? appendToJournal(ids) : m_writeBehind ? enqueueWrites(ids) : writeToPersistence(ids))
+			return true;
+		restoreDirty(taken);
+		return false;
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::openJournal(const std::string& journalPath, const std::string& snapshotPath, const JournalPolicy& policy)
+	{
+		closeJournal();
+
+		// Highest journal generation that the checkpoint contains
+		JournalGeneration generation = 0;
+		const bool snapshotExists = std::filesystem::exists(snapshotPath);
+		if (snapshotExists)
+		{
+			BinarySnapshotFile snapshot;
+			if (!snapshot.open(snapshotPath))
+			{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+				if (m_logger) m_logger->error("Can't open the snapshot file: " + snapshotPath);
+#endif
+				return false;
+			}
+			if (!loadBinarySnapshot(snapshot))
+				return false;
+			generation = snapshot.getJournalGeneration();
+		}
+		size_t recordCount = 0;
+		if (std::filesystem::exists(journalPath))
+		{
+			// A crash between a checkpoint and the truncation leaves a journal that is already in the checkpoint
+			JournalGeneration journalGeneration = 0;
+			if (!AggregateJournal::readGeneration(journalPath, journalGeneration))
+			{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+				if (m_logger) m_logger->error("Can't read the journal: " + journalPath);
+#endif
+				return false;
+			}
+			if (journalGeneration > generation && !replayJournal(journalPath, recordCount))
+				return false;
+			generation = std::max(generation, journalGeneration);
+		}
+
+		// The old journal gets replaced, so its records have to be in the checkpoint first
+		if (recordCount > 0 || !snapshotExists)
+		{
+			std::array<std::vector<ID>, aggregateTypeCount> taken;
+			size_t slot = 0;
+			forEachContainer([&taken, &slot](const auto& obj) { taken[slot++] = obj.takeDirtyIDs(); });
+			if (!writeBinarySnapshot(snapshotPath, generation))
+			{
+				restoreDirty(taken);
+				return false;
+			}
+		}
+
+		std::vector<AggregateJournal::TypeInfo> types;
+		forEachContainer([&types](const auto& obj)
+			{
+				const auto factory = obj.getFactory();
+				AggregateJournal::TypeInfo type;
+				type.name = factory ? factory->getAggregateName() : std::string();
+				type.version = factory ? factory->getSnapshotVersion() : 0;
+				types.push_back(std::move(type));
+			});
+		std::unique_ptr<AggregateJournal> journal = std::make_unique<AggregateJournal>(policy);
+		if (!journal->create(journalPath, types, generation + 1))
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("Can't create the journal: " + journalPath);
+#endif
+			return false;
+		}
+		m_journal = std::move(journal);
+		m_snapshotPath = snapshotPath;
+		return true;
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::checkpoint() const
+	{
+		if (!m_journal)
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("No journal open");
+#endif
+			return false;
+		}
+		ExclusiveWriteLock lock(m_checkpointMutex);
+		return checkpointLocked();
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::checkpointLocked() const
+	{
+		// Changes from now on stay dirty, they go into the new journal
+		std::array<std::vector<ID>, aggregateTypeCount> taken;
+		size_t slot = 0;
+		forEachContainer([&taken, &slot](const auto& obj) { taken[slot++] = obj.takeDirtyIDs(); });
+		if (writeBinarySnapshot(m_snapshotPath, m_journal->getGeneration()) && m_journal->truncate())
+			return true;
+		restoreDirty(taken);
+		return false;
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::appendToJournal(const std::vector<ID>& ids) const
+	{
+		AggregateJournal::Sequence sequence = 0;
+		AggregateJournal::Generation generation = 0;
+		{
+			SharedReadLock lock(m_checkpointMutex);
+			generation = m_journal->getGeneration();
+			BinarySnapshotOutput output;
+			for (ID id : ids)
+			{
+				size_t slot;
+				if (!findTypeSlot(id, slot))
+					sequence = m_journal->appendRemove(id);
+				else
+				{
+					sequence = visitContainer(slot, [this, id, slot, &output](const auto& obj)
+						{
+							const auto aggregate = obj.tryGet(id);
+							if (!aggregate)
+								return m_journal->appendRemove(id);
+							const auto factory = obj.getFactory();
+							output.clear();
+							if (!factory || !factory->serialize(*aggregate, output))
+								return AggregateJournal::Sequence(0);
+							return m_journal->appendPut(id, static_cast<uint32_t>(slot), output);
+						});
+				}
+				if (sequence == 0)
+				{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+					if (m_logger) m_logger->error("Can't append aggregate " + std::to_string(id) + " to the journal");
+#endif
+					return false;
+				}
+			}
+		}
+		const JournalPolicy policy = m_journal->getPolicy();
+		if (policy.waitForSync && !m_journal->awaitDurable(sequence))
+			return false;
+
+		// The appended records are durable, a failed checkpoint only delays the truncation
+		if (policy.checkpointSize > 0 && m_journal->getStats().size > policy.checkpointSize)
+		{
+			// Threads that exceeded the size together queue here, the records of the later ones are in the first checkpoint
+			ExclusiveWriteLock lock(m_checkpointMutex);
+			if (m_journal->getGeneration() == generation && !checkpointLocked())
+			{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+				if (m_logger) m_logger->warning("The journal checkpoint failed");
+#endif
+			}
+		}
+		return true;
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::replayJournal(const std::string& path, size_t& recordCount)
+	{
+		// Each record holds the whole state, only the last record of an aggregate has to be applied
+		std::vector<AggregateJournal::TypeInfo> types;
+		HashMap<ID, size_t> lastRecords;
+		size_t index = 0;
+		bool success = AggregateJournal::read(path, types, [&lastRecords, &index](const AggregateJournal::Record& record)
+			{
+				lastRecords.try_emplace(record.id, index).first->second = index;
+				++index;
+				return true;
+			});
+		if (!success)
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("Can't read the journal: " + path);
+#endif
+			return false;
+		}
+		recordCount = index;
+
+		// Journal type index -> type slot
+		std::vector<size_t> typeSlots(types.size(), aggregateTypeCount);
+		size_t slot = 0;
+		forEachContainer([&types, &typeSlots, &slot](const auto& obj)
+			{
+				using AGG = typename std::decay_t<decltype(obj.getFactory())>::element_type::AggregateType;
+				for (size_t i = 0; i < types.size(); ++i)
+					if (types[i].name == AggregateFactory<AGG>::getAggregateName())
+						typeSlots[i] = slot;
+				++slot;
+			});
+
+		std::vector<std::shared_ptr<Aggregate>> aggregates;
+		std::vector<ID> removedIDs;
+		ID highestID = INVALID_ID;
+		index = 0;
+		success = AggregateJournal::read(path, types, [&](const AggregateJournal::Record& record)
+			{
+				if (lastRecords.find(record.id)->second != index++)
+					return true;
+				if (record.type == AggregateJournal::RecordType::Remove)
+				{
+					removedIDs.push_back(record.id);
+					return true;
+				}
+				if (record.typeIndex >= typeSlots.size() || typeSlots[record.typeIndex] == aggregateTypeCount)
+					return false;
+				std::shared_ptr<Aggregate> aggregate = visitContainer(typeSlots[record.typeIndex], [&record](const auto& obj)
+					{
+						std::shared_ptr<Aggregate> created;
+						const auto factory = obj.getFactory();
+						BinarySnapshotInput input = record.data;
+						if (factory)
+							created = factory->deserialize(input);
+						return input.isValid() ? created : nullptr;
+					});
+				if (!aggregate)
+					return false;
+				UniqueIDDomain::restoreID(*aggregate, record.id);
+				highestID = std::max(highestID, record.id);
+				aggregates.push_back(std::move(aggregate));
+				return true;
+			});
+		if (!success)
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("Can't replay the journal: " + path);
+#endif
+			return false;
+		}
+
+		for (ID id : removedIDs)
+			if (contains(id))
+				removeAggregate(id);
+		forEachContainer([&removedIDs](const auto& obj) { obj.clearDirty(removedIDs); });
+		return addBinarySnapshotAggregates(std::move(aggregates), highestID);
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::enableWriteBehind(const WriteBehindPolicy& policy)
+	{
+		if (!m_persistence)
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("No persistence layer attached to the model");
+#endif
+			return false;
+		}
+		if (!m_persistence->supportsSnapshots())
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("Write-behind needs a persistence layer that supports snapshots");
+#endif
+			return false;
+		}
+		if (m_writeBehind)
+			m_writeBehind->setPolicy(policy);
+		else
+			m_writeBehind = std::make_unique<WriteBehindQueue>(m_persistence, policy);
+		return true;
+	}
+	template <DerivedFromAggregate... Ts>
+	std::vector<ID> Model<Ts...>::getSavableIDs(const std::vector<ID>& ids) const
+	{
+		std::vector<ID> savable;
+		savable.reserve(ids.size());
+		for (ID id : ids)
+		{
+			bool known = contains(id);
+			forEachContainer([id, &known](const auto& obj) { known = known || obj.isDirty(id); });
+			if (known)
+				savable.push_back(id);
+		}
+		return savable;
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::enqueueWrites(const std::vector<ID>& ids) const
+	{
+		std::vector<WriteBehindQueue::Entry> entries;
+		entries.reserve(ids.size());
+		for (ID id : ids)
+		{
+			WriteBehindQueue::Entry entry;
+			entry.id = id;
+			size_t slot;
+			std::shared_ptr<const Aggregate> aggregate;
+			if (findTypeSlot(id, slot))
+				aggregate = visitContainer(slot, [id](const auto& obj) -> std::shared_ptr<const Aggregate> { return obj.tryGet(id); });
+			if (aggregate)
+			{
+				entry.snapshot = m_persistence->createSnapshot(*aggregate);
+				if (!entry.snapshot)
+				{
+					// The writer thread can't read the aggregate, write in order on this thread
+					return m_writeBehind->flush() && writeToPersistence(ids);
+				}
+			}
+			// Catalogued aggregates are stored and did not change, they are not loaded yet
+			else if (m_lazyLoader && m_lazyLoader->findInCatalog(id, slot))
+				continue;
+			else
+				entry.removed = true;
+			entries.push_back(std::move(entry));
+		}
+		if (entries.empty() || m_writeBehind->enqueue(std::move(entries)) != 0)
+			return true;
+#if LOGGER_LIBRARY_AVAILABLE == 1
+		if (m_logger) m_logger->warning("The write-behind queue is full, " + std::to_string(ids.size()) + " aggregates were not saved");
+#endif
+		return false;
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::writeToPersistence(const std::vector<ID>& ids) const
+	{
+		std::vector<ID> storedIDs;
+		std::vector<ID> removedIDs;
+		storedIDs.reserve(ids.size());
+		for (ID id : ids)
+		{
+			size_t slot;
+			if (contains(id))
+				storedIDs.push_back(id);
+
+			// Catalogued aggregates are stored and did not change, they are not loaded yet
+			else if (!m_lazyLoader || !m_lazyLoader->findInCatalog(id, slot))
+				removedIDs.push_back(id);
+		}
+		return (storedIDs.empty() || m_persistence->save(storedIDs)) &&
+			(removedIDs.empty() || m_persistence->remove(removedIDs));
+	}
+	template <DerivedFromAggregate... Ts>
+	void Model<Ts...>::restoreDirty(const std::array<std::vector<ID>, aggregateTypeCount>& taken) const
+	{
+		size_t slot = 0;
+		forEachContainer([&taken, &slot](const auto& obj) { obj.markDirty(taken[slot++]); });
+	}
+	template <DerivedFromAggregate... Ts>
+	[[nodiscard]] std::vector<ID> Model<Ts...>::getDirtyIDs() const
+	{
+		std::vector<ID> ids;
+		forEachContainer([&ids](const auto& obj)
+			{
+				std::vector<ID> typeIDs = obj.getDirtyIDs();
+				ids.insert(ids.end(), typeIDs.begin(), typeIDs.end());
+			});
+		return ids;
+	}
+	template <DerivedFromAggregate... Ts>
+	[[nodiscard]] size_t Model<Ts...>::getDirtyCount() const
+	{
+		size_t count = 0;
+		forEachContainer([&count](const auto& obj) { count += obj.getDirtyCount(); });
+		return count;
+	}
+
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::saveMetadata(std::shared_ptr<MetadataContainer::MetaContext> context) const
+	{
+		if (!m_metadata)
+			return false;
+		m_metadata->onSaveBegin(context);
+		if (m_persistence->save(m_metadata))
+		{
+			m_metadata->onSaveEnd(context);
+			return true;
+		}
+		return false;
+	}
+
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::load()
+	{
+		if (!m_persistence)
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("No persistence layer attached to the model");
+#endif
+			return false;
+		}
+		// The loaded aggregates match the persistence, they are not dirty
+		if (!m_persistence->load())
+			return false;
+		clearDirty();
+		return true;
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::load(const std::vector<ID>& ids)
+	{
+		if (!m_persistence)
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("No persistence layer attached to the model");
+#endif
+			return false;
+		}
+		if (!m_persistence->load(ids))
+			return false;
+		forEachContainer([&ids](const auto& obj) { obj.clearDirty(ids); });
+		return true;
+	}
+
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::enableLazyLoading()
+	{
+		if (!m_persistence)
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("No persistence layer attached to the model");
+#endif
+			return false;
+		}
+		std::vector<AggregateCatalogEntry> entries;
+		if (!m_persistence->loadCatalog(entries))
 		{
 #if LOGGER_LIBRARY_AVAILABLE == 1
-			if (m_logger) m_logger->debug("Detaching persistence layer");
+			if (m_logger) m_logger->error("The persistence layer provides no aggregate catalog");
 #endif
-			m_persistence = nullptr;
+			return false;
+		}
+
+		// Type slot -> catalogued IDs that are not in the model yet
+		const std::array<std::string, aggregateTypeCount> typeNames{ AggregateFactory<Ts>::getAggregateName()... };
+		std::array<std::vector<ID>, aggregateTypeCount> ids;
+		ID highestID = INVALID_ID;
+		size_t unknownCount = 0;
+		for (const AggregateCatalogEntry& entry : entries)
+		{
+			highestID = std::max(highestID, entry.id);
+			const auto it = std::find(typeNames.begin(), typeNames.end(), entry.typeName);
+			if (it == typeNames.end())
+				++unknownCount;
+			else if (!contains(entry.id))
+				ids[static_cast<size_t>(it - typeNames.begin())].push_back(entry.id);
 		}
 #if LOGGER_LIBRARY_AVAILABLE == 1
-		if (m_logger) m_logger->debug("Attaching persistence layer");
+		if (unknownCount > 0 && m_logger)
+			m_logger->warning(std::to_string(unknownCount) + " catalogued aggregates are not part of this model");
+#else
+		DDD_UNUSED(unknownCount);
 #endif
-		std::shared_ptr<PER> persistence = std::make_shared<PER>();
-		m_persistence = persistence;
-		return persistence;
+
+		// The catalogued IDs must not be handed out again
+		m_idDomain.setCurrentIDIFLarger(highestID);
+
+		auto loader = std::make_unique<LazyAggregateLoader>([this](const std::vector<ID>& batch) { return loadLazily(batch); });
+		for (size_t slot = 0; slot < aggregateTypeCount; ++slot)
+			loader->addToCatalog(ids[slot], slot);
+		m_lazyLoader = std::move(loader);
+		return true;
+	}
+	template <DerivedFromAggregate... Ts>
+	void Model<Ts...>::faultIn(const std::vector<ID>& ids) const
+	{
+		std::vector<ID> missing;
+		for (ID id : ids)
+			if (!contains(id))
+				missing.push_back(id);
+		if (!missing.empty())
+			m_lazyLoader->load(missing);
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::faultIn(ID id, size_t slot) const
+	{
+		size_t catalogSlot;
+		return m_lazyLoader->findInCatalog(id, catalogSlot) && catalogSlot == slot && m_lazyLoader->load(id);
 	}
 
 	template <DerivedFromAggregate... Ts>
-	bool Model<Ts...>::addAggregate(std::shared_ptr<Aggregate> aggregate)
+	bool Model<Ts...>::loadLazily(const std::vector<ID>& ids)
 	{
-		ID id = aggregate->getID();
-		if (id == INVALID_ID)
-		{
-			m_idDomain.setUniqueIDFor(aggregate);
-		}
-		else if (contains(id))
+		// Evicted aggregates must not be read before their queued saves are written
+		if (m_evictionEnabled && !flushWrites())
+			return false;
+		if (!load(ids))
 			return false;
 
-
-		bool result = false;
-		for (auto& agg : m_domains)
+		// Loaded aggregates left the catalog when they were added, the rest is not stored
+		for (ID id : ids)
+			if (!contains(id))
+				m_lazyLoader->removeFromCatalog(id);
+		if (m_evictionEnabled)
 		{
-			std::visit([&aggregate, &result](auto& obj) {
-				if (obj.isAggregateTypeForThis(aggregate))
-					result = obj.add(aggregate);
-				}, agg);
+			// The loaded aggregates are the most recent ones, they must not be evicted before the waiting lookups get them
+			for (ID id : ids)
+			{
+				size_t slot;
+				if (findTypeSlot(id, slot))
+					visitContainer(slot, [this, id](const auto& obj) { recordAccess(obj.tryGet(id).get()); });
+			}
+			evictAggregates(true);
 		}
-		return result;
+		return true;
 	}
 	template <DerivedFromAggregate... Ts>
-	bool Model<Ts...>::replaceAggregate(std::shared_ptr<Aggregate> aggregate)
+	bool Model<Ts...>::setEvictionPolicy(const EvictionPolicy& policy)
 	{
-		bool result = false;
-		for (auto& agg : m_domains)
+		if (!m_lazyLoader)
 		{
-			std::visit([&aggregate, &result](auto& obj) {
-				if (obj.isAggregateTypeForThis(aggregate))
-					result = obj.replace(aggregate);
-				}, agg);
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("Eviction needs lazy loading, see enableLazyLoading()");
+#endif
+			return false;
 		}
-		return result;
+		m_evictionPolicy = policy;
+		m_evictionEnabled = policy.maxCount > 0 || policy.maxBytes > 0;
+		return true;
 	}
-
-
 	template <DerivedFromAggregate... Ts>
-	std::vector<bool> Model<Ts...>::addAggregate(std::vector<std::shared_ptr<Aggregate>> aggregates)
+	size_t Model<Ts...>::evictAggregates(bool automatic)
 	{
-		// Check if object with same ID already exists
-		size_t newIDsCount = 0;
-		for (auto& aggregate : aggregates)
+		// Saves to the journal don't reach the persistence that lazy loads read
+		if (!m_evictionEnabled || !m_lazyLoader || m_journal)
+			return 0;
+
+		// A lazy load does not wait for an eviction that is already running
+		std::unique_lock<std::mutex> lock(m_evictionMutex, std::defer_lock);
+		if (automatic)
 		{
-			if (!aggregate)
-				continue;
-			ID id = aggregate->getID();
-			if (id == INVALID_ID)
+			if (!lock.try_lock())
+				return 0;
+		}
+		else
+			lock.lock();
+
+		const EvictionPolicy& policy = m_evictionPolicy;
+		auto exceeds = [&policy](size_t count, size_t bytes, double ratio)
 			{
-				++newIDsCount;
-			}
-			else if (contains(id))
+				return (policy.maxCount > 0 && count > policy.maxCount * ratio) ||
+					(policy.maxBytes > 0 && bytes > policy.maxBytes * ratio);
+			};
+
+		// The memory gets estimated from the average of the last scan
+		size_t count = 0;
+		forEachContainer([&count](const auto& obj) { count += obj.size(); });
+		const bool estimated = policy.maxBytes == 0 || m_averageAggregateBytes > 0;
+		if (automatic && estimated && !exceeds(count, count * m_averageAggregateBytes, 1.0))
+			return 0;
+
+		struct Candidate
+		{
+			uint64_t lastAccess;
+			ID id;
+			size_t slot;
+			size_t bytes;
+			bool dirty;
+		};
+		std::vector<Candidate> candidates;
+		candidates.reserve(count);
+		size_t totalBytes = 0;
+		size_t slot = 0;
+		forEachContainer([&candidates, &totalBytes, &slot](const auto& obj)
 			{
-				aggregate = nullptr;
-			}
-		}
-		if (newIDsCount > 0)
+				obj.forEach([&candidates, &totalBytes, slot](const auto& aggregate)
+					{
+						const size_t bytes = sizeof(aggregate) + aggregate.getApproximateHeapSize();
+						totalBytes += bytes;
+						candidates.push_back({ aggregate.getLastAccess(), aggregate.getID(), slot, bytes, false });
+					});
+				++slot;
+			});
+		m_averageAggregateBytes = candidates.empty() ? 0 : std::max<size_t>(totalBytes / candidates.size(), 1);
+		if (!exceeds(candidates.size(), totalBytes, 1.0))
+			return 0;
+
+		// Aggregates that are not dirty may still wait in the write-behind queue
+		if (!flushWrites())
 		{
-			std::vector<std::shared_ptr<IID>> newIDAggregates;
-			newIDAggregates.reserve(newIDsCount);
-			for (auto& aggregate : aggregates)
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->warning("The queued saves could not be written, no aggregates were evicted");
+#endif
+			return 0;
+		}
+		++m_evictionStats.passes;
+
+		// Least recently used first
+		std::sort(candidates.begin(), candidates.end(),
+			[](const Candidate& a, const Candidate& b) { return a.lastAccess < b.lastAccess; });
+		std::vector<Candidate> selected;
+		std::vector<ID> dirtyIDs;
+		size_t remainingCount = candidates.size();
+		size_t remainingBytes = totalBytes;
+		for (Candidate& candidate : candidates)
+		{
+			if (!exceeds(remainingCount, remainingBytes, policy.targetRatio))
+				break;
+			candidate.dirty = visitContainer(candidate.slot, [&candidate](const auto& obj) { return obj.isDirty(candidate.id); });
+			if (isAggregateLocked(candidate.id) || (candidate.dirty && !policy.saveDirty))
 			{
-				if (!aggregate)
-					continue;
-				ID id = aggregate->getID();
-				if (id == INVALID_ID)
-				{
-					newIDAggregates.push_back(aggregate);
-				}
+				++m_evictionStats.skipped;
+				continue;
 			}
-			m_idDomain.setUniqueIDFor(newIDAggregates);
+			if (candidate.dirty)
+				dirtyIDs.push_back(candidate.id);
+			selected.push_back(candidate);
+			--remainingCount;
+			remainingBytes -= candidate.bytes;
 		}
 
-		std::vector<bool> results(aggregates.size(), false);
-		for (auto& agg : m_domains)
+		// Evicted aggregates get loaded from the persistence again, the saves have to be written
+		bool dirtySaved = true;
+		if (!dirtyIDs.empty())
 		{
-			std::visit([&aggregates, &results](auto& obj) {
-				for (size_t i = 0; i < aggregates.size(); ++i)
-				{
-					auto& aggregate = aggregates[i];
-					if (!aggregate)
-						continue;
-					if (obj.isAggregateTypeForThis(aggregate))
-						results[i] = obj.add(aggregate);
-				}
-				}, agg);
+			dirtySaved = save(dirtyIDs) && flushWrites();
+			if (dirtySaved)
+				m_evictionStats.saved += dirtyIDs.size();
 		}
-		return results;
-	}
 
-	template <DerivedFromAggregate... Ts>
-	std::vector<bool> Model<Ts...>::replaceAggregate(const std::vector<std::shared_ptr<Aggregate>>& aggregates)
-	{
-		std::vector<bool> results(aggregates.size(), false);
-		for (auto& agg : m_domains)
+		size_t evicted = 0;
+		for (const Candidate& candidate : selected)
 		{
-			std::visit([&aggregates, &results](auto& obj) {
-				for (size_t i = 0; i < aggregates.size(); ++i)
-				{
-					auto aggregate = aggregates[i];
-					if (obj.isAggregateTypeForThis(aggregate))
-						results[i] = obj.replace(aggregate);
-				}
-				}, agg);
+			// Catalogued first, so that a lookup right after the eviction finds it
+			m_lazyLoader->addToCatalog(candidate.id, candidate.slot);
+			if ((!candidate.dirty || dirtySaved) && !isPinned(candidate.id) &&
+				visitContainer(candidate.slot, [&candidate](auto& obj) { return obj.evict(candidate.id); }))
+				++evicted;
+			else
+			{
+				m_lazyLoader->removeFromCatalog(candidate.id);
+				++m_evictionStats.skipped;
+			}
 		}
-		return results;
+		m_evictionStats.evicted += evicted;
+		return evicted;
 	}
 
-
 	template <DerivedFromAggregate... Ts>
-	bool Model<Ts...>::save() const
+	bool Model<Ts...>::saveBinarySnapshot(const std::string& path) const
 	{
-		if (!m_persistence)
+		return writeBinarySnapshot(path, 0);
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::writeBinarySnapshot(const std::string& path, JournalGeneration journalGeneration) const
+	{
+		BinarySnapshotWriter writer;
+		if (!writer.open(path))
 		{
 #if LOGGER_LIBRARY_AVAILABLE == 1
-			if (m_logger) m_logger->error("No persistence layer attached to the model");
+			if (m_logger) m_logger->error("Can't create the snapshot file: " + path);
 #endif
 			return false;
 		}
-		else
+		bool success = true;
+		BinarySnapshotOutput output;
+		forEachContainer([this, &writer, &output, &success](const auto& obj)
+			{
+				if (!success || obj.empty())
+					return;
+				const auto factory = obj.getFactory();
+				if (!factory)
+				{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+					if (m_logger) m_logger->error("Can't write a snapshot of aggregates without factory");
+#endif
+					success = false;
+					return;
+				}
+				success = writer.beginSection(factory->getAggregateName(), factory->getSnapshotVersion());
+				obj.forEach([&factory, &writer, &output, &success](const auto& aggregate)
+					{
+						output.clear();
+						success = success && factory->serialize(aggregate, output) && writer.writeRecord(aggregate.getID(), output);
+						return success;
+					});
+#if LOGGER_LIBRARY_AVAILABLE == 1
+				if (!success && m_logger) m_logger->error("Can't write the " + factory->getAggregateName() + " aggregates to the snapshot");
+#endif
+			});
+		if (!success)
 		{
-			return m_persistence->save();
+			writer.cancel();
+			return false;
 		}
+		return writer.commit(m_idDomain.getCurrentID(), journalGeneration);
 	}
 	template <DerivedFromAggregate... Ts>
-	bool Model<Ts...>::save(const std::vector<ID>& ids) const
+	bool Model<Ts...>::loadBinarySnapshot(const std::string& path, size_t threadCount)
 	{
-		if (!m_persistence)
+		BinarySnapshotFile snapshot;
+		if (!snapshot.open(path))
 		{
 #if LOGGER_LIBRARY_AVAILABLE == 1
-			if (m_logger) m_logger->error("No persistence layer attached to the model");
+			if (m_logger) m_logger->error("Can't open the snapshot file: " + path);
 #endif
 			return false;
 		}
-		else
-		{
-			return m_persistence->save(ids);
-		}
+		return loadBinarySnapshot(snapshot, threadCount);
 	}
-
 	template <DerivedFromAggregate... Ts>
-	bool Model<Ts...>::saveMetadata(std::shared_ptr<MetadataContainer::MetaContext> context) const
+	bool Model<Ts...>::loadBinarySnapshot(const BinarySnapshotFile& snapshot, size_t threadCount)
 	{
-		if (!m_metadata)
+		if (!snapshot.isOpen())
 			return false;
-		m_metadata->onSaveBegin(context);
-		if (m_persistence->save(m_metadata))
+		if (threadCount == 0)
+			threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+		std::vector<std::shared_ptr<Aggregate>> aggregates;
+		bool success = true;
+		forEachContainer([this, &snapshot, threadCount, &aggregates, &success](const auto& obj)
+			{
+				success = success && readBinarySnapshotSection(obj, snapshot, nullptr, threadCount, aggregates);
+			});
+		return success && addBinarySnapshotAggregates(std::move(aggregates), snapshot.getHighestID());
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::loadBinarySnapshot(const BinarySnapshotFile& snapshot, const std::vector<ID>& ids)
+	{
+		if (!snapshot.isOpen())
+			return false;
+		std::vector<ID> uniqueIDs = ids;
+		std::sort(uniqueIDs.begin(), uniqueIDs.end());
+		uniqueIDs.erase(std::unique(uniqueIDs.begin(), uniqueIDs.end()), uniqueIDs.end());
+		std::vector<std::shared_ptr<Aggregate>> aggregates;
+		bool success = true;
+		forEachContainer([this, &snapshot, &uniqueIDs, &aggregates, &success](const auto& obj)
+			{
+				success = success && readBinarySnapshotSection(obj, snapshot, &uniqueIDs, 1, aggregates);
+			});
+		if (success && aggregates.size() != uniqueIDs.size())
 		{
-			m_metadata->onSaveEnd(context);
-			return true;
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("The snapshot does not contain all requested aggregates");
+#endif
+			success = false;
 		}
-		return false;
+		return success && addBinarySnapshotAggregates(std::move(aggregates), snapshot.getHighestID());
 	}
-
 	template <DerivedFromAggregate... Ts>
-	bool Model<Ts...>::load()
+	template <typename AGG>
+	bool Model<Ts...>::readBinarySnapshotSection(const AggregateContainer<AGG>& container, const BinarySnapshotFile& snapshot,
+		const std::vector<ID>* ids, size_t threadCount, std::vector<std::shared_ptr<Aggregate>>& aggregates) const
 	{
-		if (!m_persistence)
+		const size_t section = snapshot.findSection(AggregateFactory<AGG>::getAggregateName());
+		if (section == BinarySnapshotFile::npos)
+			return true;
+		std::vector<size_t> records;
+		if (ids)
+		{
+			for (ID id : *ids)
+			{
+				const size_t record = snapshot.findRecord(section, id);
+				if (record != BinarySnapshotFile::npos)
+					records.push_back(record);
+			}
+		}
+		else
+		{
+			records.resize(snapshot.getRecordCount(section));
+			for (size_t i = 0; i < records.size(); ++i)
+				records[i] = i;
+		}
+		if (records.empty())
+			return true;
+		const std::shared_ptr<AggregateFactory<AGG>> factory = container.getFactory();
+		if (!factory)
 		{
 #if LOGGER_LIBRARY_AVAILABLE == 1
-			if (m_logger) m_logger->error("No persistence layer attached to the model");
+			if (m_logger) m_logger->error("Can't read the " + AggregateFactory<AGG>::getAggregateName() + " aggregates of the snapshot without factory");
 #endif
 			return false;
 		}
+
+		// Each thread creates a contiguous range of the records
+		const size_t offset = aggregates.size();
+		aggregates.resize(offset + records.size());
+		std::atomic<bool> failed{ false };
+		QThread* const callingThread = QThread::currentThread();
+		auto readRange = [&](size_t begin, size_t end)
+			{
+				const bool onWorker = QThread::currentThread() != callingThread;
+				for (size_t i = begin; i < end && !failed.load(std::memory_order_relaxed); ++i)
+				{
+					BinarySnapshotInput input = snapshot.getRecord(section, records[i]);
+					std::shared_ptr<AGG> aggregate = factory->deserialize(input);
+					if (!aggregate || !input.isValid())
+					{
+						failed = true;
+						return;
+					}
+					if (onWorker)
+					{
+						// The worker thread ends before the objects are used, only it can hand them over
+						aggregate->moveToThread(callingThread);
+						for (const auto& entity : aggregate->getEntities())
+							entity->moveToThread(callingThread);
+					}
+					UniqueIDDomain::restoreID(*aggregate, snapshot.getID(section, records[i]));
+					aggregates[offset + i] = std::move(aggregate);
+				}
+			};
+		constexpr size_t minRecordsPerThread = 1024;
+		const size_t rangeCount = std::min(threadCount, (records.size() + minRecordsPerThread - 1) / minRecordsPerThread);
+		if (rangeCount <= 1)
+			readRange(0, records.size());
 		else
 		{
-			return m_persistence->load();
+			const size_t rangeSize = (records.size() + rangeCount - 1) / rangeCount;
+			std::vector<std::thread> threads;
+			threads.reserve(rangeCount - 1);
+			for (size_t begin = rangeSize; begin < records.size(); begin += rangeSize)
+				threads.emplace_back(readRange, begin, std::min(begin + rangeSize, records.size()));
+			readRange(0, rangeSize);
+			for (auto& thread : threads)
+				thread.join();
 		}
-	}
-	template <DerivedFromAggregate... Ts>
-	bool Model<Ts...>::load(const std::vector<ID>& ids)
-	{
-		if (!m_persistence)
+		if (failed)
 		{
 #if LOGGER_LIBRARY_AVAILABLE == 1
-			if (m_logger) m_logger->error("No persistence layer attached to the model");
+			if (m_logger) m_logger->error("Can't read the " + AggregateFactory<AGG>::getAggregateName() + " aggregates of the snapshot");
 #endif
+			aggregates.resize(offset);
 			return false;
 		}
-		else
+		return true;
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::addBinarySnapshotAggregates(std::vector<std::shared_ptr<Aggregate>> aggregates, ID highestID)
+	{
+		// The restored IDs must not be handed out again
+		m_idDomain.setCurrentIDIFLarger(highestID);
+
+		std::vector<ID> ids;
+		std::vector<std::shared_ptr<Aggregate>> existing;
+		ids.reserve(aggregates.size());
+		for (auto& aggregate : aggregates)
 		{
-			return m_persistence->load(ids);
+			ids.push_back(aggregate->getID());
+			if (contains(aggregate->getID()))
+				existing.push_back(std::move(aggregate));
 		}
+		if (!existing.empty())
+			aggregates.erase(std::remove(aggregates.begin(), aggregates.end(), nullptr), aggregates.end());
+
+		beginNotificationBatch();
+		std::vector<bool> results = addAggregate(std::move(aggregates));
+		const std::vector<bool> replaced = replaceAggregate(existing);
+		results.insert(results.end(), replaced.begin(), replaced.end());
+		endNotificationBatch();
+
+		// The loaded aggregates match the snapshot, they are not dirty
+		forEachContainer([&ids](const auto& obj) { obj.clearDirty(ids); });
+		return std::find(results.begin(), results.end(), false) == results.end();
 	}
 
 	template <DerivedFromAggregate... Ts>
@@ -1219,11 +3051,37 @@ namespace DDD
 		}
 		else
 		{
-			m_lockedAggregates = m_persistence->getLocks();
+			if (loadLockChanges())
+				return true;
+			// Read the version first, changes during getLocks() are loaded again next time
+			const uint64_t version = m_persistence->getLockVersion();
+			const std::vector<std::shared_ptr<AggregateLock>> locks = m_persistence->getLocks();
+			ExclusiveWriteLock lock(m_lockTableMutex);
+			m_lockVersion = version;
+			m_lockTable.assign(locks);
 			return true;
 		}
 	}
 
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::loadLockChanges()
+	{
+		uint64_t version;
+		{
+			SharedReadLock lock(m_lockTableMutex);
+			version = m_lockVersion;
+		}
+		if (version == 0)
+			return false;
+		AggregateLockChanges changes;
+		if (!m_persistence->getLockChanges(version, changes))
+			return false;
+		ExclusiveWriteLock lock(m_lockTableMutex);
+		m_lockTable.apply(changes);
+		m_lockVersion = std::max(m_lockVersion, changes.version);
+		return true;
+	}
+
 	template <DerivedFromAggregate... Ts>
 	bool Model<Ts...>::manualLockDatabase()
 	{
@@ -1281,7 +3139,9 @@ namespace DDD
 		{
 			if (m_persistence->lock(id))
 			{
-				loadLockedObjects();
+				// Without lock versions, only the new lock gets loaded
+				if (!loadLockChanges() && (m_persistence->getLockVersion() != 0 || !insertLock(m_persistence->getLock(id))))
+					loadLockedObjects();
 				return true;
 			}
 			return false;
@@ -1323,10 +3183,8 @@ namespace DDD
 		{
 			if (m_persistence->unlock(id))
 			{
-				std::erase_if(m_lockedAggregates,
-					[&id](const std::shared_ptr<AggregateLock>& lock) {
-						return lock->getAggregateID() == id;
-					});
+				ExclusiveWriteLock lock(m_lockTableMutex);
+				m_lockTable.remove(id);
 				return true;
 			}
 			return false;
@@ -1347,17 +3205,8 @@ namespace DDD
 		else
 		{
 			std::vector<bool> res = m_persistence->unlock(ids);
-			for (size_t i = 0; i < ids.size(); ++i)
-			{
-				if (res[i])
-				{
-					const ID& id = ids[i];
-					std::erase_if(m_lockedAggregates,
-						[&id](const std::shared_ptr<AggregateLock>& lock) {
-							return lock->getAggregateID() == id;
-						});
-				}
-			}
+			ExclusiveWriteLock lock(m_lockTableMutex);
+			m_lockTable.remove(ids, res);
 			return res;
 		}
 	}
@@ -1375,7 +3224,13 @@ namespace DDD
 		}
 		else
 		{
-			return m_persistence->tryUnlockIfLocked(id);
+			if (m_persistence->tryUnlockIfLocked(id))
+			{
+				ExclusiveWriteLock lock(m_lockTableMutex);
+				m_lockTable.remove(id);
+				return true;
+			}
+			return false;
 		}
 	}
 
@@ -1391,12 +3246,8 @@ namespace DDD
 		}
 		else
 		{
-			for (const auto& lock : m_lockedAggregates)
-			{
-				if (lock->getAggregateID() == id)
-					return true;
-			}
-			return false;
+			SharedReadLock lock(m_lockTableMutex);
+			return m_lockTable.contains(id);
 			//return m_persistence->isLocked(id);
 		}
 	}
@@ -1413,7 +3264,8 @@ namespace DDD
 		}
 		else
 		{
-			return m_lockedAggregates;
+			SharedReadLock lock(m_lockTableMutex);
+			return m_lockTable.getAll();
 			//return m_persistence->getLocks();
 		}
 	}
@@ -1430,16 +3282,33 @@ namespace DDD
 		}
 		else
 		{
-			for (const auto& lock : m_lockedAggregates)
-			{
-				if (lock->getAggregateID() == id)
-					return lock;
-			}
-			return nullptr;
+			SharedReadLock lock(m_lockTableMutex);
+			return m_lockTable.get(id);
 			//return m_persistence->getLock(id);
 		}
 	}
 
+	template <DerivedFromAggregate... Ts>
+	std::vector<std::shared_ptr<AggregateLock>> Model<Ts...>::getLocksOfOwner(const std::string& owner) const
+	{
+		SharedReadLock lock(m_lockTableMutex);
+		return m_lockTable.getLocksOfOwner(owner);
+	}
+
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::unlockAggregatesOfOwner(const std::string& owner)
+	{
+		std::vector<ID> ids;
+		{
+			SharedReadLock lock(m_lockTableMutex);
+			ids = m_lockTable.getIDsOfOwner(owner);
+		}
+		if (ids.empty())
+			return true;
+		const std::vector<bool> res = unlockAggregate(ids);
+		return std::find(res.begin(), res.end(), false) == res.end();
+	}
+
 	template <DerivedFromAggregate... Ts>
 	bool Model<Ts...>::logOnUser(std::shared_ptr<User> user)
 	{
@@ -1492,6 +3361,26 @@ namespace DDD
 	// PRIVATE
 	//
 
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::enableAtomicIDAllocation(const std::string& sharedCounterKey)
+	{
+		if (!m_idDomain.enableAtomicAllocation(sharedCounterKey))
+		{
+#if LOGGER_LIBRARY_AVAILABLE == 1
+			if (m_logger) m_logger->error("Can't attach the shared ID counter: " + sharedCounterKey);
+#endif
+			return false;
+		}
+		if (m_metadata && m_persistence && manualLockDatabase())
+		{
+			std::shared_ptr<MetadataContainer::NewAggregateIDContext> context = std::make_shared<MetadataContainer::NewAggregateIDContext>();
+			if (loadMetadata(context))
+				m_idDomain.setCurrentIDIFLarger(m_metadata->getCurrentHighestID());
+			manualUnlockDatabase();
+		}
+		return true;
+	}
+
 	template <DerivedFromAggregate... Ts>
 	bool Model<Ts...>::tryReserveNextID(ID id, ID amount)
 	{
@@ -1505,9 +3394,9 @@ namespace DDD
 				//	if (m_persistence->load(m_metadata))
 			{
 				ID highestID = m_metadata->getCurrentHighestID();
-				if (id > highestID && (id + amount) > highestID)
+				if (id > highestID)
 				{
-					m_metadata->setCurrentHighestID(id + amount);
+					m_metadata->setCurrentHighestID(id + amount - 1);
 					success = saveMetadata(context);
 					//success = m_persistence->save(m_metadata);
 				}
@@ -1515,7 +3404,7 @@ namespace DDD
 			else
 			{
 				// Try to save new metadata anyway
-				m_metadata->setCurrentHighestID(id + amount);
+				m_metadata->setCurrentHighestID(id + amount - 1);
 				success = saveMetadata(context);
 				//success = m_persistence->save(m_metadata);
 			}
@@ -1524,33 +3413,127 @@ namespace DDD
 		}
 		return false;
 	}
+	template <DerivedFromAggregate... Ts>
+	ID Model<Ts...>::getHighestReservedID()
+	{
+		if (!m_metadata || !m_persistence || !manualLockDatabase())
+			return INVALID_ID;
+		ID highestID = INVALID_ID;
+		std::shared_ptr<MetadataContainer::NewAggregateIDContext> context = std::make_shared<MetadataContainer::NewAggregateIDContext>();
+		if (loadMetadata(context))
+			highestID = m_metadata->getCurrentHighestID();
+		manualUnlockDatabase();
+		return highestID;
+	}
+	template <DerivedFromAggregate... Ts>
+	bool Model<Ts...>::tryReleaseIDs(ID id, ID amount)
+	{
+		if (!m_metadata || !m_persistence)
+			return true;
+		if (!manualLockDatabase())
+			return false;
+		bool success = true;
+		std::shared_ptr<MetadataContainer::NewAggregateIDContext> context = std::make_shared<MetadataContainer::NewAggregateIDContext>();
+		if (loadMetadata(context) && m_metadata->getCurrentHighestID() == id + amount - 1)
+		{
+			m_metadata->setCurrentHighestID(id - 1);
+			success = saveMetadata(context);
+		}
+		success &= manualUnlockDatabase();
+		return success;
+	}
 
 	template <DerivedFromAggregate... Ts>
-	template <typename AGG>
-	[[nodiscard]] Model<Ts...>::AggregateContainer<AGG>& Model<Ts...>::getAggregateContainer() {
-		// Check if D exists in the variant array, otherwise static assert
-		static_assert((std::is_same_v<AGG, Ts> || ...), "Aggregate type <AGG> not found in this model");
+	template <typename F>
+	decltype(auto) Model<Ts...>::visitContainer(size_t slot, F&& func)
+	{
+		// Jump table with one entry per type slot, no search over the containers
+		using Result = std::invoke_result_t<F&, std::tuple_element_t<0, ContainerTuple>&>;
+		using Dispatcher = Result(*)(ContainerTuple&, F&);
+		static constexpr auto table = []<size_t... Is>(std::index_sequence<Is...>) {
+			return std::array<Dispatcher, aggregateTypeCount>{
+				[](ContainerTuple& containers, F& f) -> Result { return f(std::get<Is>(containers)); }...
+			};
+		}(std::index_sequence_for<Ts...>{});
+		return table[slot](m_containers, func);
+	}
 
-		for (auto& var : m_domains) {
-			if (auto* ptr = std::get_if<AggregateContainer<AGG>>(&var)) {
-				return *ptr;
+	template <DerivedFromAggregate... Ts>
+	template <typename F>
+	decltype(auto) Model<Ts...>::visitContainer(size_t slot, F&& func) const
+	{
+		using Result = std::invoke_result_t<F&, const std::tuple_element_t<0, ContainerTuple>&>;
+		using Dispatcher = Result(*)(const ContainerTuple&, F&);
+		static constexpr auto table = []<size_t... Is>(std::index_sequence<Is...>) {
+			return std::array<Dispatcher, aggregateTypeCount>{
+				[](const ContainerTuple& containers, F& f) -> Result { return f(std::get<Is>(containers)); }...
+			};
+		}(std::index_sequence_for<Ts...>{});
+		return table[slot](m_containers, func);
+	}
+
+	template <DerivedFromAggregate... Ts>
+	[[nodiscard]] bool Model<Ts...>::resolveTypeSlot(const Aggregate& aggregate, size_t& slot) const
+	{
+		const std::type_index type(typeid(aggregate));
+		{
+			SharedReadLock lock(m_typeSlotsMutex);
+			const auto it = m_typeSlots.find(type);
+			if (it != m_typeSlots.end())
+			{
+				slot = it->second;
+				return slot < aggregateTypeCount;
 			}
 		}
-		throw std::runtime_error("Aggregate container not found");
+
+		// Unknown concrete type, search the most derived registered base once.
+		// isBaseOf[b][d] is true if the type in slot b is a base of the type in slot d
+		static constexpr std::array<std::array<bool, aggregateTypeCount>, aggregateTypeCount> isBaseOf{
+			getDerivedTypeMask<Ts>()...
+		};
+		size_t best = aggregateTypeCount;
+		size_t candidate = 0;
+		([&] {
+			if (dynamic_cast<const Ts*>(&aggregate) &&
+				(best == aggregateTypeCount || isBaseOf[best][candidate]))
+				best = candidate;
+			++candidate;
+			}(), ...);
+
+		{
+			ExclusiveWriteLock lock(m_typeSlotsMutex);
+			m_typeSlots.emplace(type, best);
+		}
+		slot = best;
+		return slot < aggregateTypeCount;
+	}
+
+	template <DerivedFromAggregate... Ts>
+	[[nodiscard]] bool Model<Ts...>::findTypeSlot(ID id, size_t& slot) const
+	{
+		const IndexShard& shard = getIndexShard(id);
+		SharedReadLock lock(shard.mutex);
+		const auto it = shard.entries.find(id);
+		if (it == shard.entries.end())
+			return false;
+		slot = it->second;
+		return true;
 	}
 
 	template <DerivedFromAggregate... Ts>
 	template <typename AGG>
-	[[nodiscard]] const  Model<Ts...>::AggregateContainer<AGG>& Model<Ts...>::getAggregateContainer() const {
-		// Check if D exists in the variant array, otherwise static assert
+	[[nodiscard]] typename Model<Ts...>::template AggregateContainer<AGG>& Model<Ts...>::getAggregateContainer() {
+		// Check if AGG exists in the type list, otherwise static assert
 		static_assert((std::is_same_v<AGG, Ts> || ...), "Aggregate type <AGG> not found in this model");
+		return std::get<getTypeSlot<AGG>()>(m_containers);
+	}
 
-		for (auto& var : m_domains) {
-			if (auto* ptr = std::get_if<AggregateContainer<AGG>>(&var)) {
-				return *ptr;
-			}
-		}
-		throw std::runtime_error("Aggregate container not found");
+	template <DerivedFromAggregate... Ts>
+	template <typename AGG>
+	[[nodiscard]] const typename Model<Ts...>::template AggregateContainer<AGG>& Model<Ts...>::getAggregateContainer() const {
+		// Check if AGG exists in the type list, otherwise static assert
+		static_assert((std::is_same_v<AGG, Ts> || ...), "Aggregate type <AGG> not found in this model");
+		return std::get<getTypeSlot<AGG>()>(m_containers);
 	}
 }
 
@@ -1,17 +1,25 @@
 #pragma once
 #include "DDD_base.h"
 #include "Aggregate.h"
+#include "AggregateView.h"
 #include "utilities/UniqueIDDomain.h"
-#include <unordered_map>
+#include "utilities/OptionalSharedMutex.h"
+#include "utilities/Sharding.h"
+#include "utilities/FlatHashMap.h"
+#include "utilities/PagedIDMap.h"
+#include "utilities/DeletedAggregateCache.h"
+#include "utilities/HotPathLog.h"
 #include <functional>
 #include <memory>
+#include <vector>
+#include <bit>
 #include <QObject>
 
 
 
 namespace DDD
 {
-	class DDD_API IRepository : public QObject
+	class DDD_API IRepository : public QObject, public EntityObserver
 	{
 		Q_OBJECT
 	public:
@@ -26,14 +34,35 @@ namespace DDD
 		}
 	protected:
 		virtual void onAggregateMarketForDelete(Aggregate* agg) = 0;
+		virtual void onAggregateDataChanged(Aggregate* agg) = 0;
 
-		void unclaimAggregate(std::shared_ptr<Aggregate> agg)
+		/**
+		 * @brief
+		 * Links the aggregate to this repository.
+		 * The repository gets the lifecycle events of the aggregate through the owner back-pointer,
+		 * linking and unlinking does not allocate.
+		 */
+		void claimAggregate(Aggregate& agg)
 		{
-			agg->m_isInRepository = false;
+			agg.m_isInRepository = true;
+			agg.m_owner = this;
 		}
-		void claimAggregate(std::shared_ptr<Aggregate> agg)
+		void unclaimAggregate(Aggregate& agg)
 		{
-			agg->m_isInRepository = true;
+			agg.m_isInRepository = false;
+			if (agg.m_owner == this)
+				agg.m_owner = nullptr;
+		}
+
+		void onEntityDeleteMarked(Entity& entity) override
+		{
+			// Only aggregates are owned by a repository
+			onAggregateMarketForDelete(static_cast<Aggregate*>(&entity));
+		}
+		void onEntityDataChanged(Entity& entity) override
+		{
+			// Also called by the aggregate when one of its child entities changed
+			onAggregateDataChanged(static_cast<Aggregate*>(&entity));
 		}
 	public slots:
 		void onAggregateMarketForDeleteSlot()
@@ -46,22 +75,144 @@ namespace DDD
 		std::string_view m_name;
 	};
 
+	/**
+	 * @brief
+	 * Selects the container that holds the aggregates of Repository<AGG>.
+	 *
+	 * @details
+	 * The default hashes the IDs. Aggregate types with many instances and few removals
+	 * can use the ID indexed PagedIDMap instead, it needs less memory per aggregate,
+	 * has cheaper lookups and iterates in ID order:
+	 * @code
+	 * template <> struct DDD::RepositoryTraits<Cat>
+	 * {
+	 *     using Storage = DDD::PagedIDMap<std::shared_ptr<Cat>>;
+	 * };
+	 * @endcode
+	 * The specialization must be visible before the Model<...> is instantiated.
+	 */
+	template <DerivedFromAggregate AGG>
+	struct RepositoryTraits
+	{
+		using Storage = HashMap<ID, std::shared_ptr<AGG>>;
+	};
+
 	template <DerivedFromAggregate AGG>
 	class Repository : public IRepository
 	{
+		using StorageMap = typename RepositoryTraits<AGG>::Storage;
+		using DeletedCache = DeletedAggregateCache<AGG>;
+		using DirtySet = HashSet<ID>;
+
+		// Ordered storages support lowerBound() and iterate in ascending ID order
+		static constexpr bool isOrderedStorage = requires(const StorageMap & map, ID id) { map.lowerBound(id); };
+
+		// Storages that keep blocks of neighboring IDs together get sharded by block, not by single ID
+		static constexpr unsigned int getShardKeyShift()
+		{
+			if constexpr (requires { StorageMap::idBlockBits; })
+				return StorageMap::idBlockBits;
+			else
+				return 0;
+		}
+
+		// Independently locked partition of the storage
+		struct Shard
+		{
+			StorageMap storage;
+			DeletedCache deleted;
+
+			// Dirty tracking is bookkeeping for the persistence, saving a const repository clears it
+			mutable DirtySet dirty;
+			mutable OptionalSharedMutex mutex;
+
+			// Guards dirty. Separate from mutex, so that aggregates can change while the shard
+			// is locked for reading, e.g. inside forEach(). Taken after mutex, never before it
+			mutable OptionalSharedMutex dirtyMutex;
+		};
+		using ShardList = std::vector<std::unique_ptr<Shard>>;
+
+		/**
+		 * @brief Walks the storage of all shards, shard by shard.
+		 */
+		template <bool IsConst>
+		class ShardedIterator
+		{
+			using MapIterator = std::conditional_t<IsConst, typename StorageMap::const_iterator, typename StorageMap::iterator>;
+		public:
+			ShardedIterator() = default;
+			ShardedIterator(typename ShardList::const_iterator shard, typename ShardList::const_iterator shardEnd)
+				: m_shard(shard)
+				, m_shardEnd(shardEnd)
+			{
+				if (m_shard != m_shardEnd)
+					m_it = (*m_shard)->storage.begin();
+				skipEmptyShards();
+			}
+
+			auto operator->() const
+			{
+				return m_it.operator->();
+			}
+			ShardedIterator& operator++()
+			{
+				++m_it;
+				skipEmptyShards();
+				return *this;
+			}
+			bool operator==(const ShardedIterator& other) const
+			{
+				return m_shard == other.m_shard && (m_shard == m_shardEnd || m_it == other.m_it);
+			}
+			bool operator!=(const ShardedIterator& other) const
+			{
+				return !(*this == other);
+			}
+		private:
+			void skipEmptyShards()
+			{
+				while (m_shard != m_shardEnd && m_it == (*m_shard)->storage.end())
+				{
+					++m_shard;
+					if (m_shard != m_shardEnd)
+						m_it = (*m_shard)->storage.begin();
+				}
+			}
+
+			typename ShardList::const_iterator m_shard{};
+			typename ShardList::const_iterator m_shardEnd{};
+			MapIterator m_it{};
+		};
 	public:
 		typedef AGG AggregateType;
+		using View = AggregateView<AGG, ShardedIterator<false>>;
+		using ConstView = AggregateView<const AGG, ShardedIterator<true>>;
+
 		Repository(UniqueIDDomain &domain)
 			: IRepository(typeid(AGG).name())
 			, m_idDomain(domain)
-		{}
+		{
+			m_shards.push_back(std::make_unique<Shard>());
+		}
 		Repository(const Repository& other) = delete;
 		Repository(Repository&& other) noexcept
 			: IRepository(typeid(AGG).name())
-			, m_storage(std::move(other.m_storage))
+			, m_shards(std::move(other.m_shards))
+			, m_shardBits(other.m_shardBits)
+			, m_deletedCachePolicy(other.m_deletedCachePolicy)
+			, m_threadSafe(other.m_threadSafe)
 			, m_idDomain(other.m_idDomain)
 		{
-			
+			other.m_shards.push_back(std::make_unique<Shard>());
+			other.m_shardBits = 0;
+			relinkAggregates();
+		}
+		~Repository() override
+		{
+			// Aggregates may outlive the repository, they must not point to it anymore
+			for (auto& shard : m_shards)
+				for (auto& pair : shard->storage)
+					unclaimAggregate(*pair.second);
 		}
 
 		Repository& operator=(const Repository& other) = delete;
@@ -69,8 +220,16 @@ namespace DDD
 		{
 			if (this != &other)
 			{
-				m_storage = std::move(other.m_storage);
-				m_idDomain = std::move(other.m_idDomain);
+				for (auto& shard : m_shards)
+					for (auto& pair : shard->storage)
+						unclaimAggregate(*pair.second);
+				m_shards = std::move(other.m_shards);
+				m_shardBits = other.m_shardBits;
+				m_deletedCachePolicy = other.m_deletedCachePolicy;
+				m_threadSafe = other.m_threadSafe;
+				other.m_shards.push_back(std::make_unique<Shard>());
+				other.m_shardBits = 0;
+				relinkAggregates();
 			}
 			return *this;
 		}
@@ -82,31 +241,214 @@ namespace DDD
 		}
 #endif
 
+		/**
+		 * @brief
+		 * Enables the internal reader-writer locks.
+		 * Lookups run in parallel, modifications are serialized per shard.
+		 * Must be called before the repository is shared between threads.
+		 */
+		void setThreadSafe(bool enabled)
+		{
+			m_threadSafe = enabled;
+			for (auto& shard : m_shards)
+			{
+				shard->mutex.setEnabled(enabled);
+				shard->dirtyMutex.setEnabled(enabled);
+			}
+		}
+		[[nodiscard]] bool isThreadSafe() const
+		{
+			return m_threadSafe;
+		}
+
+		/**
+		 * @brief
+		 * Partitions the storage by ID hash into independently locked shards.
+		 * In thread safe mode, adds and removes of different shards run in parallel.
+		 * The count gets rounded up to a power of two, 1 disables sharding (default).
+		 * A PagedIDMap storage is partitioned by ID block, so its pages stay dense.
+		 * The stored aggregates get redistributed, so call this before the
+		 * repository is shared between threads.
+		 */
+		void setShardCount(size_t count);
+		[[nodiscard]] size_t getShardCount() const
+		{
+			return m_shards.size();
+		}
+
+		/**
+		 * @brief
+		 * Locks all shards for reading until the returned locks are destroyed.
+		 * Use it to keep a view() valid while other threads may write.
+		 */
+		[[nodiscard]] std::vector<SharedReadLock> lockShared() const
+		{
+			std::vector<SharedReadLock> locks;
+			locks.reserve(m_shards.size());
+			for (const auto& shard : m_shards)
+				locks.emplace_back(shard->mutex);
+			return locks;
+		}
+
 		bool add(const std::shared_ptr<AGG>& aggregate);
 		bool remove(ID id);
-		//bool replace(const std::shared_ptr<AGG>& aggregate);
+
+		/**
+		 * @brief
+		 * Drops a clean aggregate from memory that is still stored in the persistence.
+		 * Unlike remove(), the aggregate does not get dirty and does not go to the deleted cache.
+		 * @return false if the aggregate is not stored, is dirty, or is referenced outside of the repository.
+		 */
+		bool evict(ID id);
+
+		/**
+		 * @brief Replaces the stored aggregate with the same ID in one step.
+		 * Lookups see either the old or the new aggregate, the replaced one does not go to the deleted cache.
+		 * @return false if no aggregate with that ID is stored, or the new one is not alive.
+		 */
+		bool replace(const std::shared_ptr<AGG>& aggregate);
 		[[nodiscard]] std::shared_ptr<AGG> get(ID id);
 		[[nodiscard]] std::shared_ptr<const AGG> get(ID id) const;
+
+		/**
+		 * @brief Like get(), but a miss is expected and does not get logged.
+		 */
+		[[nodiscard]] std::shared_ptr<AGG> tryGet(ID id);
+		[[nodiscard]] std::shared_ptr<const AGG> tryGet(ID id) const;
 		
 		[[nodiscard]] std::vector<std::shared_ptr<AGG>> getAll();
 		[[nodiscard]] std::vector<std::shared_ptr<const AGG>> getAll() const;
 		[[nodiscard]] std::vector<ID> getIDs() const;
+
+		/**
+		 * @brief Gets the IDs of toFilter that are stored in this repository.
+		 */
+		[[nodiscard]] std::vector<ID> filterIDs(const std::vector<ID>& toFilter) const
+		{
+			std::vector<ID> filteredIDs;
+			filteredIDs.reserve(toFilter.size());
+			if (m_shards.size() == 1)
+			{
+				// Lock once for the whole list
+				const Shard& shard = *m_shards[0];
+				SharedReadLock lock(shard.mutex);
+				for (const ID& id : toFilter)
+				{
+					if (shard.storage.contains(id))
+						filteredIDs.push_back(id);
+				}
+				return filteredIDs;
+			}
+			for (const ID& id : toFilter)
+			{
+				if (contains(id))
+					filteredIDs.push_back(id);
+			}
+			return filteredIDs;
+		}
+
+		/**
+		 * @brief
+		 * Gets a non owning view over all stored aggregates.
+		 * In thread safe mode, hold lockShared() while using the view.
+		 * @see AggregateView
+		 */
+		[[nodiscard]] View view()
+		{
+			return View(ShardedIterator<false>(m_shards.cbegin(), m_shards.cend()),
+				ShardedIterator<false>(m_shards.cend(), m_shards.cend()), sizeUnlocked());
+		}
+		[[nodiscard]] ConstView view() const
+		{
+			return ConstView(ShardedIterator<true>(m_shards.cbegin(), m_shards.cend()),
+				ShardedIterator<true>(m_shards.cend(), m_shards.cend()), sizeUnlocked());
+		}
+
+		/**
+		 * @brief
+		 * Calls func(AGG&) for each stored aggregate without copying any shared_ptr.
+		 * If func returns bool, returning false stops the iteration.
+		 * The repository must not be modified from inside func, the visited aggregates may change.
+		 * In thread safe mode, each shard is locked for reading while it gets visited.
+		 */
+		template <typename F> void forEach(F&& func)
+		{
+			for (auto& shard : m_shards)
+			{
+				SharedReadLock lock(shard->mutex);
+				for (auto& pair : shard->storage)
+					if (!invokeAggregateVisitor(func, *pair.second))
+						return;
+			}
+		}
+		template <typename F> void forEach(F&& func) const
+		{
+			for (const auto& shard : m_shards)
+			{
+				SharedReadLock lock(shard->mutex);
+				for (const auto& pair : shard->storage)
+					if (!invokeAggregateVisitor(func, std::as_const(*pair.second)))
+						return;
+			}
+		}
+
+		/**
+		 * @brief
+		 * Like forEach(), but only visits the aggregates with first <= ID <= last.
+		 * With an ordered storage (see RepositoryTraits) only the range gets scanned
+		 * and the aggregates of a shard are visited in ascending ID order,
+		 * otherwise all aggregates get tested.
+		 */
+		template <typename F> void forEachInRange(ID first, ID last, F&& func)
+		{
+			forEachInRangeImpl(*this, first, last, func);
+		}
+		template <typename F> void forEachInRange(ID first, ID last, F&& func) const
+		{
+			forEachInRangeImpl(*this, first, last, func);
+		}
 		void clear()
 		{
-			m_storage.clear();
+			for (auto& shard : m_shards)
+			{
+				ExclusiveWriteLock lock(shard->mutex);
+				ExclusiveWriteLock dirtyLock(shard->dirtyMutex);
+				for (const auto& pair : shard->storage)
+				{
+					unclaimAggregate(*pair.second);
+					shard->dirty.insert(pair.first);
+					if (m_onRemoved)
+						m_onRemoved(pair.first);
+				}
+				shard->storage.clear();
+			}
 		}
 
 		[[nodiscard]] size_t size() const
 		{
-			return m_storage.size();
+			size_t count = 0;
+			for (const auto& shard : m_shards)
+			{
+				SharedReadLock lock(shard->mutex);
+				count += shard->storage.size();
+			}
+			return count;
 		}
 		[[nodiscard]] bool empty() const
 		{
-			return m_storage.empty();
+			for (const auto& shard : m_shards)
+			{
+				SharedReadLock lock(shard->mutex);
+				if (!shard->storage.empty())
+					return false;
+			}
+			return true;
 		}
 		[[nodiscard]] bool contains(ID id) const
 		{
-			return m_storage.contains(id);
+			const Shard& shard = getShard(id);
+			SharedReadLock lock(shard.mutex);
+			return shard.storage.contains(id);
 		}
 		[[nodiscard]] bool contains(const AGG& aggregate) const
 		{
@@ -124,26 +466,199 @@ namespace DDD
 		[[nodiscard]] std::vector<std::shared_ptr<AGG>> getDeleted()
 		{
 			std::vector<std::shared_ptr<AGG>> result;
-			for (auto& pair : m_deleted)
-				result.push_back(pair.second);
+			for (auto& shard : m_shards)
+			{
+				SharedReadLock lock(shard->mutex);
+				shard->deleted.forEach([&result](ID, const std::shared_ptr<AGG>& aggregate)
+					{
+						result.push_back(aggregate);
+					});
+			}
 			return result;
 		}
 		[[nodiscard]] std::vector<std::shared_ptr<const AGG>> getDeleted() const
 		{
 			std::vector<std::shared_ptr<const AGG>> result;
-			for (auto& pair : m_deleted)
-				result.push_back(pair.second);
+			for (const auto& shard : m_shards)
+			{
+				SharedReadLock lock(shard->mutex);
+				shard->deleted.forEach([&result](ID, const std::shared_ptr<AGG>& aggregate)
+					{
+						result.push_back(aggregate);
+					});
+			}
 			return result;
 		}
+
+		/**
+		 * @brief Gets the IDs of all entries in the deleted cache, including tombstones.
+		 */
+		[[nodiscard]] std::vector<ID> getDeletedIDs() const
+		{
+			std::vector<ID> ids;
+			for (const auto& shard : m_shards)
+			{
+				SharedReadLock lock(shard->mutex);
+				shard->deleted.forEachInOrder([&ids](ID id, const std::shared_ptr<AGG>&, size_t)
+					{
+						ids.push_back(id);
+					});
+			}
+			return ids;
+		}
 		void clearDeletedCache()
 		{
-			m_deleted.clear();
+			for (auto& shard : m_shards)
+			{
+				ExclusiveWriteLock lock(shard->mutex);
+				shard->deleted.clear();
+			}
+		}
+
+		/**
+		 * @brief
+		 * Limits the deleted cache, see DeletedCachePolicy.
+		 * The policy gets applied to the cached entries immediately.
+		 */
+		void setDeletedCachePolicy(const DeletedCachePolicy& policy)
+		{
+			m_deletedCachePolicy = policy;
+			const DeletedCachePolicy shardPolicy = getShardDeletedCachePolicy();
+			for (auto& shard : m_shards)
+			{
+				ExclusiveWriteLock lock(shard->mutex);
+				shard->deleted.setPolicy(shardPolicy);
+			}
+		}
+		[[nodiscard]] const DeletedCachePolicy& getDeletedCachePolicy() const
+		{
+			return m_deletedCachePolicy;
+		}
+
+		/**
+		 * @brief Drops the entries of the deleted cache that are older than DeletedCachePolicy::maxAge.
+		 */
+		void trimDeletedCache()
+		{
+			for (auto& shard : m_shards)
+			{
+				ExclusiveWriteLock lock(shard->mutex);
+				shard->deleted.trim();
+			}
+		}
+		[[nodiscard]] DeletedCacheStats getDeletedCacheStats() const
+		{
+			DeletedCacheStats stats;
+			for (const auto& shard : m_shards)
+			{
+				SharedReadLock lock(shard->mutex);
+				stats += shard->deleted.getStats();
+			}
+			return stats;
+		}
+
+		/**
+		 * @brief
+		 * Gets the IDs of the aggregates that were added, replaced, removed or changed
+		 * since they were saved the last time.
+		 * An aggregate is changed when it or one of its entities calls emitDataChanged(),
+		 * or when entities get added to or removed from it.
+		 * The cost is proportional to the number of dirty aggregates, not to the repository size.
+		 */
+		[[nodiscard]] std::vector<ID> getDirtyIDs() const
+		{
+			std::vector<ID> ids;
+			for (const auto& shard : m_shards)
+			{
+				SharedReadLock lock(shard->dirtyMutex);
+				ids.insert(ids.end(), shard->dirty.begin(), shard->dirty.end());
+			}
+			return ids;
+		}
+		[[nodiscard]] size_t getDirtyCount() const
+		{
+			size_t count = 0;
+			for (const auto& shard : m_shards)
+			{
+				SharedReadLock lock(shard->dirtyMutex);
+				count += shard->dirty.size();
+			}
+			return count;
+		}
+		[[nodiscard]] bool isDirty(ID id) const
+		{
+			const Shard& shard = getShard(id);
+			SharedReadLock lock(shard.dirtyMutex);
+			return shard.dirty.contains(id);
+		}
+
+		/**
+		 * @brief
+		 * Gets the dirty IDs and resets the dirty state in one step.
+		 * Changes made while the returned IDs get saved are tracked again.
+		 * If saving fails, hand the IDs back with markDirty().
+		 */
+		[[nodiscard]] std::vector<ID> takeDirtyIDs() const
+		{
+			std::vector<ID> ids;
+			for (const auto& shard : m_shards)
+			{
+				DirtySet taken;
+				{
+					ExclusiveWriteLock lock(shard->dirtyMutex);
+					std::swap(taken, shard->dirty);
+				}
+				ids.insert(ids.end(), taken.begin(), taken.end());
+			}
+			return ids;
+		}
+		void markDirty(const std::vector<ID>& ids) const
+		{
+			for (const ID id : ids)
+			{
+				const Shard& shard = getShard(id);
+				ExclusiveWriteLock lock(shard.dirtyMutex);
+				shard.dirty.insert(id);
+			}
+		}
+		void clearDirty(const std::vector<ID>& ids) const
+		{
+			for (const ID id : ids)
+			{
+				const Shard& shard = getShard(id);
+				ExclusiveWriteLock lock(shard.dirtyMutex);
+				shard.dirty.erase(id);
+			}
+		}
+		void clearDirty() const
+		{
+			for (const auto& shard : m_shards)
+			{
+				DirtySet empty;
+				ExclusiveWriteLock lock(shard->dirtyMutex);
+				std::swap(empty, shard->dirty);
+			}
 		}
 
 		UniqueIDDomain& getIDDomain() const
 		{
 			return m_idDomain;
 		}
+
+		/**
+		 * @brief
+		 * Sets the hooks that get called whenever an aggregate enters or leaves the storage.
+		 * The model uses them to keep its global ID index in sync, also for aggregates
+		 * that get removed because they were marked for deletion.
+		 * The hooks are called while the shard of the aggregate is locked for writing.
+		 * @param onStored is called after an aggregate was inserted.
+		 * @param onRemoved is called after an aggregate was removed.
+		 */
+		void setStorageCallbacks(const std::function<void(ID)>& onStored, const std::function<void(ID)>& onRemoved)
+		{
+			m_onStored = onStored;
+			m_onRemoved = onRemoved;
+		}
 		
 	protected:
 		
@@ -153,15 +668,75 @@ namespace DDD
 		{
 			if (agg)
 			{
-#if LOGGER_LIBRARY_AVAILABLE == 1
-				if (m_logger) m_logger->debug("Object: " + std::to_string(agg->getID()) + " marked for delete");
-#endif
+				DDD_HOT_LOG_DEBUG(m_logger, "Object: " + std::to_string(agg->getID()) + " marked for delete");
 				remove(agg->getID());
 			}
 		}
-		std::unordered_map<ID, std::shared_ptr<AGG>> m_storage;
-		std::unordered_map<ID, std::shared_ptr<AGG>> m_deleted;
+		void onAggregateDataChanged(Aggregate* agg) override
+		{
+			if (agg)
+			{
+				// Only the dirty set gets locked, the shard may be locked for reading by this thread
+				Shard& shard = getShard(agg->getID());
+				ExclusiveWriteLock lock(shard.dirtyMutex);
+				shard.dirty.insert(agg->getID());
+			}
+		}
+
+		Shard& getShard(ID id)
+		{
+			return *m_shards[Sharding::getShardIndex(id >> getShardKeyShift(), m_shardBits)];
+		}
+		const Shard& getShard(ID id) const
+		{
+			return *m_shards[Sharding::getShardIndex(id >> getShardKeyShift(), m_shardBits)];
+		}
+		// Points the owner back-pointer of all stored aggregates to this repository
+		void relinkAggregates()
+		{
+			for (auto& shard : m_shards)
+				for (auto& pair : shard->storage)
+					claimAggregate(*pair.second);
+		}
+		size_t sizeUnlocked() const
+		{
+			size_t count = 0;
+			for (const auto& shard : m_shards)
+				count += shard->storage.size();
+			return count;
+		}
+
+		template <typename Self, typename F>
+		static void forEachInRangeImpl(Self& self, ID first, ID last, F& func);
+
+		// Unlocked helpers, the caller must hold the write lock of the shard
+		bool insertLocked(Shard& shard, const std::shared_ptr<AGG>& aggregate);
+		bool removeLocked(Shard& shard, ID id);
+		static void markDirtyLocked(const Shard& shard, ID id)
+		{
+			ExclusiveWriteLock lock(shard.dirtyMutex);
+			shard.dirty.insert(id);
+		}
+
+		// Each shard gets an equal part of the count and memory limits
+		DeletedCachePolicy getShardDeletedCachePolicy() const
+		{
+			DeletedCachePolicy policy = m_deletedCachePolicy;
+			const size_t shardCount = m_shards.size();
+			if (policy.maxCount > 0)
+				policy.maxCount = (policy.maxCount + shardCount - 1) / shardCount;
+			if (policy.maxBytes > 0)
+				policy.maxBytes = (policy.maxBytes + shardCount - 1) / shardCount;
+			return policy;
+		}
+
+		ShardList m_shards;
+		unsigned int m_shardBits = 0;
+		DeletedCachePolicy m_deletedCachePolicy;
+		bool m_threadSafe = false;
 		UniqueIDDomain& m_idDomain;
+		std::function<void(ID)> m_onStored;
+		std::function<void(ID)> m_onRemoved;
 
 #if LOGGER_LIBRARY_AVAILABLE == 1
 		Log::LogObject* m_logger = nullptr;
@@ -170,111 +745,223 @@ namespace DDD
 
 
 	template <DerivedFromAggregate AGG>
-	bool Repository<AGG>::add(const std::shared_ptr<AGG>& aggregate)
+	void Repository<AGG>::setShardCount(size_t count)
 	{
-		const ID id = aggregate->getID();
+		count = Sharding::normalizeShardCount(count);
+		if (count == m_shards.size())
+			return;
 
-		if (contains(id)) {
-			// Remove existing object
-			remove(id);
-#if LOGGER_LIBRARY_AVAILABLE == 1
-			if (m_logger) m_logger->debug("Repository<" + std::string(typeid(AGG).name()) + ">::add(): Aggregate with ID " + IID::getIDString(id) + " already exists in the repository, it will be replaced by the new instance.");
-#endif
+		ShardList oldShards = std::move(m_shards);
+		m_shards.clear();
+		m_shardBits = static_cast<unsigned int>(std::countr_zero(count));
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_shards.push_back(std::make_unique<Shard>());
+			m_shards.back()->mutex.setEnabled(m_threadSafe);
+			m_shards.back()->dirtyMutex.setEnabled(m_threadSafe);
 		}
-		if (!aggregate->isAlive())
+		const DeletedCachePolicy shardPolicy = getShardDeletedCachePolicy();
+		for (auto& shard : m_shards)
+			shard->deleted.setPolicy(shardPolicy);
+		for (auto& oldShard : oldShards)
 		{
-#if LOGGER_LIBRARY_AVAILABLE == 1
-			if (m_logger) m_logger->error("Repository<" + std::string(typeid(AGG).name()) + ">::add(): Aggregate with ID " + IID::getIDString(id) + " is not alive.");
-#endif
-			return false;
+			for (auto& pair : oldShard->storage)
+				getShard(pair.first).storage.insert(std::move(pair));
+			oldShard->deleted.forEachInOrder([this](ID id, const std::shared_ptr<AGG>& aggregate, size_t bytes)
+				{
+					getShard(id).deleted.insert(id, aggregate, bytes);
+				});
+			for (ID id : oldShard->dirty)
+				getShard(id).dirty.insert(id);
 		}
-		if (id == INVALID_ID)
-			m_idDomain.setUniqueIDFor(aggregate);
-		else
+	}
+
+	template <DerivedFromAggregate AGG>
+	template <typename Self, typename F>
+	void Repository<AGG>::forEachInRangeImpl(Self& self, ID first, ID last, F& func)
+	{
+		using Visited = std::conditional_t<std::is_const_v<Self>, const AGG, AGG>;
+		if (first > last)
+			return;
+		for (const auto& shard : self.m_shards)
 		{
-			m_idDomain.setCurrentIDIFLarger(id);
+			SharedReadLock lock(shard->mutex);
+			const StorageMap& storage = shard->storage;
+			if constexpr (isOrderedStorage)
+			{
+				for (auto it = storage.lowerBound(first); it != storage.end() && it->first <= last; ++it)
+				{
+					Visited& aggregate = *it->second;
+					if (!invokeAggregateVisitor(func, aggregate))
+						return;
+				}
+			}
+			else
+			{
+				for (const auto& pair : storage)
+				{
+					Visited& aggregate = *pair.second;
+					if (pair.first >= first && pair.first <= last && !invokeAggregateVisitor(func, aggregate))
+						return;
+				}
+			}
 		}
-		if (!m_storage.contains(aggregate->getID()))
+	}
+
+	template <DerivedFromAggregate AGG>
+	bool Repository<AGG>::add(const std::shared_ptr<AGG>& aggregate)
+	{
+		// The ID selects the shard, so it has to be assigned before locking
+		if (aggregate->getID() == INVALID_ID && aggregate->isAlive())
+			m_idDomain.setUniqueIDFor(aggregate);
+		const ID id = aggregate->getID();
+		if (id == INVALID_ID)
 		{
-			claimAggregate(aggregate);
-			m_storage.insert({ aggregate->getID(), aggregate });
-			QObject::connect(aggregate.get(), &Aggregate::deleteMarked, this, &IRepository::onAggregateMarketForDeleteSlot);
-			return true;
+			DDD_HOT_LOG_ERROR(m_logger, "Repository<" + std::string(typeid(AGG).name()) + ">::add(): No ID could be reserved for the aggregate.");
+			return false;
 		}
-#if LOGGER_LIBRARY_AVAILABLE == 1
-		if (m_logger) m_logger->error("Repository<" + std::string(typeid(AGG).name()) + ">::add(): Aggregate with ID " + aggregate->getIDString() + " already exists in the repository.");
-#endif
-		return false;
+
+		Shard& shard = getShard(id);
+		ExclusiveWriteLock lock(shard.mutex);
+		if (shard.storage.contains(id)) {
+			// Remove existing object
+			removeLocked(shard, id);
+			DDD_HOT_LOG_DEBUG(m_logger, "Repository<" + std::string(typeid(AGG).name()) + ">::add(): Aggregate with ID " + IID::getIDString(id) + " already exists in the repository, it will be replaced by the new instance.");
+		}
+		return insertLocked(shard, aggregate);
 	}
 	template <DerivedFromAggregate AGG>
 	bool Repository<AGG>::remove(ID id)
 	{
-		auto it = m_storage.find(id);
-		if (it != m_storage.end())
-		{
-			QObject::disconnect(it->second.get(), &Aggregate::deleteMarked, this, &IRepository::onAggregateMarketForDeleteSlot);
-			unclaimAggregate(it->second);
-			m_deleted.insert({ it->first, it->second });
-			m_storage.erase(it);
+		Shard& shard = getShard(id);
+		ExclusiveWriteLock lock(shard.mutex);
+		if (removeLocked(shard, id))
 			return true;
-		}
-#if LOGGER_LIBRARY_AVAILABLE == 1
-		if (m_logger) m_logger->warning("Repository<" + std::string(typeid(AGG).name()) + ">::remove(): Aggregate with ID " + IID::getIDString(id) + " does not exists in the repository.");
-#endif
+		DDD_HOT_LOG_WARNING(m_logger, "Repository<" + std::string(typeid(AGG).name()) + ">::remove(): Aggregate with ID " + IID::getIDString(id) + " does not exists in the repository.");
 		return false;
 	}
-	/*
+	template <DerivedFromAggregate AGG>
+	bool Repository<AGG>::evict(ID id)
+	{
+		// Gets destroyed after the lock is released
+		std::shared_ptr<AGG> evicted;
+		Shard& shard = getShard(id);
+		ExclusiveWriteLock lock(shard.mutex);
+		auto it = shard.storage.find(id);
+
+		// Another holder would keep a copy that differs from the one that gets loaded next time
+		if (it == shard.storage.end() || it->second.use_count() > 1)
+			return false;
+		{
+			SharedReadLock dirtyLock(shard.dirtyMutex);
+			if (shard.dirty.contains(id))
+				return false;
+		}
+		unclaimAggregate(*it->second);
+		evicted = std::move(it->second);
+		shard.storage.erase(it);
+		if (m_onRemoved)
+			m_onRemoved(id);
+		return true;
+	}
 	template <DerivedFromAggregate AGG>
 	bool Repository<AGG>::replace(const std::shared_ptr<AGG>& aggregate)
 	{
+		const ID id = aggregate->getID();
 		if (!aggregate->isAlive())
 		{
-#if LOGGER_LIBRARY_AVAILABLE == 1
-			Logger::logError("Repository<" + std::string(typeid(AGG).name()) + ">::add(): Aggregate with ID " + aggregate->getIDString() + " is not alive.");
-#endif
+			DDD_HOT_LOG_ERROR(m_logger, "Repository<" + std::string(typeid(AGG).name()) + ">::replace(): Aggregate with ID " + IID::getIDString(id) + " is not alive.");
+			return false;
+		}
+
+		// Gets destroyed after the lock is released
+		std::shared_ptr<AGG> replaced;
+		Shard& shard = getShard(id);
+		ExclusiveWriteLock lock(shard.mutex);
+		auto it = shard.storage.find(id);
+		if (it == shard.storage.end())
+		{
+			DDD_HOT_LOG_WARNING(m_logger, "Repository<" + std::string(typeid(AGG).name()) + ">::replace(): Aggregate with ID " + aggregate->getIDString() + " does not exists in the repository.");
+			return false;
+		}
+
+		// Swapped in place, the ID stays stored, so the removal and storage callbacks don't run
+		unclaimAggregate(*it->second);
+		replaced = std::move(it->second);
+		it->second = aggregate;
+		claimAggregate(*aggregate);
+		markDirtyLocked(shard, id);
+		return true;
+	}
+
+	template <DerivedFromAggregate AGG>
+	bool Repository<AGG>::insertLocked(Shard& shard, const std::shared_ptr<AGG>& aggregate)
+	{
+		const ID id = aggregate->getID();
+		if (!aggregate->isAlive())
+		{
+			DDD_HOT_LOG_ERROR(m_logger, "Repository<" + std::string(typeid(AGG).name()) + ">::add(): Aggregate with ID " + IID::getIDString(id) + " is not alive.");
 			return false;
 		}
-		auto it = m_storage.find(aggregate->getID());
-		if (it != m_storage.end())
+		m_idDomain.setCurrentIDIFLarger(id);
+		if (shard.storage.insert({ id, aggregate }).second)
 		{
-			QObject::disconnect(it->second.get(), &Aggregate::deleteMarked, this, &IRepository::onAggregateMarketForDeleteSlot);
-			unclaimAggregate(it->second);
-			claimAggregate(aggregate);
-			it->second = aggregate;
-			QObject::connect(aggregate.get(), &Aggregate::deleteMarked, this, &IRepository::onAggregateMarketForDeleteSlot);
+			claimAggregate(*aggregate);
+			markDirtyLocked(shard, id);
+			if (m_onStored)
+				m_onStored(id);
 			return true;
 		}
-#if LOGGER_LIBRARY_AVAILABLE == 1
-		Logger::logWarning("Repository<" + std::string(typeid(AGG).name()) + ">::replace(): Aggregate with ID " + aggregate->getIDString() + " does not exists in the repository.");
-#endif
+		DDD_HOT_LOG_ERROR(m_logger, "Repository<" + std::string(typeid(AGG).name()) + ">::add(): Aggregate with ID " + aggregate->getIDString() + " already exists in the repository.");
 		return false;
-	}*/
+	}
+	template <DerivedFromAggregate AGG>
+	bool Repository<AGG>::removeLocked(Shard& shard, ID id)
+	{
+		auto it = shard.storage.find(id);
+		if (it == shard.storage.end())
+			return false;
+		unclaimAggregate(*it->second);
+		shard.deleted.insert(it->first, it->second, sizeof(AGG) + it->second->getApproximateHeapSize());
+		shard.storage.erase(it);
+		markDirtyLocked(shard, id);
+		if (m_onRemoved)
+			m_onRemoved(id);
+		return true;
+	}
+
 	template <DerivedFromAggregate AGG>
 	[[nodiscard]] std::shared_ptr<AGG> Repository<AGG>::get(ID id)
 	{
-		auto it = m_storage.find(id);
-		if (it != m_storage.end())
-		{
-			return it->second;
-		}
-#if LOGGER_LIBRARY_AVAILABLE == 1
-		if (m_logger) m_logger->error("Repository<" + std::string(typeid(AGG).name()) + ">::get(): Aggregate with ID " + IID::getIDString(id) + " does not exists in the repository.");
-#endif
-		return nullptr;
+		std::shared_ptr<AGG> aggregate = tryGet(id);
+		if (!aggregate)
+			DDD_HOT_LOG_ERROR(m_logger, "Repository<" + std::string(typeid(AGG).name()) + ">::get(): Aggregate with ID " + IID::getIDString(id) + " does not exists in the repository.");
+		return aggregate;
+	}
+	template <DerivedFromAggregate AGG>
+	[[nodiscard]] std::shared_ptr<AGG> Repository<AGG>::tryGet(ID id)
+	{
+		const Shard& shard = getShard(id);
+		SharedReadLock lock(shard.mutex);
+		auto it = shard.storage.find(id);
+		return it != shard.storage.end() ? it->second : nullptr;
 	}
 
 	template <DerivedFromAggregate AGG>
 	[[nodiscard]] std::shared_ptr<const AGG> Repository<AGG>::get(ID id) const
 	{
-		auto it = m_storage.find(id);
-		if (it != m_storage.end())
-		{
-			return it->second;
-		}
-#if LOGGER_LIBRARY_AVAILABLE == 1
-		if (m_logger) m_logger->error("Repository<" + std::string(typeid(AGG).name()) + ">::get(): Aggregate with ID " + IID::getIDString(id) + " does not exists in the repository.");
-#endif
-		return nullptr;
+		std::shared_ptr<const AGG> aggregate = tryGet(id);
+		if (!aggregate)
+			DDD_HOT_LOG_ERROR(m_logger, "Repository<" + std::string(typeid(AGG).name()) + ">::get(): Aggregate with ID " + IID::getIDString(id) + " does not exists in the repository.");
+		return aggregate;
+	}
+	template <DerivedFromAggregate AGG>
+	[[nodiscard]] std::shared_ptr<const AGG> Repository<AGG>::tryGet(ID id) const
+	{
+		const Shard& shard = getShard(id);
+		SharedReadLock lock(shard.mutex);
+		auto it = shard.storage.find(id);
+		return it != shard.storage.end() ? it->second : nullptr;
 	}
 
 
@@ -282,9 +969,14 @@ namespace DDD
 	[[nodiscard]] std::vector<std::shared_ptr<AGG>> Repository<AGG>::getAll()
 	{
 		std::vector<std::shared_ptr<AGG>> result;
-		for (auto& pair : m_storage)
+		result.reserve(size());
+		for (const auto& shard : m_shards)
 		{
-			result.push_back(pair.second);
+			SharedReadLock lock(shard->mutex);
+			for (auto& pair : shard->storage)
+			{
+				result.push_back(pair.second);
+			}
 		}
 		return result;
 	}
@@ -293,9 +985,14 @@ namespace DDD
 	[[nodiscard]] std::vector<std::shared_ptr<const AGG>> Repository<AGG>::getAll() const
 	{
 		std::vector<std::shared_ptr<const AGG>> result;
-		for (auto& pair : m_storage)
+		result.reserve(size());
+		for (const auto& shard : m_shards)
 		{
-			result.push_back(pair.second);
+			SharedReadLock lock(shard->mutex);
+			for (auto& pair : shard->storage)
+			{
+				result.push_back(pair.second);
+			}
 		}
 		return result;
 	}
@@ -304,10 +1001,14 @@ namespace DDD
 	[[nodiscard]] std::vector<ID> Repository<AGG>::getIDs() const
 	{
 		std::vector<ID> ids;
-		ids.reserve(m_storage.size());
-		for (const auto& el : m_storage)
+		ids.reserve(size());
+		for (const auto& shard : m_shards)
 		{
-			ids.emplace_back(el.first);
+			SharedReadLock lock(shard->mutex);
+			for (const auto& el : shard->storage)
+			{
+				ids.emplace_back(el.first);
+			}
 		}
 		return ids;
 	}
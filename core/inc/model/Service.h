@@ -67,6 +67,17 @@ namespace DDD
 			return {};
 		}
 
+		/**
+		 * @brief
+		 * Calls func(AGG&) for each aggregate of the repository without copying the aggregate list.
+		 * @see Repository::forEach
+		 */
+		template <typename F> void forEachAggregate(F&& func) const
+		{
+			if (m_repository)
+				m_repository->forEach(std::forward<F>(func));
+		}
+
 		virtual std::shared_ptr<ServiceExecutionResult> execute() = 0;
 
 
@@ -0,0 +1,130 @@
+#pragma once
+#include "DDD_base.h"
+#include "model/IPersistence.h"
+#include "utilities/FlatHashMap.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace DDD
+{
+	/**
+	 * @brief Controls the queue and the writer thread of a WriteBehindQueue.
+	 */
+	struct WriteBehindPolicy
+	{
+		// Maximum number of different aggregates that wait to be written, 0 disables the limit
+		size_t maxQueuedAggregates = 100000;
+
+		// true: enqueue() waits while the queue is full, false: enqueue() fails
+		bool blockWhenFull = true;
+
+		// The writer waits this long after the first queued save, so that more saves
+		// get written together. flush() and awaitDurable() cut it short.
+		std::chrono::milliseconds writeDelay{ 0 };
+
+		// Delay before a failed write is tried again
+		std::chrono::milliseconds retryDelay{ 100 };
+	};
+
+	struct WriteBehindStats
+	{
+		// Aggregates that wait to be written or are being written
+		size_t queued = 0;
+
+		// Aggregates that were written
+		size_t written = 0;
+
+		// Saves that replaced a queued save of the same aggregate
+		size_t coalesced = 0;
+
+		size_t failedWrites = 0;
+	};
+
+	/**
+	 * @brief
+	 * Write-behind stage between the Model and its IPersistence.
+	 *
+	 * @details
+	 * enqueue() only stores the captured aggregates, a background thread writes them.
+	 * An aggregate that gets saved again while it waits is written once, with its latest capture.
+	 * Each enqueue() returns a ticket, awaitDurable() blocks until the saves of a ticket are written.
+	 * Failed writes are kept in the queue and tried again after WriteBehindPolicy::retryDelay.
+	 * The destructor writes the queued aggregates before it returns.
+	 *
+	 * The writer thread only calls IPersistence::saveSnapshots(), the persistence must support snapshots.
+	 * It gets called from the writer thread while the model may use the persistence as well.
+	 */
+	class DDD_API WriteBehindQueue
+	{
+	public:
+		using Ticket = uint64_t;
+
+		struct Entry
+		{
+			ID id = INVALID_ID;
+
+			// nullptr if the aggregate was removed
+			std::shared_ptr<AggregateSnapshot> snapshot;
+			bool removed = false;
+		};
+
+		explicit WriteBehindQueue(std::shared_ptr<IPersistence> persistence, const WriteBehindPolicy& policy = WriteBehindPolicy());
+		WriteBehindQueue(const WriteBehindQueue&) = delete;
+		WriteBehindQueue& operator=(const WriteBehindQueue&) = delete;
+		~WriteBehindQueue();
+
+		void setPolicy(const WriteBehindPolicy& policy);
+		[[nodiscard]] WriteBehindPolicy getPolicy() const;
+
+		/**
+		 * @brief Queues the entries for writing.
+		 * @return the ticket of the entries, 0 if the queue is full and blockWhenFull is false.
+		 */
+		Ticket enqueue(std::vector<Entry> entries);
+
+		/**
+		 * @brief Blocks until all entries that were queued before are written.
+		 * @return false if a write failed while waiting, the entries stay queued.
+		 */
+		bool flush();
+
+		/**
+		 * @brief Blocks until the entries of the ticket are written.
+		 * @return false if a write failed while waiting, or on timeout.
+		 */
+		bool awaitDurable(Ticket ticket, std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+
+		[[nodiscard]] bool isDurable(Ticket ticket) const;
+		[[nodiscard]] Ticket getLastTicket() const;
+		[[nodiscard]] Ticket getDurableTicket() const;
+		[[nodiscard]] WriteBehindStats getStats() const;
+
+	private:
+		void run();
+		bool write(const std::vector<Entry>& batch);
+
+		std::shared_ptr<IPersistence> m_persistence;
+		WriteBehindPolicy m_policy;
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_wakeUp;
+		std::condition_variable m_written;
+		std::condition_variable m_spaceAvailable;
+
+		// Latest entry per aggregate ID
+		HashMap<ID, Entry> m_pending;
+		size_t m_inFlight = 0;
+		Ticket m_lastTicket = 0;
+		Ticket m_durableTicket = 0;
+		size_t m_waiters = 0;
+		bool m_stopping = false;
+		WriteBehindStats m_stats;
+
+		std::thread m_thread;
+	};
+}
@@ -1,6 +1,9 @@
 #pragma once
 #include "DDD_base.h"
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace DDD
 {
@@ -13,11 +16,13 @@ namespace DDD
 		}
 		AggregateLock(const AggregateLock& other)
 			: m_lockedAggregateID(other.m_lockedAggregateID)
+			, m_owner(other.m_owner)
 		{
 			
 		}
 		AggregateLock(AggregateLock&& other) noexcept
 			: m_lockedAggregateID(other.m_lockedAggregateID)
+			, m_owner(std::move(other.m_owner))
 		{
 		}
 		virtual ~AggregateLock() = default;
@@ -30,8 +35,29 @@ namespace DDD
 		virtual void setAggregateID(const DDD::ID& ref) { m_lockedAggregateID = ref; }
 		const DDD::ID& getAggregateID() const { return m_lockedAggregateID; }
 
+		// Identifies the user or session that holds the lock, see AggregateLockTable
+		virtual void setOwner(const std::string& owner) { m_owner = owner; }
+		const std::string& getOwner() const { return m_owner; }
+
 
 	private:
 		DDD::ID m_lockedAggregateID;
+		std::string m_owner;
+	};
+
+	/**
+	 * @brief
+	 * Lock changes of the persistence since a lock version, see IPersistence::getLockChanges().
+	 */
+	struct AggregateLockChanges
+	{
+		// Lock version of the persistence that includes these changes
+		uint64_t version = 0;
+
+		// New locks and locks that changed, for example their owner
+		std::vector<std::shared_ptr<AggregateLock>> changed;
+
+		// IDs of the aggregates that got unlocked
+		std::vector<ID> removed;
 	};
-}
\ No newline at end of file
+}
@@ -0,0 +1,189 @@
+#pragma once
+#include "DDD_base.h"
+#include "utilities/AggregateLock.h"
+#include "utilities/FlatHashMap.h"
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace DDD
+{
+	/**
+	 * @brief
+	 * Locks of the aggregates, indexed by the aggregate ID and grouped by the lock owner.
+	 * Query, insert and remove are O(1), removing all locks of an owner is O(locks of the owner).
+	 *
+	 * @details
+	 * The owner of a lock is read when the lock gets inserted,
+	 * a lock must not change its owner while it is in the table.
+	 * Not thread safe.
+	 */
+	class AggregateLockTable
+	{
+	public:
+		/**
+		 * @brief Adds the lock, an existing lock of the same aggregate gets replaced.
+		 * @return false if the lock is nullptr.
+		 */
+		bool insert(const std::shared_ptr<AggregateLock>& lock)
+		{
+			if (!lock)
+				return false;
+			const ID id = lock->getAggregateID();
+			auto it = m_locks.find(id);
+			if (it != m_locks.end())
+			{
+				removeFromOwner(it->second->getOwner(), id);
+				it->second = lock;
+			}
+			else
+				m_locks.insert({ id, lock });
+			m_owners.try_emplace(lock->getOwner()).first->second.insert(id);
+			return true;
+		}
+
+		/**
+		 * @brief Replaces the content of the table with the given locks.
+		 */
+		void assign(const std::vector<std::shared_ptr<AggregateLock>>& locks)
+		{
+			clear();
+			m_locks.reserve(locks.size());
+			for (const auto& lock : locks)
+				insert(lock);
+		}
+
+		/**
+		 * @brief Applies the lock changes of the persistence, see IPersistence::getLockChanges().
+		 */
+		void apply(const AggregateLockChanges& changes)
+		{
+			for (ID id : changes.removed)
+				remove(id);
+			for (const auto& lock : changes.changed)
+				insert(lock);
+		}
+
+		/**
+		 * @return true if the aggregate was locked.
+		 */
+		bool remove(ID id)
+		{
+			auto it = m_locks.find(id);
+			if (it == m_locks.end())
+				return false;
+			removeFromOwner(it->second->getOwner(), id);
+			m_locks.erase(it);
+			return true;
+		}
+
+		/**
+		 * @brief Removes the locks of all aggregates whose result is true.
+		 * @param results must have the same size as ids, like the result of IPersistence::unlock().
+		 */
+		void remove(const std::vector<ID>& ids, const std::vector<bool>& results)
+		{
+			const size_t count = std::min(ids.size(), results.size());
+			for (size_t i = 0; i < count; ++i)
+				if (results[i])
+					remove(ids[i]);
+		}
+
+		/**
+		 * @brief Removes all locks of the owner.
+		 * @return the IDs of the aggregates that were locked by the owner.
+		 */
+		std::vector<ID> removeOwner(const std::string& owner)
+		{
+			std::vector<ID> ids = getIDsOfOwner(owner);
+			for (ID id : ids)
+				m_locks.erase(id);
+			m_owners.erase(owner);
+			return ids;
+		}
+
+		void clear()
+		{
+			m_locks.clear();
+			m_owners.clear();
+		}
+
+		[[nodiscard]] bool contains(ID id) const
+		{
+			return m_locks.contains(id);
+		}
+		[[nodiscard]] std::shared_ptr<AggregateLock> get(ID id) const
+		{
+			auto it = m_locks.find(id);
+			return it != m_locks.end() ? it->second : nullptr;
+		}
+		[[nodiscard]] size_t size() const
+		{
+			return m_locks.size();
+		}
+		[[nodiscard]] bool empty() const
+		{
+			return m_locks.empty();
+		}
+
+		[[nodiscard]] std::vector<std::shared_ptr<AggregateLock>> getAll() const
+		{
+			std::vector<std::shared_ptr<AggregateLock>> locks;
+			locks.reserve(m_locks.size());
+			for (const auto& pair : m_locks)
+				locks.push_back(pair.second);
+			return locks;
+		}
+
+		[[nodiscard]] std::vector<ID> getIDsOfOwner(const std::string& owner) const
+		{
+			std::vector<ID> ids;
+			auto it = m_owners.find(owner);
+			if (it == m_owners.end())
+				return ids;
+			ids.assign(it->second.begin(), it->second.end());
+			return ids;
+		}
+		[[nodiscard]] std::vector<std::shared_ptr<AggregateLock>> getLocksOfOwner(const std::string& owner) const
+		{
+			std::vector<std::shared_ptr<AggregateLock>> locks;
+			auto it = m_owners.find(owner);
+			if (it == m_owners.end())
+				return locks;
+			locks.reserve(it->second.size());
+			for (ID id : it->second)
+				locks.push_back(m_locks.find(id)->second);
+			return locks;
+		}
+		[[nodiscard]] size_t getLockCountOfOwner(const std::string& owner) const
+		{
+			auto it = m_owners.find(owner);
+			return it != m_owners.end() ? it->second.size() : 0;
+		}
+		[[nodiscard]] std::vector<std::string> getOwners() const
+		{
+			std::vector<std::string> owners;
+			owners.reserve(m_owners.size());
+			for (const auto& pair : m_owners)
+				owners.push_back(pair.first);
+			return owners;
+		}
+
+	private:
+		using IDSet = HashSet<ID>;
+
+		void removeFromOwner(const std::string& owner, ID id)
+		{
+			auto it = m_owners.find(owner);
+			if (it == m_owners.end())
+				return;
+			it->second.erase(id);
+			if (it->second.empty())
+				m_owners.erase(it);
+		}
+
+		HashMap<ID, std::shared_ptr<AggregateLock>> m_locks;
+		HashMap<std::string, IDSet> m_owners;
+	};
+}
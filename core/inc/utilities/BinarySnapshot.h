@@ -0,0 +1,311 @@
+#pragma once
+#include "DDD_base.h"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+class QFile;
+class QSaveFile;
+
+namespace DDD
+{
+	// Number of the journal that a snapshot contains the records of, see AggregateJournal
+	using JournalGeneration = uint64_t;
+
+	/**
+	 * @brief
+	 * Buffer for the data of one aggregate in a binary snapshot, see AggregateFactory::serialize().
+	 * Values are stored in the byte order of the host.
+	 */
+	class BinarySnapshotOutput
+	{
+	public:
+		void writeBytes(const void* data, size_t size)
+		{
+			const char* bytes = static_cast<const char*>(data);
+			m_data.insert(m_data.end(), bytes, bytes + size);
+		}
+		template <typename T> void write(const T& value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be written directly");
+			writeBytes(&value, sizeof(T));
+		}
+		void writeString(const std::string& value)
+		{
+			write<uint64_t>(value.size());
+			writeBytes(value.data(), value.size());
+		}
+
+		[[nodiscard]] const char* getData() const
+		{
+			return m_data.data();
+		}
+		[[nodiscard]] size_t getSize() const
+		{
+			return m_data.size();
+		}
+		void clear()
+		{
+			m_data.clear();
+		}
+
+	private:
+		std::vector<char> m_data;
+	};
+
+	/**
+	 * @brief
+	 * Reads the data of one aggregate from a binary snapshot, see AggregateFactory::deserialize().
+	 * Points into the mapped file, no data gets copied until it is read.
+	 * A read beyond the end of the record fails and leaves the input invalid.
+	 */
+	class BinarySnapshotInput
+	{
+	public:
+		BinarySnapshotInput() = default;
+		BinarySnapshotInput(const char* data, size_t size, uint32_t typeVersion)
+			: m_data(data)
+			, m_size(size)
+			, m_typeVersion(typeVersion)
+		{}
+
+		bool readBytes(void* data, size_t size)
+		{
+			if (!m_valid || size > m_size - m_pos)
+			{
+				m_valid = false;
+				return false;
+			}
+			if (size > 0)
+				std::memcpy(data, m_data + m_pos, size);
+			m_pos += size;
+			return true;
+		}
+		template <typename T> bool read(T& value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be read directly");
+			return readBytes(&value, sizeof(T));
+		}
+		bool readString(std::string& value)
+		{
+			uint64_t size = 0;
+			if (!read(size) || size > m_size - m_pos)
+			{
+				m_valid = false;
+				return false;
+			}
+			value.assign(m_data + m_pos, static_cast<size_t>(size));
+			m_pos += static_cast<size_t>(size);
+			return true;
+		}
+
+		/**
+		 * @brief Gets the version that AggregateFactory::getSnapshotVersion() returned when the snapshot was written.
+		 */
+		[[nodiscard]] uint32_t getTypeVersion() const
+		{
+			return m_typeVersion;
+		}
+		[[nodiscard]] size_t getRemaining() const
+		{
+			return m_size - m_pos;
+		}
+		[[nodiscard]] bool isValid() const
+		{
+			return m_valid;
+		}
+
+		/**
+		 * @brief Marks the record as invalid, for data that can be read but makes no sense.
+		 */
+		void invalidate()
+		{
+			m_valid = false;
+		}
+
+	private:
+		const char* m_data = nullptr;
+		size_t m_size = 0;
+		size_t m_pos = 0;
+		uint32_t m_typeVersion = 0;
+		bool m_valid = true;
+	};
+
+	/**
+	 * @brief
+	 * Writes a binary snapshot sequentially, one section per aggregate type.
+	 *
+	 * @details
+	 * File layout, all offsets are 8 byte aligned:
+	 *  - Header: magic, format version and byte order mark
+	 *  - The records of all sections
+	 *  - Per section, the index of its records sorted by ID: {ID, offset, size}
+	 *  - Section table: index offset, record count, type version and type name per section
+	 *  - Footer: section table offset, section count, highest ID, journal generation and magic
+	 *
+	 * The file is written to a temporary file and replaces the target on commit(),
+	 * a failed or aborted write keeps the previous snapshot.
+	 */
+	class DDD_API BinarySnapshotWriter
+	{
+	public:
+		BinarySnapshotWriter();
+		BinarySnapshotWriter(const BinarySnapshotWriter&) = delete;
+		BinarySnapshotWriter& operator=(const BinarySnapshotWriter&) = delete;
+		~BinarySnapshotWriter();
+
+		bool open(const std::string& path);
+
+		/**
+		 * @brief Starts the section of an aggregate type, the previous section gets closed.
+		 */
+		bool beginSection(const std::string& typeName, uint32_t typeVersion);
+		bool writeRecord(ID id, const char* data, size_t size);
+		bool writeRecord(ID id, const BinarySnapshotOutput& output)
+		{
+			return writeRecord(id, output.getData(), output.getSize());
+		}
+
+		/**
+		 * @brief Writes the indexes and the footer and replaces the target file.
+		 * @param highestID the highest ID that was handed out when the snapshot was taken.
+		 * @param journalGeneration the generation of the journal that the snapshot contains, 0 for none.
+		 */
+		bool commit(ID highestID, JournalGeneration journalGeneration = 0);
+
+		/**
+		 * @brief Discards the written data, the target file stays unchanged.
+		 */
+		void cancel();
+
+		[[nodiscard]] bool isOpen() const
+		{
+			return m_file != nullptr;
+		}
+
+	private:
+		struct IndexEntry
+		{
+			uint64_t id;
+			uint64_t offset;
+			uint64_t size;
+		};
+		struct Section
+		{
+			std::string typeName;
+			uint32_t typeVersion = 0;
+			uint64_t indexOffset = 0;
+			std::vector<IndexEntry> index;
+		};
+
+		bool write(const void* data, size_t size);
+		bool flushBuffer();
+		bool writePadding();
+		bool endSection();
+
+		std::unique_ptr<QSaveFile> m_file;
+		std::vector<char> m_buffer;
+		std::vector<Section> m_sections;
+		uint64_t m_offset = 0;
+		bool m_sectionOpen = false;
+	};
+
+	/**
+	 * @brief
+	 * Memory mapped binary snapshot, written by BinarySnapshotWriter.
+	 *
+	 * @details
+	 * open() only validates the header, the footer and the section table,
+	 * the records are read from the mapping when they are accessed.
+	 * The record indexes are sorted by ID, findRecord() is a binary search in the mapping.
+	 * All const functions can be called from multiple threads at once.
+	 */
+	class DDD_API BinarySnapshotFile
+	{
+	public:
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		BinarySnapshotFile();
+		BinarySnapshotFile(const BinarySnapshotFile&) = delete;
+		BinarySnapshotFile& operator=(const BinarySnapshotFile&) = delete;
+		~BinarySnapshotFile();
+
+		/**
+		 * @return false if the file can't be mapped or is not a valid snapshot.
+		 */
+		bool open(const std::string& path);
+		void close();
+		[[nodiscard]] bool isOpen() const
+		{
+			return m_data != nullptr;
+		}
+
+		[[nodiscard]] ID getHighestID() const
+		{
+			return m_highestID;
+		}
+
+		/**
+		 * @return the generation of the journal whose records the snapshot contains, see AggregateJournal.
+		 */
+		[[nodiscard]] JournalGeneration getJournalGeneration() const
+		{
+			return m_journalGeneration;
+		}
+		[[nodiscard]] size_t getSectionCount() const
+		{
+			return m_sections.size();
+		}
+
+		/**
+		 * @return the section of the aggregate type, npos if the snapshot has no such section.
+		 */
+		[[nodiscard]] size_t findSection(const std::string& typeName) const;
+		[[nodiscard]] const std::string& getTypeName(size_t section) const
+		{
+			return m_sections[section].typeName;
+		}
+		[[nodiscard]] uint32_t getTypeVersion(size_t section) const
+		{
+			return m_sections[section].typeVersion;
+		}
+		[[nodiscard]] size_t getRecordCount(size_t section) const
+		{
+			return m_sections[section].recordCount;
+		}
+
+		/**
+		 * @brief Gets the ID of the record at the index position, records are sorted by ID.
+		 */
+		[[nodiscard]] ID getID(size_t section, size_t index) const;
+		[[nodiscard]] std::vector<ID> getIDs(size_t section) const;
+		[[nodiscard]] BinarySnapshotInput getRecord(size_t section, size_t index) const;
+
+		/**
+		 * @return the index of the record with the ID in the section, npos if it is not in the section.
+		 */
+		[[nodiscard]] size_t findRecord(size_t section, ID id) const;
+
+	private:
+		struct Section
+		{
+			std::string typeName;
+			uint32_t typeVersion = 0;
+			uint64_t indexOffset = 0;
+			size_t recordCount = 0;
+		};
+
+		bool readSections();
+		[[nodiscard]] uint64_t readIndexValue(size_t section, size_t index, size_t field) const;
+
+		std::unique_ptr<QFile> m_file;
+		const char* m_data = nullptr;
+		uint64_t m_size = 0;
+		ID m_highestID = INVALID_ID;
+		JournalGeneration m_journalGeneration = 0;
+		std::vector<Section> m_sections;
+	};
+}
@@ -0,0 +1,227 @@
+#pragma once
+#include "DDD_base.h"
+#include "utilities/FlatHashMap.h"
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace DDD
+{
+	/**
+	 * @brief
+	 * Controls how long removed aggregates are kept in the deleted cache of a repository.
+	 *
+	 * @details
+	 * By default, all removed aggregates are kept until the cache gets cleared.
+	 * The limits are enforced each time an aggregate gets removed, the oldest entries
+	 * are dropped first. There is no background timer, call Model::trimDeletedAggregates()
+	 * periodically to also drop entries that got too old while nothing was removed.
+	 * With a sharded repository, each shard gets an equal part of maxCount and maxBytes.
+	 */
+	struct DeletedCachePolicy
+	{
+		// Keep only the IDs of removed aggregates and release the aggregates themselves
+		bool tombstonesOnly = false;
+
+		// Maximum number of entries, 0 disables the limit
+		size_t maxCount = 0;
+
+		// Drop entries that were removed longer ago than this, 0 disables the limit
+		std::chrono::milliseconds maxAge{ 0 };
+
+		// Maximum approximate memory of the cached aggregates, 0 disables the limit.
+		// See Aggregate::getApproximateHeapSize()
+		size_t maxBytes = 0;
+	};
+
+	/**
+	 * @brief Current size of a deleted cache.
+	 */
+	struct DeletedCacheStats
+	{
+		// Entries, including tombstones
+		size_t count = 0;
+
+		// Entries that only hold the ID
+		size_t tombstones = 0;
+
+		// Approximate memory of the cached aggregates
+		size_t bytes = 0;
+
+		// Entries that were dropped because of the policy
+		size_t evicted = 0;
+
+		DeletedCacheStats& operator+=(const DeletedCacheStats& other)
+		{
+			count += other.count;
+			tombstones += other.tombstones;
+			bytes += other.bytes;
+			evicted += other.evicted;
+			return *this;
+		}
+	};
+
+	/**
+	 * @brief
+	 * Removed aggregates of one repository shard, in the order they were removed.
+	 * Enforces a DeletedCachePolicy with amortized O(1) cost per removal.
+	 * Not thread safe, the repository guards it with the shard lock.
+	 */
+	template <typename T>
+	class DeletedAggregateCache
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		void setPolicy(const DeletedCachePolicy& policy)
+		{
+			m_policy = policy;
+			if (m_policy.tombstonesOnly)
+			{
+				for (auto& pair : m_entries)
+					releasePayload(pair.second);
+			}
+			trim();
+		}
+		[[nodiscard]] const DeletedCachePolicy& getPolicy() const
+		{
+			return m_policy;
+		}
+
+		/**
+		 * @brief
+		 * Adds a removed aggregate, a nullptr adds a tombstone.
+		 * An ID that is already cached keeps its first entry.
+		 * @param bytes is the approximate memory of the aggregate.
+		 * @return false if the ID is already cached.
+		 */
+		bool insert(ID id, const std::shared_ptr<T>& aggregate, size_t bytes)
+		{
+			Entry entry;
+			if (aggregate && !m_policy.tombstonesOnly)
+			{
+				entry.aggregate = aggregate;
+				entry.bytes = bytes;
+			}
+			if (m_policy.maxAge.count() > 0)
+				entry.removedAt = Clock::now();
+			if (!m_entries.insert({ id, entry }).second)
+				return false;
+			m_order.push_back(id);
+			m_bytes += entry.bytes;
+			if (!entry.aggregate)
+				++m_tombstones;
+			trim();
+			return true;
+		}
+
+		/**
+		 * @brief Drops the entries that exceed the limits of the policy, oldest first.
+		 */
+		void trim()
+		{
+			const bool checkAge = m_policy.maxAge.count() > 0;
+			const Clock::time_point now = checkAge ? Clock::now() : Clock::time_point();
+			while (!m_order.empty())
+			{
+				auto it = m_entries.find(m_order.front());
+				if (it == m_entries.end())
+				{
+					m_order.pop_front();
+					continue;
+				}
+				const bool overCount = m_policy.maxCount > 0 && m_entries.size() > m_policy.maxCount;
+				const bool overBytes = m_policy.maxBytes > 0 && m_bytes > m_policy.maxBytes;
+				const bool tooOld = checkAge && now - it->second.removedAt > m_policy.maxAge;
+				if (!overCount && !overBytes && !tooOld)
+					break;
+				eraseEntry(it);
+				m_order.pop_front();
+				++m_evicted;
+			}
+		}
+		void clear()
+		{
+			m_entries.clear();
+			m_order.clear();
+			m_bytes = 0;
+			m_tombstones = 0;
+		}
+
+		[[nodiscard]] bool contains(ID id) const
+		{
+			return m_entries.contains(id);
+		}
+		[[nodiscard]] size_t size() const
+		{
+			return m_entries.size();
+		}
+		[[nodiscard]] DeletedCacheStats getStats() const
+		{
+			DeletedCacheStats stats;
+			stats.count = m_entries.size();
+			stats.tombstones = m_tombstones;
+			stats.bytes = m_bytes;
+			stats.evicted = m_evicted;
+			return stats;
+		}
+
+		/**
+		 * @brief Calls func(ID, const std::shared_ptr<T>&) for each cached aggregate, tombstones are skipped.
+		 */
+		template <typename F> void forEach(F&& func) const
+		{
+			for (const auto& pair : m_entries)
+				if (pair.second.aggregate)
+					func(pair.first, pair.second.aggregate);
+		}
+
+		/**
+		 * @brief Calls func(ID, const std::shared_ptr<T>&, size_t bytes) for each entry, oldest first.
+		 *        Tombstones get a nullptr.
+		 */
+		template <typename F> void forEachInOrder(F&& func) const
+		{
+			for (ID id : m_order)
+			{
+				auto it = m_entries.find(id);
+				if (it != m_entries.end())
+					func(id, it->second.aggregate, it->second.bytes);
+			}
+		}
+
+	private:
+		struct Entry
+		{
+			std::shared_ptr<T> aggregate;
+			size_t bytes = 0;
+			Clock::time_point removedAt;
+		};
+		using EntryMap = HashMap<ID, Entry>;
+
+		void releasePayload(Entry& entry)
+		{
+			if (!entry.aggregate)
+				return;
+			entry.aggregate.reset();
+			m_bytes -= entry.bytes;
+			entry.bytes = 0;
+			++m_tombstones;
+		}
+		void eraseEntry(typename EntryMap::iterator it)
+		{
+			m_bytes -= it->second.bytes;
+			if (!it->second.aggregate)
+				--m_tombstones;
+			m_entries.erase(it);
+		}
+
+		DeletedCachePolicy m_policy;
+		EntryMap m_entries;
+		std::deque<ID> m_order;
+		size_t m_bytes = 0;
+		size_t m_tombstones = 0;
+		size_t m_evicted = 0;
+	};
+}
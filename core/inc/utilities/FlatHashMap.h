@@ -0,0 +1,733 @@
+#pragma once
+#include "DDD_base.h"
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define DDD_FLAT_HASH_MAP_SSE2 1
+#else
+	#define DDD_FLAT_HASH_MAP_SSE2 0
+#endif
+
+namespace DDD
+{
+	namespace FlatHashMapDetail
+	{
+		// Control byte of a slot.
+		// Full slots store the lower 7 bits of the hash (0..127), the special states are negative.
+		using ControlByte = int8_t;
+		static constexpr ControlByte kEmpty = -128;
+		static constexpr ControlByte kDeleted = -2;
+		static constexpr size_t kGroupWidth = 16;
+
+		/**
+		 * @brief Set of slot indices inside one group, one bit per slot.
+		 */
+		class BitMask
+		{
+		public:
+			explicit BitMask(uint32_t mask)
+				: m_mask(mask)
+			{}
+			explicit operator bool() const
+			{
+				return m_mask != 0;
+			}
+			size_t lowest() const
+			{
+				return static_cast<size_t>(std::countr_zero(m_mask));
+			}
+			void removeLowest()
+			{
+				m_mask &= m_mask - 1;
+			}
+		private:
+			uint32_t m_mask;
+		};
+
+		/**
+		 * @brief Compares the control bytes of kGroupWidth slots at once.
+		 */
+		class Group
+		{
+		public:
+			explicit Group(const ControlByte* ctrl)
+			{
+#if DDD_FLAT_HASH_MAP_SSE2 == 1
+				m_ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+#else
+				std::memcpy(m_ctrl, ctrl, kGroupWidth);
+#endif
+			}
+
+			BitMask match(ControlByte hash) const
+			{
+#if DDD_FLAT_HASH_MAP_SSE2 == 1
+				return BitMask(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(hash), m_ctrl))));
+#else
+				uint32_t mask = 0;
+				for (size_t i = 0; i < kGroupWidth; ++i)
+					mask |= static_cast<uint32_t>(m_ctrl[i] == hash) << i;
+				return BitMask(mask);
+#endif
+			}
+			BitMask matchEmpty() const
+			{
+				return match(kEmpty);
+			}
+			BitMask matchEmptyOrDeleted() const
+			{
+#if DDD_FLAT_HASH_MAP_SSE2 == 1
+				// Both special states are smaller than -1, full slots are >= 0
+				return BitMask(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), m_ctrl))));
+#else
+				uint32_t mask = 0;
+				for (size_t i = 0; i < kGroupWidth; ++i)
+					mask |= static_cast<uint32_t>(m_ctrl[i] < -1) << i;
+				return BitMask(mask);
+#endif
+			}
+		private:
+#if DDD_FLAT_HASH_MAP_SSE2 == 1
+			__m128i m_ctrl;
+#else
+			ControlByte m_ctrl[kGroupWidth];
+#endif
+		};
+
+		/**
+		 * @brief Mixes the bits of the user hash, std::hash of integers is the identity on most platforms
+		 */
+		inline uint64_t mixHash(uint64_t h)
+		{
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdull;
+			h ^= h >> 33;
+			return h;
+		}
+	}
+
+	/**
+	 * @brief
+	 * Open addressing hash map in the style of a swiss table.
+	 *
+	 * @details
+	 * The elements are stored in one flat array, next to an array of one control byte per slot.
+	 * A lookup compares the 7 bit hash fragment of 16 slots at once (SSE2, with a scalar fallback)
+	 * and only touches the elements whose fragment matches, so most lookups cost one or two cache misses.
+	 * The table grows at a load factor of 7/8.
+	 *
+	 * The interface is the subset of std::unordered_map that is used in this library.
+	 * Unlike std::unordered_map, inserting can move the elements:
+	 * iterators, pointers and references to elements are invalidated by insertions that grow the table.
+	 * Erasing does not move other elements.
+	 */
+	template <typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+	class FlatHashMap
+	{
+		using ControlByte = FlatHashMapDetail::ControlByte;
+		using Group = FlatHashMapDetail::Group;
+		static constexpr size_t kGroupWidth = FlatHashMapDetail::kGroupWidth;
+
+		template <bool IsConst>
+		class IteratorBase
+		{
+			friend class FlatHashMap;
+			template <bool> friend class IteratorBase;
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = std::pair<const K, V>;
+			using difference_type = std::ptrdiff_t;
+			using pointer = std::conditional_t<IsConst, const value_type*, value_type*>;
+			using reference = std::conditional_t<IsConst, const value_type&, value_type&>;
+
+			IteratorBase() = default;
+
+			// Allow iterator -> const_iterator
+			template <bool OtherConst, typename = std::enable_if_t<IsConst && !OtherConst>>
+			IteratorBase(const IteratorBase<OtherConst>& other)
+				: m_ctrl(other.m_ctrl)
+				, m_ctrlEnd(other.m_ctrlEnd)
+				, m_slot(other.m_slot)
+			{}
+
+			reference operator*() const
+			{
+				return *m_slot;
+			}
+			pointer operator->() const
+			{
+				return m_slot;
+			}
+			IteratorBase& operator++()
+			{
+				++m_ctrl;
+				++m_slot;
+				skipFreeSlots();
+				return *this;
+			}
+			IteratorBase operator++(int)
+			{
+				IteratorBase tmp = *this;
+				++(*this);
+				return tmp;
+			}
+			template <bool OtherConst>
+			bool operator==(const IteratorBase<OtherConst>& other) const
+			{
+				return m_ctrl == other.m_ctrl;
+			}
+			template <bool OtherConst>
+			bool operator!=(const IteratorBase<OtherConst>& other) const
+			{
+				return m_ctrl != other.m_ctrl;
+			}
+		private:
+			IteratorBase(const ControlByte* ctrl, const ControlByte* ctrlEnd, pointer slot)
+				: m_ctrl(ctrl)
+				, m_ctrlEnd(ctrlEnd)
+				, m_slot(slot)
+			{}
+			void skipFreeSlots()
+			{
+				while (m_ctrl != m_ctrlEnd && *m_ctrl < 0)
+				{
+					++m_ctrl;
+					++m_slot;
+				}
+			}
+
+			const ControlByte* m_ctrl = nullptr;
+			const ControlByte* m_ctrlEnd = nullptr;
+			pointer m_slot = nullptr;
+		};
+
+	public:
+		using key_type = K;
+		using mapped_type = V;
+		using value_type = std::pair<const K, V>;
+		using size_type = size_t;
+		using hasher = Hash;
+		using key_equal = KeyEqual;
+		using iterator = IteratorBase<false>;
+		using const_iterator = IteratorBase<true>;
+
+		FlatHashMap() = default;
+		FlatHashMap(const FlatHashMap& other)
+		{
+			reserve(other.size());
+			for (const auto& value : other)
+				insertUnique(value);
+		}
+		FlatHashMap(FlatHashMap&& other) noexcept
+		{
+			swap(other);
+		}
+		~FlatHashMap()
+		{
+			destroy();
+		}
+
+		FlatHashMap& operator=(const FlatHashMap& other)
+		{
+			if (this != &other)
+			{
+				FlatHashMap copy(other);
+				swap(copy);
+			}
+			return *this;
+		}
+		FlatHashMap& operator=(FlatHashMap&& other) noexcept
+		{
+			if (this != &other)
+			{
+				destroy();
+				swap(other);
+			}
+			return *this;
+		}
+
+		void swap(FlatHashMap& other) noexcept
+		{
+			std::swap(m_ctrl, other.m_ctrl);
+			std::swap(m_slots, other.m_slots);
+			std::swap(m_capacity, other.m_capacity);
+			std::swap(m_size, other.m_size);
+			std::swap(m_growthLeft, other.m_growthLeft);
+		}
+
+		[[nodiscard]] iterator begin()
+		{
+			iterator it(m_ctrl, m_ctrl + m_capacity, m_slots);
+			it.skipFreeSlots();
+			return it;
+		}
+		[[nodiscard]] iterator end()
+		{
+			return iterator(m_ctrl + m_capacity, m_ctrl + m_capacity, m_slots + m_capacity);
+		}
+		[[nodiscard]] const_iterator begin() const
+		{
+			const_iterator it(m_ctrl, m_ctrl + m_capacity, m_slots);
+			it.skipFreeSlots();
+			return it;
+		}
+		[[nodiscard]] const_iterator end() const
+		{
+			return const_iterator(m_ctrl + m_capacity, m_ctrl + m_capacity, m_slots + m_capacity);
+		}
+		[[nodiscard]] const_iterator cbegin() const
+		{
+			return begin();
+		}
+		[[nodiscard]] const_iterator cend() const
+		{
+			return end();
+		}
+
+		[[nodiscard]] size_t size() const
+		{
+			return m_size;
+		}
+		[[nodiscard]] bool empty() const
+		{
+			return m_size == 0;
+		}
+		[[nodiscard]] size_t capacity() const
+		{
+			return m_capacity;
+		}
+
+		void clear()
+		{
+			if (m_capacity == 0)
+				return;
+			if constexpr (!std::is_trivially_destructible_v<value_type>)
+			{
+				for (size_t i = 0; i < m_capacity; ++i)
+					if (m_ctrl[i] >= 0)
+						std::destroy_at(m_slots + i);
+			}
+			std::memset(m_ctrl, FlatHashMapDetail::kEmpty, m_capacity);
+			m_size = 0;
+			m_growthLeft = maxLoad(m_capacity);
+		}
+
+		/**
+		 * @brief Makes room for count elements without growing again
+		 */
+		void reserve(size_t count)
+		{
+			size_t capacity = kGroupWidth;
+			while (maxLoad(capacity) < count)
+				capacity *= 2;
+			if (capacity > m_capacity)
+				rehash(capacity);
+		}
+
+		[[nodiscard]] iterator find(const K& key)
+		{
+			const size_t index = findIndex(key);
+			return index == npos ? end() : iteratorAt(index);
+		}
+		[[nodiscard]] const_iterator find(const K& key) const
+		{
+			const size_t index = findIndex(key);
+			return index == npos ? end() : const_iterator(m_ctrl + index, m_ctrl + m_capacity, m_slots + index);
+		}
+		[[nodiscard]] bool contains(const K& key) const
+		{
+			return findIndex(key) != npos;
+		}
+		[[nodiscard]] size_t count(const K& key) const
+		{
+			return contains(key) ? 1 : 0;
+		}
+
+		std::pair<iterator, bool> insert(const value_type& value)
+		{
+			return try_emplace(value.first, value.second);
+		}
+		std::pair<iterator, bool> insert(value_type&& value)
+		{
+			return try_emplace(value.first, std::move(value.second));
+		}
+		template <typename... Args>
+		std::pair<iterator, bool> try_emplace(const K& key, Args&&... args)
+		{
+			const uint64_t hash = hashOf(key);
+			size_t index = findIndex(key, hash);
+			if (index != npos)
+				return { iteratorAt(index), false };
+			index = prepareInsert(hash);
+			std::construct_at(m_slots + index, std::piecewise_construct,
+				std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+			commitInsert(index, hash);
+			return { iteratorAt(index), true };
+		}
+		V& operator[](const K& key)
+		{
+			return try_emplace(key).first->second;
+		}
+
+		iterator erase(const_iterator it)
+		{
+			const size_t index = static_cast<size_t>(it.m_ctrl - m_ctrl);
+			eraseAt(index);
+			iterator next = iteratorAt(index);
+			++next;
+			return next;
+		}
+		iterator erase(iterator it)
+		{
+			return erase(const_iterator(it));
+		}
+		size_t erase(const K& key)
+		{
+			const size_t index = findIndex(key);
+			if (index == npos)
+				return 0;
+			eraseAt(index);
+			return 1;
+		}
+
+	private:
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		static size_t maxLoad(size_t capacity)
+		{
+			return capacity - capacity / 8;
+		}
+		static uint64_t hashOf(const K& key)
+		{
+			return FlatHashMapDetail::mixHash(static_cast<uint64_t>(Hash{}(key)));
+		}
+		static ControlByte h2(uint64_t hash)
+		{
+			return static_cast<ControlByte>(hash & 0x7F);
+		}
+
+		iterator iteratorAt(size_t index)
+		{
+			return iterator(m_ctrl + index, m_ctrl + m_capacity, m_slots + index);
+		}
+
+		/**
+		 * @brief Visits the groups in triangular order, which reaches every group once
+		 *        for a power of two amount of groups.
+		 */
+		class ProbeSequence
+		{
+		public:
+			ProbeSequence(uint64_t hash, size_t groupMask)
+				: m_group(static_cast<size_t>(hash >> 7) & groupMask)
+				, m_groupMask(groupMask)
+			{}
+			size_t offset() const
+			{
+				return m_group * kGroupWidth;
+			}
+			void next()
+			{
+				++m_step;
+				m_group = (m_group + m_step) & m_groupMask;
+			}
+		private:
+			size_t m_group;
+			size_t m_groupMask;
+			size_t m_step = 0;
+		};
+
+		size_t findIndex(const K& key) const
+		{
+			return findIndex(key, hashOf(key));
+		}
+		size_t findIndex(const K& key, uint64_t hash) const
+		{
+			if (m_capacity == 0)
+				return npos;
+			const ControlByte fragment = h2(hash);
+			ProbeSequence seq(hash, m_capacity / kGroupWidth - 1);
+			while (true)
+			{
+				const Group group(m_ctrl + seq.offset());
+				for (auto match = group.match(fragment); match; match.removeLowest())
+				{
+					const size_t index = seq.offset() + match.lowest();
+					if (KeyEqual{}(m_slots[index].first, key))
+						return index;
+				}
+				if (group.matchEmpty())
+					return npos;
+				seq.next();
+			}
+		}
+
+		size_t findFreeSlot(uint64_t hash) const
+		{
+			ProbeSequence seq(hash, m_capacity / kGroupWidth - 1);
+			while (true)
+			{
+				const auto mask = Group(m_ctrl + seq.offset()).matchEmptyOrDeleted();
+				if (mask)
+					return seq.offset() + mask.lowest();
+				seq.next();
+			}
+		}
+
+		/**
+		 * @brief Finds the slot for a new element, grows the table if needed
+		 */
+		size_t prepareInsert(uint64_t hash)
+		{
+			if (m_capacity == 0)
+				rehash(kGroupWidth);
+			size_t index = findFreeSlot(hash);
+			if (m_growthLeft == 0 && m_ctrl[index] == FlatHashMapDetail::kEmpty)
+			{
+				// Drop the tombstones if they take most of the space, grow otherwise
+				rehash(m_size * 2 < maxLoad(m_capacity) ? m_capacity : m_capacity * 2);
+				index = findFreeSlot(hash);
+			}
+			return index;
+		}
+
+		/**
+		 * @brief Marks the slot as used, after the element was constructed in it
+		 */
+		void commitInsert(size_t index, uint64_t hash)
+		{
+			if (m_ctrl[index] == FlatHashMapDetail::kEmpty)
+				--m_growthLeft;
+			m_ctrl[index] = h2(hash);
+			++m_size;
+		}
+
+		void eraseAt(size_t index)
+		{
+			std::destroy_at(m_slots + index);
+			--m_size;
+			// A lookup stops at a group with an empty slot. If the group of this slot already has one,
+			// no probe sequence continues past it and the slot can become empty again.
+			const size_t groupOffset = index - index % kGroupWidth;
+			if (Group(m_ctrl + groupOffset).matchEmpty())
+			{
+				m_ctrl[index] = FlatHashMapDetail::kEmpty;
+				++m_growthLeft;
+			}
+			else
+				m_ctrl[index] = FlatHashMapDetail::kDeleted;
+		}
+
+		void insertUnique(const value_type& value)
+		{
+			const uint64_t hash = hashOf(value.first);
+			const size_t index = prepareInsert(hash);
+			std::construct_at(m_slots + index, value);
+			commitInsert(index, hash);
+		}
+
+		void rehash(size_t newCapacity)
+		{
+			ControlByte* oldCtrl = m_ctrl;
+			value_type* oldSlots = m_slots;
+			const size_t oldCapacity = m_capacity;
+
+			m_ctrl = static_cast<ControlByte*>(::operator new(newCapacity));
+			m_slots = std::allocator<value_type>().allocate(newCapacity);
+			std::memset(m_ctrl, FlatHashMapDetail::kEmpty, newCapacity);
+			m_capacity = newCapacity;
+			m_growthLeft = maxLoad(newCapacity) - m_size;
+
+			for (size_t i = 0; i < oldCapacity; ++i)
+			{
+				if (oldCtrl[i] < 0)
+					continue;
+				const uint64_t hash = hashOf(oldSlots[i].first);
+				const size_t index = findFreeSlot(hash);
+				m_ctrl[index] = h2(hash);
+				std::construct_at(m_slots + index, std::move(oldSlots[i]));
+				std::destroy_at(oldSlots + i);
+			}
+			if (oldCapacity > 0)
+			{
+				::operator delete(oldCtrl);
+				std::allocator<value_type>().deallocate(oldSlots, oldCapacity);
+			}
+		}
+
+		void destroy()
+		{
+			if (m_capacity == 0)
+				return;
+			clear();
+			::operator delete(m_ctrl);
+			std::allocator<value_type>().deallocate(m_slots, m_capacity);
+			m_ctrl = nullptr;
+			m_slots = nullptr;
+			m_capacity = 0;
+			m_growthLeft = 0;
+		}
+
+		ControlByte* m_ctrl = nullptr;
+		value_type* m_slots = nullptr;
+		size_t m_capacity = 0;
+		size_t m_size = 0;
+		size_t m_growthLeft = 0;
+	};
+
+	/**
+	 * @brief
+	 * Hash set on top of FlatHashMap, the keys map to an empty value.
+	 * Iterating visits the keys, the same invalidation rules as for FlatHashMap apply.
+	 */
+	template <typename K, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+	class FlatHashSet
+	{
+		struct Empty {};
+		using Map = FlatHashMap<K, Empty, Hash, KeyEqual>;
+
+		class KeyIterator
+		{
+			friend class FlatHashSet;
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = K;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const K*;
+			using reference = const K&;
+
+			KeyIterator() = default;
+
+			reference operator*() const
+			{
+				return m_it->first;
+			}
+			pointer operator->() const
+			{
+				return &m_it->first;
+			}
+			KeyIterator& operator++()
+			{
+				++m_it;
+				return *this;
+			}
+			KeyIterator operator++(int)
+			{
+				KeyIterator tmp = *this;
+				++m_it;
+				return tmp;
+			}
+			bool operator==(const KeyIterator& other) const
+			{
+				return m_it == other.m_it;
+			}
+			bool operator!=(const KeyIterator& other) const
+			{
+				return m_it != other.m_it;
+			}
+		private:
+			explicit KeyIterator(typename Map::const_iterator it)
+				: m_it(it)
+			{}
+
+			typename Map::const_iterator m_it;
+		};
+
+	public:
+		using key_type = K;
+		using value_type = K;
+		using size_type = size_t;
+		using hasher = Hash;
+		using key_equal = KeyEqual;
+		using iterator = KeyIterator;
+		using const_iterator = KeyIterator;
+
+		void swap(FlatHashSet& other) noexcept
+		{
+			m_map.swap(other.m_map);
+		}
+
+		[[nodiscard]] const_iterator begin() const
+		{
+			return const_iterator(m_map.begin());
+		}
+		[[nodiscard]] const_iterator end() const
+		{
+			return const_iterator(m_map.end());
+		}
+
+		[[nodiscard]] size_t size() const
+		{
+			return m_map.size();
+		}
+		[[nodiscard]] bool empty() const
+		{
+			return m_map.empty();
+		}
+		void clear()
+		{
+			m_map.clear();
+		}
+		void reserve(size_t count)
+		{
+			m_map.reserve(count);
+		}
+
+		[[nodiscard]] const_iterator find(const K& key) const
+		{
+			return const_iterator(m_map.find(key));
+		}
+		[[nodiscard]] bool contains(const K& key) const
+		{
+			return m_map.contains(key);
+		}
+		[[nodiscard]] size_t count(const K& key) const
+		{
+			return m_map.count(key);
+		}
+
+		std::pair<iterator, bool> insert(const K& key)
+		{
+			auto result = m_map.try_emplace(key);
+			return { iterator(result.first), result.second };
+		}
+		iterator erase(const_iterator it)
+		{
+			return iterator(m_map.erase(it.m_it));
+		}
+		size_t erase(const K& key)
+		{
+			return m_map.erase(key);
+		}
+
+	private:
+		Map m_map;
+	};
+
+	/**
+	 * @brief
+	 * Hash map used for the aggregate and entity storage, and the matching hash set.
+	 * Selected by DDD_USE_FLAT_HASH_MAP, see DDD_global.h
+	 */
+#if DDD_USE_FLAT_HASH_MAP == 1
+	template <typename K, typename V>
+	using HashMap = FlatHashMap<K, V>;
+	template <typename K>
+	using HashSet = FlatHashSet<K>;
+#else
+	template <typename K, typename V>
+	using HashMap = std::unordered_map<K, V>;
+	template <typename K>
+	using HashSet = std::unordered_set<K>;
+#endif
+}
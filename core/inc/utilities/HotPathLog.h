@@ -0,0 +1,93 @@
+#pragma once
+#include "DDD_base.h"
+#include <functional>
+#include <string>
+
+namespace DDD
+{
+	enum class LogLevel
+	{
+		Trace = 0,
+		Debug = 1,
+		Info = 2,
+		Warning = 3,
+		Error = 4,
+		Off = 5
+	};
+
+	/**
+	 * @brief
+	 * Filter and dispatcher for the log messages of the repository and model hot paths,
+	 * like the lookup misses of Repository::get().
+	 *
+	 * @details
+	 * Use the DDD_HOT_LOG_... macros, they check the level before the message gets built:
+	 *  - Levels below DDD_HOT_PATH_LOG_LEVEL (see DDD_global.h) are removed at compile time.
+	 *  - Levels below the runtime level of setLevel() cost one relaxed atomic load.
+	 *  - Only enabled messages get formatted and written.
+	 *
+	 * With setAsync(true), enabled messages are written by a background thread,
+	 * so that the calling thread does not wait for the log sink.
+	 * Loggers that receive asynchronous messages must outlive them,
+	 * call flush() or setAsync(false) before destroying them.
+	 */
+	class DDD_API HotPathLog
+	{
+	public:
+		[[nodiscard]] static constexpr bool isCompiledIn(LogLevel level)
+		{
+			return static_cast<int>(level) >= DDD_HOT_PATH_LOG_LEVEL && level != LogLevel::Off;
+		}
+
+		static void setLevel(LogLevel level);
+		[[nodiscard]] static LogLevel getLevel();
+		[[nodiscard]] static bool isEnabled(LogLevel level);
+
+		static void setAsync(bool enabled);
+		[[nodiscard]] static bool isAsync();
+
+		/**
+		 * @brief Blocks until all asynchronous messages are written.
+		 */
+		static void flush();
+
+		/**
+		 * @brief Runs write now, or on the background thread in async mode.
+		 */
+		static void dispatch(std::function<void()> write);
+	};
+}
+
+#if LOGGER_LIBRARY_AVAILABLE == 1
+	// Writes message with logger->method(message), only if level is enabled.
+	// message is only evaluated if the message gets written.
+	#define DDD_HOT_LOG(level, logger, method, message) \
+		do { \
+			if constexpr (DDD::HotPathLog::isCompiledIn(level)) \
+			{ \
+				Log::LogObject* dddHotLogTarget = (logger); \
+				if (dddHotLogTarget && DDD::HotPathLog::isEnabled(level)) \
+					DDD::HotPathLog::dispatch([dddHotLogTarget, dddHotLogMessage = std::string(message)]() { dddHotLogTarget->method(dddHotLogMessage); }); \
+			} \
+		} while (false)
+
+	// Same for the library wide DDD::Logger
+	#define DDD_HOT_LIB_LOG(level, method, message) \
+		do { \
+			if constexpr (DDD::HotPathLog::isCompiledIn(level)) \
+			{ \
+				if (DDD::HotPathLog::isEnabled(level)) \
+					DDD::HotPathLog::dispatch([dddHotLogMessage = std::string(message)]() { DDD::Logger::method(dddHotLogMessage); }); \
+			} \
+		} while (false)
+#else
+	#define DDD_HOT_LOG(level, logger, method, message) do {} while (false)
+	#define DDD_HOT_LIB_LOG(level, method, message) do {} while (false)
+#endif
+
+#define DDD_HOT_LOG_DEBUG(logger, message) DDD_HOT_LOG(DDD::LogLevel::Debug, logger, debug, message)
+#define DDD_HOT_LOG_WARNING(logger, message) DDD_HOT_LOG(DDD::LogLevel::Warning, logger, warning, message)
+#define DDD_HOT_LOG_ERROR(logger, message) DDD_HOT_LOG(DDD::LogLevel::Error, logger, error, message)
+
+#define DDD_HOT_LIB_LOG_WARNING(message) DDD_HOT_LIB_LOG(DDD::LogLevel::Warning, logWarning, message)
+#define DDD_HOT_LIB_LOG_ERROR(message) DDD_HOT_LIB_LOG(DDD::LogLevel::Error, logError, message)
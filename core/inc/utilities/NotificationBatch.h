@@ -0,0 +1,154 @@
+#pragma once
+#include "DDD_base.h"
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <mutex>
+
+namespace DDD
+{
+	enum class AggregateChange
+	{
+		Added,
+		Replaced,
+		Removed
+	};
+
+	/**
+	 * @brief
+	 * Controls when buffered aggregate change notifications get delivered.
+	 *
+	 * @details
+	 * By default, notifications are only buffered inside an explicit batch.
+	 * With bufferContinuously enabled, all notifications are buffered and delivered
+	 * once one of the limits is reached or Model::flushNotifications() is called.
+	 * The limits are checked each time a change gets recorded, there is no background timer.
+	 * Call Model::flushNotifications() periodically to deliver the trailing changes.
+	 */
+	struct NotificationFlushPolicy
+	{
+		bool bufferContinuously = false;
+
+		// Flush as soon as this many changes are pending, 0 disables the limit
+		size_t maxPendingChanges = 0;
+
+		// Flush when the oldest pending change is older than this, 0 disables the limit
+		std::chrono::milliseconds maxDelay{ 0 };
+	};
+
+	/**
+	 * @brief
+	 * Collects the changes of one aggregate type until they get delivered.
+	 * Multiple changes of the same ID are coalesced:
+	 *   added + removed    -> nothing
+	 *   added + replaced   -> added
+	 *   removed + added    -> replaced
+	 *   replaced + removed -> removed
+	 */
+	class DDD_API AggregateChangeSet
+	{
+	public:
+		AggregateChangeSet() = default;
+
+		void record(AggregateChange change, ID id);
+
+		[[nodiscard]] bool empty() const
+		{
+			return m_changes.empty();
+		}
+
+		/**
+		 * @brief Moves the pending changes into the given lists, in the order they were first recorded.
+		 *        The change set is empty afterwards.
+		 */
+		void take(std::vector<ID>& added, std::vector<ID>& replaced, std::vector<ID>& removed);
+
+	private:
+		std::unordered_map<ID, AggregateChange> m_changes;
+		std::vector<ID> m_order;
+	};
+
+	/**
+	 * @brief
+	 * Shared state between the model and its aggregate containers that tells,
+	 * if notifications get buffered right now and when they have to be flushed.
+	 * All functions are thread safe, the change sets of the containers are guarded by the same lock.
+	 */
+	class DDD_API NotificationBatchState
+	{
+	public:
+		NotificationBatchState() = default;
+		NotificationBatchState(const NotificationBatchState&) = delete;
+		NotificationBatchState& operator=(const NotificationBatchState&) = delete;
+
+		void setPolicy(const NotificationFlushPolicy& policy);
+		[[nodiscard]] NotificationFlushPolicy getPolicy() const;
+
+		void begin();
+
+		/**
+		 * @return true if the outermost batch was closed
+		 */
+		bool end();
+
+		[[nodiscard]] bool isBuffering() const;
+
+		/**
+		 * @brief Records the change in the given change set if notifications get buffered right now.
+		 * @return false if the change has to be delivered immediately.
+		 */
+		bool tryRecord(AggregateChangeSet& changes, AggregateChange change, ID id);
+
+		/**
+		 * @brief Moves the pending changes out of the given change set.
+		 */
+		void take(AggregateChangeSet& changes, std::vector<ID>& added, std::vector<ID>& replaced, std::vector<ID>& removed);
+
+		[[nodiscard]] bool isFlushDue() const;
+		void onFlushed();
+
+	private:
+		bool isBufferingLocked() const
+		{
+			return m_depth > 0 || m_policy.bufferContinuously;
+		}
+
+		mutable std::mutex m_mutex;
+		NotificationFlushPolicy m_policy;
+		size_t m_depth = 0;
+		size_t m_pendingCount = 0;
+		std::chrono::steady_clock::time_point m_firstPending;
+	};
+
+	/**
+	 * @brief
+	 * RAII helper that collects all aggregate change notifications of the model
+	 * while it is alive and delivers one callback per aggregate type and change kind at the end.
+	 *
+	 * @code
+	 * {
+	 *     DDD::NotificationBatchScope batch(model);
+	 *     for (auto& agg : aggregates)
+	 *         model.addAggregate(agg);
+	 * } // aggregateAdded callback is called once per type here
+	 * @endcode
+	 */
+	template <typename MODEL>
+	class NotificationBatchScope
+	{
+	public:
+		explicit NotificationBatchScope(MODEL& model)
+			: m_model(model)
+		{
+			m_model.beginNotificationBatch();
+		}
+		NotificationBatchScope(const NotificationBatchScope&) = delete;
+		NotificationBatchScope& operator=(const NotificationBatchScope&) = delete;
+		~NotificationBatchScope()
+		{
+			m_model.endNotificationBatch();
+		}
+	private:
+		MODEL& m_model;
+	};
+}
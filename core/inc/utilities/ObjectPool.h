@@ -0,0 +1,170 @@
+#pragma once
+#include "DDD_base.h"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <typeindex>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+namespace DDD
+{
+	/**
+	 * @brief Allocation counters of a FixedBlockPool.
+	 */
+	struct ObjectPoolStats
+	{
+		// Heap allocations done by the pool, one per slab
+		size_t slabAllocations = 0;
+
+		// Blocks handed out by allocate()
+		size_t blockAllocations = 0;
+
+		// Blocks of blockAllocations that came from the free list
+		size_t reusedBlocks = 0;
+
+		// Blocks that are currently in use
+		size_t liveBlocks = 0;
+
+		// Bytes of all slabs
+		size_t reservedBytes = 0;
+	};
+
+	/**
+	 * @brief
+	 * Hands out memory blocks of one size from contiguous slabs.
+	 *
+	 * @details
+	 * Freed blocks go to a free list and get reused by the next allocate().
+	 * Slabs are kept until the end of the program, the pools are never destroyed,
+	 * so objects may be released during static destruction.
+	 * All functions are thread safe.
+	 */
+	class DDD_API FixedBlockPool
+	{
+	public:
+		FixedBlockPool(size_t blockSize, size_t alignment);
+		FixedBlockPool(const FixedBlockPool&) = delete;
+		FixedBlockPool& operator=(const FixedBlockPool&) = delete;
+		~FixedBlockPool();
+
+		[[nodiscard]] void* allocate();
+		void deallocate(void* block);
+
+		[[nodiscard]] size_t getBlockSize() const
+		{
+			return m_blockSize;
+		}
+		[[nodiscard]] ObjectPoolStats getStats() const;
+
+		/**
+		 * @brief
+		 * Gets the pool for blocks of the given size that belong to the type tag.
+		 * The pool gets created on first use.
+		 */
+		[[nodiscard]] static FixedBlockPool& getPool(std::type_index tag, size_t blockSize, size_t alignment);
+
+		/**
+		 * @brief Sums up the stats of all pools of the type tag.
+		 */
+		[[nodiscard]] static ObjectPoolStats getStats(std::type_index tag);
+
+	private:
+		struct FreeBlock
+		{
+			FreeBlock* next;
+		};
+
+		void allocateSlab();
+
+		const size_t m_blockSize;
+		const size_t m_alignment;
+		const size_t m_blocksPerSlab;
+		mutable std::mutex m_mutex;
+		FreeBlock* m_freeList = nullptr;
+		std::vector<void*> m_slabs;
+		ObjectPoolStats m_stats;
+	};
+
+	/**
+	 * @brief
+	 * Standard allocator that takes single objects from a FixedBlockPool of the type Tag.
+	 *
+	 * @details
+	 * Meant for std::allocate_shared: the rebound allocator puts the shared_ptr
+	 * control block and the object into one pooled block.
+	 * Arrays and other n != 1 requests use the global operator new.
+	 * @see makePooled
+	 */
+	template <typename T, typename Tag = T>
+	class PoolAllocator
+	{
+	public:
+		using value_type = T;
+
+		template <typename U>
+		struct rebind
+		{
+			using other = PoolAllocator<U, Tag>;
+		};
+
+		PoolAllocator() noexcept = default;
+		template <typename U>
+		PoolAllocator(const PoolAllocator<U, Tag>&) noexcept
+		{}
+
+		[[nodiscard]] T* allocate(size_t n)
+		{
+			if (n == 1)
+				return static_cast<T*>(getPool().allocate());
+			return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+		}
+		void deallocate(T* p, size_t n) noexcept
+		{
+			if (n == 1)
+				getPool().deallocate(p);
+			else
+				::operator delete(p, std::align_val_t(alignof(T)));
+		}
+
+		static FixedBlockPool& getPool()
+		{
+			static FixedBlockPool& pool = FixedBlockPool::getPool(typeid(Tag), sizeof(T), alignof(T));
+			return pool;
+		}
+
+		template <typename U>
+		bool operator==(const PoolAllocator<U, Tag>&) const noexcept
+		{
+			return true;
+		}
+		template <typename U>
+		bool operator!=(const PoolAllocator<U, Tag>&) const noexcept
+		{
+			return false;
+		}
+	};
+
+	/**
+	 * @brief
+	 * Like std::make_shared, but the memory comes from the pool of T
+	 * and gets reused once the last shared_ptr is released.
+	 * The object and its control block share one allocation.
+	 */
+	template <typename T, typename... Args>
+	[[nodiscard]] std::shared_ptr<T> makePooled(Args&&... args)
+	{
+		return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+	}
+
+	/**
+	 * @brief Gets the allocation counters of the objects created by makePooled<T>().
+	 */
+	template <typename T>
+	[[nodiscard]] ObjectPoolStats getPoolStats()
+	{
+		return FixedBlockPool::getStats(typeid(T));
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "DDD_base.h"
+#include <mutex>
+#include <shared_mutex>
+
+namespace DDD
+{
+	/**
+	 * @brief
+	 * Reader-writer mutex that can be switched off.
+	 *
+	 * @details
+	 * While disabled, all lock functions return immediately, so single threaded models
+	 * do not pay for the synchronization.
+	 * Meets the SharedMutex requirements and can be used with std::shared_lock and std::unique_lock.
+	 * setEnabled() must only be called while no other thread uses the owner of the mutex.
+	 */
+	class OptionalSharedMutex
+	{
+	public:
+		OptionalSharedMutex() = default;
+		OptionalSharedMutex(const OptionalSharedMutex&) = delete;
+		OptionalSharedMutex& operator=(const OptionalSharedMutex&) = delete;
+
+		void setEnabled(bool enabled)
+		{
+			m_enabled = enabled;
+		}
+		[[nodiscard]] bool isEnabled() const
+		{
+			return m_enabled;
+		}
+
+		void lock()
+		{
+			if (m_enabled)
+				m_mutex.lock();
+		}
+		bool try_lock()
+		{
+			return !m_enabled || m_mutex.try_lock();
+		}
+		void unlock()
+		{
+			if (m_enabled)
+				m_mutex.unlock();
+		}
+
+		void lock_shared()
+		{
+			if (m_enabled)
+				m_mutex.lock_shared();
+		}
+		bool try_lock_shared()
+		{
+			return !m_enabled || m_mutex.try_lock_shared();
+		}
+		void unlock_shared()
+		{
+			if (m_enabled)
+				m_mutex.unlock_shared();
+		}
+
+	private:
+		std::shared_mutex m_mutex;
+		bool m_enabled = false;
+	};
+
+	using SharedReadLock = std::shared_lock<OptionalSharedMutex>;
+	using ExclusiveWriteLock = std::unique_lock<OptionalSharedMutex>;
+}
@@ -0,0 +1,446 @@
+#pragma once
+#include "DDD_base.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace DDD
+{
+	/**
+	 * @brief
+	 * Map from ID to V, backed by an array of slots that is indexed by the ID itself.
+	 *
+	 * @details
+	 * The IDs of a UniqueIDDomain are handed out sequentially, so the live IDs of a repository
+	 * are nearly dense. This container splits the ID space into pages of 2^PageBits slots.
+	 * A page is allocated when the first ID of its range gets inserted and released when its last
+	 * element gets erased. A bitmap per page marks the used slots.
+	 *
+	 * - find/contains are O(1): one page table lookup and one bit test, no hashing, no probing.
+	 * - Iteration is in ascending ID order, lowerBound() allows cheap range scans by ID.
+	 * - An element costs sizeof(std::pair<const ID, V>) plus one bit,
+	 *   the page table costs one pointer per 2^PageBits IDs of the used ID span.
+	 *
+	 * Not suited for sparse IDs that span a very large range, use HashMap for those.
+	 * References to elements stay valid until the element is erased,
+	 * iterators get invalidated by insert and erase.
+	 * The interface is the subset of std::unordered_map that is used by Repository.
+	 */
+	template <typename V, unsigned int PageBits = 10>
+	class PagedIDMap
+	{
+	public:
+		using key_type = ID;
+		using mapped_type = V;
+		using value_type = std::pair<const ID, V>;
+		using size_type = size_t;
+
+		// IDs that only differ in the lower idBlockBits share a page
+		static constexpr unsigned int idBlockBits = PageBits;
+		static constexpr size_t pageSize = size_t(1) << PageBits;
+
+	private:
+		static constexpr size_t wordsPerPage = (pageSize + 63) / 64;
+
+		struct Page
+		{
+			// User provided, so make_unique does not zero the slot storage
+			Page() {}
+			Page(const Page&) = delete;
+			Page& operator=(const Page&) = delete;
+			~Page()
+			{
+				for (size_t word = 0; word < wordsPerPage; ++word)
+					for (uint64_t bits = used[word]; bits; bits &= bits - 1)
+						std::destroy_at(slot(word * 64 + static_cast<size_t>(std::countr_zero(bits))));
+			}
+
+			value_type* slot(size_t index)
+			{
+				return std::launder(reinterpret_cast<value_type*>(storage) + index);
+			}
+			const value_type* slot(size_t index) const
+			{
+				return std::launder(reinterpret_cast<const value_type*>(storage) + index);
+			}
+			bool isUsed(size_t index) const
+			{
+				return (used[index / 64] >> (index % 64)) & 1;
+			}
+
+			/**
+			 * @brief Gets the first used slot >= index, pageSize if there is none
+			 */
+			size_t nextUsed(size_t index) const
+			{
+				size_t word = index / 64;
+				if (word >= wordsPerPage)
+					return pageSize;
+				uint64_t bits = used[word] & (~uint64_t(0) << (index % 64));
+				while (true)
+				{
+					if (bits)
+						return word * 64 + static_cast<size_t>(std::countr_zero(bits));
+					if (++word == wordsPerPage)
+						return pageSize;
+					bits = used[word];
+				}
+			}
+
+			std::array<uint64_t, wordsPerPage> used{};
+			size_t count = 0;
+			alignas(value_type) unsigned char storage[pageSize * sizeof(value_type)];
+		};
+		using PageTable = std::vector<std::unique_ptr<Page>>;
+
+		template <bool IsConst>
+		class IteratorBase
+		{
+			friend class PagedIDMap;
+			template <bool> friend class IteratorBase;
+			using Map = std::conditional_t<IsConst, const PagedIDMap, PagedIDMap>;
+			using PagePointer = std::conditional_t<IsConst, const Page*, Page*>;
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = std::pair<const ID, V>;
+			using difference_type = std::ptrdiff_t;
+			using pointer = std::conditional_t<IsConst, const value_type*, value_type*>;
+			using reference = std::conditional_t<IsConst, const value_type&, value_type&>;
+
+			IteratorBase() = default;
+
+			// Allow iterator -> const_iterator
+			template <bool OtherConst, typename = std::enable_if_t<IsConst && !OtherConst>>
+			IteratorBase(const IteratorBase<OtherConst>& other)
+				: m_map(other.m_map)
+				, m_current(other.m_current)
+				, m_page(other.m_page)
+				, m_slot(other.m_slot)
+				, m_bits(other.m_bits)
+			{}
+
+			reference operator*() const
+			{
+				return *m_current->slot(m_slot);
+			}
+			pointer operator->() const
+			{
+				return m_current->slot(m_slot);
+			}
+			IteratorBase& operator++()
+			{
+				// Fast path, next used slot in the same bitmap word
+				m_bits &= m_bits - 1;
+				if (m_bits)
+				{
+					m_slot = (m_slot & ~size_t(63)) + static_cast<size_t>(std::countr_zero(m_bits));
+					return *this;
+				}
+				m_slot = (m_slot | 63) + 1;
+				settle();
+				return *this;
+			}
+			IteratorBase operator++(int)
+			{
+				IteratorBase tmp = *this;
+				++(*this);
+				return tmp;
+			}
+			template <bool OtherConst>
+			bool operator==(const IteratorBase<OtherConst>& other) const
+			{
+				return m_page == other.m_page && m_slot == other.m_slot;
+			}
+			template <bool OtherConst>
+			bool operator!=(const IteratorBase<OtherConst>& other) const
+			{
+				return !(*this == other);
+			}
+		private:
+			IteratorBase(Map* map, size_t page, size_t slot)
+				: m_map(map)
+				, m_current(page < map->m_pages.size() ? map->m_pages[page].get() : nullptr)
+				, m_page(page)
+				, m_slot(slot)
+			{
+				loadBits();
+			}
+
+			// Remaining used slots of the current bitmap word, starting at m_slot
+			void loadBits()
+			{
+				m_bits = m_current && m_slot < pageSize ? m_current->used[m_slot / 64] & (~uint64_t(0) << (m_slot % 64)) : 0;
+			}
+
+			// Moves forward to the next used slot, or to end()
+			void settle()
+			{
+				if (m_current)
+				{
+					m_slot = m_current->nextUsed(m_slot);
+					if (m_slot < pageSize)
+						return loadBits();
+					++m_page;
+				}
+				const size_t pageCount = m_map->m_pages.size();
+				for (; m_page < pageCount; ++m_page)
+				{
+					m_current = m_map->m_pages[m_page].get();
+					if (m_current)
+					{
+						m_slot = m_current->nextUsed(0);
+						if (m_slot < pageSize)
+							return loadBits();
+					}
+				}
+				m_current = nullptr;
+				m_slot = 0;
+				m_bits = 0;
+			}
+
+			Map* m_map = nullptr;
+			PagePointer m_current = nullptr;
+			size_t m_page = 0;
+			size_t m_slot = 0;
+			uint64_t m_bits = 0;
+		};
+
+	public:
+		using iterator = IteratorBase<false>;
+		using const_iterator = IteratorBase<true>;
+
+		PagedIDMap() = default;
+		PagedIDMap(const PagedIDMap& other)
+		{
+			for (const auto& value : other)
+				insert(value);
+		}
+		PagedIDMap(PagedIDMap&& other) noexcept
+		{
+			swap(other);
+		}
+		PagedIDMap& operator=(const PagedIDMap& other)
+		{
+			if (this != &other)
+			{
+				PagedIDMap copy(other);
+				swap(copy);
+			}
+			return *this;
+		}
+		PagedIDMap& operator=(PagedIDMap&& other) noexcept
+		{
+			if (this != &other)
+			{
+				clear();
+				swap(other);
+			}
+			return *this;
+		}
+
+		void swap(PagedIDMap& other) noexcept
+		{
+			std::swap(m_pages, other.m_pages);
+			std::swap(m_firstPage, other.m_firstPage);
+			std::swap(m_size, other.m_size);
+		}
+
+		[[nodiscard]] iterator begin()
+		{
+			iterator it(this, 0, 0);
+			it.settle();
+			return it;
+		}
+		[[nodiscard]] iterator end()
+		{
+			return iterator(this, m_pages.size(), 0);
+		}
+		[[nodiscard]] const_iterator begin() const
+		{
+			const_iterator it(this, 0, 0);
+			it.settle();
+			return it;
+		}
+		[[nodiscard]] const_iterator end() const
+		{
+			return const_iterator(this, m_pages.size(), 0);
+		}
+		[[nodiscard]] const_iterator cbegin() const
+		{
+			return begin();
+		}
+		[[nodiscard]] const_iterator cend() const
+		{
+			return end();
+		}
+
+		[[nodiscard]] size_t size() const
+		{
+			return m_size;
+		}
+		[[nodiscard]] bool empty() const
+		{
+			return m_size == 0;
+		}
+		void clear()
+		{
+			m_pages.clear();
+			m_firstPage = 0;
+			m_size = 0;
+		}
+
+		[[nodiscard]] iterator find(ID id)
+		{
+			size_t page, slot;
+			return locate(id, page, slot) ? iterator(this, page, slot) : end();
+		}
+		[[nodiscard]] const_iterator find(ID id) const
+		{
+			size_t page, slot;
+			return locate(id, page, slot) ? const_iterator(this, page, slot) : end();
+		}
+		[[nodiscard]] bool contains(ID id) const
+		{
+			size_t page, slot;
+			return locate(id, page, slot);
+		}
+		[[nodiscard]] size_t count(ID id) const
+		{
+			return contains(id) ? 1 : 0;
+		}
+
+		/**
+		 * @brief Gets the element with the smallest ID >= id
+		 */
+		[[nodiscard]] iterator lowerBound(ID id)
+		{
+			size_t page, slot;
+			locateLowerBound(id, page, slot);
+			iterator it(this, page, slot);
+			it.settle();
+			return it;
+		}
+		[[nodiscard]] const_iterator lowerBound(ID id) const
+		{
+			size_t page, slot;
+			locateLowerBound(id, page, slot);
+			const_iterator it(this, page, slot);
+			it.settle();
+			return it;
+		}
+
+		std::pair<iterator, bool> insert(const value_type& value)
+		{
+			return try_emplace(value.first, value.second);
+		}
+		std::pair<iterator, bool> insert(value_type&& value)
+		{
+			return try_emplace(value.first, std::move(value.second));
+		}
+		template <typename... Args>
+		std::pair<iterator, bool> try_emplace(ID id, Args&&... args)
+		{
+			const size_t page = preparePage(id >> PageBits);
+			const size_t slot = static_cast<size_t>(id & (pageSize - 1));
+			Page& p = *m_pages[page];
+			if (p.isUsed(slot))
+				return { iterator(this, page, slot), false };
+			std::construct_at(p.slot(slot), std::piecewise_construct,
+				std::forward_as_tuple(id), std::forward_as_tuple(std::forward<Args>(args)...));
+			p.used[slot / 64] |= uint64_t(1) << (slot % 64);
+			++p.count;
+			++m_size;
+			return { iterator(this, page, slot), true };
+		}
+		V& operator[](ID id)
+		{
+			return try_emplace(id).first->second;
+		}
+
+		iterator erase(const_iterator it)
+		{
+			iterator next(this, it.m_page, it.m_slot + 1);
+			Page& p = *m_pages[it.m_page];
+			std::destroy_at(p.slot(it.m_slot));
+			p.used[it.m_slot / 64] &= ~(uint64_t(1) << (it.m_slot % 64));
+			--m_size;
+			if (--p.count == 0)
+			{
+				// Release the page, the page table keeps its range
+				m_pages[it.m_page].reset();
+				next = iterator(this, it.m_page + 1, 0);
+			}
+			next.settle();
+			return next;
+		}
+		iterator erase(iterator it)
+		{
+			return erase(const_iterator(it));
+		}
+		size_t erase(ID id)
+		{
+			size_t page, slot;
+			if (!locate(id, page, slot))
+				return 0;
+			erase(const_iterator(this, page, slot));
+			return 1;
+		}
+
+	private:
+		bool locate(ID id, size_t& page, size_t& slot) const
+		{
+			page = static_cast<size_t>(id >> PageBits) - m_firstPage;
+			slot = static_cast<size_t>(id & (pageSize - 1));
+			// Unsigned wrap around covers IDs below the first page
+			return page < m_pages.size() && m_pages[page] && m_pages[page]->isUsed(slot);
+		}
+
+		// Gets the slot where the search for the smallest ID >= id starts
+		void locateLowerBound(ID id, size_t& page, size_t& slot) const
+		{
+			const size_t absolutePage = static_cast<size_t>(id >> PageBits);
+			if (absolutePage < m_firstPage)
+				page = 0, slot = 0;
+			else if (absolutePage - m_firstPage >= m_pages.size())
+				page = m_pages.size(), slot = 0;
+			else
+				page = absolutePage - m_firstPage, slot = static_cast<size_t>(id & (pageSize - 1));
+		}
+
+		/**
+		 * @brief Makes sure the page table covers the absolute page and the page is allocated
+		 * @return index of the page in m_pages
+		 */
+		size_t preparePage(size_t absolutePage)
+		{
+			if (m_pages.empty())
+				m_firstPage = absolutePage;
+			else if (absolutePage < m_firstPage)
+			{
+				// Grow the page table to the front
+				const size_t shift = m_firstPage - absolutePage;
+				PageTable pages(shift + m_pages.size());
+				std::move(m_pages.begin(), m_pages.end(), pages.begin() + shift);
+				m_pages = std::move(pages);
+				m_firstPage = absolutePage;
+			}
+			const size_t page = absolutePage - m_firstPage;
+			if (page >= m_pages.size())
+				m_pages.resize(page + 1);
+			if (!m_pages[page])
+				m_pages[page] = std::make_unique<Page>();
+			return page;
+		}
+
+		PageTable m_pages;
+		size_t m_firstPage = 0;
+		size_t m_size = 0;
+	};
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "DDD_base.h"
+#include <bit>
+#include <cstdint>
+
+namespace DDD
+{
+	/**
+	 * @brief
+	 * Helpers to partition data by ID into a power of two amount of shards.
+	 * IDs are mostly sequential, they are mixed with a multiplicative hash first,
+	 * so that neighbouring IDs and strided IDs spread evenly.
+	 */
+	namespace Sharding
+	{
+		static constexpr size_t maxShardCount = 1024;
+
+		/**
+		 * @brief Rounds the requested shard count up to the next power of two in [1, maxShardCount]
+		 */
+		[[nodiscard]] inline constexpr size_t normalizeShardCount(size_t count)
+		{
+			if (count <= 1)
+				return 1;
+			if (count >= maxShardCount)
+				return maxShardCount;
+			return std::bit_ceil(count);
+		}
+
+		/**
+		 * @param shardBits log2 of the shard count
+		 */
+		[[nodiscard]] inline constexpr size_t getShardIndex(ID id, unsigned int shardBits)
+		{
+			if (shardBits == 0)
+				return 0;
+			return static_cast<size_t>((static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ull) >> (64 - shardBits));
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "DDD_base.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class QSharedMemory;
+
+namespace DDD
+{
+	/**
+	 * @brief
+	 * State of the atomic ID allocation of a UniqueIDDomain.
+	 * current is the last ID that was handed out,
+	 * reservedEnd is the first ID behind the range that is reserved in the persistence.
+	 * skipCount counts the reservations that had to skip IDs reserved by someone else,
+	 * IDs that were fetched before one of them may belong to someone else and are not handed out.
+	 */
+	struct AtomicIDCounter
+	{
+		std::atomic<ID> current{ 0 };
+		std::atomic<ID> reservedEnd{ 0 };
+		std::atomic<uint64_t> skipCount{ 0 };
+	};
+	static_assert(std::atomic<ID>::is_always_lock_free, "The ID counter must be lock free to be placed in shared memory");
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "The ID counter must be lock free to be placed in shared memory");
+
+	/**
+	 * @brief
+	 * AtomicIDCounter in a named shared memory segment, so that multiple processes
+	 * on the same host can hand out IDs of the same ID space.
+	 *
+	 * @details
+	 * The first process that attaches creates the segment, the OS fills it with zeros.
+	 * The segment lives as long as at least one process is attached to it,
+	 * a later process has to seed the counter again, see UniqueIDDomain::enableAtomicAllocation().
+	 */
+	class DDD_API SharedIDCounter
+	{
+	public:
+		SharedIDCounter();
+		SharedIDCounter(const SharedIDCounter&) = delete;
+		SharedIDCounter& operator=(const SharedIDCounter&) = delete;
+		~SharedIDCounter();
+
+		/**
+		 * @brief Creates or attaches the segment with the given key.
+		 * @return false if the segment could not be created or attached.
+		 */
+		bool attach(const std::string& key);
+		void detach();
+
+		[[nodiscard]] bool isAttached() const
+		{
+			return m_counter != nullptr;
+		}
+		[[nodiscard]] const std::string& getKey() const
+		{
+			return m_key;
+		}
+
+		/**
+		 * @return the counter in the segment or nullptr if not attached.
+		 */
+		[[nodiscard]] AtomicIDCounter* getCounter() const
+		{
+			return m_counter;
+		}
+
+	private:
+		std::unique_ptr<QSharedMemory> m_memory;
+		AtomicIDCounter* m_counter = nullptr;
+		std::string m_key;
+	};
+}
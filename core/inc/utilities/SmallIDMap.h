@@ -0,0 +1,189 @@
+#pragma once
+#include "DDD_base.h"
+#include "utilities/FlatHashMap.h"
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace DDD
+{
+	/**
+	 * @brief
+	 * Map from ID to V for containers that hold a handful of elements with small IDs,
+	 * like the child entities of an aggregate.
+	 *
+	 * @details
+	 * IDs below DirectSlots are stored inline in an array indexed by the ID,
+	 * a bitmask marks the used slots. Larger IDs go to a HashMap that is only
+	 * allocated when the first of them gets inserted.
+	 * Lookups of small IDs are one bit test, iteration does not allocate.
+	 * Iteration visits the inline slots in ascending ID order, then the overflow map.
+	 */
+	template <typename V, size_t DirectSlots = 8>
+	class SmallIDMap
+	{
+		static_assert(DirectSlots > 0 && DirectSlots <= 64, "The used slots are tracked in a 64 bit mask");
+	public:
+		SmallIDMap() = default;
+		SmallIDMap(const SmallIDMap& other)
+			: m_direct(other.m_direct)
+			, m_used(other.m_used)
+			, m_overflow(other.m_overflow ? std::make_unique<OverflowMap>(*other.m_overflow) : nullptr)
+		{}
+		SmallIDMap(SmallIDMap&& other) noexcept
+			: m_direct(std::move(other.m_direct))
+			, m_used(other.m_used)
+			, m_overflow(std::move(other.m_overflow))
+		{
+			other.clear();
+		}
+		SmallIDMap& operator=(const SmallIDMap& other)
+		{
+			if (this != &other)
+			{
+				SmallIDMap copy(other);
+				*this = std::move(copy);
+			}
+			return *this;
+		}
+		SmallIDMap& operator=(SmallIDMap&& other) noexcept
+		{
+			if (this != &other)
+			{
+				m_direct = std::move(other.m_direct);
+				m_used = other.m_used;
+				m_overflow = std::move(other.m_overflow);
+				other.clear();
+			}
+			return *this;
+		}
+
+		[[nodiscard]] size_t size() const
+		{
+			return static_cast<size_t>(std::popcount(m_used)) + (m_overflow ? m_overflow->size() : 0);
+		}
+		[[nodiscard]] bool empty() const
+		{
+			return m_used == 0 && (!m_overflow || m_overflow->empty());
+		}
+		[[nodiscard]] bool contains(ID id) const
+		{
+			if (id < DirectSlots)
+				return (m_used >> id) & 1;
+			return m_overflow && m_overflow->contains(id);
+		}
+
+		/**
+		 * @return pointer to the value, nullptr if the ID is not contained
+		 */
+		[[nodiscard]] V* find(ID id)
+		{
+			return const_cast<V*>(std::as_const(*this).find(id));
+		}
+		[[nodiscard]] const V* find(ID id) const
+		{
+			if (id < DirectSlots)
+				return ((m_used >> id) & 1) ? &m_direct[id] : nullptr;
+			if (!m_overflow)
+				return nullptr;
+			auto it = m_overflow->find(id);
+			return it != m_overflow->end() ? &it->second : nullptr;
+		}
+
+		/**
+		 * @return false if the ID is already contained
+		 */
+		bool insert(ID id, const V& value)
+		{
+			if (id < DirectSlots)
+			{
+				if ((m_used >> id) & 1)
+					return false;
+				m_direct[id] = value;
+				m_used |= uint64_t(1) << id;
+				return true;
+			}
+			if (!m_overflow)
+				m_overflow = std::make_unique<OverflowMap>();
+			return m_overflow->insert({ id, value }).second;
+		}
+
+		/**
+		 * @return false if the ID is not contained
+		 */
+		bool erase(ID id)
+		{
+			if (id < DirectSlots)
+			{
+				if (!((m_used >> id) & 1))
+					return false;
+				m_direct[id] = V();
+				m_used &= ~(uint64_t(1) << id);
+				return true;
+			}
+			return m_overflow && m_overflow->erase(id) > 0;
+		}
+		void clear()
+		{
+			for (uint64_t bits = m_used; bits; bits &= bits - 1)
+				m_direct[std::countr_zero(bits)] = V();
+			m_used = 0;
+			m_overflow.reset();
+		}
+
+		/**
+		 * @brief
+		 * Calls func(ID, V&) for each element.
+		 * If func returns bool, returning false stops the iteration.
+		 * The map must not be modified from inside func.
+		 * @return false if func stopped the iteration
+		 */
+		template <typename F> bool forEach(F&& func)
+		{
+			return forEachImpl(*this, func);
+		}
+		template <typename F> bool forEach(F&& func) const
+		{
+			return forEachImpl(*this, func);
+		}
+
+	private:
+		using OverflowMap = HashMap<ID, V>;
+
+		template <typename Self, typename F>
+		static bool forEachImpl(Self& self, F& func)
+		{
+			for (uint64_t bits = self.m_used; bits; bits &= bits - 1)
+			{
+				const ID id = static_cast<ID>(std::countr_zero(bits));
+				if (!invoke(func, id, self.m_direct[id]))
+					return false;
+			}
+			if (self.m_overflow)
+			{
+				for (auto& pair : *self.m_overflow)
+					if (!invoke(func, pair.first, pair.second))
+						return false;
+			}
+			return true;
+		}
+		template <typename F, typename T>
+		static bool invoke(F& func, ID id, T& value)
+		{
+			if constexpr (std::is_same_v<std::invoke_result_t<F&, ID, T&>, bool>)
+				return func(id, value);
+			else
+			{
+				func(id, value);
+				return true;
+			}
+		}
+
+		std::array<V, DirectSlots> m_direct{};
+		uint64_t m_used = 0;
+		std::unique_ptr<OverflowMap> m_overflow;
+	};
+}
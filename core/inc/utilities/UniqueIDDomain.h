@@ -2,23 +2,73 @@
 
 #include "DDD_base.h"
 #include "utilities/IID.h"
+#include "utilities/OptionalSharedMutex.h"
+#include "utilities/SharedIDCounter.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace DDD
 {
+	/**
+	 * @brief
+	 * Controls how many IDs a UniqueIDDomain reserves at once.
+	 *
+	 * @details
+	 * The domain reserves ID blocks through its reserve function and hands out the IDs
+	 * of the current block locally. A block that gets used up within sustainedLoadWindow
+	 * doubles the size of the next block, up to maxBlockSize. A block that lasted longer
+	 * halves it again, down to minBlockSize.
+	 * Use minBlockSize = maxBlockSize = 1 to reserve each ID on its own.
+	 */
+	struct IDLeasePolicy
+	{
+		ID minBlockSize = 16;
+		ID maxBlockSize = 65536;
+		std::chrono::milliseconds sustainedLoadWindow{ 1000 };
+	};
+
 	class UniqueIDDomain
 	{
 	public:
 		// reserveFunc: Function that takes the base ID and the amount of IDs to reserve, and returns true if the IDs were successfully reserved
-		UniqueIDDomain(const std::function<bool(ID, ID)> &reserveFunc)
+		// releaseFunc: Optional function that gets the unused IDs of the current block back, see releaseLease()
+		// highestReservedFunc: Optional function that reads the highest ID reserved by anyone, INVALID_ID if it is unknown.
+		//                      A failed reservation is tried again behind it
+		UniqueIDDomain(const std::function<bool(ID, ID)> &reserveFunc,
+			const std::function<bool(ID, ID)>& releaseFunc = nullptr,
+			const std::function<ID()>& highestReservedFunc = nullptr)
 			: m_tryReserveNewID(reserveFunc)
+			, m_tryReleaseIDs(releaseFunc)
+			, m_getHighestReservedID(highestReservedFunc)
+			, m_blockSize(m_leasePolicy.minBlockSize)
 		{
 
 		}
 		UniqueIDDomain(const UniqueIDDomain& other) = delete;
 		UniqueIDDomain(UniqueIDDomain&& other) noexcept
 			: m_currentID(other.m_currentID)
+			, m_leaseEnd(other.m_leaseEnd)
+			, m_tryReserveNewID(std::move(other.m_tryReserveNewID))
+			, m_tryReleaseIDs(std::move(other.m_tryReleaseIDs))
+			, m_getHighestReservedID(std::move(other.m_getHighestReservedID))
+			, m_leasePolicy(other.m_leasePolicy)
+			, m_blockSize(other.m_blockSize)
+			, m_leaseTime(other.m_leaseTime)
+			, m_reservationCount(other.m_reservationCount.load())
+			, m_counter(other.m_counter)
+			, m_localCounter(std::move(other.m_localCounter))
+			, m_sharedCounter(std::move(other.m_sharedCounter))
 		{
 			other.m_currentID = 0;
+			other.m_leaseEnd = 0;
+			other.m_counter = nullptr;
+			m_mutex.setEnabled(other.m_mutex.isEnabled());
 		}
 
 		~UniqueIDDomain() = default;
@@ -29,51 +79,195 @@ namespace DDD
 			if (this != &other)
 			{
 				m_currentID = other.m_currentID;
+				m_leaseEnd = other.m_leaseEnd;
+				m_tryReserveNewID = std::move(other.m_tryReserveNewID);
+				m_tryReleaseIDs = std::move(other.m_tryReleaseIDs);
+				m_getHighestReservedID = std::move(other.m_getHighestReservedID);
+				m_leasePolicy = other.m_leasePolicy;
+				m_blockSize = other.m_blockSize;
+				m_leaseTime = other.m_leaseTime;
+				m_reservationCount = other.m_reservationCount.load();
+				m_counter = other.m_counter;
+				m_localCounter = std::move(other.m_localCounter);
+				m_sharedCounter = std::move(other.m_sharedCounter);
 				other.m_currentID = 0;
+				other.m_leaseEnd = 0;
+				other.m_counter = nullptr;
 			}
 			return *this;
 		}
 
-		[[nodiscard]] ID getNextID()
+		/**
+		 * @brief
+		 * Serializes the ID generation, so that multiple threads can request IDs from the same domain.
+		 * Must be called before the domain is shared between threads.
+		 * Not needed for getNextID() in the atomic allocation mode.
+		 */
+		void setThreadSafe(bool enabled)
+		{
+			m_mutex.setEnabled(enabled);
+		}
+
+		/**
+		 * @brief
+		 * Switches to the atomic allocation mode.
+		 *
+		 * @details
+		 * The IDs are taken from an atomic counter, getNextID() is lock free
+		 * and can be called from any thread, also without setThreadSafe().
+		 * The reserve function still gets called once per block, see IDLeasePolicy,
+		 * only the thread that crosses the end of the reserved range waits for it.
+		 *
+		 * With a sharedKey, the counter is placed in a shared memory segment with that name,
+		 * all processes on the host that use the same key hand out IDs of one ID space
+		 * and reserve their blocks together. Without a key, the counter is local to this domain.
+		 *
+		 * The unused IDs of the current lease are given back first and the counter
+		 * continues behind the current ID, or behind the shared counter if it is further.
+		 * Must be called while no other thread uses the domain.
+		 * @return false if the shared memory segment could not be attached,
+		 *         the domain stays in its previous mode.
+		 */
+		bool enableAtomicAllocation(const std::string& sharedKey = std::string())
 		{
-			ID nextID = ++m_currentID;
-			size_t timeoutCounter = 0;
-			while (!m_tryReserveNewID(nextID, 1))
+			ExclusiveWriteLock lock(m_mutex);
+			std::unique_ptr<AtomicIDCounter> localCounter;
+			std::unique_ptr<SharedIDCounter> sharedCounter;
+			AtomicIDCounter* counter = nullptr;
+			if (sharedKey.empty())
 			{
-				++nextID;
-				if (timeoutCounter++ > 100)
-				{
-					m_currentID = nextID;
-					return nextID; // give up after 100 tries and hope that the new id will not collide
-				}
+				localCounter = std::make_unique<AtomicIDCounter>();
+				counter = localCounter.get();
 			}
-			return nextID;
+			else
+			{
+				sharedCounter = std::make_unique<SharedIDCounter>();
+				if (!sharedCounter->attach(sharedKey))
+					return false;
+				counter = sharedCounter->getCounter();
+			}
+			disableAtomicAllocationLocked();
+			releaseLeaseLocked();
+
+			// IDs up to the current ID are used, treat them as reserved
+			storeMax(counter->current, m_currentID);
+			storeMax(counter->reservedEnd, m_currentID + 1);
+			m_counter = counter;
+			m_localCounter = std::move(localCounter);
+			m_sharedCounter = std::move(sharedCounter);
+			return true;
 		}
-		[[nodiscard]] ID getNextID(ID amount)
+
+		/**
+		 * @brief
+		 * Switches back to the leased allocation mode, the current ID is taken over from the counter.
+		 * The reserved IDs of a local counter continue as current lease.
+		 * Must be called while no other thread uses the domain.
+		 */
+		void disableAtomicAllocation()
+		{
+			ExclusiveWriteLock lock(m_mutex);
+			disableAtomicAllocationLocked();
+		}
+		[[nodiscard]] bool isAtomicAllocationEnabled() const
+		{
+			return m_counter != nullptr;
+		}
+		[[nodiscard]] bool isSharedAllocationEnabled() const
+		{
+			return m_sharedCounter != nullptr;
+		}
+
+		void setLeasePolicy(const IDLeasePolicy& policy)
+		{
+			ExclusiveWriteLock lock(m_mutex);
+			std::lock_guard<std::mutex> reserveLock(m_reserveMutex);
+			m_leasePolicy = policy;
+			if (m_leasePolicy.minBlockSize == 0)
+				m_leasePolicy.minBlockSize = 1;
+			if (m_leasePolicy.maxBlockSize < m_leasePolicy.minBlockSize)
+				m_leasePolicy.maxBlockSize = m_leasePolicy.minBlockSize;
+			m_blockSize = m_leasePolicy.minBlockSize;
+		}
+		[[nodiscard]] IDLeasePolicy getLeasePolicy() const
 		{
-			ID nextID = ++m_currentID;
-			size_t timeoutCounter = 0;
-			while (!m_tryReserveNewID(nextID, amount))
+			SharedReadLock lock(m_mutex);
+			return m_leasePolicy;
+		}
+
+		/**
+		 * @return the number of successful calls of the reserve function.
+		 */
+		[[nodiscard]] size_t getReservationCount() const
+		{
+			return m_reservationCount.load(std::memory_order_relaxed);
+		}
+
+		/**
+		 * @return the number of reserved IDs that were not handed out yet.
+		 */
+		[[nodiscard]] ID getLeasedIDCount() const
+		{
+			SharedReadLock lock(m_mutex);
+			if (m_counter)
 			{
-				++nextID;
-				if (timeoutCounter++ > 100)
-				{
-					return nextID; // give up after 100 tries and hope that the new id will not collide
-				}
+				const ID current = m_counter->current.load(std::memory_order_relaxed);
+				const ID reservedEnd = m_counter->reservedEnd.load(std::memory_order_relaxed);
+				return reservedEnd > current + 1 ? reservedEnd - current - 1 : 0;
 			}
-			return nextID;
+			return m_leaseEnd > m_currentID + 1 ? m_leaseEnd - m_currentID - 1 : 0;
+		}
+
+		[[nodiscard]] ID getNextID()
+		{
+			return getNextID(1);
+		}
+
+		/**
+		 * @brief Hands out amount consecutive IDs.
+		 * @return the first of the IDs, INVALID_ID if the IDs could not be reserved.
+		 */
+		[[nodiscard]] ID getNextID(ID amount)
+		{
+			if (amount == 0)
+				amount = 1;
+			if (m_counter)
+				return getNextAtomicID(amount);
+			ExclusiveWriteLock lock(m_mutex);
+			const ID firstID = m_currentID + 1;
+			if (firstID + amount > m_leaseEnd)
+				return leaseBlock(firstID, amount);
+			m_currentID += amount;
+			return firstID;
 		}
 		[[nodiscard]] ID getCurrentID() const
 		{
+			if (m_counter)
+				return m_counter->current.load(std::memory_order_relaxed);
+			SharedReadLock lock(m_mutex);
 			return m_currentID;
 		}
 		void setCurrentID(ID id)
 		{
+			if (m_counter)
+			{
+				m_counter->current.store(id, std::memory_order_relaxed);
+				return;
+			}
+			ExclusiveWriteLock lock(m_mutex);
 			m_currentID = id;
 		}
 
 		void setCurrentIDIFLarger(ID id)
 		{
+			if (m_counter)
+			{
+				// The IDs up to id are used, no one has to reserve them again
+				storeMax(m_counter->current, id);
+				storeMax(m_counter->reservedEnd, id + 1);
+				return;
+			}
+			ExclusiveWriteLock lock(m_mutex);
 			if (id > m_currentID)
 			{
 				m_currentID = id;
@@ -87,6 +281,8 @@ namespace DDD
 		void setUniqueIDFor(const std::vector<std::shared_ptr<IID>>& objs)
 		{
 			ID nextID = getNextID(objs.size());
+			if (nextID == INVALID_ID)
+				return;
 			ID currentID = nextID;
 			for (auto& obj : objs)
 			{
@@ -96,8 +292,31 @@ namespace DDD
 				++currentID;
 			}
 		}
+		/**
+		 * @brief
+		 * Sets the ID of an object that gets restored from storage, without checking it against the domain.
+		 * Call setCurrentIDIFLarger() with the highest restored ID afterwards.
+		 */
+		static void restoreID(IID& obj, ID id)
+		{
+			obj.m_id = id;
+		}
 		bool tryAssignCustomID(std::shared_ptr<IID> obj, ID id)
 		{
+			if (m_counter)
+			{
+				ID current = m_counter->current.load(std::memory_order_relaxed);
+				while (id > current)
+				{
+					if (m_counter->current.compare_exchange_weak(current, id, std::memory_order_relaxed))
+					{
+						obj->m_id = id;
+						return true;
+					}
+				}
+				return false;
+			}
+			ExclusiveWriteLock lock(m_mutex);
 			if (id > m_currentID)
 			{
 				m_currentID = id;
@@ -106,16 +325,234 @@ namespace DDD
 			}
 			return false;
 		}
-		bool canAssignCustomID(ID id) const 
+		bool canAssignCustomID(ID id) const
 		{
-			return id > m_currentID;
+			return id > getCurrentID();
 		}
+
+		/**
+		 * @brief
+		 * Gives the reserved but unused IDs of the current block back through the release function,
+		 * call it on shutdown. IDs that were handed out stay reserved.
+		 * In the atomic allocation mode, only the IDs of a local counter are given back,
+		 * the reserved IDs of a shared counter may still be used by other processes.
+		 * @return false if the release function failed.
+		 */
+		bool releaseLease()
+		{
+			ExclusiveWriteLock lock(m_mutex);
+			if (m_counter)
+			{
+				if (m_sharedCounter)
+					return true;
+				// Only valid while no other thread allocates IDs
+				const ID firstUnused = m_counter->current.load(std::memory_order_acquire) + 1;
+				const ID reservedEnd = m_counter->reservedEnd.load(std::memory_order_acquire);
+				if (reservedEnd <= firstUnused)
+					return true;
+				m_counter->reservedEnd.store(firstUnused, std::memory_order_release);
+				return !m_tryReleaseIDs || m_tryReleaseIDs(firstUnused, reservedEnd - firstUnused);
+			}
+			return releaseLeaseLocked();
+		}
+
+		/**
+		 * @brief
+		 * Starts again at ID 0.
+		 * The counter of a shared allocation is not reset, other processes still use it.
+		 */
 		void reset()
 		{
+			ExclusiveWriteLock lock(m_mutex);
 			m_currentID = 0;
+			m_leaseEnd = 0;
+			m_blockSize = m_leasePolicy.minBlockSize;
+			if (m_localCounter)
+			{
+				m_localCounter->current.store(0, std::memory_order_relaxed);
+				m_localCounter->reservedEnd.store(0, std::memory_order_relaxed);
+				m_localCounter->skipCount.store(0, std::memory_order_relaxed);
+			}
 		}
 	private:
+		static void storeMax(std::atomic<ID>& value, ID newValue)
+		{
+			ID current = value.load(std::memory_order_relaxed);
+			while (newValue > current && !value.compare_exchange_weak(current, newValue, std::memory_order_release, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		// A block that got used up within the sustained load window doubles the next block size, otherwise it shrinks
+		void adaptBlockSize(std::chrono::steady_clock::time_point now)
+		{
+			if (now - m_leaseTime <= m_leasePolicy.sustainedLoadWindow)
+				m_blockSize = std::min(m_blockSize * 2, m_leasePolicy.maxBlockSize);
+			else
+				m_blockSize = std::max(m_blockSize / 2, m_leasePolicy.minBlockSize);
+		}
+
+		// Start of the next reservation after a failed one, behind the reservations of others if they can be read
+		ID getRetryStart(ID failedStart, ID blockSize) const
+		{
+			const ID highestReserved = m_getHighestReservedID ? m_getHighestReservedID() : INVALID_ID;
+			return std::max(failedStart + blockSize, highestReserved + 1);
+		}
+
+		// Reserves a new block that starts at firstID or later and contains at least amount IDs.
+		// Returns INVALID_ID if no block could be reserved, no IDs are handed out then
+		ID leaseBlock(ID firstID, ID amount)
+		{
+			const auto now = std::chrono::steady_clock::now();
+			if (m_leaseEnd != 0)
+			{
+				// The previous block got used up, adapt the size to the creation rate
+				adaptBlockSize(now);
+			}
+			const ID blockSize = std::max(m_blockSize, amount);
+
+			// The rest of the old block is still reserved, the new block continues behind it
+			ID reserveStart = std::max(firstID, m_leaseEnd);
+			ID nextID = firstID;
+			size_t attempts = 0;
+			while (!m_tryReserveNewID(reserveStart, blockSize))
+			{
+				if (++attempts >= maxReserveAttempts)
+					return INVALID_ID;
+
+				// Someone else reserved behind the old block, the IDs have to start in the new block
+				reserveStart = getRetryStart(reserveStart, blockSize);
+				nextID = reserveStart;
+			}
+			++m_reservationCount;
+			m_leaseTime = now;
+			m_leaseEnd = reserveStart + blockSize;
+			m_currentID = nextID + amount - 1;
+			return nextID;
+		}
+		bool releaseLeaseLocked()
+		{
+			const ID firstUnused = m_currentID + 1;
+			if (m_leaseEnd <= firstUnused)
+				return true;
+			bool success = true;
+			if (m_tryReleaseIDs)
+				success = m_tryReleaseIDs(firstUnused, m_leaseEnd - firstUnused);
+			m_leaseEnd = 0;
+			return success;
+		}
+		void disableAtomicAllocationLocked()
+		{
+			if (!m_counter)
+				return;
+			m_currentID = std::max(m_currentID, m_counter->current.load(std::memory_order_acquire));
+			const ID reservedEnd = m_counter->reservedEnd.load(std::memory_order_acquire);
+			m_leaseEnd = 0;
+			if (!m_sharedCounter && reservedEnd > m_currentID + 1)
+				m_leaseEnd = reservedEnd;
+			m_counter = nullptr;
+			m_localCounter.reset();
+			m_sharedCounter.reset();
+		}
+
+		enum class AtomicReservation
+		{
+			Reserved,
+
+			// The IDs may belong to someone else, the caller has to take new ones
+			Skipped,
+			Failed
+		};
+
+		ID getNextAtomicID(ID amount)
+		{
+			while (true)
+			{
+				// Load the end and the skips first, values that change after the fetch can only make the checks fail
+				const ID reservedEnd = m_counter->reservedEnd.load(std::memory_order_acquire);
+				const uint64_t skipCount = m_counter->skipCount.load(std::memory_order_acquire);
+				const ID firstID = m_counter->current.fetch_add(amount, std::memory_order_relaxed) + 1;
+				const ID lastID = firstID + amount - 1;
+				if (lastID < reservedEnd)
+					return firstID;
+				const AtomicReservation reservation = reserveAtomic(lastID, skipCount);
+				if (reservation == AtomicReservation::Reserved)
+					return firstID;
+				if (reservation == AtomicReservation::Failed)
+					return INVALID_ID;
+			}
+		}
+
+		// Slow path of the atomic allocation, makes sure that the IDs up to lastID are reserved.
+		// skipCount is the AtomicIDCounter::skipCount that was loaded before the IDs were fetched.
+		AtomicReservation reserveAtomic(ID lastID, uint64_t skipCount)
+		{
+			std::lock_guard<std::mutex> lock(m_reserveMutex);
+			AtomicIDCounter& counter = *m_counter;
+			ID reservedEnd = counter.reservedEnd.load(std::memory_order_acquire);
+			ID start = reservedEnd;
+			size_t attempts = 0;
+			while (lastID >= reservedEnd)
+			{
+				const auto now = std::chrono::steady_clock::now();
+				adaptBlockSize(now);
+				const ID blockSize = std::max(m_blockSize, lastID >= start ? lastID + 1 - start : 0);
+				if (m_tryReserveNewID(start, blockSize))
+				{
+					++m_reservationCount;
+					m_leaseTime = now;
+					if (start > reservedEnd)
+					{
+						// The IDs in front of the new block were reserved by someone else.
+						// The current ID moves first, so that IDs fetched after the new skip count are behind them
+						storeMax(counter.current, start - 1);
+						counter.skipCount.fetch_add(1, std::memory_order_acq_rel);
+					}
+					storeMax(counter.reservedEnd, start + blockSize);
+					break;
+				}
+
+				// Another process that shares the counter may have reserved the block already
+				const ID newEnd = counter.reservedEnd.load(std::memory_order_acquire);
+				if (newEnd > reservedEnd)
+				{
+					reservedEnd = newEnd;
+					start = std::max(start, newEnd);
+					continue;
+				}
+				if (++attempts >= maxReserveAttempts)
+					return AtomicReservation::Failed;
+				start = getRetryStart(start, blockSize);
+			}
+
+			// Any skip since the fetch may have covered the IDs, not only the last one
+			if (counter.skipCount.load(std::memory_order_acquire) != skipCount)
+				return AtomicReservation::Skipped;
+			return AtomicReservation::Reserved;
+		}
+
+		// Reservations that fail this often in a row give up, no unreserved IDs are handed out
+		static constexpr size_t maxReserveAttempts = 100;
+
 		ID m_currentID = 0;
+
+		// First ID after the reserved block, 0 if no block is reserved
+		ID m_leaseEnd = 0;
 		std::function<bool(ID, ID) > m_tryReserveNewID;
+		std::function<bool(ID, ID) > m_tryReleaseIDs;
+		std::function<ID()> m_getHighestReservedID;
+		IDLeasePolicy m_leasePolicy;
+		ID m_blockSize;
+		std::chrono::steady_clock::time_point m_leaseTime;
+		std::atomic<size_t> m_reservationCount{ 0 };
+		mutable OptionalSharedMutex m_mutex;
+
+		// Atomic allocation mode, m_counter points to the local or the shared counter
+		AtomicIDCounter* m_counter = nullptr;
+		std::unique_ptr<AtomicIDCounter> m_localCounter;
+		std::unique_ptr<SharedIDCounter> m_sharedCounter;
+
+		// Serializes the reservations of the atomic allocation mode
+		std::mutex m_reserveMutex;
 	};
-}
\ No newline at end of file
+}
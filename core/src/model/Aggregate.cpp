@@ -1,22 +1,34 @@
 #include "model/Aggregate.h"
+#include "utilities/HotPathLog.h"
 #include <QJsonArray>
 
 namespace DDD
 {
+	Aggregate::~Aggregate()
+	{
+		// Entities may outlive the aggregate, they must not point to it anymore
+		unlinkEntities();
+	}
+
 	bool Aggregate::operator==(const Aggregate& other) const
 	{
 		if(Entity::operator!=(other))
 			return false;
 
-		if (m_entities.size() != other.m_entities.size())
+		if (m_entities.size() != other.m_entities.size() ||
+			getLightEntityCount() != other.getLightEntityCount())
 			return false;
-		for (const auto& [id, entity] : m_entities)
-		{
-			const auto it = other.m_entities.find(id);
-			if (it == other.m_entities.end() || *entity != *(it->second))
-				return false;
-		}
-		return true;
+		if (m_lightEntities && !m_lightEntities->forEach([&other](ID id, const std::shared_ptr<LightEntity>& entity)
+			{
+				const std::shared_ptr<LightEntity>* otherEntity = other.m_lightEntities->find(id);
+				return otherEntity && *entity == **otherEntity;
+			}))
+			return false;
+		return m_entities.forEach([&other](ID id, const std::shared_ptr<Entity>& entity)
+			{
+				const std::shared_ptr<Entity>* otherEntity = other.m_entities.find(id);
+				return otherEntity && *entity == **otherEntity;
+			});
 	}
 	bool Aggregate::operator!=(const Aggregate& other) const
 	{
@@ -25,63 +37,133 @@ namespace DDD
 	Aggregate& Aggregate::operator=(Aggregate&& other) noexcept
 	{
 		Entity::operator=(std::move(other));
+		unlinkEntities();
 		m_entities = std::move(other.m_entities);
+		m_lightEntities = std::move(other.m_lightEntities);
+		linkEntities();
 		return *this;
 	}
+	void Aggregate::unlinkEntities()
+	{
+		m_entities.forEach([](ID, const std::shared_ptr<Entity>& entity)
+			{
+				entity->m_owner = nullptr;
+				entity->setEntityParent(nullptr);
+			});
+		if (m_lightEntities)
+		{
+			m_lightEntities->forEach([](ID, const std::shared_ptr<LightEntity>& entity)
+				{
+					entity->m_parent = nullptr;
+				});
+		}
+	}
+	void Aggregate::linkEntities()
+	{
+		m_entities.forEach([this](ID, const std::shared_ptr<Entity>& entity)
+			{
+				entity->m_owner = this;
+				entity->setEntityParent(this);
+			});
+		if (m_lightEntities)
+		{
+			m_lightEntities->forEach([this](ID, const std::shared_ptr<LightEntity>& entity)
+				{
+					entity->m_parent = this;
+				});
+		}
+	}
 
 	bool Aggregate::addEntity(const std::shared_ptr<Entity>& entity)
 	{
 		if (!entity)
 		{
-#if LOGGER_LIBRARY_AVAILABLE == 1
-			Logger::logError("Aggregate::addEntity(): Entity is nullptr");
-#endif
+			DDD_HOT_LIB_LOG_ERROR("Aggregate::addEntity(): Entity is nullptr");
 			return false;
 		}
-		if (!m_entities.contains(entity->getID()))
+		if ((!m_lightEntities || !m_lightEntities->contains(entity->getID())) &&
+			m_entities.insert(entity->getID(), entity))
 		{
 			entity->setEntityParent(this);
-			m_entities.insert({ entity->getID(), entity });
-			connect(entity.get(), &Entity::deleteMarked, this, &Aggregate::onEntityDeleteMarketd);
-			connect(entity.get(), &Entity::dataChanged, this, &Aggregate::entityChanged);
+			entity->m_owner = this;
 			emit entityAdded(entity->getID());
+			notifyOwnerDataChanged();
 			return true;
 		}
-#if LOGGER_LIBRARY_AVAILABLE == 1
-		Logger::logError("Aggregate::addEntity(): Entity with ID " + entity->getIDString() + " already exists in the aggregate.");
-#endif
+		DDD_HOT_LIB_LOG_ERROR("Aggregate::addEntity(): Entity with ID " + entity->getIDString() + " already exists in the aggregate.");
 		return false;
 	}
 	bool Aggregate::removeEntity(const ID id)
 	{
-		const auto it = m_entities.find(id);
-		if (it != m_entities.end())
+		std::shared_ptr<Entity>* entity = m_entities.find(id);
+		if (entity)
 		{
-			disconnect(it->second.get(), &Entity::deleteMarked, this, &Aggregate::onEntityDeleteMarketd);
-			disconnect(it->second.get(), &Entity::dataChanged, this, &Aggregate::entityChanged);
-			it->second.get()->setEntityParent(nullptr); // Clear parent pointer
-			m_entities.erase(it);
+			(*entity)->m_owner = nullptr;
+			(*entity)->setEntityParent(nullptr); // Clear parent pointer
+			m_entities.erase(id);
 			emit entityRemoved(id);
+			notifyOwnerDataChanged();
 			return true;
 		}
-#if LOGGER_LIBRARY_AVAILABLE == 1
-		Logger::logError("Aggregate::removeEntity(): Entity with ID " + IID::getIDString(id) + " does not exist in this aggregate.");
-#endif
+		DDD_HOT_LIB_LOG_ERROR("Aggregate::removeEntity(): Entity with ID " + IID::getIDString(id) + " does not exist in this aggregate.");
 		return false;
 	}
 	[[nodiscard]] std::shared_ptr<Entity> Aggregate::getEntity(const ID id) const
 	{
-		const auto it = m_entities.find(id);
-		if (it != m_entities.end())
+		const std::shared_ptr<Entity>* entity = m_entities.find(id);
+		if (entity)
 		{
-			return it->second;
+			return *entity;
 		}
-#if LOGGER_LIBRARY_AVAILABLE == 1
-		Logger::logWarning("Aggregate::removeEntity(): Entity with ID " + IID::getIDString(id) + " does not exist in this aggregate.");
-#endif
+		DDD_HOT_LIB_LOG_WARNING("Aggregate::getEntity(): Entity with ID " + IID::getIDString(id) + " does not exist in this aggregate.");
 		return nullptr;
 	}
 
+	bool Aggregate::addLightEntity(const std::shared_ptr<LightEntity>& entity)
+	{
+		if (!entity)
+		{
+			DDD_HOT_LIB_LOG_ERROR("Aggregate::addLightEntity(): Entity is nullptr");
+			return false;
+		}
+		if (!m_lightEntities)
+			m_lightEntities = std::make_unique<SmallIDMap<std::shared_ptr<LightEntity>>>();
+		if (!m_entities.contains(entity->getID()) &&
+			m_lightEntities->insert(entity->getID(), entity))
+		{
+			entity->m_parent = this;
+			emit entityAdded(entity->getID());
+			notifyOwnerDataChanged();
+			return true;
+		}
+		DDD_HOT_LIB_LOG_ERROR("Aggregate::addLightEntity(): Entity with ID " + entity->getIDString() + " already exists in the aggregate.");
+		return false;
+	}
+	bool Aggregate::removeLightEntity(const ID id)
+	{
+		std::shared_ptr<LightEntity>* entity = m_lightEntities ? m_lightEntities->find(id) : nullptr;
+		if (entity)
+		{
+			(*entity)->m_parent = nullptr;
+			m_lightEntities->erase(id);
+			emit entityRemoved(id);
+			notifyOwnerDataChanged();
+			return true;
+		}
+		DDD_HOT_LIB_LOG_ERROR("Aggregate::removeLightEntity(): Entity with ID " + IID::getIDString(id) + " does not exist in this aggregate.");
+		return false;
+	}
+	[[nodiscard]] std::shared_ptr<LightEntity> Aggregate::getLightEntity(const ID id) const
+	{
+		const std::shared_ptr<LightEntity>* entity = m_lightEntities ? m_lightEntities->find(id) : nullptr;
+		return entity ? *entity : nullptr;
+	}
+
+	[[nodiscard]] size_t Aggregate::getApproximateHeapSize() const
+	{
+		return getEntityCount() * sizeof(Entity) + getLightEntityCount() * sizeof(LightEntity);
+	}
+
 	QJsonObject Aggregate::toDebugJsonObject() const
 	{
 		QJsonObject data = Entity::toDebugJsonObject();
@@ -89,10 +171,14 @@ namespace DDD
 		aggregateData["isRegistred"] = m_isInRepository;
 		// Add childs
 		QJsonArray entitiesArray;
-		for (const auto& entity : m_entities)
-		{
-			entitiesArray.append(entity.second->toDebugJsonObject());
-		}
+		m_entities.forEach([&entitiesArray](ID, const std::shared_ptr<Entity>& entity)
+			{
+				entitiesArray.append(entity->toDebugJsonObject());
+			});
+		forEachLightEntity([&entitiesArray](const LightEntity& entity)
+			{
+				entitiesArray.append(entity.toDebugJsonObject());
+			});
 		aggregateData["ChildEntities"] = entitiesArray;
 		data["Aggregate"] = aggregateData;
 		return data;
@@ -102,8 +188,10 @@ namespace DDD
 	{
 		std::vector<std::shared_ptr<Entity>> entities;
 		entities.reserve(m_entities.size());
-		for (const auto& it : m_entities)
-			entities.push_back(it.second);
+		m_entities.forEach([&entities](ID, const std::shared_ptr<Entity>& entity)
+			{
+				entities.push_back(entity);
+			});
 		return entities;
 	}
 
@@ -0,0 +1,402 @@
+#include "model/AggregateJournal.h"
+#include "utilities/HotPathLog.h"
+#include <QFile>
+#include <QSaveFile>
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace DDD
+{
+	namespace
+	{
+		constexpr char journalMagic[8] = { 'D', 'D', 'D', 'J', 'R', 'N', 'L', '\0' };
+		constexpr uint32_t journalFormatVersion = 1;
+		constexpr uint32_t byteOrderMark = 0x01020304;
+
+		// Header: magic, format version, byte order mark, type count, 4 bytes padding, generation
+		constexpr size_t headerSize = 32;
+
+		// Record: payload size, checksum, type, 3 bytes padding, type index, ID
+		constexpr size_t recordHeaderSize = 24;
+
+		// The checksum covers the record header behind the checksum and the payload
+		constexpr size_t checksumOffset = 8;
+
+		size_t alignedSize(size_t size)
+		{
+			return (size + 7) & ~size_t(7);
+		}
+
+		constexpr std::array<uint32_t, 256> makeCrcTable()
+		{
+			std::array<uint32_t, 256> table{};
+			for (uint32_t i = 0; i < 256; ++i)
+			{
+				uint32_t crc = i;
+				for (int bit = 0; bit < 8; ++bit)
+					crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+				table[i] = crc;
+			}
+			return table;
+		}
+		constexpr std::array<uint32_t, 256> crcTable = makeCrcTable();
+
+		// CRC-32, call it with crc = 0 for the first block
+		uint32_t updateCrc(uint32_t crc, const char* data, size_t size)
+		{
+			crc = ~crc;
+			for (size_t i = 0; i < size; ++i)
+				crc = crcTable[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+			return ~crc;
+		}
+
+		template <typename T> T readValue(const char* data)
+		{
+			T value;
+			std::memcpy(&value, data, sizeof(T));
+			return value;
+		}
+		template <typename T> void writeValue(char* data, const T& value)
+		{
+			std::memcpy(data, &value, sizeof(T));
+		}
+
+		bool syncFile(QFile& file)
+		{
+			if (!file.flush())
+				return false;
+#ifdef _WIN32
+			return _commit(file.handle()) == 0;
+#else
+			return ::fsync(file.handle()) == 0;
+#endif
+		}
+	}
+
+	AggregateJournal::AggregateJournal(const JournalPolicy& policy)
+		: m_policy(policy)
+	{}
+	AggregateJournal::~AggregateJournal()
+	{
+		close();
+	}
+
+	bool AggregateJournal::create(const std::string& path, const std::vector<TypeInfo>& types, Generation generation)
+	{
+		close();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_path = path;
+		m_types = types;
+		m_generation = generation;
+		m_stats = JournalStats();
+		m_failed = false;
+		if (!openFile())
+		{
+			m_file.reset();
+			return false;
+		}
+		m_thread = std::thread(&AggregateJournal::run, this);
+		return true;
+	}
+	void AggregateJournal::close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_thread.joinable())
+				return;
+			m_stopping = true;
+		}
+		// The writer writes the buffered records before it stops
+		m_wakeUp.notify_all();
+		m_thread.join();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = false;
+		m_file.reset();
+		m_synced.notify_all();
+	}
+	bool AggregateJournal::isOpen() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_file != nullptr;
+	}
+
+	bool AggregateJournal::readGeneration(const std::string& path, Generation& generation)
+	{
+		QFile file(QString::fromStdString(path));
+		if (!file.open(QIODevice::ReadOnly))
+			return false;
+		if (file.size() < static_cast<qint64>(headerSize))
+		{
+			generation = 0;
+			return true;
+		}
+		char header[headerSize];
+		if (file.read(header, static_cast<qint64>(headerSize)) != static_cast<qint64>(headerSize) ||
+			std::memcmp(header, journalMagic, sizeof(journalMagic)) != 0 ||
+			readValue<uint32_t>(header + 8) != journalFormatVersion ||
+			readValue<uint32_t>(header + 12) != byteOrderMark)
+			return false;
+		generation = readValue<Generation>(header + 24);
+		return true;
+	}
+	bool AggregateJournal::read(const std::string& path, std::vector<TypeInfo>& types, const std::function<bool(const Record&)>& func)
+	{
+		QFile file(QString::fromStdString(path));
+		if (!file.open(QIODevice::ReadOnly))
+			return false;
+		const qint64 fileSize = file.size();
+		if (fileSize < static_cast<qint64>(headerSize))
+		{
+			DDD_HOT_LIB_LOG_WARNING("AggregateJournal: " + path + " ends inside the header, it has no records");
+			types.clear();
+			return true;
+		}
+		const uchar* mapped = file.map(0, fileSize);
+		if (!mapped)
+			return false;
+		const char* data = reinterpret_cast<const char*>(mapped);
+		const size_t size = static_cast<size_t>(fileSize);
+
+		if (std::memcmp(data, journalMagic, sizeof(journalMagic)) != 0 ||
+			readValue<uint32_t>(data + 8) != journalFormatVersion ||
+			readValue<uint32_t>(data + 12) != byteOrderMark)
+			return false;
+		const uint32_t typeCount = readValue<uint32_t>(data + 16);
+		size_t offset = headerSize;
+		types.clear();
+		for (uint32_t i = 0; i < typeCount; ++i)
+		{
+			if (size - offset < 2 * sizeof(uint32_t))
+				return false;
+			TypeInfo type;
+			type.version = readValue<uint32_t>(data + offset);
+			const uint32_t length = readValue<uint32_t>(data + offset + sizeof(uint32_t));
+			offset += 2 * sizeof(uint32_t);
+			if (size - offset < length)
+				return false;
+			type.name.assign(data + offset, length);
+			types.push_back(std::move(type));
+			offset = alignedSize(offset + length);
+			if (offset > size)
+				return false;
+		}
+
+		while (size - offset >= recordHeaderSize)
+		{
+			const char* header = data + offset;
+			const uint64_t payloadSize = readValue<uint32_t>(header);
+			if (payloadSize > size - offset - recordHeaderSize)
+				break;
+			const uint32_t crc = updateCrc(0, header + checksumOffset, recordHeaderSize - checksumOffset + payloadSize);
+			const uint8_t type = readValue<uint8_t>(header + 8);
+			if (crc != readValue<uint32_t>(header + 4) ||
+				(type != static_cast<uint8_t>(RecordType::Put) && type != static_cast<uint8_t>(RecordType::Remove)))
+				break;
+
+			Record record;
+			record.type = static_cast<RecordType>(type);
+			record.typeIndex = readValue<uint32_t>(header + 12);
+			record.id = static_cast<ID>(readValue<uint64_t>(header + 16));
+			const uint32_t version = record.typeIndex < types.size() ? types[record.typeIndex].version : 0;
+			record.data = BinarySnapshotInput(header + recordHeaderSize, static_cast<size_t>(payloadSize), version);
+			if (!func(record))
+				return false;
+			offset = std::min(size, alignedSize(offset + recordHeaderSize + payloadSize));
+		}
+		if (offset < size)
+			DDD_HOT_LIB_LOG_WARNING("AggregateJournal: " + path + " ends with an incomplete record, it was ignored");
+		return true;
+	}
+
+	AggregateJournal::Sequence AggregateJournal::appendPut(ID id, uint32_t typeIndex, const BinarySnapshotOutput& data)
+	{
+		return append(RecordType::Put, id, typeIndex, data.getData(), data.getSize());
+	}
+	AggregateJournal::Sequence AggregateJournal::appendRemove(ID id)
+	{
+		return append(RecordType::Remove, id, 0, nullptr, 0);
+	}
+	AggregateJournal::Sequence AggregateJournal::append(RecordType type, ID id, uint32_t typeIndex, const char* data, size_t size)
+	{
+		char header[recordHeaderSize] = {};
+		writeValue<uint32_t>(header, static_cast<uint32_t>(size));
+		writeValue<uint8_t>(header + 8, static_cast<uint8_t>(type));
+		writeValue<uint32_t>(header + 12, typeIndex);
+		writeValue<uint64_t>(header + 16, static_cast<uint64_t>(id));
+		uint32_t crc = updateCrc(0, header + checksumOffset, recordHeaderSize - checksumOffset);
+		crc = updateCrc(crc, data, size);
+		writeValue<uint32_t>(header + 4, crc);
+		const size_t recordSize = alignedSize(recordHeaderSize + size);
+
+		Sequence sequence;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_file || m_failed)
+				return 0;
+			m_buffer.insert(m_buffer.end(), header, header + recordHeaderSize);
+			if (size > 0)
+				m_buffer.insert(m_buffer.end(), data, data + size);
+			m_buffer.resize(m_buffer.size() + recordSize - recordHeaderSize - size, 0);
+			m_stats.size += recordSize;
+			++m_stats.records;
+			sequence = ++m_lastSequence;
+		}
+		m_wakeUp.notify_one();
+		return sequence;
+	}
+
+	bool AggregateJournal::awaitDurable(Sequence sequence)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		++m_waiters;
+		m_wakeUp.notify_one();
+		m_synced.wait(lock, [this, sequence]() { return m_durableSequence >= sequence || m_failed || !m_file; });
+		--m_waiters;
+		return m_durableSequence >= sequence;
+	}
+	bool AggregateJournal::flush()
+	{
+		return awaitDurable(getLastSequence());
+	}
+
+	bool AggregateJournal::truncate()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!m_thread.joinable())
+			return false;
+		m_synced.wait(lock, [this]() { return !m_writing; });
+
+		// The checkpoint contains the changes of the dropped records
+		m_buffer.clear();
+		m_durableSequence = m_lastSequence;
+		m_stats.records = 0;
+		++m_stats.checkpoints;
+		++m_generation;
+		m_failed = !openFile();
+		m_synced.notify_all();
+		return !m_failed;
+	}
+
+	void AggregateJournal::setPolicy(const JournalPolicy& policy)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_policy = policy;
+		}
+		m_wakeUp.notify_all();
+	}
+	JournalPolicy AggregateJournal::getPolicy() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_policy;
+	}
+	AggregateJournal::Sequence AggregateJournal::getLastSequence() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_lastSequence;
+	}
+	AggregateJournal::Sequence AggregateJournal::getDurableSequence() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_durableSequence;
+	}
+	AggregateJournal::Generation AggregateJournal::getGeneration() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_generation;
+	}
+	JournalStats AggregateJournal::getStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	bool AggregateJournal::openFile()
+	{
+		// The old journal gets replaced as a whole, it must not be open meanwhile
+		m_file.reset();
+		std::vector<char> header(headerSize, 0);
+		std::memcpy(header.data(), journalMagic, sizeof(journalMagic));
+		writeValue<uint32_t>(header.data() + 8, journalFormatVersion);
+		writeValue<uint32_t>(header.data() + 12, byteOrderMark);
+		writeValue<uint32_t>(header.data() + 16, static_cast<uint32_t>(m_types.size()));
+		writeValue<Generation>(header.data() + 24, m_generation);
+		for (const TypeInfo& type : m_types)
+		{
+			// Version, name length, name
+			const size_t offset = header.size();
+			header.resize(alignedSize(offset + 2 * sizeof(uint32_t) + type.name.size()), 0);
+			writeValue<uint32_t>(header.data() + offset, type.version);
+			writeValue<uint32_t>(header.data() + offset + sizeof(uint32_t), static_cast<uint32_t>(type.name.size()));
+			std::memcpy(header.data() + offset + 2 * sizeof(uint32_t), type.name.data(), type.name.size());
+		}
+		m_stats.size = header.size();
+		QSaveFile headerFile(QString::fromStdString(m_path));
+		if (!headerFile.open(QIODevice::WriteOnly) ||
+			headerFile.write(header.data(), static_cast<qint64>(header.size())) != static_cast<qint64>(header.size()) ||
+			!headerFile.commit())
+		{
+			DDD_HOT_LIB_LOG_ERROR("AggregateJournal: can't write the header of " + m_path);
+			return false;
+		}
+
+		// The records are appended behind the header
+		m_file = std::make_unique<QFile>(QString::fromStdString(m_path));
+		if (!m_file->open(QIODevice::WriteOnly | QIODevice::Append))
+		{
+			DDD_HOT_LIB_LOG_ERROR("AggregateJournal: can't open " + m_path);
+			m_file.reset();
+			return false;
+		}
+		return true;
+	}
+
+	void AggregateJournal::run()
+	{
+		std::vector<char> batch;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_wakeUp.wait(lock, [this] { return !m_buffer.empty() || m_stopping; });
+			if (m_buffer.empty())
+				break;
+
+			// Collect more records, unless someone waits for them
+			if (m_policy.groupCommitDelay.count() > 0 && !m_stopping && m_waiters == 0)
+				m_wakeUp.wait_for(lock, m_policy.groupCommitDelay, [this] { return m_stopping || m_waiters > 0; });
+
+			batch.swap(m_buffer);
+			const Sequence sequence = m_lastSequence;
+			m_writing = true;
+			lock.unlock();
+
+			const bool success = m_file->write(batch.data(), static_cast<qint64>(batch.size())) == static_cast<qint64>(batch.size())
+				&& syncFile(*m_file);
+			batch.clear();
+
+			lock.lock();
+			m_writing = false;
+			if (success)
+			{
+				m_durableSequence = sequence;
+				++m_stats.syncs;
+			}
+			else
+			{
+				// The records behind a lost batch must not be written, they would leave a gap
+				DDD_HOT_LIB_LOG_ERROR("AggregateJournal: writing to " + m_path + " failed");
+				m_failed = true;
+				m_buffer.clear();
+			}
+			m_synced.notify_all();
+		}
+	}
+}
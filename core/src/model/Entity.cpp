@@ -1,4 +1,5 @@
 #include "model/Entity.h"
+#include <algorithm>
 
 
 namespace DDD
@@ -20,6 +21,54 @@ namespace DDD
 		return !(*this == other);
 	}
 
+	void Entity::markDeleted()
+	{
+		m_alive = false;
+		emit deleteMarked(getID());
+		notifyObservers([this](EntityObserver& observer) { observer.onEntityDeleteMarked(*this); });
+	}
+	void Entity::emitDataChanged()
+	{
+		emit dataChanged(getID());
+		notifyObservers([this](EntityObserver& observer) { observer.onEntityDataChanged(*this); });
+	}
+
+	void Entity::addObserver(EntityObserver* observer)
+	{
+		if (!observer)
+			return;
+		if (!m_observers)
+			m_observers = std::make_unique<std::vector<EntityObserver*>>();
+		m_observers->push_back(observer);
+	}
+	bool Entity::removeObserver(EntityObserver* observer)
+	{
+		if (!m_observers)
+			return false;
+		auto it = std::find(m_observers->begin(), m_observers->end(), observer);
+		if (it == m_observers->end())
+			return false;
+		m_observers->erase(it);
+		if (m_observers->empty())
+			m_observers.reset();
+		return true;
+	}
+
+	template <typename F>
+	void Entity::notifyObservers(F&& notify)
+	{
+		if (m_observers)
+		{
+			// Copy, observers may detach themselves
+			const std::vector<EntityObserver*> observers = *m_observers;
+			for (EntityObserver* observer : observers)
+				notify(*observer);
+		}
+		// May release this entity, nothing must be accessed afterwards
+		if (m_owner)
+			notify(*m_owner);
+	}
+
 	QJsonObject Entity::toDebugJsonObject() const
 	{
 		QJsonObject entityData;
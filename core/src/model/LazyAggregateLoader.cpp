@@ -0,0 +1,136 @@
+#include "model/LazyAggregateLoader.h"
+#include "utilities/HotPathLog.h"
+
+namespace DDD
+{
+	LazyAggregateLoader::LazyAggregateLoader(LoadFunction load)
+		: m_load(std::move(load))
+	{}
+
+	void LazyAggregateLoader::addToCatalog(ID id, size_t typeSlot)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_catalog.try_emplace(id, typeSlot).first->second = typeSlot;
+	}
+	void LazyAggregateLoader::addToCatalog(const std::vector<ID>& ids, size_t typeSlot)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_catalog.reserve(m_catalog.size() + ids.size());
+		for (ID id : ids)
+			m_catalog.try_emplace(id, typeSlot).first->second = typeSlot;
+	}
+	bool LazyAggregateLoader::removeFromCatalog(ID id)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_catalog.erase(id) > 0;
+	}
+	bool LazyAggregateLoader::withdraw(ID id, size_t& typeSlot)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_loading && m_loadingThread == std::this_thread::get_id())
+		{
+			DDD_HOT_LIB_LOG_ERROR("LazyAggregateLoader: aggregates can't be removed from within the load function");
+			return false;
+		}
+		m_loaded.wait(lock, [this, id]() { return !m_requested.contains(id); });
+
+		// Loads only request catalogued IDs, no load can add the aggregate from now on
+		auto it = m_catalog.find(id);
+		if (it == m_catalog.end())
+			return false;
+		typeSlot = it->second;
+		m_catalog.erase(it);
+		return true;
+	}
+	bool LazyAggregateLoader::findInCatalog(ID id, size_t& typeSlot) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_catalog.find(id);
+		if (it == m_catalog.end())
+			return false;
+		typeSlot = it->second;
+		return true;
+	}
+
+	bool LazyAggregateLoader::load(const std::vector<ID>& ids)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_loading && m_loadingThread == std::this_thread::get_id())
+		{
+			DDD_HOT_LIB_LOG_ERROR("LazyAggregateLoader: aggregates can't be loaded from within the load function");
+			return false;
+		}
+
+		// The batches that load the requested IDs, IDs that are requested already are not requested again
+		std::vector<std::shared_ptr<Batch>> batches;
+		for (ID id : ids)
+		{
+			if (!m_catalog.contains(id))
+				continue;
+			auto it = m_requested.find(id);
+			if (it != m_requested.end())
+			{
+				batches.push_back(it->second);
+				continue;
+			}
+			if (!m_pending)
+				m_pending = std::make_shared<Batch>();
+			m_pending->ids.push_back(id);
+			m_requested.try_emplace(id, m_pending);
+			batches.push_back(m_pending);
+			++m_stats.faults;
+		}
+		auto isDone = [&batches]()
+			{
+				for (const auto& batch : batches)
+					if (!batch->done)
+						return false;
+				return true;
+			};
+
+		while (!isDone())
+		{
+			if (m_loading || !m_pending)
+			{
+				m_loaded.wait(lock);
+				continue;
+			}
+
+			// Load everything that was missed so far, not only the own IDs
+			std::shared_ptr<Batch> batch = std::move(m_pending);
+			m_loading = true;
+			m_loadingThread = std::this_thread::get_id();
+			lock.unlock();
+
+			const bool success = m_load(batch->ids);
+
+			lock.lock();
+			m_loading = false;
+			m_loadingThread = std::thread::id();
+			++m_stats.loads;
+			for (ID id : batch->ids)
+				m_requested.erase(id);
+			batch->done = true;
+			batch->success = success;
+			if (!success)
+			{
+				++m_stats.failedLoads;
+				DDD_HOT_LIB_LOG_WARNING("LazyAggregateLoader: loading " + std::to_string(batch->ids.size()) + " aggregates failed");
+			}
+			m_loaded.notify_all();
+		}
+
+		for (const auto& batch : batches)
+			if (!batch->success)
+				return false;
+		return true;
+	}
+
+	LazyLoadStats LazyAggregateLoader::getStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		LazyLoadStats stats = m_stats;
+		stats.catalogued = m_catalog.size();
+		return stats;
+	}
+}
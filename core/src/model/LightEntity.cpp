@@ -0,0 +1,69 @@
+#include "model/LightEntity.h"
+#include "model/Aggregate.h"
+#include "utilities/Utilities.h"
+#include <algorithm>
+
+namespace DDD
+{
+	void LightEntity::markDeleted()
+	{
+		m_alive = false;
+		notifyObservers([this](LightEntityObserver& observer) { observer.onEntityDeleteMarked(*this); });
+
+		// May release this entity, nothing must be accessed afterwards
+		if (m_parent)
+			m_parent->onLightEntityDeleteMarked(*this);
+	}
+	void LightEntity::emitDataChanged()
+	{
+		notifyObservers([this](LightEntityObserver& observer) { observer.onEntityDataChanged(*this); });
+		if (m_parent)
+			m_parent->onLightEntityDataChanged(*this);
+	}
+
+	void LightEntity::addObserver(LightEntityObserver* observer)
+	{
+		if (!observer)
+			return;
+		if (!m_observers)
+			m_observers = std::make_unique<std::vector<LightEntityObserver*>>();
+		m_observers->push_back(observer);
+	}
+	bool LightEntity::removeObserver(LightEntityObserver* observer)
+	{
+		if (!m_observers)
+			return false;
+		auto it = std::find(m_observers->begin(), m_observers->end(), observer);
+		if (it == m_observers->end())
+			return false;
+		m_observers->erase(it);
+		if (m_observers->empty())
+			m_observers.reset();
+		return true;
+	}
+
+	template <typename F>
+	void LightEntity::notifyObservers(F&& notify)
+	{
+		if (!m_observers)
+			return;
+		// Copy, observers may detach themselves
+		const std::vector<LightEntityObserver*> observers = *m_observers;
+		for (LightEntityObserver* observer : observers)
+			notify(*observer);
+	}
+
+	QJsonObject LightEntity::toDebugJsonObject() const
+	{
+		QJsonObject entityData;
+		entityData["id"] = QString::fromStdString(getIDString());
+		entityData["alive"] = m_alive;
+		return QJsonObject{
+			{"Entity", entityData},
+		};
+	}
+	std::string LightEntity::toString() const
+	{
+		return jsonToString(toDebugJsonObject());
+	}
+}
@@ -0,0 +1,198 @@
+#include "model/WriteBehindQueue.h"
+#include "utilities/HotPathLog.h"
+
+namespace DDD
+{
+	WriteBehindQueue::WriteBehindQueue(std::shared_ptr<IPersistence> persistence, const WriteBehindPolicy& policy)
+		: m_persistence(std::move(persistence))
+		, m_policy(policy)
+	{
+		m_thread = std::thread(&WriteBehindQueue::run, this);
+	}
+	WriteBehindQueue::~WriteBehindQueue()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wakeUp.notify_all();
+		m_spaceAvailable.notify_all();
+		m_thread.join();
+	}
+
+	void WriteBehindQueue::setPolicy(const WriteBehindPolicy& policy)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_policy = policy;
+		}
+		m_wakeUp.notify_all();
+		m_spaceAvailable.notify_all();
+	}
+	WriteBehindPolicy WriteBehindQueue::getPolicy() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_policy;
+	}
+
+	WriteBehindQueue::Ticket WriteBehindQueue::enqueue(std::vector<Entry> entries)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (entries.empty())
+			return m_lastTicket;
+
+		// Backpressure, only aggregates that are not queued yet take space
+		auto isFull = [this, &entries]()
+			{
+				if (m_policy.maxQueuedAggregates == 0 || m_stopping)
+					return false;
+				const size_t queued = m_pending.size() + m_inFlight;
+				if (queued == 0)
+					return false;
+				size_t added = 0;
+				for (const Entry& entry : entries)
+					if (!m_pending.contains(entry.id))
+						++added;
+				return queued + added > m_policy.maxQueuedAggregates;
+			};
+		if (isFull())
+		{
+			if (!m_policy.blockWhenFull)
+				return 0;
+			m_spaceAvailable.wait(lock, [&isFull]() { return !isFull(); });
+		}
+
+		for (Entry& entry : entries)
+		{
+			auto result = m_pending.try_emplace(entry.id, std::move(entry));
+			if (!result.second)
+			{
+				result.first->second = std::move(entry);
+				++m_stats.coalesced;
+			}
+		}
+		const Ticket ticket = ++m_lastTicket;
+		lock.unlock();
+		m_wakeUp.notify_one();
+		return ticket;
+	}
+
+	bool WriteBehindQueue::flush()
+	{
+		return awaitDurable(getLastTicket());
+	}
+	bool WriteBehindQueue::awaitDurable(Ticket ticket, std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		const size_t failedWrites = m_stats.failedWrites;
+		auto isDone = [this, ticket, failedWrites]()
+			{
+				return m_durableTicket >= ticket || m_stats.failedWrites != failedWrites;
+			};
+		++m_waiters;
+		m_wakeUp.notify_one();
+		bool done;
+		if (timeout == std::chrono::milliseconds::max())
+		{
+			m_written.wait(lock, isDone);
+			done = true;
+		}
+		else
+			done = m_written.wait_for(lock, timeout, isDone);
+		--m_waiters;
+		return done && m_durableTicket >= ticket;
+	}
+
+	bool WriteBehindQueue::isDurable(Ticket ticket) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_durableTicket >= ticket;
+	}
+	WriteBehindQueue::Ticket WriteBehindQueue::getLastTicket() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_lastTicket;
+	}
+	WriteBehindQueue::Ticket WriteBehindQueue::getDurableTicket() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_durableTicket;
+	}
+	WriteBehindStats WriteBehindQueue::getStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		WriteBehindStats stats = m_stats;
+		stats.queued = m_pending.size() + m_inFlight;
+		return stats;
+	}
+
+	void WriteBehindQueue::run()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_wakeUp.wait(lock, [this] { return !m_pending.empty() || m_stopping; });
+			if (m_pending.empty())
+				break;
+
+			// Collect more saves, unless someone waits for them
+			if (m_policy.writeDelay.count() > 0 && !m_stopping && m_waiters == 0)
+				m_wakeUp.wait_for(lock, m_policy.writeDelay, [this] { return m_stopping || m_waiters > 0; });
+
+			std::vector<Entry> batch;
+			batch.reserve(m_pending.size());
+			for (auto& pair : m_pending)
+				batch.push_back(std::move(pair.second));
+			m_pending.clear();
+			const Ticket ticket = m_lastTicket;
+			m_inFlight = batch.size();
+			lock.unlock();
+
+			const bool success = write(batch);
+
+			lock.lock();
+			m_inFlight = 0;
+			if (success)
+			{
+				m_durableTicket = ticket;
+				m_stats.written += batch.size();
+			}
+			else
+			{
+				++m_stats.failedWrites;
+				// Newer saves of the same aggregates replace the failed ones
+				for (Entry& entry : batch)
+					m_pending.try_emplace(entry.id, std::move(entry));
+			}
+			m_written.notify_all();
+			m_spaceAvailable.notify_all();
+			if (!success)
+			{
+				if (m_stopping)
+				{
+					DDD_HOT_LIB_LOG_ERROR("WriteBehindQueue: " + std::to_string(m_pending.size()) + " aggregates could not be written before shutdown");
+					break;
+				}
+				m_wakeUp.wait_for(lock, m_policy.retryDelay, [this] { return m_stopping; });
+			}
+		}
+	}
+
+	bool WriteBehindQueue::write(const std::vector<Entry>& batch)
+	{
+		std::vector<std::shared_ptr<AggregateSnapshot>> snapshots;
+		std::vector<ID> removedIDs;
+		for (const Entry& entry : batch)
+		{
+			if (entry.snapshot)
+				snapshots.push_back(entry.snapshot);
+			else if (entry.removed)
+				removedIDs.push_back(entry.id);
+		}
+
+		const bool success = m_persistence->saveSnapshots(snapshots, removedIDs);
+		if (!success)
+			DDD_HOT_LIB_LOG_WARNING("WriteBehindQueue: writing " + std::to_string(batch.size()) + " aggregates failed, trying again");
+		return success;
+	}
+}
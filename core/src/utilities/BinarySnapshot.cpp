@@ -0,0 +1,300 @@
+#include "utilities/BinarySnapshot.h"
+#include <QFile>
+#include <QSaveFile>
+#include <algorithm>
+
+namespace DDD
+{
+	namespace
+	{
+		constexpr char snapshotMagic[8] = { 'D', 'D', 'D', 'S', 'N', 'A', 'P', '\0' };
+		constexpr uint32_t snapshotFormatVersion = 1;
+		constexpr uint32_t byteOrderMark = 0x01020304;
+
+		constexpr uint64_t headerSize = 16;
+		constexpr uint64_t footerSize = 40;
+		constexpr uint64_t indexEntrySize = 24;
+		constexpr uint64_t sectionEntrySize = 24;
+
+		// Records are collected and written in blocks of this size
+		constexpr size_t writeBufferSize = 1 << 20;
+
+		uint64_t alignedSize(uint64_t size)
+		{
+			return (size + 7) & ~uint64_t(7);
+		}
+		template <typename T> T readValue(const char* data)
+		{
+			T value;
+			std::memcpy(&value, data, sizeof(T));
+			return value;
+		}
+	}
+
+	BinarySnapshotWriter::BinarySnapshotWriter() = default;
+	BinarySnapshotWriter::~BinarySnapshotWriter()
+	{
+		cancel();
+	}
+
+	bool BinarySnapshotWriter::open(const std::string& path)
+	{
+		cancel();
+		m_file = std::make_unique<QSaveFile>(QString::fromStdString(path));
+		if (!m_file->open(QIODevice::WriteOnly))
+		{
+			m_file.reset();
+			return false;
+		}
+		m_offset = 0;
+		m_buffer.reserve(writeBufferSize);
+		const uint32_t header[2] = { snapshotFormatVersion, byteOrderMark };
+		if (!write(snapshotMagic, sizeof(snapshotMagic)) || !write(header, sizeof(header)))
+		{
+			cancel();
+			return false;
+		}
+		return true;
+	}
+
+	bool BinarySnapshotWriter::beginSection(const std::string& typeName, uint32_t typeVersion)
+	{
+		if (!m_file || !endSection())
+			return false;
+		Section section;
+		section.typeName = typeName;
+		section.typeVersion = typeVersion;
+		m_sections.push_back(std::move(section));
+		m_sectionOpen = true;
+		return true;
+	}
+	bool BinarySnapshotWriter::writeRecord(ID id, const char* data, size_t size)
+	{
+		if (!m_file || !m_sectionOpen)
+			return false;
+		m_sections.back().index.push_back({ id, m_offset, size });
+		return write(data, size) && writePadding();
+	}
+
+	bool BinarySnapshotWriter::commit(ID highestID, JournalGeneration journalGeneration)
+	{
+		if (!m_file || !endSection())
+		{
+			cancel();
+			return false;
+		}
+		const uint64_t sectionTableOffset = m_offset;
+		bool success = true;
+		for (const Section& section : m_sections)
+		{
+			const uint64_t entry[2] = { section.indexOffset, section.index.size() };
+			const uint32_t typeInfo[2] = { section.typeVersion, static_cast<uint32_t>(section.typeName.size()) };
+			success = success && write(entry, sizeof(entry)) && write(typeInfo, sizeof(typeInfo))
+				&& write(section.typeName.data(), section.typeName.size()) && writePadding();
+		}
+		const uint64_t footer[4] = { sectionTableOffset, m_sections.size(), highestID, journalGeneration };
+		success = success && write(footer, sizeof(footer)) && write(snapshotMagic, sizeof(snapshotMagic));
+		success = success && flushBuffer() && m_file->commit();
+		m_file.reset();
+		m_buffer.clear();
+		m_sections.clear();
+		m_sectionOpen = false;
+		return success;
+	}
+	void BinarySnapshotWriter::cancel()
+	{
+		if (m_file)
+			m_file->cancelWriting();
+		m_file.reset();
+		m_buffer.clear();
+		m_sections.clear();
+		m_sectionOpen = false;
+	}
+
+	bool BinarySnapshotWriter::write(const void* data, size_t size)
+	{
+		if (m_buffer.size() + size > writeBufferSize && !flushBuffer())
+			return false;
+		const char* bytes = static_cast<const char*>(data);
+		if (size > writeBufferSize)
+		{
+			if (m_file->write(bytes, static_cast<qint64>(size)) != static_cast<qint64>(size))
+				return false;
+		}
+		else
+			m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+		m_offset += size;
+		return true;
+	}
+	bool BinarySnapshotWriter::flushBuffer()
+	{
+		if (m_buffer.empty())
+			return true;
+		const bool success = m_file->write(m_buffer.data(), static_cast<qint64>(m_buffer.size())) == static_cast<qint64>(m_buffer.size());
+		m_buffer.clear();
+		return success;
+	}
+	bool BinarySnapshotWriter::writePadding()
+	{
+		static constexpr char padding[8] = {};
+		return write(padding, alignedSize(m_offset) - m_offset);
+	}
+	bool BinarySnapshotWriter::endSection()
+	{
+		if (!m_sectionOpen)
+			return true;
+		m_sectionOpen = false;
+		Section& section = m_sections.back();
+		std::sort(section.index.begin(), section.index.end(),
+			[](const IndexEntry& a, const IndexEntry& b) { return a.id < b.id; });
+		section.indexOffset = m_offset;
+		static_assert(sizeof(IndexEntry) == indexEntrySize, "The index entries are written as they are");
+		return write(section.index.data(), section.index.size() * sizeof(IndexEntry));
+	}
+
+
+
+	BinarySnapshotFile::BinarySnapshotFile() = default;
+	BinarySnapshotFile::~BinarySnapshotFile()
+	{
+		close();
+	}
+
+	bool BinarySnapshotFile::open(const std::string& path)
+	{
+		close();
+		m_file = std::make_unique<QFile>(QString::fromStdString(path));
+		if (!m_file->open(QIODevice::ReadOnly))
+		{
+			m_file.reset();
+			return false;
+		}
+		const qint64 size = m_file->size();
+		uchar* data = size >= static_cast<qint64>(headerSize + footerSize) ? m_file->map(0, size) : nullptr;
+		if (!data)
+		{
+			close();
+			return false;
+		}
+		m_data = reinterpret_cast<const char*>(data);
+		m_size = static_cast<uint64_t>(size);
+		if (!readSections())
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+	void BinarySnapshotFile::close()
+	{
+		if (m_file && m_data)
+			m_file->unmap(reinterpret_cast<uchar*>(const_cast<char*>(m_data)));
+		m_file.reset();
+		m_data = nullptr;
+		m_size = 0;
+		m_highestID = INVALID_ID;
+		m_journalGeneration = 0;
+		m_sections.clear();
+	}
+
+	size_t BinarySnapshotFile::findSection(const std::string& typeName) const
+	{
+		for (size_t i = 0; i < m_sections.size(); ++i)
+			if (m_sections[i].typeName == typeName)
+				return i;
+		return npos;
+	}
+
+	ID BinarySnapshotFile::getID(size_t section, size_t index) const
+	{
+		return static_cast<ID>(readIndexValue(section, index, 0));
+	}
+	std::vector<ID> BinarySnapshotFile::getIDs(size_t section) const
+	{
+		std::vector<ID> ids;
+		ids.reserve(m_sections[section].recordCount);
+		for (size_t i = 0; i < m_sections[section].recordCount; ++i)
+			ids.push_back(getID(section, i));
+		return ids;
+	}
+	BinarySnapshotInput BinarySnapshotFile::getRecord(size_t section, size_t index) const
+	{
+		const uint64_t offset = readIndexValue(section, index, 1);
+		const uint64_t size = readIndexValue(section, index, 2);
+
+		// Records are stored in front of the indexes
+		if (offset < headerSize || offset > m_sections[section].indexOffset || size > m_sections[section].indexOffset - offset)
+		{
+			BinarySnapshotInput invalid;
+			invalid.invalidate();
+			return invalid;
+		}
+		return BinarySnapshotInput(m_data + offset, static_cast<size_t>(size), m_sections[section].typeVersion);
+	}
+	size_t BinarySnapshotFile::findRecord(size_t section, ID id) const
+	{
+		size_t first = 0;
+		size_t last = m_sections[section].recordCount;
+		while (first < last)
+		{
+			const size_t middle = first + (last - first) / 2;
+			if (getID(section, middle) < id)
+				first = middle + 1;
+			else
+				last = middle;
+		}
+		if (first < m_sections[section].recordCount && getID(section, first) == id)
+			return first;
+		return npos;
+	}
+
+	bool BinarySnapshotFile::readSections()
+	{
+		if (std::memcmp(m_data, snapshotMagic, sizeof(snapshotMagic)) != 0 ||
+			readValue<uint32_t>(m_data + 8) != snapshotFormatVersion ||
+			readValue<uint32_t>(m_data + 12) != byteOrderMark)
+			return false;
+
+		const char* footer = m_data + m_size - footerSize;
+		if (std::memcmp(footer + footerSize - sizeof(snapshotMagic), snapshotMagic, sizeof(snapshotMagic)) != 0)
+			return false;
+		const uint64_t sectionTableOffset = readValue<uint64_t>(footer);
+		const uint64_t sectionCount = readValue<uint64_t>(footer + 8);
+		m_highestID = static_cast<ID>(readValue<uint64_t>(footer + 16));
+		m_journalGeneration = readValue<JournalGeneration>(footer + 24);
+
+		const uint64_t tableEnd = m_size - footerSize;
+		if (sectionTableOffset < headerSize || sectionTableOffset > tableEnd)
+			return false;
+		uint64_t offset = sectionTableOffset;
+		for (uint64_t i = 0; i < sectionCount; ++i)
+		{
+			if (tableEnd - offset < sectionEntrySize)
+				return false;
+			Section section;
+			section.indexOffset = readValue<uint64_t>(m_data + offset);
+			const uint64_t recordCount = readValue<uint64_t>(m_data + offset + 8);
+			section.typeVersion = readValue<uint32_t>(m_data + offset + 16);
+			const uint32_t nameLength = readValue<uint32_t>(m_data + offset + 20);
+			offset += sectionEntrySize;
+			if (tableEnd - offset < nameLength)
+				return false;
+			section.typeName.assign(m_data + offset, nameLength);
+			offset = alignedSize(offset + nameLength);
+			if (offset > tableEnd)
+				return false;
+
+			// The index must lie between the header and the section table
+			if (section.indexOffset < headerSize || section.indexOffset > sectionTableOffset ||
+				recordCount > (sectionTableOffset - section.indexOffset) / indexEntrySize)
+				return false;
+			section.recordCount = static_cast<size_t>(recordCount);
+			m_sections.push_back(std::move(section));
+		}
+		return true;
+	}
+	uint64_t BinarySnapshotFile::readIndexValue(size_t section, size_t index, size_t field) const
+	{
+		return readValue<uint64_t>(m_data + m_sections[section].indexOffset + index * indexEntrySize + field * sizeof(uint64_t));
+	}
+}
@@ -0,0 +1,143 @@
+#include "utilities/HotPathLog.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace DDD
+{
+	namespace
+	{
+		/**
+		 * @brief Background thread that writes the queued messages in order.
+		 */
+		class AsyncLogWriter
+		{
+		public:
+			~AsyncLogWriter()
+			{
+				stop();
+			}
+
+			void start()
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_thread.joinable())
+					return;
+				m_stopping = false;
+				m_thread = std::thread(&AsyncLogWriter::run, this);
+			}
+
+			// Writes the pending messages and joins the thread
+			void stop()
+			{
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					if (!m_thread.joinable())
+						return;
+					m_stopping = true;
+				}
+				m_wakeUp.notify_all();
+				m_thread.join();
+			}
+
+			// Returns false if the thread is not running
+			bool push(std::function<void()>& write)
+			{
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					if (!m_thread.joinable() || m_stopping)
+						return false;
+					m_queue.push_back(std::move(write));
+				}
+				m_wakeUp.notify_one();
+				return true;
+			}
+
+			void flush()
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_idle.wait(lock, [this] { return m_queue.empty() && !m_writing; });
+			}
+
+		private:
+			void run()
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				while (true)
+				{
+					m_wakeUp.wait(lock, [this] { return !m_queue.empty() || m_stopping; });
+					if (m_queue.empty())
+						break;
+					std::deque<std::function<void()>> batch;
+					batch.swap(m_queue);
+					m_writing = true;
+					lock.unlock();
+					for (auto& write : batch)
+						write();
+					lock.lock();
+					m_writing = false;
+					m_idle.notify_all();
+				}
+				m_idle.notify_all();
+			}
+
+			std::mutex m_mutex;
+			std::condition_variable m_wakeUp;
+			std::condition_variable m_idle;
+			std::deque<std::function<void()>> m_queue;
+			std::thread m_thread;
+			bool m_stopping = false;
+			bool m_writing = false;
+		};
+
+		std::atomic<int> s_level{ static_cast<int>(LogLevel::Trace) };
+		std::atomic<bool> s_async{ false };
+
+		AsyncLogWriter& getWriter()
+		{
+			static AsyncLogWriter writer;
+			return writer;
+		}
+	}
+
+	void HotPathLog::setLevel(LogLevel level)
+	{
+		s_level.store(static_cast<int>(level), std::memory_order_relaxed);
+	}
+	LogLevel HotPathLog::getLevel()
+	{
+		return static_cast<LogLevel>(s_level.load(std::memory_order_relaxed));
+	}
+	bool HotPathLog::isEnabled(LogLevel level)
+	{
+		return isCompiledIn(level) && static_cast<int>(level) >= s_level.load(std::memory_order_relaxed);
+	}
+
+	void HotPathLog::setAsync(bool enabled)
+	{
+		if (enabled)
+			getWriter().start();
+		s_async.store(enabled, std::memory_order_release);
+		if (!enabled)
+			getWriter().stop();
+	}
+	bool HotPathLog::isAsync()
+	{
+		return s_async.load(std::memory_order_acquire);
+	}
+
+	void HotPathLog::flush()
+	{
+		if (isAsync())
+			getWriter().flush();
+	}
+
+	void HotPathLog::dispatch(std::function<void()> write)
+	{
+		if (isAsync() && getWriter().push(write))
+			return;
+		write();
+	}
+}
@@ -0,0 +1,115 @@
+#include "utilities/NotificationBatch.h"
+
+namespace DDD
+{
+	void AggregateChangeSet::record(AggregateChange change, ID id)
+	{
+		auto it = m_changes.find(id);
+		if (it == m_changes.end())
+		{
+			m_changes.insert({ id, change });
+			m_order.push_back(id);
+			return;
+		}
+
+		AggregateChange& pending = it->second;
+		switch (change)
+		{
+			case AggregateChange::Added:
+				pending = (pending == AggregateChange::Removed ? AggregateChange::Replaced : AggregateChange::Added);
+				break;
+			case AggregateChange::Replaced:
+				if (pending != AggregateChange::Added)
+					pending = AggregateChange::Replaced;
+				break;
+			case AggregateChange::Removed:
+				if (pending == AggregateChange::Added)
+					m_changes.erase(it); // The ID stays in m_order and gets skipped in take()
+				else
+					pending = AggregateChange::Removed;
+				break;
+		}
+	}
+
+	void AggregateChangeSet::take(std::vector<ID>& added, std::vector<ID>& replaced, std::vector<ID>& removed)
+	{
+		for (const ID id : m_order)
+		{
+			auto it = m_changes.find(id);
+			if (it == m_changes.end())
+				continue;
+			switch (it->second)
+			{
+				case AggregateChange::Added:	added.push_back(id);	break;
+				case AggregateChange::Replaced: replaced.push_back(id); break;
+				case AggregateChange::Removed:	removed.push_back(id);	break;
+			}
+			m_changes.erase(it); // IDs that occur multiple times in m_order get delivered once
+		}
+		m_order.clear();
+		m_changes.clear();
+	}
+
+	void NotificationBatchState::setPolicy(const NotificationFlushPolicy& policy)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_policy = policy;
+	}
+	NotificationFlushPolicy NotificationBatchState::getPolicy() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_policy;
+	}
+
+	void NotificationBatchState::begin()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_depth;
+	}
+	bool NotificationBatchState::end()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_depth > 0)
+			--m_depth;
+		return m_depth == 0;
+	}
+	bool NotificationBatchState::isBuffering() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return isBufferingLocked();
+	}
+
+	bool NotificationBatchState::tryRecord(AggregateChangeSet& changes, AggregateChange change, ID id)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!isBufferingLocked())
+			return false;
+		changes.record(change, id);
+		if (m_pendingCount++ == 0)
+			m_firstPending = std::chrono::steady_clock::now();
+		return true;
+	}
+	void NotificationBatchState::take(AggregateChangeSet& changes, std::vector<ID>& added, std::vector<ID>& replaced, std::vector<ID>& removed)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		changes.take(added, replaced, removed);
+	}
+
+	bool NotificationBatchState::isFlushDue() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_pendingCount == 0)
+			return false;
+		if (m_policy.maxPendingChanges > 0 && m_pendingCount >= m_policy.maxPendingChanges)
+			return true;
+		if (m_policy.maxDelay.count() > 0 &&
+			std::chrono::steady_clock::now() - m_firstPending >= m_policy.maxDelay)
+			return true;
+		return false;
+	}
+	void NotificationBatchState::onFlushed()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pendingCount = 0;
+	}
+}
@@ -0,0 +1,119 @@
+#include "utilities/ObjectPool.h"
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+namespace DDD
+{
+	namespace
+	{
+		// Target size of a slab, small blocks get at least minBlocksPerSlab per slab
+		constexpr size_t slabBytes = 64 * 1024;
+		constexpr size_t minBlocksPerSlab = 16;
+
+		struct PoolRegistry
+		{
+			std::mutex mutex;
+			std::map<std::tuple<std::type_index, size_t, size_t>, std::unique_ptr<FixedBlockPool>> pools;
+		};
+
+		PoolRegistry& getRegistry()
+		{
+			// Never destroyed, pooled objects may outlive the static objects of this module
+			static PoolRegistry* registry = new PoolRegistry();
+			return *registry;
+		}
+
+		size_t alignBlockSize(size_t blockSize, size_t alignment)
+		{
+			blockSize = std::max(blockSize, sizeof(void*));
+			return (blockSize + alignment - 1) / alignment * alignment;
+		}
+	}
+
+	FixedBlockPool::FixedBlockPool(size_t blockSize, size_t alignment)
+		: m_blockSize(alignBlockSize(blockSize, std::max(alignment, alignof(FreeBlock))))
+		, m_alignment(std::max(alignment, alignof(FreeBlock)))
+		, m_blocksPerSlab(std::max(minBlocksPerSlab, slabBytes / m_blockSize))
+	{}
+	FixedBlockPool::~FixedBlockPool()
+	{
+		for (void* slab : m_slabs)
+			::operator delete(slab, std::align_val_t(m_alignment));
+	}
+
+	void* FixedBlockPool::allocate()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_freeList)
+			++m_stats.reusedBlocks;
+		else
+			allocateSlab();
+		FreeBlock* block = m_freeList;
+		m_freeList = block->next;
+		++m_stats.blockAllocations;
+		++m_stats.liveBlocks;
+		return block;
+	}
+	void FixedBlockPool::deallocate(void* block)
+	{
+		if (!block)
+			return;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		FreeBlock* freeBlock = static_cast<FreeBlock*>(block);
+		freeBlock->next = m_freeList;
+		m_freeList = freeBlock;
+		--m_stats.liveBlocks;
+	}
+
+	ObjectPoolStats FixedBlockPool::getStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	FixedBlockPool& FixedBlockPool::getPool(std::type_index tag, size_t blockSize, size_t alignment)
+	{
+		PoolRegistry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		auto& pool = registry.pools[{ tag, blockSize, alignment }];
+		if (!pool)
+			pool = std::make_unique<FixedBlockPool>(blockSize, alignment);
+		return *pool;
+	}
+	ObjectPoolStats FixedBlockPool::getStats(std::type_index tag)
+	{
+		ObjectPoolStats sum;
+		PoolRegistry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		for (const auto& [key, pool] : registry.pools)
+		{
+			if (std::get<0>(key) != tag)
+				continue;
+			ObjectPoolStats stats = pool->getStats();
+			sum.slabAllocations += stats.slabAllocations;
+			sum.blockAllocations += stats.blockAllocations;
+			sum.reusedBlocks += stats.reusedBlocks;
+			sum.liveBlocks += stats.liveBlocks;
+			sum.reservedBytes += stats.reservedBytes;
+		}
+		return sum;
+	}
+
+	void FixedBlockPool::allocateSlab()
+	{
+		const size_t bytes = m_blockSize * m_blocksPerSlab;
+		char* slab = static_cast<char*>(::operator new(bytes, std::align_val_t(m_alignment)));
+		m_slabs.push_back(slab);
+
+		// Link the blocks in address order, so consecutive allocations are contiguous
+		for (size_t i = m_blocksPerSlab; i-- > 0;)
+		{
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + i * m_blockSize);
+			block->next = m_freeList;
+			m_freeList = block;
+		}
+		++m_stats.slabAllocations;
+		m_stats.reservedBytes += bytes;
+	}
+}
@@ -0,0 +1,46 @@
+#include "utilities/SharedIDCounter.h"
+#include <QSharedMemory>
+
+namespace DDD
+{
+	SharedIDCounter::SharedIDCounter() = default;
+	SharedIDCounter::~SharedIDCounter()
+	{
+		detach();
+	}
+
+	bool SharedIDCounter::attach(const std::string& key)
+	{
+		detach();
+		m_memory = std::make_unique<QSharedMemory>(QString::fromStdString(key));
+		if (!m_memory->create(sizeof(AtomicIDCounter)))
+		{
+			// Another process created it already
+			if (m_memory->error() != QSharedMemory::AlreadyExists || !m_memory->attach())
+			{
+				m_memory.reset();
+				return false;
+			}
+		}
+		if (static_cast<size_t>(m_memory->size()) < sizeof(AtomicIDCounter))
+		{
+			m_memory.reset();
+			return false;
+		}
+		// The zero filled memory is a valid counter, no constructor may run
+		// since other processes may already use it.
+		m_counter = static_cast<AtomicIDCounter*>(m_memory->data());
+		m_key = key;
+		return true;
+	}
+	void SharedIDCounter::detach()
+	{
+		m_counter = nullptr;
+		m_key.clear();
+		if (m_memory)
+		{
+			m_memory->detach();
+			m_memory.reset();
+		}
+	}
+}
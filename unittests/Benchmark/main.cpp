@@ -0,0 +1,17 @@
+#include <iostream>
+#include "DDD.h"
+#include <iostream>
+#include "tests.h"
+
+
+int main(int argc, char* argv[])
+{
+	DDD::LibraryInfo::printInfo();
+
+	std::cout << "Running "<< UnitTest::Test::getTests().size() << " tests...\n";
+	UnitTest::Test::TestResults results;
+	UnitTest::Test::runAllTests(results);
+	UnitTest::Test::printResults(results);
+
+	return results.getSuccess();
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "test.h"
+#include "tests/TST_concurrency.h"
+#include "tests/TST_hashMap.h"
+#include "tests/TST_allocation.h"
+#include "tests/TST_entityMemory.h"
+#include "tests/TST_dirtyTracking.h"
+#include "tests/TST_snapshot.h"
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "DDD.h"
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#ifdef _WIN32
+#ifndef PSAPI_VERSION
+#define PSAPI_VERSION 2
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fstream>
+#include <unistd.h>
+#endif
+
+
+class Item : public DDD::Aggregate
+{
+public:
+	Item()
+		: Aggregate()
+	{}
+
+	void setValue(uint64_t newValue)
+	{
+		value = newValue;
+		emitDataChanged();
+	}
+
+	uint64_t value = 0;
+};
+
+class Order : public DDD::Aggregate
+{
+public:
+	Order()
+		: Aggregate()
+	{}
+
+	uint64_t itemCount = 0;
+};
+
+using BenchmarkModel = DDD::Model<Item, Order>;
+
+
+class ItemPart : public DDD::Entity
+{
+public:
+	explicit ItemPart(DDD::ID id)
+		: Entity(id)
+	{}
+
+	uint64_t value = 0;
+};
+
+class LightItemPart : public DDD::LightEntity
+{
+public:
+	explicit LightItemPart(DDD::ID id)
+		: LightEntity(id)
+	{}
+
+	uint64_t value = 0;
+};
+
+
+/**
+ * @brief Measures the wall time between construction and elapsedSeconds().
+ */
+class BenchmarkTimer
+{
+public:
+	BenchmarkTimer()
+		: m_start(std::chrono::steady_clock::now())
+	{}
+
+	double elapsedSeconds() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+	}
+private:
+	std::chrono::steady_clock::time_point m_start;
+};
+
+inline void printBenchmarkResult(const std::string& name, size_t operations, double seconds)
+{
+	double opsPerSecond = seconds > 0 ? operations / seconds : 0;
+	std::cout << std::left << std::setw(48) << name
+		<< std::right << std::setw(12) << operations << " ops "
+		<< std::setw(10) << std::fixed << std::setprecision(3) << seconds * 1000.0 << " ms "
+		<< std::setw(14) << std::setprecision(0) << opsPerSecond << " ops/s\n";
+}
+
+/**
+ * @return the resident memory of this process in bytes, 0 if it is not available.
+ */
+inline size_t getProcessMemoryBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.WorkingSetSize;
+	return 0;
+#else
+	std::ifstream statm("/proc/self/statm");
+	size_t totalPages = 0;
+	size_t residentPages = 0;
+	if (!(statm >> totalPages >> residentPages))
+		return 0;
+	return residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "UnitTest.h"
+#include "BenchmarkObjs.h"
+#include <memory>
+#include <vector>
+
+
+class TST_allocation : public UnitTest::Test
+{
+	TEST_CLASS(TST_allocation)
+public:
+	TST_allocation()
+		: Test("TST_allocation")
+	{
+		ADD_TEST(TST_allocation::createAndRelease);
+	}
+
+private:
+	static constexpr size_t batchSize = 100000;
+	static constexpr size_t batchCount = 10;
+
+	// Creates and releases batches of aggregates, like a model with a steady churn
+	template <typename CREATE>
+	static void runChurn(const std::string& name, CREATE&& create)
+	{
+		std::vector<std::shared_ptr<Item>> items;
+		items.reserve(batchSize);
+		BenchmarkTimer timer;
+		for (size_t batch = 0; batch < batchCount; ++batch)
+		{
+			for (size_t i = 0; i < batchSize; ++i)
+				items.push_back(create());
+			items.clear();
+		}
+		printBenchmarkResult(name, batchSize * batchCount, timer.elapsedSeconds());
+	}
+
+	// Tests
+	TEST_FUNCTION(createAndRelease)
+	{
+		TEST_START;
+
+		runChurn("std::make_shared<Item>", [] { return std::make_shared<Item>(); });
+		const DDD::ObjectPoolStats before = DDD::getPoolStats<Item>();
+		runChurn("DDD::makePooled<Item>", [] { return DDD::makePooled<Item>(); });
+		const DDD::ObjectPoolStats after = DDD::getPoolStats<Item>();
+
+		const size_t created = after.blockAllocations - before.blockAllocations;
+		std::cout << "heap allocations: make_shared " << created
+			<< ", makePooled " << (after.slabAllocations - before.slabAllocations)
+			<< " slabs for " << created << " aggregates ("
+			<< (after.reusedBlocks - before.reusedBlocks) << " blocks reused)\n";
+		TEST_ASSERT(created == batchSize * batchCount);
+		TEST_ASSERT(after.liveBlocks == before.liveBlocks);
+		TEST_ASSERT(after.slabAllocations - before.slabAllocations < created / 100);
+	}
+};
+
+TEST_INSTANTIATE(TST_allocation);
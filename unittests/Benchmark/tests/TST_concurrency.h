@@ -0,0 +1,252 @@
+#pragma once
+
+#include "UnitTest.h"
+#include "BenchmarkObjs.h"
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+
+class TST_concurrency : public UnitTest::Test
+{
+	TEST_CLASS(TST_concurrency)
+public:
+	TST_concurrency()
+		: Test("TST_concurrency")
+	{
+		ADD_TEST(TST_concurrency::readScaling);
+		ADD_TEST(TST_concurrency::mixedReadWrite);
+		ADD_TEST(TST_concurrency::shardedIngestion);
+		ADD_TEST(TST_concurrency::idAllocation);
+	}
+
+private:
+	static constexpr size_t itemCount = 100000;
+	static constexpr size_t lookupsPerThread = 1000000;
+
+	static std::vector<size_t> getThreadCounts()
+	{
+		std::vector<size_t> counts;
+		size_t maxThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+		for (size_t count = 1; count < maxThreads; count *= 2)
+			counts.push_back(count);
+		counts.push_back(maxThreads);
+		return counts;
+	}
+
+	static std::vector<DDD::ID> fillModel(BenchmarkModel& model, size_t count)
+	{
+		std::vector<std::shared_ptr<DDD::Aggregate>> items;
+		items.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+			items.push_back(std::make_shared<Item>());
+		model.addAggregate(items);
+		return model.getIDs<Item>();
+	}
+
+	// Tests
+	TEST_FUNCTION(readScaling)
+	{
+		TEST_START;
+
+		// Lookup throughput of the concurrent mode for an increasing number of reader threads.
+		// Each thread does the same amount of work, so the total throughput should grow with the core count.
+		BenchmarkModel model;
+		model.setThreadSafe(true);
+		const std::vector<DDD::ID> ids = fillModel(model, itemCount);
+		TEST_ASSERT(ids.size() == itemCount);
+
+		for (size_t threadCount : getThreadCounts())
+		{
+			std::atomic<size_t> misses{ 0 };
+			std::vector<std::thread> threads;
+			BenchmarkTimer timer;
+			for (size_t t = 0; t < threadCount; ++t)
+			{
+				threads.emplace_back([&model, &ids, &misses, t]()
+					{
+						std::mt19937_64 rng(t);
+						std::uniform_int_distribution<size_t> dist(0, ids.size() - 1);
+						size_t localMisses = 0;
+						for (size_t i = 0; i < lookupsPerThread; ++i)
+						{
+							const DDD::ID id = ids[dist(rng)];
+							if (i % 2)
+							{
+								if (!model.getAggregate<Item>(id))
+									++localMisses;
+							}
+							else if (!model.contains(id))
+								++localMisses;
+						}
+						misses += localMisses;
+					});
+			}
+			for (auto& thread : threads)
+				thread.join();
+			double seconds = timer.elapsedSeconds();
+			printBenchmarkResult("readScaling threads=" + std::to_string(threadCount), threadCount * lookupsPerThread, seconds);
+			TEST_ASSERT(misses == 0);
+		}
+	}
+
+	TEST_FUNCTION(mixedReadWrite)
+	{
+		TEST_START;
+
+		// Readers scan and look up items while one writer per aggregate type adds and removes aggregates.
+		BenchmarkModel model;
+		model.setThreadSafe(true);
+		const std::vector<DDD::ID> ids = fillModel(model, itemCount);
+		// One core per writer, the readers get the remaining cores
+		constexpr size_t writerCount = 2;
+		constexpr size_t writesPerWriter = 20000;
+		const size_t hardwareThreads = std::thread::hardware_concurrency();
+		const size_t readerCount = hardwareThreads > writerCount + 1 ? hardwareThreads - writerCount : 1;
+
+		std::atomic<bool> running{ true };
+		std::atomic<size_t> reads{ 0 };
+		std::atomic<size_t> misses{ 0 };
+		std::vector<std::thread> readers;
+		BenchmarkTimer timer;
+		for (size_t t = 0; t < readerCount; ++t)
+		{
+			readers.emplace_back([&, t]()
+				{
+					std::mt19937_64 rng(t);
+					std::uniform_int_distribution<size_t> dist(0, ids.size() - 1);
+					size_t localReads = 0;
+					size_t localMisses = 0;
+					while (running)
+					{
+						if (!model.getAggregate(ids[dist(rng)]))
+							++localMisses;
+						++localReads;
+					}
+					reads += localReads;
+					misses += localMisses;
+				});
+		}
+
+		std::vector<std::thread> writers;
+		std::atomic<size_t> failedWrites{ 0 };
+		writers.emplace_back([&]()
+			{
+				// Adds new items and removes them again, the prefilled items stay untouched
+				for (size_t i = 0; i < writesPerWriter; ++i)
+				{
+					std::shared_ptr<Item> item = std::make_shared<Item>();
+					if (!model.addAggregate(item) || !model.removeAggregate(item->getID()))
+						++failedWrites;
+				}
+			});
+		writers.emplace_back([&]()
+			{
+				for (size_t i = 0; i < writesPerWriter; ++i)
+				{
+					if (!model.addAggregate(std::make_shared<Order>()))
+						++failedWrites;
+				}
+			});
+		for (auto& writer : writers)
+			writer.join();
+		double writeSeconds = timer.elapsedSeconds();
+		running = false;
+		for (auto& reader : readers)
+			reader.join();
+		double seconds = timer.elapsedSeconds();
+
+		printBenchmarkResult("mixedReadWrite writes", 3 * writesPerWriter, writeSeconds);
+		printBenchmarkResult("mixedReadWrite reads threads=" + std::to_string(readerCount), reads, seconds);
+		TEST_ASSERT(failedWrites == 0);
+		TEST_ASSERT(misses == 0);
+		TEST_ASSERT(model.size<Item>() == itemCount);
+		TEST_ASSERT(model.size<Order>() == writesPerWriter);
+		TEST_ASSERT(model.getIDs().size() == itemCount + writesPerWriter);
+	}
+
+	TEST_FUNCTION(shardedIngestion)
+	{
+		TEST_START;
+
+		// All threads add aggregates of the same type.
+		// Without sharding they serialize on the repository lock, with sharding they spread over the shards.
+		const size_t threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+		const size_t addsPerThread = itemCount / threadCount;
+		for (size_t shardCount : { size_t(1), threadCount * 4 })
+		{
+			BenchmarkModel model;
+			model.setThreadSafe(true);
+			model.setShardCount(shardCount);
+
+			// Create the aggregates upfront, only the insertion is measured
+			std::vector<std::vector<std::shared_ptr<Item>>> items(threadCount);
+			for (auto& list : items)
+			{
+				list.reserve(addsPerThread);
+				for (size_t i = 0; i < addsPerThread; ++i)
+					list.push_back(std::make_shared<Item>());
+			}
+
+			std::atomic<size_t> failedWrites{ 0 };
+			std::vector<std::thread> threads;
+			BenchmarkTimer timer;
+			for (size_t t = 0; t < threadCount; ++t)
+			{
+				threads.emplace_back([&model, &failedWrites, &list = items[t]]()
+					{
+						for (const auto& item : list)
+							if (!model.addAggregate(item))
+								++failedWrites;
+					});
+			}
+			for (auto& thread : threads)
+				thread.join();
+			double seconds = timer.elapsedSeconds();
+			printBenchmarkResult("shardedIngestion shards=" + std::to_string(model.getShardCount<Item>()) +
+				" threads=" + std::to_string(threadCount), threadCount * addsPerThread, seconds);
+			TEST_ASSERT(failedWrites == 0);
+			TEST_ASSERT(model.size<Item>() == threadCount * addsPerThread);
+		}
+	}
+
+	TEST_FUNCTION(idAllocation)
+	{
+		TEST_START;
+
+		// New IDs from all threads, the locked leased mode against the atomic mode
+		constexpr size_t idsPerThread = 1000000;
+		for (size_t threadCount : getThreadCounts())
+		{
+			for (bool atomic : { false, true })
+			{
+				DDD::UniqueIDDomain domain([](DDD::ID, DDD::ID) { return true; });
+				domain.setThreadSafe(!atomic);
+				if (atomic)
+					TEST_ASSERT(domain.enableAtomicAllocation());
+
+				std::vector<std::thread> threads;
+				BenchmarkTimer timer;
+				for (size_t t = 0; t < threadCount; ++t)
+				{
+					threads.emplace_back([&domain]()
+						{
+							for (size_t i = 0; i < idsPerThread; ++i)
+								(void)domain.getNextID();
+						});
+				}
+				for (auto& thread : threads)
+					thread.join();
+				double seconds = timer.elapsedSeconds();
+				printBenchmarkResult(std::string("idAllocation ") + (atomic ? "atomic" : "locked") +
+					" threads=" + std::to_string(threadCount), threadCount * idsPerThread, seconds);
+				TEST_ASSERT(domain.getCurrentID() == threadCount * idsPerThread);
+			}
+		}
+	}
+
+};
+
+TEST_INSTANTIATE(TST_concurrency);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "UnitTest.h"
+#include "BenchmarkObjs.h"
+#include <memory>
+#include <vector>
+
+
+class TST_dirtyTracking : public UnitTest::Test
+{
+	TEST_CLASS(TST_dirtyTracking)
+public:
+	TST_dirtyTracking()
+		: Test("TST_dirtyTracking")
+	{
+		ADD_TEST(TST_dirtyTracking::checkpoint);
+	}
+
+private:
+	static constexpr size_t aggregateCount = 1000000;
+	static constexpr size_t changeInterval = 1000; // 0.1% of the aggregates change
+
+	// Tests
+	TEST_FUNCTION(checkpoint)
+	{
+		TEST_START;
+
+		BenchmarkModel model;
+		std::vector<std::shared_ptr<Item>> items;
+		items.reserve(aggregateCount);
+		for (size_t i = 0; i < aggregateCount; ++i)
+		{
+			items.push_back(std::make_shared<Item>());
+			model.addAggregate(items.back());
+		}
+		model.clearDirty();
+
+		BenchmarkTimer changeTimer;
+		for (size_t i = 0; i < aggregateCount; i += changeInterval)
+			items[i]->setValue(i);
+		printBenchmarkResult("Item::setValue() with dirty tracking", aggregateCount / changeInterval, changeTimer.elapsedSeconds());
+
+		// What a checkpoint had to collect without dirty tracking
+		BenchmarkTimer allTimer;
+		const std::vector<DDD::ID> allIDs = model.getIDs<Item>();
+		printBenchmarkResult("Model::getIDs<Item>() n=" + std::to_string(aggregateCount), allIDs.size(), allTimer.elapsedSeconds());
+
+		BenchmarkTimer dirtyTimer;
+		const std::vector<DDD::ID> dirtyIDs = model.getDirtyIDs<Item>();
+		printBenchmarkResult("Model::getDirtyIDs<Item>() n=" + std::to_string(aggregateCount), dirtyIDs.size(), dirtyTimer.elapsedSeconds());
+
+		TEST_ASSERT(allIDs.size() == aggregateCount);
+		TEST_ASSERT(dirtyIDs.size() == aggregateCount / changeInterval);
+	}
+};
+
+TEST_INSTANTIATE(TST_dirtyTracking);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "UnitTest.h"
+#include "BenchmarkObjs.h"
+#include <memory>
+#include <vector>
+
+
+class TST_entityMemory : public UnitTest::Test
+{
+	TEST_CLASS(TST_entityMemory)
+public:
+	TST_entityMemory()
+		: Test("TST_entityMemory")
+	{
+		ADD_TEST(TST_entityMemory::bytesPerEntity);
+	}
+
+private:
+	static constexpr size_t aggregateCount = 1000;
+	static constexpr size_t entitiesPerAggregate = 1000;
+
+	// Fills aggregates with child entities and returns the resident memory they added.
+	// The aggregates stay alive in the given list, so that the next measurement
+	// does not reuse the freed memory.
+	template <typename ADD>
+	static size_t measureChildren(std::vector<std::shared_ptr<Item>>& items, ADD&& add)
+	{
+		const size_t before = getProcessMemoryBytes();
+		for (size_t i = 0; i < aggregateCount; ++i)
+		{
+			std::shared_ptr<Item> item = std::make_shared<Item>();
+			for (DDD::ID id = 1; id <= entitiesPerAggregate; ++id)
+				add(*item, id);
+			items.push_back(item);
+		}
+		const size_t after = getProcessMemoryBytes();
+		return after > before ? after - before : 0;
+	}
+
+	static void printMemoryResult(const std::string& name, size_t objectSize, size_t bytes)
+	{
+		const size_t count = aggregateCount * entitiesPerAggregate;
+		std::cout << std::left << std::setw(48) << name
+			<< std::right << std::setw(12) << count << " entities "
+			<< std::setw(6) << objectSize << " sizeof "
+			<< std::setw(8) << std::fixed << std::setprecision(1) << double(bytes) / count << " bytes/entity\n";
+	}
+
+	// Tests
+	TEST_FUNCTION(bytesPerEntity)
+	{
+		TEST_START;
+
+		std::vector<std::shared_ptr<Item>> lightItems;
+		std::vector<std::shared_ptr<Item>> items;
+		lightItems.reserve(aggregateCount);
+		items.reserve(aggregateCount);
+
+		const size_t lightBytes = measureChildren(lightItems, [](Item& item, DDD::ID id)
+			{
+				item.addLightEntity(std::make_shared<LightItemPart>(id));
+			});
+		const size_t bytes = measureChildren(items, [](Item& item, DDD::ID id)
+			{
+				item.addEntity(std::make_shared<ItemPart>(id));
+			});
+
+		printMemoryResult("DDD::Entity child", sizeof(ItemPart), bytes);
+		printMemoryResult("DDD::LightEntity child", sizeof(LightItemPart), lightBytes);
+
+		TEST_ASSERT(sizeof(LightItemPart) < sizeof(ItemPart));
+		TEST_ASSERT(lightItems.front()->getLightEntityCount() == entitiesPerAggregate);
+		TEST_ASSERT(items.front()->getEntityCount() == entitiesPerAggregate);
+		// Only comparable if the platform reports the process memory
+		if (bytes > 0 && lightBytes > 0)
+			TEST_ASSERT(lightBytes < bytes);
+	}
+};
+
+TEST_INSTANTIATE(TST_entityMemory);
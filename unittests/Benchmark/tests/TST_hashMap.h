@@ -0,0 +1,108 @@
+#pragma once
+
+#include "UnitTest.h"
+#include "BenchmarkObjs.h"
+#include "utilities/FlatHashMap.h"
+#include "utilities/PagedIDMap.h"
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+
+class TST_hashMap : public UnitTest::Test
+{
+	TEST_CLASS(TST_hashMap)
+public:
+	TST_hashMap()
+		: Test("TST_hashMap")
+	{
+		ADD_TEST(TST_hashMap::lookup);
+		ADD_TEST(TST_hashMap::iteration);
+	}
+
+private:
+	static constexpr size_t lookupCount = 1000000;
+	static constexpr size_t elementCounts[] = { 10000, 100000, 1000000, 10000000 };
+
+	// Same layout as the repository storage. All entries share one aggregate,
+	// so that only the map itself is measured
+	template <typename MAP>
+	static void fill(MAP& map, size_t count, const std::shared_ptr<Item>& item)
+	{
+		if constexpr (requires { map.reserve(count); })
+			map.reserve(count);
+		for (DDD::ID id = 1; id <= count; ++id)
+			map.insert({ id, item });
+	}
+
+	template <typename MAP>
+	static size_t runLookups(const std::string& name, size_t count, const std::shared_ptr<Item>& item)
+	{
+		MAP map;
+		fill(map, count, item);
+		std::mt19937_64 rng(count);
+		std::vector<DDD::ID> keys(lookupCount);
+		for (auto& key : keys)
+			key = rng() % (count * 2) + 1; // about half of the lookups miss
+
+		size_t hits = 0;
+		BenchmarkTimer timer;
+		for (DDD::ID key : keys)
+			hits += map.contains(key);
+		for (DDD::ID key : keys)
+		{
+			auto it = map.find(key);
+			if (it != map.end())
+				hits += (it->second.get() == item.get());
+		}
+		printBenchmarkResult(name + " lookup n=" + std::to_string(count), 2 * lookupCount, timer.elapsedSeconds());
+		return hits;
+	}
+
+	template <typename MAP>
+	static size_t runIteration(const std::string& name, size_t count, const std::shared_ptr<Item>& item)
+	{
+		MAP map;
+		fill(map, count, item);
+		size_t sum = 0;
+		BenchmarkTimer timer;
+		for (int pass = 0; pass < 4; ++pass)
+			for (const auto& pair : map)
+				sum += pair.first + (pair.second.get() == item.get());
+		printBenchmarkResult(name + " iteration n=" + std::to_string(count), 4 * count, timer.elapsedSeconds());
+		return sum;
+	}
+
+	// Tests
+	TEST_FUNCTION(lookup)
+	{
+		TEST_START;
+
+		std::shared_ptr<Item> item = std::make_shared<Item>();
+		for (size_t count : elementCounts)
+		{
+			size_t stdHits = runLookups<std::unordered_map<DDD::ID, std::shared_ptr<Item>>>("std::unordered_map", count, item);
+			size_t flatHits = runLookups<DDD::FlatHashMap<DDD::ID, std::shared_ptr<Item>>>("DDD::FlatHashMap  ", count, item);
+			size_t pagedHits = runLookups<DDD::PagedIDMap<std::shared_ptr<Item>>>("DDD::PagedIDMap   ", count, item);
+			TEST_ASSERT(stdHits == flatHits);
+			TEST_ASSERT(stdHits == pagedHits);
+		}
+	}
+
+	TEST_FUNCTION(iteration)
+	{
+		TEST_START;
+
+		std::shared_ptr<Item> item = std::make_shared<Item>();
+		for (size_t count : elementCounts)
+		{
+			size_t stdSum = runIteration<std::unordered_map<DDD::ID, std::shared_ptr<Item>>>("std::unordered_map", count, item);
+			size_t flatSum = runIteration<DDD::FlatHashMap<DDD::ID, std::shared_ptr<Item>>>("DDD::FlatHashMap  ", count, item);
+			size_t pagedSum = runIteration<DDD::PagedIDMap<std::shared_ptr<Item>>>("DDD::PagedIDMap   ", count, item);
+			TEST_ASSERT(stdSum == flatSum);
+			TEST_ASSERT(stdSum == pagedSum);
+		}
+	}
+};
+
+TEST_INSTANTIATE(TST_hashMap);
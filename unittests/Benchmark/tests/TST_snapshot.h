@@ -0,0 +1,87 @@
+#pragma once
+
+#include "UnitTest.h"
+#include "BenchmarkObjs.h"
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+class TST_snapshot : public UnitTest::Test
+{
+	TEST_CLASS(TST_snapshot)
+public:
+	TST_snapshot()
+		: Test("TST_snapshot")
+	{
+		ADD_TEST(TST_snapshot::coldStart);
+	}
+
+private:
+	static constexpr size_t aggregateCount = 1000000;
+
+	class ItemFactory : public DDD::AggregateFactory<Item>
+	{
+	public:
+		bool serialize(const Item& item, DDD::BinarySnapshotOutput& output) const override
+		{
+			output.write(item.value);
+			return true;
+		}
+		std::shared_ptr<Item> deserialize(DDD::BinarySnapshotInput& input) const override
+		{
+			std::shared_ptr<Item> item = createPooledAggregate();
+			return input.read(item->value) ? item : nullptr;
+		}
+	};
+
+	// Tests
+	TEST_FUNCTION(coldStart)
+	{
+		TEST_START;
+
+		const std::string path = (std::filesystem::temp_directory_path() / "DDD_TST_snapshot.bin").string();
+		{
+			BenchmarkModel model;
+			model.createFactory<ItemFactory>();
+			std::vector<std::shared_ptr<DDD::Aggregate>> items;
+			items.reserve(aggregateCount);
+			for (size_t i = 0; i < aggregateCount; ++i)
+			{
+				std::shared_ptr<Item> item = std::make_shared<Item>();
+				item->value = i;
+				items.push_back(item);
+			}
+			model.addAggregate(std::move(items));
+
+			BenchmarkTimer saveTimer;
+			TEST_ASSERT(model.saveBinarySnapshot(path));
+			printBenchmarkResult("Model::saveBinarySnapshot() n=" + std::to_string(aggregateCount), aggregateCount, saveTimer.elapsedSeconds());
+		}
+
+		BenchmarkTimer openTimer;
+		DDD::BinarySnapshotFile snapshot;
+		TEST_ASSERT(snapshot.open(path));
+		const size_t section = snapshot.findSection(ItemFactory::getAggregateName());
+		TEST_ASSERT(section != DDD::BinarySnapshotFile::npos);
+		const std::vector<DDD::ID> ids = snapshot.getIDs(section);
+		printBenchmarkResult("BinarySnapshotFile::open() + getIDs()", ids.size(), openTimer.elapsedSeconds());
+		TEST_ASSERT(ids.size() == aggregateCount);
+
+		const size_t maxThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+		for (size_t threads = 1; threads <= maxThreads; threads *= 2)
+		{
+			BenchmarkModel model;
+			model.createFactory<ItemFactory>();
+			BenchmarkTimer loadTimer;
+			TEST_ASSERT(model.loadBinarySnapshot(snapshot, threads));
+			printBenchmarkResult("Model::loadBinarySnapshot() threads=" + std::to_string(threads), aggregateCount, loadTimer.elapsedSeconds());
+			TEST_ASSERT(model.size<Item>() == aggregateCount);
+		}
+		snapshot.close();
+		std::filesystem::remove(path);
+	}
+};
+
+TEST_INSTANTIATE(TST_snapshot);
@@ -2,4 +2,6 @@
 
 #include "test.h"
 #include "tests/TST_simple.h"
+#include "tests/TST_flatHashMap.h"
+#include "tests/TST_pagedIDMap.h"
 //#include "test_nasted.h"
\ No newline at end of file
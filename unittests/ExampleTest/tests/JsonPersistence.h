@@ -54,7 +54,9 @@ public:
 
 	bool save(std::shared_ptr<DDD::MetadataContainer> metadata)	override
 	{
-		return false;
+		// Only the ID reservations are kept, in memory
+		m_highestID = metadata->getCurrentHighestID();
+		return true;
 	}
 
 	/**
@@ -74,10 +76,18 @@ public:
 	 * @param ids The aggregate ids to remove
 	 * @return true if the operation was successful, false otherwise
 	 */
-	 /*bool remove(const std::vector<DDD::ID>& ids)  override
-	{
-		return false;
-	}*/
+	 bool remove(const std::vector<DDD::ID>& ids) override
+	 {
+		 QDir dir(m_folderPath.c_str());
+		 bool success = true;
+		 for (DDD::ID id : ids)
+		 {
+			 const QString fileName = QString::fromStdString(DDD::IID::getIDString(id)) + ".json";
+			 if (dir.exists(fileName) && !dir.remove(fileName))
+				 success = false;
+		 }
+		 return success;
+	 }
 
 	/**
 	 * @brief Remove the given aggregate from the persistance layer
@@ -133,7 +143,8 @@ public:
 
 	 bool load(std::shared_ptr<DDD::MetadataContainer> metadata) override
 	 {
-		 return false;
+		 metadata->setCurrentHighestID(m_highestID);
+		 return true;
 	 }
 
 	/**
@@ -297,21 +308,25 @@ public:
 
 	 bool lockDatabase() override
 	 {
-		 return false;
+		 m_databaseLocked = true;
+		 return true;
 	 }
 
 	 bool unlockDatabase() override
 	 {
-		 return false;
+		 m_databaseLocked = false;
+		 return true;
 	 }
 
 	 bool isDatabaseLocked() const override
 	 {
-		 return false;
+		 return m_databaseLocked;
 	 }
 
 	private:
 		std::string m_folderPath;
+		DDD::ID m_highestID = DDD::INVALID_ID;
+		bool m_databaseLocked = false;
 		std::shared_ptr<AnimalFactory> animalFactory;
 		std::shared_ptr<CatFactory> catFactory;
 };
\ No newline at end of file
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "UnitTest.h"
+#include "DDD.h"
+#include "utilities/FlatHashMap.h"
+#include <random>
+#include <string>
+#include <unordered_map>
+
+
+class TST_flatHashMap : public UnitTest::Test
+{
+	TEST_CLASS(TST_flatHashMap)
+public:
+	TST_flatHashMap()
+		: Test("TST_flatHashMap")
+	{
+		ADD_TEST(TST_flatHashMap::basicOperations);
+		ADD_TEST(TST_flatHashMap::compareWithUnorderedMap);
+		ADD_TEST(TST_flatHashMap::eraseWhileIterating);
+		ADD_TEST(TST_flatHashMap::hashSet);
+	}
+
+private:
+	using Map = DDD::FlatHashMap<DDD::ID, std::shared_ptr<std::string>>;
+
+	// Tests
+	TEST_FUNCTION(basicOperations)
+	{
+		TEST_START;
+
+		Map map;
+		TEST_ASSERT(map.empty());
+		TEST_ASSERT(map.find(1) == map.end());
+		TEST_ASSERT(map.begin() == map.end());
+
+		TEST_ASSERT(map.insert({ 1, std::make_shared<std::string>("a") }).second);
+		TEST_ASSERT(!map.insert({ 1, std::make_shared<std::string>("b") }).second);
+		TEST_ASSERT(*map.find(1)->second == "a");
+		map[2] = std::make_shared<std::string>("c");
+		TEST_ASSERT(map.size() == 2);
+		TEST_ASSERT(map.contains(2));
+
+		Map copy = map;
+		TEST_ASSERT(copy.size() == 2);
+		TEST_ASSERT(copy.find(2)->second == map.find(2)->second);
+		Map moved = std::move(copy);
+		TEST_ASSERT(moved.size() == 2);
+		TEST_ASSERT(copy.empty());
+
+		TEST_ASSERT(map.erase(1) == 1);
+		TEST_ASSERT(map.erase(1) == 0);
+		TEST_ASSERT(!map.contains(1));
+		map.clear();
+		TEST_ASSERT(map.empty());
+		TEST_ASSERT(map.begin() == map.end());
+	}
+
+	TEST_FUNCTION(compareWithUnorderedMap)
+	{
+		TEST_START;
+
+		// Random operations must give the same results as std::unordered_map,
+		// also with keys that only differ in the high bits
+		std::mt19937_64 rng(42);
+		for (DDD::ID stride : { DDD::ID(1), DDD::ID(4096) })
+		{
+			Map map;
+			std::unordered_map<DDD::ID, std::shared_ptr<std::string>> reference;
+			for (size_t i = 0; i < 100000; ++i)
+			{
+				const DDD::ID key = (rng() % 5000) * stride;
+				switch (rng() % 3)
+				{
+					case 0:
+					{
+						auto value = std::make_shared<std::string>(std::to_string(key));
+						TEST_ASSERT(map.insert({ key, value }).second == reference.insert({ key, value }).second);
+						break;
+					}
+					case 1:
+						TEST_ASSERT(map.erase(key) == reference.erase(key));
+						break;
+					case 2:
+					{
+						auto it = map.find(key);
+						auto refIt = reference.find(key);
+						TEST_ASSERT((it == map.end()) == (refIt == reference.end()));
+						if (it != map.end() && refIt != reference.end())
+							TEST_ASSERT(it->second == refIt->second);
+						break;
+					}
+				}
+			}
+			TEST_ASSERT(map.size() == reference.size());
+			size_t count = 0;
+			for (const auto& [key, value] : map)
+			{
+				TEST_ASSERT(reference.contains(key) && reference[key] == value);
+				++count;
+			}
+			TEST_ASSERT(count == reference.size());
+		}
+	}
+
+	TEST_FUNCTION(eraseWhileIterating)
+	{
+		TEST_START;
+
+		Map map;
+		for (DDD::ID id = 1; id <= 1000; ++id)
+			map.insert({ id, nullptr });
+		for (auto it = map.begin(); it != map.end();)
+		{
+			if (it->first % 2)
+				it = map.erase(it);
+			else
+				++it;
+		}
+		TEST_ASSERT(map.size() == 500);
+		for (const auto& pair : map)
+			TEST_ASSERT(pair.first % 2 == 0);
+	}
+
+	TEST_FUNCTION(hashSet)
+	{
+		TEST_START;
+
+		DDD::FlatHashSet<DDD::ID> set;
+		TEST_ASSERT(set.empty());
+		TEST_ASSERT(set.begin() == set.end());
+		for (DDD::ID id = 1; id <= 1000; ++id)
+			TEST_ASSERT(set.insert(id).second);
+		TEST_ASSERT(!set.insert(1).second);
+		TEST_ASSERT(*set.find(7) == 7);
+		TEST_ASSERT(set.find(1001) == set.end());
+		TEST_ASSERT(set.size() == 1000);
+
+		for (auto it = set.begin(); it != set.end();)
+		{
+			if (*it % 2)
+				it = set.erase(it);
+			else
+				++it;
+		}
+		TEST_ASSERT(set.erase(2) == 1);
+		TEST_ASSERT(set.erase(2) == 0);
+		TEST_ASSERT(set.size() == 499);
+
+		size_t count = 0;
+		for (DDD::ID id : set)
+		{
+			TEST_ASSERT(id % 2 == 0 && id != 2);
+			++count;
+		}
+		TEST_ASSERT(count == set.size());
+		set.clear();
+		TEST_ASSERT(set.empty());
+		TEST_ASSERT(!set.contains(4));
+	}
+};
+
+TEST_INSTANTIATE(TST_flatHashMap);
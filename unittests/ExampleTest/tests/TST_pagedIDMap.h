@@ -0,0 +1,186 @@
+#pragma once
+
+#include "UnitTest.h"
+#include "DDD.h"
+#include "utilities/PagedIDMap.h"
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+
+class DenseItem : public DDD::Aggregate
+{
+public:
+	DenseItem()
+		: Aggregate()
+	{}
+};
+
+template <>
+struct DDD::RepositoryTraits<DenseItem>
+{
+	using Storage = DDD::PagedIDMap<std::shared_ptr<DenseItem>>;
+};
+
+
+class TST_pagedIDMap : public UnitTest::Test
+{
+	TEST_CLASS(TST_pagedIDMap)
+public:
+	TST_pagedIDMap()
+		: Test("TST_pagedIDMap")
+	{
+		ADD_TEST(TST_pagedIDMap::basicOperations);
+		ADD_TEST(TST_pagedIDMap::compareWithStdMap);
+		ADD_TEST(TST_pagedIDMap::repositoryStorage);
+	}
+
+private:
+	// Small pages, so that the tests cross many page borders
+	using Map = DDD::PagedIDMap<std::shared_ptr<std::string>, 6>;
+
+	// Tests
+	TEST_FUNCTION(basicOperations)
+	{
+		TEST_START;
+
+		Map map;
+		TEST_ASSERT(map.empty());
+		TEST_ASSERT(map.find(1) == map.end());
+		TEST_ASSERT(map.begin() == map.end());
+		TEST_ASSERT(map.lowerBound(0) == map.end());
+
+		TEST_ASSERT(map.insert({ 1000, std::make_shared<std::string>("a") }).second);
+		TEST_ASSERT(!map.insert({ 1000, std::make_shared<std::string>("b") }).second);
+		TEST_ASSERT(*map.find(1000)->second == "a");
+		// Grows the page table to the front
+		map[3] = std::make_shared<std::string>("c");
+		TEST_ASSERT(map.size() == 2);
+		TEST_ASSERT(map.contains(3));
+		TEST_ASSERT(!map.contains(2));
+		TEST_ASSERT(!map.contains(100000));
+		TEST_ASSERT(map.begin()->first == 3);
+		TEST_ASSERT(map.lowerBound(4)->first == 1000);
+		TEST_ASSERT(map.lowerBound(1001) == map.end());
+
+		Map copy = map;
+		TEST_ASSERT(copy.size() == 2);
+		TEST_ASSERT(copy.find(3)->second == map.find(3)->second);
+		Map moved = std::move(copy);
+		TEST_ASSERT(moved.size() == 2);
+		TEST_ASSERT(copy.empty());
+
+		TEST_ASSERT(map.erase(3) == 1);
+		TEST_ASSERT(map.erase(3) == 0);
+		TEST_ASSERT(!map.contains(3));
+		TEST_ASSERT(map.begin()->first == 1000);
+		map.clear();
+		TEST_ASSERT(map.empty());
+		TEST_ASSERT(map.begin() == map.end());
+	}
+
+	TEST_FUNCTION(compareWithStdMap)
+	{
+		TEST_START;
+
+		// Random operations must give the same results as std::map,
+		// including the iteration order and lowerBound()
+		std::mt19937_64 rng(42);
+		Map map;
+		std::map<DDD::ID, std::shared_ptr<std::string>> reference;
+		for (size_t i = 0; i < 100000; ++i)
+		{
+			const DDD::ID key = rng() % 5000 + 1;
+			switch (rng() % 4)
+			{
+				case 0:
+				{
+					auto value = std::make_shared<std::string>(std::to_string(key));
+					TEST_ASSERT(map.insert({ key, value }).second == reference.insert({ key, value }).second);
+					break;
+				}
+				case 1:
+					TEST_ASSERT(map.erase(key) == reference.erase(key));
+					break;
+				case 2:
+				{
+					auto it = map.find(key);
+					auto refIt = reference.find(key);
+					TEST_ASSERT((it == map.end()) == (refIt == reference.end()));
+					if (it != map.end() && refIt != reference.end())
+						TEST_ASSERT(it->second == refIt->second);
+					break;
+				}
+				case 3:
+				{
+					auto it = map.lowerBound(key);
+					auto refIt = reference.lower_bound(key);
+					TEST_ASSERT((it == map.end()) == (refIt == reference.end()));
+					if (it != map.end() && refIt != reference.end())
+						TEST_ASSERT(it->first == refIt->first);
+					break;
+				}
+			}
+		}
+		TEST_ASSERT(map.size() == reference.size());
+		auto refIt = reference.begin();
+		for (const auto& [key, value] : map)
+		{
+			TEST_ASSERT(refIt != reference.end() && refIt->first == key && refIt->second == value);
+			++refIt;
+		}
+		TEST_ASSERT(refIt == reference.end());
+
+		// Erasing every other element while iterating releases no live element
+		for (auto it = map.begin(); it != map.end();)
+		{
+			if (it->first % 2)
+				it = map.erase(it);
+			else
+				++it;
+		}
+		for (const auto& pair : map)
+			TEST_ASSERT(pair.first % 2 == 0);
+	}
+
+	TEST_FUNCTION(repositoryStorage)
+	{
+		TEST_START;
+
+		DDD::UniqueIDDomain domain([](DDD::ID, DDD::ID) { return true; });
+		DDD::Repository<DenseItem> repository(domain);
+		for (size_t i = 0; i < 3000; ++i)
+			TEST_ASSERT(repository.add(std::make_shared<DenseItem>()));
+		TEST_ASSERT(repository.size() == 3000);
+
+		std::vector<DDD::ID> ids = repository.getIDs();
+		TEST_ASSERT(std::is_sorted(ids.begin(), ids.end()));
+
+		// Range scans visit exactly the IDs of the range, in ascending order
+		const DDD::ID first = ids[100];
+		const DDD::ID last = ids[2500];
+		std::vector<DDD::ID> visited;
+		repository.forEachInRange(first, last, [&visited](const DenseItem& item) { visited.push_back(item.getID()); });
+		TEST_ASSERT(visited == std::vector<DDD::ID>(ids.begin() + 100, ids.begin() + 2501));
+
+		// Sharding keeps blocks of IDs together and all aggregates reachable
+		repository.setShardCount(4);
+		TEST_ASSERT(repository.size() == 3000);
+		for (DDD::ID id : ids)
+			TEST_ASSERT(repository.get(id) != nullptr);
+		visited.clear();
+		repository.forEachInRange(first, last, [&visited](const DenseItem& item) { visited.push_back(item.getID()); });
+		std::sort(visited.begin(), visited.end());
+		TEST_ASSERT(visited == std::vector<DDD::ID>(ids.begin() + 100, ids.begin() + 2501));
+
+		TEST_ASSERT(repository.remove(ids[0]));
+		TEST_ASSERT(!repository.contains(ids[0]));
+		TEST_ASSERT(repository.getDeleted().size() == 1);
+		repository.clear();
+		TEST_ASSERT(repository.empty());
+	}
+};
+
+TEST_INSTANTIATE(TST_pagedIDMap);
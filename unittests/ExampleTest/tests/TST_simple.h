@@ -1,6 +1,15 @@
 #pragma once
 
 #include <QApplication>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #include "UnitTest.h"
 #include "DDD.h"
@@ -37,6 +46,185 @@ protected:
 
 };
 
+class UserLock : public DDD::AggregateLock
+{
+public:
+	std::string toString() override
+	{
+		return getOwner() + " locks " + std::to_string(getAggregateID());
+	}
+};
+
+// Keeps the locks in memory, with a change log for the lock deltas
+class LockingPersistence : public JsonPersistence
+{
+public:
+	bool lock(const DDD::ID& id) override
+	{
+		if (locks.contains(id))
+			return false;
+		std::shared_ptr<UserLock> lock = std::make_shared<UserLock>();
+		lock->setAggregateID(id);
+		lock->setOwner(user);
+		locks[id] = lock;
+		changeLog.push_back(id);
+		return true;
+	}
+	std::vector<bool> lock(const std::vector<DDD::ID>& ids) override
+	{
+		std::vector<bool> res;
+		for (DDD::ID id : ids)
+			res.push_back(lock(id));
+		return res;
+	}
+	bool unlock(const DDD::ID& id) override
+	{
+		if (locks.erase(id) == 0)
+			return false;
+		changeLog.push_back(id);
+		return true;
+	}
+	std::vector<bool> unlock(const std::vector<DDD::ID>& ids) override
+	{
+		std::vector<bool> res;
+		for (DDD::ID id : ids)
+			res.push_back(unlock(id));
+		return res;
+	}
+	std::vector<std::shared_ptr<DDD::AggregateLock>> getLocks() override
+	{
+		std::vector<std::shared_ptr<DDD::AggregateLock>> res;
+		for (const auto& pair : locks)
+			res.push_back(pair.second);
+		transferredLocks += res.size();
+		return res;
+	}
+	std::shared_ptr<DDD::AggregateLock> getLock(const DDD::ID& id) override
+	{
+		auto it = locks.find(id);
+		return it != locks.end() ? it->second : nullptr;
+	}
+
+	uint64_t getLockVersion() override
+	{
+		return supportsDeltas ? changeLog.size() + 1 : 0;
+	}
+	bool getLockChanges(uint64_t sinceVersion, DDD::AggregateLockChanges& changes) override
+	{
+		if (!supportsDeltas || sinceVersion == 0)
+			return false;
+		std::set<DDD::ID> changedIDs(changeLog.begin() + (sinceVersion - 1), changeLog.end());
+		for (DDD::ID id : changedIDs)
+		{
+			if (std::shared_ptr<DDD::AggregateLock> lock = getLock(id))
+				changes.changed.push_back(lock);
+			else
+				changes.removed.push_back(id);
+		}
+		changes.version = getLockVersion();
+		transferredLocks += changedIDs.size();
+		return true;
+	}
+
+	std::map<DDD::ID, std::shared_ptr<DDD::AggregateLock>> locks;
+	std::vector<DDD::ID> changeLog;
+	std::string user = "alice";
+	bool supportsDeltas = false;
+	size_t transferredLocks = 0;
+};
+
+// Writes cats to binary snapshots and journals, remembers the names of the cats it has read
+class SerializingCatFactory : public CatFactory
+{
+public:
+	bool serialize(const Cat& cat, DDD::BinarySnapshotOutput& output) const override
+	{
+		output.write<uint32_t>(static_cast<uint32_t>(cat.getEntityCount()));
+		output.writeString("Cat " + cat.getIDString());
+		return true;
+	}
+	std::shared_ptr<Cat> deserialize(DDD::BinarySnapshotInput& input) const override
+	{
+		uint32_t entityCount = 0;
+		std::string name;
+		if (input.getTypeVersion() != 2 || !input.read(entityCount) || !input.readString(name))
+			return nullptr;
+		std::shared_ptr<Cat> cat = createPooledAggregate();
+		if (cat->getEntityCount() != entityCount)
+			return nullptr;
+		std::lock_guard<std::mutex> lock(namesMutex);
+		names.insert(name);
+		return cat;
+	}
+	uint32_t getSnapshotVersion() const override
+	{
+		return 2;
+	}
+
+	mutable std::mutex namesMutex;
+	mutable std::set<std::string> names;
+};
+
+// Stores only the IDs of the cats, load(ids) creates the cats again
+class CatalogPersistence : public LockingPersistence
+{
+public:
+	bool loadCatalog(std::vector<DDD::AggregateCatalogEntry>& entries) override
+	{
+		for (DDD::ID id : stored)
+			entries.push_back({ id, DDD::AggregateFactory<Cat>::getAggregateName() });
+		return true;
+	}
+	bool load(const std::vector<DDD::ID>& ids) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			loadCalls.push_back(ids);
+		}
+		std::this_thread::sleep_for(loadDelay);
+		for (DDD::ID id : ids)
+		{
+			if (!stored.contains(id))
+				continue;
+			std::shared_ptr<Cat> cat = factory->createAggregate();
+			DDD::UniqueIDDomain::restoreID(*cat, id);
+			if (!model->addAggregate(cat))
+				return false;
+		}
+		return true;
+	}
+	bool save() override
+	{
+		// The loaded aggregates are unchanged, the others stay stored
+		return true;
+	}
+	bool save(const std::vector<DDD::ID>& ids) override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		saved.insert(saved.end(), ids.begin(), ids.end());
+		return true;
+	}
+	bool remove(const std::vector<DDD::ID>& ids) override
+	{
+		for (DDD::ID id : ids)
+			stored.erase(id);
+		return true;
+	}
+	size_t getLoadCount()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return loadCalls.size();
+	}
+
+	AnimalModel* model = nullptr;
+	std::shared_ptr<CatFactory> factory;
+	std::set<DDD::ID> stored;
+	std::chrono::milliseconds loadDelay{ 0 };
+	std::mutex mutex;
+	std::vector<std::vector<DDD::ID>> loadCalls;
+	std::vector<DDD::ID> saved;
+};
+
 class TST_simple : public UnitTest::Test
 {
 	TEST_CLASS(TST_simple)
@@ -51,6 +239,27 @@ public:
 		ADD_TEST(TST_simple::runAnimalService);
 		ADD_TEST(TST_simple::searchAggregates);
 		ADD_TEST(TST_simple::signalsAndSlots);
+		ADD_TEST(TST_simple::globalIDIndex);
+		ADD_TEST(TST_simple::typeRouting);
+		ADD_TEST(TST_simple::notificationBatch);
+		ADD_TEST(TST_simple::aggregateViews);
+		ADD_TEST(TST_simple::shardedStorage);
+		ADD_TEST(TST_simple::pooledAllocation);
+		ADD_TEST(TST_simple::entityAccess);
+		ADD_TEST(TST_simple::lifecycleObservers);
+		ADD_TEST(TST_simple::lightEntities);
+		ADD_TEST(TST_simple::dirtyTracking);
+		ADD_TEST(TST_simple::deletedCacheRetention);
+		ADD_TEST(TST_simple::hotPathLog);
+		ADD_TEST(TST_simple::idLeasing);
+		ADD_TEST(TST_simple::atomicIDAllocation);
+		ADD_TEST(TST_simple::lockTable);
+		ADD_TEST(TST_simple::lockDeltas);
+		ADD_TEST(TST_simple::writeBehind);
+		ADD_TEST(TST_simple::binarySnapshot);
+		ADD_TEST(TST_simple::journal);
+		ADD_TEST(TST_simple::lazyLoading);
+		ADD_TEST(TST_simple::eviction);
 
 	}
 
@@ -242,6 +451,1464 @@ private:
 		TEST_ASSERT(cat->getEntities().size() == entitySize - 1);
 	}
 
+	TEST_FUNCTION(globalIDIndex)
+	{
+		TEST_START;
+
+		// Untyped lookups are routed through the global ID index
+		std::shared_ptr<Cat> cat = catFactory->createAggregate();
+		TEST_ASSERT(model.addAggregate(cat));
+		DDD::ID id = cat->getID();
+		TEST_ASSERT(model.contains(id));
+		TEST_ASSERT(model.getAggregate(id) == cat);
+		TEST_ASSERT(model.getAggregates(std::vector<DDD::ID>{ id }).size() == 1);
+		TEST_ASSERT(model.removeAggregate(id));
+		TEST_ASSERT(!model.contains(id));
+		TEST_ASSERT(model.getAggregate(id) == nullptr);
+		TEST_ASSERT(!model.removeAggregate(id));
+
+		// The index must also follow removals triggered by markDeleted()
+		cat = catFactory->createAggregate();
+		TEST_ASSERT(model.addAggregate(cat));
+		id = cat->getID();
+		TEST_ASSERT(model.contains(id));
+		cat->markDeleted();
+		QApplication::processEvents();
+		TEST_ASSERT(!model.contains(id));
+		TEST_ASSERT(model.getAggregate(id) == nullptr);
+	}
+
+	TEST_FUNCTION(typeRouting)
+	{
+		TEST_START;
+
+		// Each aggregate is stored only in the repository of its concrete type
+		size_t animalCount = model.size<Animal>();
+		size_t catCount = model.size<Cat>();
+		std::vector<std::shared_ptr<DDD::Aggregate>> aggregates;
+		for (size_t i = 0; i < 10; ++i)
+		{
+			if (i % 2)
+				aggregates.push_back(animalFactory->createAggregate());
+			else
+				aggregates.push_back(catFactory->createAggregate());
+		}
+		std::vector<bool> results = model.addAggregate(aggregates);
+		TEST_ASSERT(std::find(results.begin(), results.end(), false) == results.end());
+		TEST_ASSERT(model.size<Animal>() == animalCount + 5);
+		TEST_ASSERT(model.size<Cat>() == catCount + 5);
+		TEST_ASSERT(model.getAggregate<Cat>(aggregates[0]->getID()) != nullptr);
+		TEST_ASSERT(model.getAggregate<Animal>(aggregates[0]->getID()) == nullptr);
+		TEST_ASSERT(model.replaceAggregate(aggregates[1]));
+	}
+
+	TEST_FUNCTION(notificationBatch)
+	{
+		TEST_START;
+
+		size_t addedCalls = 0;
+		size_t removedCalls = 0;
+		std::vector<DDD::ID> addedIDs;
+		model.setCallback_aggregateAdded([&](const std::vector<DDD::ID>& ids)
+			{
+				++addedCalls;
+				addedIDs.insert(addedIDs.end(), ids.begin(), ids.end());
+			});
+		model.setCallback_aggregateRemoved([&](const std::vector<DDD::ID>&)
+			{
+				++removedCalls;
+			});
+
+		// One callback for all aggregates added inside the batch
+		std::vector<std::shared_ptr<Cat>> cats;
+		{
+			DDD::NotificationBatchScope batch(model);
+			for (size_t i = 0; i < 5; ++i)
+			{
+				cats.push_back(catFactory->createAggregate());
+				TEST_ASSERT(model.addAggregate(cats.back()));
+			}
+			TEST_ASSERT(addedCalls == 0);
+		}
+		TEST_ASSERT(addedCalls == 1);
+		TEST_ASSERT(addedIDs.size() == cats.size());
+
+		// Added and removed inside the same batch cancel out
+		addedCalls = 0;
+		{
+			DDD::NotificationBatchScope batch(model);
+			std::shared_ptr<Cat> cat = catFactory->createAggregate();
+			TEST_ASSERT(model.addAggregate(cat));
+			TEST_ASSERT(model.removeAggregate(cat->getID()));
+		}
+		TEST_ASSERT(addedCalls == 0);
+		TEST_ASSERT(removedCalls == 0);
+
+		// Continuous buffering flushes when the limit is reached
+		DDD::NotificationFlushPolicy policy;
+		policy.bufferContinuously = true;
+		policy.maxPendingChanges = 3;
+		model.setNotificationFlushPolicy(policy);
+		for (size_t i = 0; i < 2; ++i)
+			TEST_ASSERT(model.removeAggregate(cats[i]->getID()));
+		TEST_ASSERT(removedCalls == 0);
+		TEST_ASSERT(model.removeAggregate(cats[2]->getID()));
+		TEST_ASSERT(removedCalls == 1);
+		TEST_ASSERT(model.removeAggregate(cats[3]->getID()));
+		model.flushNotifications();
+		TEST_ASSERT(removedCalls == 2);
+
+		model.setNotificationFlushPolicy(DDD::NotificationFlushPolicy());
+		model.setCallback_aggregateAdded(nullptr);
+		model.setCallback_aggregateRemoved(nullptr);
+	}
+
+	TEST_FUNCTION(aggregateViews)
+	{
+		TEST_START;
+
+		// Views and visitors see the same aggregates as the owning getters
+		size_t catCount = 0;
+		for (const Cat& cat : model.view<Cat>())
+		{
+			TEST_ASSERT(model.contains<Cat>(cat.getID()));
+			++catCount;
+		}
+		TEST_ASSERT(catCount == model.size<Cat>());
+		TEST_ASSERT(model.view<Cat>().size() == catCount);
+
+		size_t visited = 0;
+		model.forEach<Cat>([&visited](Cat&) { ++visited; });
+		TEST_ASSERT(visited == catCount);
+
+		size_t total = 0;
+		model.forEachAggregate([&total](const DDD::Aggregate&) { ++total; });
+		TEST_ASSERT(total == model.getAggregates().size());
+
+		// Returning false stops the iteration
+		visited = 0;
+		model.forEachAggregate([&visited](DDD::Aggregate&) { ++visited; return false; });
+		TEST_ASSERT(visited == 1);
+
+		visited = 0;
+		catService->forEachAggregate([&visited](const Cat&) { ++visited; });
+		TEST_ASSERT(visited == catCount);
+	}
+
+	TEST_FUNCTION(shardedStorage)
+	{
+		TEST_START;
+
+		// Resharding keeps all aggregates reachable
+		std::vector<DDD::ID> catIDs = model.getIDs<Cat>();
+		model.setShardCount(5);
+		TEST_ASSERT(model.getShardCount<Cat>() == 8);
+		TEST_ASSERT(model.size<Cat>() == catIDs.size());
+		for (DDD::ID id : catIDs)
+		{
+			TEST_ASSERT(model.contains(id));
+			TEST_ASSERT(model.getAggregate<Cat>(id) != nullptr);
+		}
+
+		std::vector<std::shared_ptr<DDD::Aggregate>> cats;
+		for (size_t i = 0; i < 100; ++i)
+			cats.push_back(catFactory->createAggregate());
+		std::vector<bool> results = model.addAggregate(cats);
+		TEST_ASSERT(std::find(results.begin(), results.end(), false) == results.end());
+		TEST_ASSERT(model.size<Cat>() == catIDs.size() + cats.size());
+		TEST_ASSERT(model.view<Cat>().size() == model.size<Cat>());
+
+		size_t visited = 0;
+		for (const Cat& cat : model.view<Cat>())
+		{
+			TEST_ASSERT(model.contains<Cat>(cat.getID()));
+			++visited;
+		}
+		TEST_ASSERT(visited == model.size<Cat>());
+
+		for (const auto& cat : cats)
+			TEST_ASSERT(model.removeAggregate(cat->getID()));
+		model.setShardCount(1);
+		TEST_ASSERT(model.getShardCount<Cat>() == 1);
+		TEST_ASSERT(model.size<Cat>() == catIDs.size());
+	}
+
+	TEST_FUNCTION(pooledAllocation)
+	{
+		TEST_START;
+
+		const DDD::ObjectPoolStats catsBefore = CatFactory::getPoolStats();
+		const DDD::ObjectPoolStats legsBefore = DDD::getPoolStats<CatLeg>();
+		{
+			std::vector<std::shared_ptr<Cat>> cats;
+			for (size_t i = 0; i < 100; ++i)
+				cats.push_back(catFactory->createAggregate());
+
+			const DDD::ObjectPoolStats cats1 = CatFactory::getPoolStats();
+			TEST_ASSERT(cats1.blockAllocations == catsBefore.blockAllocations + 100);
+			TEST_ASSERT(cats1.liveBlocks == catsBefore.liveBlocks + 100);
+			TEST_ASSERT(DDD::getPoolStats<CatLeg>().blockAllocations == legsBefore.blockAllocations + 400);
+		}
+		TEST_ASSERT(CatFactory::getPoolStats().liveBlocks == catsBefore.liveBlocks);
+
+		// The memory of the released cats gets reused
+		const DDD::ObjectPoolStats cats2 = CatFactory::getPoolStats();
+		std::vector<std::shared_ptr<Cat>> cats;
+		for (size_t i = 0; i < 100; ++i)
+			cats.push_back(catFactory->createAggregate());
+		const DDD::ObjectPoolStats cats3 = CatFactory::getPoolStats();
+		TEST_ASSERT(cats3.reusedBlocks == cats2.reusedBlocks + 100);
+		TEST_ASSERT(cats3.slabAllocations == cats2.slabAllocations);
+	}
+
+	TEST_FUNCTION(entityAccess)
+	{
+		TEST_START;
+
+		std::shared_ptr<Cat> cat = catFactory->createAggregate();
+		TEST_ASSERT(cat->getEntityCount() == 6);
+		TEST_ASSERT(cat->findEntity<CatLeg>(Cat::LEG1) != nullptr);
+		TEST_ASSERT(cat->findEntity<CatHead>(Cat::LEG1) == nullptr);
+		TEST_ASSERT(cat->getEntity<CatHead>(Cat::HEAD) != nullptr);
+		TEST_ASSERT(cat->getEntities<Leg>().size() == 4);
+
+		size_t legs = 0;
+		cat->forEachEntity<Leg>([&legs](const Leg&) { ++legs; });
+		TEST_ASSERT(legs == 4);
+
+		// Visitors returning false stop the iteration
+		size_t visited = 0;
+		cat->forEachEntity([&visited](DDD::Entity&) { ++visited; return false; });
+		TEST_ASSERT(visited == 1);
+
+		// Large IDs use the overflow storage
+		TEST_ASSERT(cat->addEntity(std::make_shared<CatLeg>(1000)));
+		TEST_ASSERT(!cat->addEntity(std::make_shared<CatLeg>(1000)));
+		TEST_ASSERT(cat->getEntityCount() == 7);
+		TEST_ASSERT(cat->findEntity<CatLeg>(1000) != nullptr);
+		TEST_ASSERT(cat->getEntities<CatLeg>().size() == 5);
+
+		TEST_ASSERT(cat->removeEntity(1000));
+		TEST_ASSERT(cat->removeEntity(Cat::LEG2));
+		TEST_ASSERT(!cat->removeEntity(Cat::LEG2));
+		TEST_ASSERT(cat->getEntityCount() == 5);
+		TEST_ASSERT(cat->getEntities().size() == 5);
+		TEST_ASSERT(cat->getEntity(Cat::LEG2) == nullptr);
+	}
+
+	TEST_FUNCTION(lifecycleObservers)
+	{
+		TEST_START;
+
+		class CountingObserver : public DDD::EntityObserver
+		{
+		public:
+			void onEntityDeleteMarked(DDD::Entity&) override { ++deleteMarked; }
+			void onEntityDataChanged(DDD::Entity&) override { ++dataChanged; }
+			size_t deleteMarked = 0;
+			size_t dataChanged = 0;
+		};
+
+		// The owners get the events without any Qt connection
+		std::shared_ptr<Cat> cat = catFactory->createAggregate();
+		TEST_ASSERT(model.addAggregate(cat));
+		const DDD::ID id = cat->getID();
+		std::shared_ptr<CatLeg> leg = cat->getEntity<CatLeg>(Cat::LEG3);
+		CountingObserver observer;
+		leg->addObserver(&observer);
+		leg->walk();
+		TEST_ASSERT(observer.dataChanged == 1);
+		leg->markDeleted();
+		TEST_ASSERT(observer.deleteMarked == 1);
+		TEST_ASSERT(cat->getEntity(Cat::LEG3) == nullptr);
+		TEST_ASSERT(leg->removeObserver(&observer));
+		TEST_ASSERT(!leg->removeObserver(&observer));
+
+		cat->markDeleted();
+		TEST_ASSERT(!model.contains(id));
+
+		// Aggregates that outlive their repository are unlinked
+		std::shared_ptr<Cat> survivor = catFactory->createAggregate();
+		{
+			DDD::UniqueIDDomain domain([](DDD::ID, DDD::ID) { return true; });
+			DDD::Repository<Cat> repository(domain);
+			TEST_ASSERT(repository.add(survivor));
+			TEST_ASSERT(survivor->isRegistred());
+		}
+		TEST_ASSERT(!survivor->isRegistred());
+		survivor->markDeleted();
+	}
+
+	TEST_FUNCTION(lightEntities)
+	{
+		TEST_START;
+
+		class Claw : public DDD::LightEntity
+		{
+		public:
+			explicit Claw(DDD::ID id)
+				: LightEntity(id)
+			{}
+			void scratch()
+			{
+				++scratches;
+				emitDataChanged();
+			}
+			size_t scratches = 0;
+		};
+		class CountingObserver : public DDD::LightEntityObserver
+		{
+		public:
+			void onEntityDeleteMarked(DDD::LightEntity&) override { ++deleteMarked; }
+			void onEntityDataChanged(DDD::LightEntity&) override { ++dataChanged; }
+			size_t deleteMarked = 0;
+			size_t dataChanged = 0;
+		};
+
+		TEST_ASSERT(sizeof(Claw) < sizeof(Leg));
+
+		std::shared_ptr<Cat> cat = catFactory->createAggregate();
+		const size_t entityCount = cat->getEntityCount();
+		TEST_ASSERT(cat->addLightEntity(std::make_shared<Claw>(10)));
+		TEST_ASSERT(cat->addLightEntity(std::make_shared<Claw>(1000)));
+		TEST_ASSERT(!cat->addLightEntity(std::make_shared<Claw>(10)));
+
+		// Entity and LightEntity children share the ID space
+		TEST_ASSERT(!cat->addLightEntity(std::make_shared<Claw>(Cat::LEG1)));
+		TEST_ASSERT(!cat->addEntity(std::make_shared<CatLeg>(10)));
+		TEST_ASSERT(cat->getEntityCount() == entityCount);
+		TEST_ASSERT(cat->getLightEntityCount() == 2);
+
+		Claw* claw = cat->findLightEntity<Claw>(10);
+		TEST_ASSERT(claw != nullptr);
+		TEST_ASSERT(cat->getLightEntity(1000) != nullptr);
+		TEST_ASSERT(cat->getLightEntity(11) == nullptr);
+
+		size_t visited = 0;
+		cat->forEachLightEntity([&visited](const DDD::LightEntity&) { ++visited; });
+		TEST_ASSERT(visited == 2);
+
+		// The aggregate re-emits the entity events
+		size_t changed = 0;
+		size_t deleted = 0;
+		QObject::connect(cat.get(), &DDD::Aggregate::entityChanged, [&changed](DDD::ID) { ++changed; });
+		QObject::connect(cat.get(), &DDD::Aggregate::entityDeleted, [&deleted](DDD::ID) { ++deleted; });
+		CountingObserver observer;
+		claw->addObserver(&observer);
+		claw->scratch();
+		TEST_ASSERT(observer.dataChanged == 1);
+		TEST_ASSERT(changed == 1);
+
+		std::shared_ptr<DDD::LightEntity> keep = cat->getLightEntity(10);
+		claw->markDeleted();
+		TEST_ASSERT(observer.deleteMarked == 1);
+		TEST_ASSERT(deleted == 1);
+		TEST_ASSERT(!keep->isAlive());
+		TEST_ASSERT(cat->getLightEntity(10) == nullptr);
+		TEST_ASSERT(claw->removeObserver(&observer));
+
+		TEST_ASSERT(cat->removeLightEntity(1000));
+		TEST_ASSERT(!cat->removeLightEntity(1000));
+		TEST_ASSERT(cat->getLightEntityCount() == 0);
+	}
+
+	TEST_FUNCTION(dirtyTracking)
+	{
+		TEST_START;
+
+		class RecordingPersistence : public JsonPersistence
+		{
+		public:
+			bool save() override
+			{
+				++fullSaves;
+				return succeed;
+			}
+			bool save(const std::vector<DDD::ID>& ids) override
+			{
+				saved = ids;
+				return succeed;
+			}
+			bool remove(const std::vector<DDD::ID>& ids) override
+			{
+				removed = ids;
+				return succeed;
+			}
+			std::vector<DDD::ID> saved;
+			std::vector<DDD::ID> removed;
+			size_t fullSaves = 0;
+			bool succeed = true;
+		};
+
+		DDD::Model<Animal, Cat> dirtyModel;
+		std::shared_ptr<RecordingPersistence> persistence = dirtyModel.attachPersistence<RecordingPersistence>();
+		std::vector<std::shared_ptr<Cat>> cats;
+		for (size_t i = 0; i < 10; ++i)
+		{
+			cats.push_back(catFactory->createAggregate());
+			TEST_ASSERT(dirtyModel.addAggregate(cats.back()));
+		}
+		TEST_ASSERT(dirtyModel.getDirtyCount() == 10);
+		TEST_ASSERT(dirtyModel.save());
+		TEST_ASSERT(persistence->fullSaves == 1);
+		TEST_ASSERT(dirtyModel.getDirtyCount() == 0);
+
+		// Nothing changed, nothing to save
+		TEST_ASSERT(dirtyModel.saveDirty());
+		TEST_ASSERT(persistence->saved.empty());
+
+		// Changes of the aggregate entities, entity removal and aggregate removal
+		const DDD::ID walkedID = cats[2]->getID();
+		const DDD::ID removedEntityID = cats[5]->getID();
+		const DDD::ID removedID = cats[7]->getID();
+		cats[2]->getEntity<CatLeg>(Cat::LEG1)->walk();
+		TEST_ASSERT(cats[5]->removeEntity(Cat::HEAD));
+		cats[7]->markDeleted();
+		TEST_ASSERT(dirtyModel.isDirty<Cat>(walkedID));
+		TEST_ASSERT(!dirtyModel.isDirty<Cat>(cats[3]->getID()));
+		std::vector<DDD::ID> dirty = dirtyModel.getDirtyIDs();
+		std::sort(dirty.begin(), dirty.end());
+		std::vector<DDD::ID> expected = { walkedID, removedEntityID, removedID };
+		std::sort(expected.begin(), expected.end());
+		TEST_ASSERT(dirty == expected);
+
+		// Failed saves keep the dirty state
+		persistence->succeed = false;
+		TEST_ASSERT(!dirtyModel.saveDirty());
+		TEST_ASSERT(dirtyModel.getDirtyCount() == 3);
+
+		// Removed aggregates are passed to remove(ids), not to save(ids)
+		persistence->succeed = true;
+		TEST_ASSERT(dirtyModel.saveDirty());
+		std::sort(persistence->saved.begin(), persistence->saved.end());
+		expected = { walkedID, removedEntityID };
+		std::sort(expected.begin(), expected.end());
+		TEST_ASSERT(persistence->saved == expected);
+		TEST_ASSERT(persistence->removed == std::vector<DDD::ID>{ removedID });
+		TEST_ASSERT(dirtyModel.getDirtyCount() == 0);
+
+		// Saving explicit IDs only clears those
+		cats[0]->getEntity<CatLeg>(Cat::LEG2)->walk();
+		cats[1]->getEntity<CatLeg>(Cat::LEG2)->walk();
+		TEST_ASSERT(dirtyModel.save({ cats[0]->getID() }));
+		TEST_ASSERT(dirtyModel.getDirtyIDs<Cat>() == std::vector<DDD::ID>{ cats[1]->getID() });
+
+		// IDs that are neither in the model nor removed from it are not passed on,
+		// a stored aggregate that was not loaded must not be removed from the persistence
+		persistence->saved.clear();
+		persistence->removed.clear();
+		TEST_ASSERT(dirtyModel.save({ removedID, 999999 }));
+		TEST_ASSERT(persistence->saved.empty());
+		TEST_ASSERT(persistence->removed.empty());
+
+		// In thread safe mode, aggregates can change while their shard is locked for reading
+		dirtyModel.setThreadSafe(true);
+		TEST_ASSERT(dirtyModel.saveDirty());
+		std::thread walker([&dirtyModel]()
+			{
+				dirtyModel.forEach<Cat>([](Cat& cat) { cat.getEntity<CatLeg>(Cat::LEG3)->walk(); });
+			});
+		dirtyModel.forEach<Cat>([](Cat& cat) { cat.getEntity<CatLeg>(Cat::LEG4)->walk(); });
+		walker.join();
+		TEST_ASSERT(dirtyModel.getDirtyCount() == dirtyModel.size<Cat>());
+		dirtyModel.setThreadSafe(false);
+	}
+
+	TEST_FUNCTION(deletedCacheRetention)
+	{
+		TEST_START;
+
+		DDD::Model<Animal, Cat> cacheModel;
+		auto addCats = [&cacheModel, this](size_t count)
+			{
+				std::vector<DDD::ID> ids;
+				for (size_t i = 0; i < count; ++i)
+				{
+					std::shared_ptr<Cat> cat = catFactory->createAggregate();
+					cacheModel.addAggregate(cat);
+					ids.push_back(cat->getID());
+				}
+				return ids;
+			};
+
+		// Without a policy, everything is kept
+		for (DDD::ID id : addCats(3))
+			TEST_ASSERT(cacheModel.removeAggregate(id));
+		DDD::DeletedCacheStats stats = cacheModel.getDeletedCacheStats();
+		TEST_ASSERT(stats.count == 3);
+		TEST_ASSERT(stats.tombstones == 0);
+		TEST_ASSERT(stats.bytes >= 3 * sizeof(Cat));
+		const size_t catBytes = stats.bytes / 3;
+		cacheModel.clearDeletedAggregates();
+
+		// Count limit, the oldest entries are dropped first
+		DDD::DeletedCachePolicy policy;
+		policy.maxCount = 3;
+		cacheModel.setDeletedCachePolicy(policy);
+		std::vector<DDD::ID> ids = addCats(5);
+		for (DDD::ID id : ids)
+			TEST_ASSERT(cacheModel.removeAggregate(id));
+		TEST_ASSERT(cacheModel.getDeletedIDs<Cat>() == std::vector<DDD::ID>(ids.begin() + 2, ids.end()));
+		stats = cacheModel.getDeletedCacheStats<Cat>();
+		TEST_ASSERT(stats.count == 3);
+		TEST_ASSERT(stats.evicted == 2);
+
+		// Tombstones keep the IDs, but release the aggregates
+		policy.tombstonesOnly = true;
+		cacheModel.setDeletedCachePolicy(policy);
+		stats = cacheModel.getDeletedCacheStats();
+		TEST_ASSERT(stats.count == 3);
+		TEST_ASSERT(stats.tombstones == 3);
+		TEST_ASSERT(stats.bytes == 0);
+		TEST_ASSERT(cacheModel.getDeletedAggregates<Cat>().empty());
+		TEST_ASSERT(cacheModel.getDeletedIDs<Cat>().size() == 3);
+		cacheModel.clearDeletedAggregates();
+
+		// Memory limit
+		policy = DDD::DeletedCachePolicy();
+		policy.maxBytes = 2 * catBytes;
+		cacheModel.setDeletedCachePolicy(policy);
+		for (DDD::ID id : addCats(4))
+			TEST_ASSERT(cacheModel.removeAggregate(id));
+		stats = cacheModel.getDeletedCacheStats();
+		TEST_ASSERT(stats.count == 2);
+		TEST_ASSERT(stats.bytes <= policy.maxBytes);
+		cacheModel.clearDeletedAggregates();
+
+		// Age limit, trimmed by the next removal or explicitly
+		policy = DDD::DeletedCachePolicy();
+		policy.maxAge = std::chrono::milliseconds(1);
+		cacheModel.setDeletedCachePolicy(policy);
+		for (DDD::ID id : addCats(2))
+			TEST_ASSERT(cacheModel.removeAggregate(id));
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		cacheModel.trimDeletedAggregates();
+		TEST_ASSERT(cacheModel.getDeletedCacheStats().count == 0);
+	}
+
+	TEST_FUNCTION(hotPathLog)
+	{
+		TEST_START;
+
+		// Expected misses
+		std::shared_ptr<Cat> cat = catFactory->createAggregate();
+		TEST_ASSERT(model.addAggregate(cat));
+		TEST_ASSERT(model.tryGetAggregate<Cat>(cat->getID()) == cat);
+		TEST_ASSERT(model.tryGetAggregate<Cat>(DDD::INVALID_ID) == nullptr);
+		TEST_ASSERT(std::as_const(model).tryGetAggregate<Cat>(DDD::INVALID_ID) == nullptr);
+
+		// Level filter
+		const DDD::LogLevel oldLevel = DDD::HotPathLog::getLevel();
+		DDD::HotPathLog::setLevel(DDD::LogLevel::Error);
+		TEST_ASSERT(!DDD::HotPathLog::isEnabled(DDD::LogLevel::Warning));
+		TEST_ASSERT(DDD::HotPathLog::isEnabled(DDD::LogLevel::Error) == DDD::HotPathLog::isCompiledIn(DDD::LogLevel::Error));
+		TEST_ASSERT(!DDD::HotPathLog::isCompiledIn(DDD::LogLevel::Off));
+		DDD::HotPathLog::setLevel(oldLevel);
+
+		// Asynchronous writes keep their order
+		std::vector<int> written;
+		DDD::HotPathLog::setAsync(true);
+		for (int i = 0; i < 100; ++i)
+			DDD::HotPathLog::dispatch([&written, i] { written.push_back(i); });
+		DDD::HotPathLog::flush();
+		TEST_ASSERT(written.size() == 100);
+		DDD::HotPathLog::setAsync(false);
+		TEST_ASSERT(!DDD::HotPathLog::isAsync());
+		DDD::HotPathLog::dispatch([&written] { written.push_back(100); });
+		TEST_ASSERT(written.size() == 101);
+		for (int i = 0; i <= 100; ++i)
+			TEST_ASSERT(written[i] == i);
+
+		cat->markDeleted();
+	}
+
+	TEST_FUNCTION(idLeasing)
+	{
+		TEST_START;
+
+		std::vector<std::pair<DDD::ID, DDD::ID>> reserved;
+		std::vector<std::pair<DDD::ID, DDD::ID>> released;
+		DDD::UniqueIDDomain domain(
+			[&reserved](DDD::ID id, DDD::ID amount) { reserved.push_back({ id, amount }); return true; },
+			[&released](DDD::ID id, DDD::ID amount) { released.push_back({ id, amount }); return true; });
+		DDD::IDLeasePolicy policy;
+		policy.minBlockSize = 4;
+		policy.maxBlockSize = 64;
+		domain.setLeasePolicy(policy);
+
+		// IDs stay sequential, the reserve function is only called once per block
+		for (DDD::ID i = 1; i <= 1000; ++i)
+			TEST_ASSERT(domain.getNextID() == i);
+		TEST_ASSERT(domain.getReservationCount() == reserved.size());
+		TEST_ASSERT(reserved.size() < 40);
+		TEST_ASSERT(reserved.front() == std::make_pair(DDD::ID(1), DDD::ID(4)));
+		TEST_ASSERT(reserved.back().second == 64);
+		for (size_t i = 1; i < reserved.size(); ++i)
+			TEST_ASSERT(reserved[i].first == reserved[i - 1].first + reserved[i - 1].second);
+
+		// A range takes the amount of IDs, also when it is larger than a block
+		DDD::ID first = domain.getNextID(10);
+		TEST_ASSERT(first == 1001);
+		TEST_ASSERT(domain.getCurrentID() == 1010);
+		first = domain.getNextID(200);
+		TEST_ASSERT(first == 1011);
+		TEST_ASSERT(domain.getCurrentID() == 1210);
+		TEST_ASSERT(domain.getNextID() == 1211);
+
+		// The unused rest of the block is given back
+		const DDD::ID leased = domain.getLeasedIDCount();
+		const DDD::ID leaseEnd = reserved.back().first + reserved.back().second;
+		TEST_ASSERT(leased == leaseEnd - 1212);
+		TEST_ASSERT(domain.releaseLease());
+		if (leased > 0)
+		{
+			TEST_ASSERT(released.size() == 1);
+			TEST_ASSERT(released[0] == std::make_pair(DDD::ID(1212), leased));
+		}
+		TEST_ASSERT(domain.getLeasedIDCount() == 0);
+		const size_t reservations = domain.getReservationCount();
+		TEST_ASSERT(domain.getNextID() == 1212);
+		TEST_ASSERT(domain.getReservationCount() == reservations + 1);
+
+		// A failed reservation continues behind the reserved range of someone else
+		DDD::UniqueIDDomain contested([](DDD::ID id, DDD::ID) { return id > 16; });
+		contested.setLeasePolicy(policy);
+		TEST_ASSERT(contested.getNextID() == 17);
+		TEST_ASSERT(contested.getNextID() == 18);
+
+		// The retry starts behind the highest reservation, also when it is larger than a block
+		DDD::ID othersHighestID = 70000;
+		DDD::UniqueIDDomain behind(
+			[&othersHighestID](DDD::ID id, DDD::ID amount)
+			{
+				if (id <= othersHighestID)
+					return false;
+				othersHighestID = id + amount - 1;
+				return true;
+			}, nullptr, [&othersHighestID]() { return othersHighestID; });
+		behind.setLeasePolicy(policy);
+		TEST_ASSERT(behind.getNextID() == 70001);
+		TEST_ASSERT(behind.getReservationCount() == 1);
+
+		// No unreserved IDs are handed out
+		DDD::UniqueIDDomain failing([](DDD::ID, DDD::ID) { return false; });
+		TEST_ASSERT(failing.getNextID() == DDD::INVALID_ID);
+		TEST_ASSERT(failing.getCurrentID() == 0);
+
+		class ReadOnlyPersistence : public JsonPersistence
+		{
+		public:
+			bool lockDatabase() override
+			{
+				return false;
+			}
+		};
+		DDD::Model<Animal, Cat> readOnlyModel;
+		readOnlyModel.attachPersistence<ReadOnlyPersistence>();
+		TEST_ASSERT(!readOnlyModel.addAggregate(catFactory->createAggregate()));
+		TEST_ASSERT(readOnlyModel.size<Cat>() == 0);
+	}
+
+	TEST_FUNCTION(atomicIDAllocation)
+	{
+		TEST_START;
+
+		// Worker threads get unique IDs without setThreadSafe()
+		size_t reservedIDs = 0;
+		DDD::UniqueIDDomain domain([&reservedIDs](DDD::ID, DDD::ID amount) { reservedIDs += amount; return true; });
+		for (int i = 0; i < 5; ++i)
+			(void)domain.getNextID();
+		TEST_ASSERT(domain.enableAtomicAllocation());
+		TEST_ASSERT(domain.isAtomicAllocationEnabled());
+		TEST_ASSERT(!domain.isSharedAllocationEnabled());
+		TEST_ASSERT(domain.getNextID() == 6);
+
+		constexpr size_t threadCount = 4;
+		constexpr size_t idsPerThread = 10000;
+		std::vector<std::vector<DDD::ID>> threadIDs(threadCount);
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < threadCount; ++t)
+			threads.emplace_back([&domain, &ids = threadIDs[t]]
+				{
+					for (size_t i = 0; i < idsPerThread; ++i)
+						ids.push_back(i % 10 == 0 ? domain.getNextID(3) : domain.getNextID());
+				});
+		for (auto& thread : threads)
+			thread.join();
+		std::vector<DDD::ID> allIDs;
+		for (const auto& ids : threadIDs)
+		{
+			for (size_t i = 0; i < ids.size(); ++i)
+			{
+				allIDs.push_back(ids[i]);
+				if (i % 10 == 0)
+				{
+					allIDs.push_back(ids[i] + 1);
+					allIDs.push_back(ids[i] + 2);
+				}
+			}
+		}
+		std::sort(allIDs.begin(), allIDs.end());
+		TEST_ASSERT(std::adjacent_find(allIDs.begin(), allIDs.end()) == allIDs.end());
+		TEST_ASSERT(allIDs.front() == 7);
+		TEST_ASSERT(allIDs.back() == domain.getCurrentID());
+		TEST_ASSERT(reservedIDs >= domain.getCurrentID());
+		TEST_ASSERT(domain.getReservationCount() < 100);
+
+		// Back to the leased mode without losing IDs
+		domain.disableAtomicAllocation();
+		TEST_ASSERT(!domain.isAtomicAllocationEnabled());
+		TEST_ASSERT(domain.getNextID() == allIDs.back() + 1);
+
+		// IDs that someone else reserved in between are never handed out, also after several skips
+		std::vector<std::pair<DDD::ID, DDD::ID>> ownRanges;
+		size_t reserveCalls = 0;
+		DDD::UniqueIDDomain contested([&ownRanges, &reserveCalls](DDD::ID id, DDD::ID amount)
+			{
+				// Every second block is taken by another process, the yield lets other threads fetch IDs meanwhile
+				std::this_thread::yield();
+				if (++reserveCalls % 2 == 0)
+					return false;
+				ownRanges.push_back({ id, id + amount });
+				return true;
+			});
+		DDD::IDLeasePolicy smallBlocks;
+		smallBlocks.minBlockSize = 4;
+		smallBlocks.maxBlockSize = 4;
+		contested.setLeasePolicy(smallBlocks);
+		TEST_ASSERT(contested.enableAtomicAllocation());
+		std::vector<std::vector<DDD::ID>> contestedIDs(2 * threadCount);
+		threads.clear();
+		for (auto& ids : contestedIDs)
+			threads.emplace_back([&contested, &ids]
+				{
+					for (size_t i = 0; i < 5000; ++i)
+						ids.push_back(contested.getNextID());
+				});
+		for (auto& thread : threads)
+			thread.join();
+		allIDs.clear();
+		for (const auto& ids : contestedIDs)
+			allIDs.insert(allIDs.end(), ids.begin(), ids.end());
+		std::sort(allIDs.begin(), allIDs.end());
+		TEST_ASSERT(std::adjacent_find(allIDs.begin(), allIDs.end()) == allIDs.end());
+		size_t foreignIDs = 0;
+		for (DDD::ID id : allIDs)
+		{
+			auto range = std::upper_bound(ownRanges.begin(), ownRanges.end(), std::make_pair(id, std::numeric_limits<DDD::ID>::max()));
+			if (range == ownRanges.begin() || id >= std::prev(range)->second)
+				++foreignIDs;
+		}
+		TEST_ASSERT(foreignIDs == 0);
+
+		// Two domains with the same key share the ID space, like two processes
+		const std::string key = "DDD_TST_simple_atomicIDAllocation";
+		DDD::UniqueIDDomain first([](DDD::ID, DDD::ID) { return true; });
+		DDD::UniqueIDDomain second([](DDD::ID, DDD::ID) { return true; });
+		first.setCurrentID(100);
+		if (first.enableAtomicAllocation(key))
+		{
+			TEST_ASSERT(second.enableAtomicAllocation(key));
+			TEST_ASSERT(second.isSharedAllocationEnabled());
+			TEST_ASSERT(second.getNextID() == 101);
+			TEST_ASSERT(first.getNextID() == 102);
+			TEST_ASSERT(second.getNextID(5) == 103);
+			TEST_ASSERT(first.getCurrentID() == 107);
+			first.disableAtomicAllocation();
+			TEST_ASSERT(!first.isSharedAllocationEnabled());
+			TEST_ASSERT(second.getNextID() == 108);
+		}
+
+		// The model continues behind the existing aggregates
+		std::shared_ptr<Cat> cat = catFactory->createAggregate();
+		TEST_ASSERT(model.addAggregate(cat));
+		TEST_ASSERT(model.enableAtomicIDAllocation());
+		std::shared_ptr<Cat> nextCat = catFactory->createAggregate();
+		TEST_ASSERT(model.addAggregate(nextCat));
+		TEST_ASSERT(nextCat->getID() > cat->getID());
+		model.disableAtomicIDAllocation();
+		cat->markDeleted();
+		nextCat->markDeleted();
+	}
+
+	TEST_FUNCTION(lockTable)
+	{
+		TEST_START;
+
+		// The table on its own
+		DDD::AggregateLockTable table;
+		std::shared_ptr<UserLock> lock = std::make_shared<UserLock>();
+		lock->setAggregateID(1);
+		lock->setOwner("alice");
+		TEST_ASSERT(table.insert(lock));
+		TEST_ASSERT(!table.insert(nullptr));
+		TEST_ASSERT(table.contains(1));
+		TEST_ASSERT(table.get(1) == lock);
+		TEST_ASSERT(table.get(2) == nullptr);
+		std::shared_ptr<UserLock> otherLock = std::make_shared<UserLock>();
+		otherLock->setAggregateID(1);
+		otherLock->setOwner("bob");
+		TEST_ASSERT(table.insert(otherLock));
+		TEST_ASSERT(table.size() == 1);
+		TEST_ASSERT(table.getLockCountOfOwner("alice") == 0);
+		TEST_ASSERT(table.getLockCountOfOwner("bob") == 1);
+		TEST_ASSERT(table.getOwners() == std::vector<std::string>{ "bob" });
+		TEST_ASSERT(table.remove(1));
+		TEST_ASSERT(!table.remove(1));
+		TEST_ASSERT(table.empty());
+		TEST_ASSERT(table.getOwners().empty());
+
+		// The model keeps the table in sync with the persistence
+		DDD::Model<Animal, Cat> lockModel;
+		std::shared_ptr<LockingPersistence> persistence = lockModel.attachPersistence<LockingPersistence>();
+		std::vector<DDD::ID> aliceIDs;
+		for (DDD::ID id = 1; id <= 1000; ++id)
+			aliceIDs.push_back(id);
+		std::vector<bool> res = lockModel.lockAggregate(aliceIDs);
+		TEST_ASSERT(std::count(res.begin(), res.end(), true) == 1000);
+		persistence->user = "bob";
+		TEST_ASSERT(lockModel.lockAggregate(DDD::ID(2000)));
+		TEST_ASSERT(!lockModel.lockAggregate(DDD::ID(5)));
+		TEST_ASSERT(lockModel.getLockedAggregateCount() == 1001);
+		TEST_ASSERT(lockModel.isAggregateLocked(500));
+		TEST_ASSERT(!lockModel.isAggregateLocked(1500));
+		TEST_ASSERT(lockModel.getLock(2000)->getOwner() == "bob");
+		TEST_ASSERT(lockModel.getLocksOfOwner("alice").size() == 1000);
+		TEST_ASSERT(lockModel.getLocksOfOwner("carol").empty());
+
+		TEST_ASSERT(lockModel.unlockAggregate(DDD::ID(1)));
+		TEST_ASSERT(!lockModel.isAggregateLocked(1));
+		res = lockModel.unlockAggregate(std::vector<DDD::ID>{ 1, 2, 3 });
+		TEST_ASSERT(res == std::vector<bool>({ false, true, true }));
+		TEST_ASSERT(lockModel.getLockedAggregateCount() == 998);
+
+		// Bulk unlock of one owner
+		TEST_ASSERT(lockModel.unlockAggregatesOfOwner("alice"));
+		TEST_ASSERT(lockModel.getLockedAggregateCount() == 1);
+		TEST_ASSERT(persistence->locks.size() == 1);
+		TEST_ASSERT(lockModel.isAggregateLocked(2000));
+		TEST_ASSERT(lockModel.unlockAggregatesOfOwner("alice"));
+	}
+
+	TEST_FUNCTION(lockDeltas)
+	{
+		TEST_START;
+
+		DDD::Model<Animal, Cat> lockModel;
+		std::shared_ptr<LockingPersistence> persistence = lockModel.attachPersistence<LockingPersistence>();
+		persistence->supportsDeltas = true;
+
+		// One lock at a time, only the new lock gets transferred
+		for (DDD::ID id = 1; id <= 200; ++id)
+			TEST_ASSERT(lockModel.lockAggregate(id));
+		TEST_ASSERT(lockModel.getLockedAggregateCount() == 200);
+		TEST_ASSERT(persistence->transferredLocks == 200);
+
+		// Changes of another client
+		persistence->user = "bob";
+		persistence->lock(std::vector<DDD::ID>{ 300, 301, 302 });
+		persistence->unlock(DDD::ID(5));
+		persistence->unlock(DDD::ID(302));
+		const size_t transferred = persistence->transferredLocks;
+		TEST_ASSERT(lockModel.onPersistenceDataChanged());
+		TEST_ASSERT(persistence->transferredLocks == transferred + 4);
+		TEST_ASSERT(lockModel.getLockedAggregateCount() == 201);
+		TEST_ASSERT(!lockModel.isAggregateLocked(5));
+		TEST_ASSERT(lockModel.isAggregateLocked(301));
+		TEST_ASSERT(!lockModel.isAggregateLocked(302));
+		TEST_ASSERT(lockModel.getLocksOfOwner("bob").size() == 2);
+
+		// Own unlocks are applied locally, the delta repeats them without harm
+		TEST_ASSERT(lockModel.unlockAggregate(DDD::ID(1)));
+		TEST_ASSERT(lockModel.loadLockedObjects());
+		TEST_ASSERT(!lockModel.isAggregateLocked(1));
+		TEST_ASSERT(lockModel.getLockedAggregateCount() == 200);
+
+		// Without deltas, the model falls back to a full reload
+		persistence->supportsDeltas = false;
+		persistence->lock(DDD::ID(400));
+		TEST_ASSERT(lockModel.loadLockedObjects());
+		TEST_ASSERT(lockModel.isAggregateLocked(400));
+		TEST_ASSERT(lockModel.getLockedAggregateCount() == persistence->locks.size());
+	}
+
+	TEST_FUNCTION(writeBehind)
+	{
+		TEST_START;
+
+		struct CountSnapshot : public DDD::AggregateSnapshot
+		{
+			CountSnapshot(const DDD::Aggregate& aggregate)
+				: AggregateSnapshot(aggregate.getID())
+				, entityCount(aggregate.getEntityCount())
+			{}
+			size_t entityCount;
+		};
+		class SnapshotPersistence : public JsonPersistence
+		{
+		public:
+			bool supportsSnapshots() const override
+			{
+				return true;
+			}
+			std::shared_ptr<DDD::AggregateSnapshot> createSnapshot(const DDD::Aggregate& aggregate) override
+			{
+				return std::make_shared<CountSnapshot>(aggregate);
+			}
+			bool saveSnapshots(const std::vector<std::shared_ptr<DDD::AggregateSnapshot>>& snapshots, const std::vector<DDD::ID>& removedIDs) override
+			{
+				++writes;
+				std::lock_guard<std::mutex> lock(gate);
+				if (!succeed)
+					return false;
+				for (const auto& snapshot : snapshots)
+					written[snapshot->getID()] = static_cast<const CountSnapshot&>(*snapshot).entityCount;
+				removed.insert(removed.end(), removedIDs.begin(), removedIDs.end());
+				return true;
+			}
+			std::mutex gate;
+			std::atomic<size_t> writes{ 0 };
+			std::atomic<bool> succeed{ true };
+			std::map<DDD::ID, size_t> written;
+			std::vector<DDD::ID> removed;
+		};
+
+		DDD::Model<Animal, Cat> writeModel;
+		std::shared_ptr<SnapshotPersistence> persistence = writeModel.attachPersistence<SnapshotPersistence>();
+		DDD::WriteBehindPolicy policy;
+		policy.maxQueuedAggregates = 20;
+		policy.blockWhenFull = false;
+		TEST_ASSERT(writeModel.enableWriteBehind(policy));
+		std::vector<std::shared_ptr<Cat>> cats;
+		std::vector<DDD::ID> ids;
+		for (size_t i = 0; i < 10; ++i)
+		{
+			cats.push_back(catFactory->createAggregate());
+			TEST_ASSERT(writeModel.addAggregate(cats.back()));
+			ids.push_back(cats.back()->getID());
+		}
+		const size_t entityCount = cats[0]->getEntityCount();
+
+		// The writer blocks in the persistence, saving only queues
+		persistence->gate.lock();
+		TEST_ASSERT(writeModel.saveDirty());
+		const DDD::WriteBehindQueue::Ticket firstTicket = writeModel.getLastSaveTicket();
+		TEST_ASSERT(firstTicket != 0);
+		TEST_ASSERT(writeModel.getDirtyCount() == 0);
+		while (persistence->writes == 0)
+			std::this_thread::yield();
+
+		// The captured state is written, not the current one
+		TEST_ASSERT(cats[0]->removeEntity(Cat::HEAD));
+		TEST_ASSERT(writeModel.save(std::vector<DDD::ID>(ids.begin(), ids.begin() + 5)));
+		TEST_ASSERT(writeModel.save(std::vector<DDD::ID>(ids.begin(), ids.begin() + 5)));
+		TEST_ASSERT(writeModel.getWriteBehindStats().coalesced == 5);
+		TEST_ASSERT(writeModel.getWriteBehindStats().queued == 15);
+		TEST_ASSERT(!writeModel.awaitDurable(firstTicket, std::chrono::milliseconds(10)));
+
+		// Backpressure
+		std::vector<DDD::ID> newIDs;
+		for (size_t i = 0; i < 10; ++i)
+		{
+			std::shared_ptr<Cat> cat = catFactory->createAggregate();
+			TEST_ASSERT(writeModel.addAggregate(cat));
+			newIDs.push_back(cat->getID());
+		}
+		TEST_ASSERT(!writeModel.save(newIDs));
+		TEST_ASSERT(writeModel.isDirty<Cat>(newIDs[0]));
+
+		persistence->gate.unlock();
+		TEST_ASSERT(writeModel.flushWrites());
+		TEST_ASSERT(writeModel.awaitDurable(firstTicket));
+		TEST_ASSERT(persistence->written.size() == 10);
+		TEST_ASSERT(persistence->written[ids[0]] == entityCount - 1);
+		TEST_ASSERT(persistence->written[ids[9]] == entityCount);
+		TEST_ASSERT(writeModel.getWriteBehindStats().written == 15);
+		TEST_ASSERT(writeModel.getWriteBehindStats().queued == 0);
+		TEST_ASSERT(writeModel.saveDirty());
+
+		// Failed writes stay queued
+		persistence->succeed = false;
+		cats[1]->markDeleted();
+		TEST_ASSERT(writeModel.saveDirty());
+		TEST_ASSERT(!writeModel.flushWrites());
+		TEST_ASSERT(writeModel.getWriteBehindStats().failedWrites > 0);
+		persistence->succeed = true;
+		while (!writeModel.flushWrites())
+		{
+		}
+		TEST_ASSERT(persistence->removed == std::vector<DDD::ID>{ ids[1] });
+
+		// Synchronous saves again
+		writeModel.disableWriteBehind();
+		TEST_ASSERT(!writeModel.isWriteBehindEnabled());
+		TEST_ASSERT(writeModel.getLastSaveTicket() == 0);
+
+		// The writer thread would read the aggregates while they change
+		DDD::Model<Animal, Cat> plainModel;
+		plainModel.attachPersistence<JsonPersistence>();
+		TEST_ASSERT(!plainModel.enableWriteBehind());
+		TEST_ASSERT(!plainModel.isWriteBehindEnabled());
+	}
+
+
+	TEST_FUNCTION(binarySnapshot)
+	{
+		TEST_START;
+
+		using SnapshotModel = DDD::Model<Animal, Cat>;
+		const std::string path = (std::filesystem::temp_directory_path() / "DDD_TST_binarySnapshot.bin").string();
+		const size_t catCount = 3000;
+
+		SnapshotModel source;
+		std::shared_ptr<SerializingCatFactory> sourceCatFactory = source.createFactory<SerializingCatFactory>();
+		std::shared_ptr<AnimalFactory> sourceAnimalFactory = source.createFactory<AnimalFactory>();
+		std::vector<DDD::ID> ids;
+		for (size_t i = 0; i < catCount; ++i)
+		{
+			std::shared_ptr<Cat> cat = sourceCatFactory->createAggregate();
+			TEST_ASSERT(source.addAggregate(cat));
+			ids.push_back(cat->getID());
+		}
+
+		// The AnimalFactory can't write snapshots
+		std::shared_ptr<Animal> animal = sourceAnimalFactory->createAggregate();
+		TEST_ASSERT(source.addAggregate(animal));
+		TEST_ASSERT(!source.saveBinarySnapshot(path));
+		TEST_ASSERT(source.removeAggregate(animal->getID()));
+		TEST_ASSERT(source.saveBinarySnapshot(path));
+
+		// Index the IDs without creating aggregates
+		DDD::BinarySnapshotFile snapshot;
+		TEST_ASSERT(snapshot.open(path));
+		TEST_ASSERT(snapshot.getSectionCount() == 1);
+		TEST_ASSERT(snapshot.getHighestID() == source.getIDDomain().getCurrentID());
+		const size_t section = snapshot.findSection(CatFactory::getAggregateName());
+		TEST_ASSERT(section != DDD::BinarySnapshotFile::npos);
+		TEST_ASSERT(snapshot.findSection(AnimalFactory::getAggregateName()) == DDD::BinarySnapshotFile::npos);
+		TEST_ASSERT(snapshot.getTypeVersion(section) == 2);
+		TEST_ASSERT(snapshot.getRecordCount(section) == catCount);
+		TEST_ASSERT(snapshot.getIDs(section) == ids);
+		TEST_ASSERT(snapshot.findRecord(section, ids[10]) == 10);
+		TEST_ASSERT(snapshot.findRecord(section, animal->getID()) == DDD::BinarySnapshotFile::npos);
+
+		// Load single aggregates on demand
+		SnapshotModel target;
+		std::shared_ptr<SerializingCatFactory> targetFactory = target.createFactory<SerializingCatFactory>();
+		TEST_ASSERT(target.loadBinarySnapshot(snapshot, std::vector<DDD::ID>{ ids[5], ids[7] }));
+		TEST_ASSERT(target.size<Cat>() == 2);
+		TEST_ASSERT(target.contains<Cat>(ids[5]));
+		TEST_ASSERT(target.getDirtyCount() == 0);
+		TEST_ASSERT(targetFactory->names.count("Cat " + std::to_string(ids[7])) == 1);
+		TEST_ASSERT(!target.loadBinarySnapshot(snapshot, std::vector<DDD::ID>{ ids[8], animal->getID() }));
+		TEST_ASSERT(target.size<Cat>() == 2);
+
+		// Load all of them in parallel, the loaded ones get replaced
+		std::shared_ptr<Cat> loaded = target.getAggregate<Cat>(ids[5]);
+		TEST_ASSERT(target.loadBinarySnapshot(path, 4));
+		TEST_ASSERT(target.size<Cat>() == catCount);
+		TEST_ASSERT(target.getIDs<Cat>().size() == catCount);
+		TEST_ASSERT(target.getAggregate<Cat>(ids[5]) != loaded);
+		TEST_ASSERT(target.getDirtyCount() == 0);
+		TEST_ASSERT(targetFactory->names.size() == catCount);
+
+		// The aggregates that were created on the worker threads belong to this thread
+		std::shared_ptr<Cat> lastCat = target.getAggregate<Cat>(ids.back());
+		TEST_ASSERT(lastCat->thread() == QThread::currentThread());
+		TEST_ASSERT(lastCat->getEntity(Cat::HEAD)->thread() == QThread::currentThread());
+		std::shared_ptr<Cat> newCat = targetFactory->createAggregate();
+		TEST_ASSERT(target.addAggregate(newCat));
+		TEST_ASSERT(newCat->getID() > snapshot.getHighestID());
+
+		// Invalid files are rejected
+		snapshot.close();
+		const std::string truncatedPath = path + ".truncated";
+		{
+			std::ifstream in(path, std::ios::binary);
+			std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			std::ofstream out(truncatedPath, std::ios::binary | std::ios::trunc);
+			out.write(data.data(), data.size() - 8);
+		}
+		TEST_ASSERT(!snapshot.open(truncatedPath));
+		TEST_ASSERT(!target.loadBinarySnapshot(truncatedPath));
+		std::filesystem::remove(truncatedPath);
+		std::filesystem::remove(path);
+	}
+
+	TEST_FUNCTION(journal)
+	{
+		TEST_START;
+
+		using JournalModel = DDD::Model<Animal, Cat>;
+		const std::filesystem::path folder = std::filesystem::temp_directory_path();
+		const std::string journalPath = (folder / "DDD_TST_journal.log").string();
+		const std::string snapshotPath = (folder / "DDD_TST_journal.bin").string();
+		std::filesystem::remove(journalPath);
+		std::filesystem::remove(snapshotPath);
+
+		std::vector<DDD::ID> ids;
+		{
+			JournalModel writer;
+			std::shared_ptr<SerializingCatFactory> factory = writer.createFactory<SerializingCatFactory>();
+			TEST_ASSERT(writer.openJournal(journalPath, snapshotPath));
+			TEST_ASSERT(writer.isJournalEnabled());
+			TEST_ASSERT(std::filesystem::exists(snapshotPath));
+
+			std::vector<std::shared_ptr<Cat>> cats;
+			for (size_t i = 0; i < 10; ++i)
+			{
+				cats.push_back(factory->createAggregate());
+				TEST_ASSERT(writer.addAggregate(cats.back()));
+				ids.push_back(cats.back()->getID());
+			}
+			TEST_ASSERT(writer.saveDirty());
+			TEST_ASSERT(writer.getDirtyCount() == 0);
+			TEST_ASSERT(writer.getJournalStats().records == 10);
+			TEST_ASSERT(writer.getJournalStats().syncs >= 1);
+
+			// Entity changes and removals
+			TEST_ASSERT(writer.removeAggregate(ids[0]));
+			cats[1]->getEntity<CatLeg>(Cat::LEG1)->walk();
+			TEST_ASSERT(writer.saveDirty());
+			TEST_ASSERT(writer.getJournalStats().records == 12);
+			writer.closeJournal();
+			TEST_ASSERT(!writer.isJournalEnabled());
+		}
+
+		// A crash during a write leaves a torn record behind
+		{
+			std::ofstream out(journalPath, std::ios::binary | std::ios::app);
+			out.write("\x10\0\0\0torn", 8);
+		}
+
+		// Restart: the empty checkpoint plus the journal
+		{
+			JournalModel reader;
+			std::shared_ptr<SerializingCatFactory> factory = reader.createFactory<SerializingCatFactory>();
+			TEST_ASSERT(reader.openJournal(journalPath, snapshotPath));
+			TEST_ASSERT(reader.size<Cat>() == 9);
+			TEST_ASSERT(!reader.contains(ids[0]));
+			TEST_ASSERT(reader.contains<Cat>(ids[9]));
+			TEST_ASSERT(reader.getDirtyCount() == 0);
+			TEST_ASSERT(factory->names.count("Cat " + std::to_string(ids[9])) == 1);
+
+			// The replayed records went into a new checkpoint
+			TEST_ASSERT(reader.getJournalStats().records == 0);
+			std::shared_ptr<Cat> cat = factory->createAggregate();
+			TEST_ASSERT(reader.addAggregate(cat));
+			TEST_ASSERT(cat->getID() > ids.back());
+			ids.push_back(cat->getID());
+
+			// Automatic checkpoints
+			DDD::JournalPolicy policy;
+			policy.checkpointSize = 1;
+			reader.closeJournal();
+			TEST_ASSERT(reader.openJournal(journalPath, snapshotPath, policy));
+			TEST_ASSERT(reader.saveDirty());
+			TEST_ASSERT(reader.getJournalStats().checkpoints == 1);
+			TEST_ASSERT(reader.getJournalStats().records == 0);
+		}
+
+		// Restart from the checkpoint alone
+		{
+			JournalModel reader;
+			reader.createFactory<SerializingCatFactory>();
+			TEST_ASSERT(reader.openJournal(journalPath, snapshotPath));
+			TEST_ASSERT(reader.size<Cat>() == 10);
+			TEST_ASSERT(reader.contains<Cat>(ids.back()));
+			TEST_ASSERT(reader.save());
+			TEST_ASSERT(reader.getJournalStats().checkpoints == 1);
+		}
+
+		// A crash between a checkpoint and the truncation leaves the old journal behind
+		const std::string oldJournalPath = journalPath + ".old";
+		{
+			JournalModel writer;
+			std::shared_ptr<SerializingCatFactory> factory = writer.createFactory<SerializingCatFactory>();
+			TEST_ASSERT(writer.openJournal(journalPath, snapshotPath));
+			std::shared_ptr<Cat> cat = factory->createAggregate();
+			TEST_ASSERT(writer.addAggregate(cat));
+			TEST_ASSERT(writer.saveDirty());
+			std::filesystem::copy_file(journalPath, oldJournalPath, std::filesystem::copy_options::overwrite_existing);
+			TEST_ASSERT(writer.removeAggregate(cat->getID()));
+			TEST_ASSERT(writer.checkpoint());
+			writer.closeJournal();
+			std::filesystem::copy_file(oldJournalPath, journalPath, std::filesystem::copy_options::overwrite_existing);
+			std::filesystem::remove(oldJournalPath);
+
+			JournalModel reader;
+			reader.createFactory<SerializingCatFactory>();
+			TEST_ASSERT(reader.openJournal(journalPath, snapshotPath));
+			TEST_ASSERT(reader.size<Cat>() == 10);
+			TEST_ASSERT(!reader.contains(cat->getID()));
+		}
+
+		// A journal that ends inside its header has no records
+		{
+			std::filesystem::resize_file(journalPath, 10);
+			JournalModel reader;
+			reader.createFactory<SerializingCatFactory>();
+			TEST_ASSERT(reader.openJournal(journalPath, snapshotPath));
+			TEST_ASSERT(reader.size<Cat>() == 10);
+			TEST_ASSERT(reader.getJournalStats().records == 0);
+		}
+
+		// Records that arrive while the writer waits are synced together
+		{
+			DDD::JournalPolicy policy;
+			policy.groupCommitDelay = std::chrono::milliseconds(50);
+			DDD::AggregateJournal journal(policy);
+			TEST_ASSERT(journal.create(journalPath, { { "Cat", 2 } }));
+			DDD::BinarySnapshotOutput output;
+			output.write<uint64_t>(42);
+			std::vector<std::thread> threads;
+			for (size_t t = 0; t < 4; ++t)
+				threads.emplace_back([&journal, &output]()
+					{
+						for (DDD::ID id = 1; id <= 25; ++id)
+							journal.appendPut(id, 0, output);
+					});
+			for (auto& thread : threads)
+				thread.join();
+			TEST_ASSERT(journal.flush());
+			TEST_ASSERT(journal.getStats().records == 100);
+			TEST_ASSERT(journal.getStats().syncs < 100);
+			journal.close();
+
+			std::vector<DDD::AggregateJournal::TypeInfo> types;
+			size_t records = 0;
+			TEST_ASSERT(DDD::AggregateJournal::read(journalPath, types, [&records](const DDD::AggregateJournal::Record& record)
+				{
+					uint64_t value = 0;
+					DDD::BinarySnapshotInput data = record.data;
+					if (data.read(value) && value == 42 && data.getTypeVersion() == 2)
+						++records;
+					return true;
+				}));
+			TEST_ASSERT(types.size() == 1 && types[0].name == "Cat");
+			TEST_ASSERT(records == 100);
+		}
+		std::filesystem::remove(journalPath);
+		std::filesystem::remove(snapshotPath);
+	}
+
+	TEST_FUNCTION(lazyLoading)
+	{
+		TEST_START;
+
+		AnimalModel lazyModel;
+		std::shared_ptr<CatFactory> factory = lazyModel.createFactory<CatFactory>();
+		TEST_ASSERT(!lazyModel.enableLazyLoading());
+		lazyModel.attachPersistence<JsonPersistence>();
+		TEST_ASSERT(!lazyModel.enableLazyLoading());
+
+		std::shared_ptr<CatalogPersistence> persistence = lazyModel.attachPersistence<CatalogPersistence>();
+		persistence->model = &lazyModel;
+		persistence->factory = factory;
+		for (DDD::ID id = 1001; id <= 1100; ++id)
+			persistence->stored.insert(id);
+
+		// Saving a stored aggregate that was not loaded keeps it stored
+		TEST_ASSERT(lazyModel.save({ 1005 }));
+		TEST_ASSERT(persistence->stored.contains(1005));
+		TEST_ASSERT(lazyModel.enableLazyLoading());
+		TEST_ASSERT(lazyModel.isLazyLoadingEnabled());
+		TEST_ASSERT(lazyModel.size<Cat>() == 0);
+		TEST_ASSERT(lazyModel.getLazyLoadStats().catalogued == 100);
+
+		// Misses load the aggregate once, it is not dirty afterwards
+		std::shared_ptr<Cat> cat = lazyModel.getAggregate<Cat>(1001);
+		TEST_ASSERT(cat && cat->getID() == 1001);
+		TEST_ASSERT(lazyModel.getAggregate<Cat>(1001) == cat);
+		TEST_ASSERT(persistence->getLoadCount() == 1);
+		TEST_ASSERT(lazyModel.size<Cat>() == 1);
+		TEST_ASSERT(lazyModel.getDirtyCount() == 0);
+		TEST_ASSERT(lazyModel.getAggregate(1002) != nullptr);
+		TEST_ASSERT(persistence->getLoadCount() == 2);
+
+		// Wrong types and unknown IDs are not loaded
+		TEST_ASSERT(lazyModel.getAggregate<Animal>(1003) == nullptr);
+		TEST_ASSERT(lazyModel.getAggregate<Cat>(5000) == nullptr);
+		TEST_ASSERT(lazyModel.getAggregate(5000) == nullptr);
+		TEST_ASSERT(persistence->getLoadCount() == 2);
+
+		// A list is loaded with one call
+		std::vector<DDD::ID> ids;
+		for (DDD::ID id = 1010; id < 1020; ++id)
+			ids.push_back(id);
+		TEST_ASSERT(lazyModel.getAggregates<Cat>(ids).size() == 10);
+		TEST_ASSERT(persistence->getLoadCount() == 3);
+		TEST_ASSERT(persistence->loadCalls.back().size() == 10);
+		TEST_ASSERT(lazyModel.getLazyLoadStats().catalogued == 88);
+
+		// Removing an aggregate that is not loaded yet
+		TEST_ASSERT(lazyModel.removeAggregate(1050));
+		TEST_ASSERT(!lazyModel.removeAggregate(1050));
+		TEST_ASSERT(lazyModel.isDirty<Cat>(1050));
+		TEST_ASSERT(lazyModel.getAggregate<Cat>(1050) == nullptr);
+		TEST_ASSERT(persistence->getLoadCount() == 3);
+
+		// New aggregates don't reuse catalogued IDs
+		std::shared_ptr<Cat> newCat = factory->createAggregate();
+		TEST_ASSERT(lazyModel.addAggregate(newCat));
+		TEST_ASSERT(newCat->getID() > 1100);
+
+		// The removal reaches the persistence, catalogued aggregates are not touched
+		TEST_ASSERT(lazyModel.save({ 1050, 1051, newCat->getID() }));
+		TEST_ASSERT(!persistence->stored.contains(1050));
+		TEST_ASSERT(persistence->stored.contains(1051));
+		TEST_ASSERT(persistence->saved == std::vector<DDD::ID>{ newCat->getID() });
+
+		// Concurrent misses share the loads
+		lazyModel.setThreadSafe(true);
+		persistence->loadDelay = std::chrono::milliseconds(20);
+		const size_t loadsBefore = persistence->getLoadCount();
+		std::atomic<bool> start = false;
+		std::atomic<size_t> found = 0;
+		std::vector<std::thread> threads;
+		for (DDD::ID i = 0; i < 8; ++i)
+			threads.emplace_back([&lazyModel, &start, &found, i]()
+				{
+					while (!start)
+						std::this_thread::yield();
+					if (lazyModel.getAggregate<Cat>(1060 + i))
+						++found;
+				});
+		start = true;
+		for (auto& thread : threads)
+			thread.join();
+		TEST_ASSERT(found == 8);
+		TEST_ASSERT(persistence->getLoadCount() - loadsBefore < 8);
+		TEST_ASSERT(lazyModel.getLazyLoadStats().faults == 20);
+
+		// A removal waits for the running load of the aggregate, the load does not bring it back
+		const size_t loadsBeforeRemoval = persistence->getLoadCount();
+		std::thread loader([&lazyModel]() { DDD_UNUSED(lazyModel.getAggregate<Cat>(1070)); });
+		while (persistence->getLoadCount() == loadsBeforeRemoval)
+			std::this_thread::yield();
+		TEST_ASSERT(lazyModel.removeAggregate(1070));
+		loader.join();
+		TEST_ASSERT(!lazyModel.contains(1070));
+		TEST_ASSERT(lazyModel.isDirty<Cat>(1070));
+		lazyModel.setThreadSafe(false);
+
+		// A full save removes the aggregates that were removed, loaded or not
+		TEST_ASSERT(lazyModel.removeAggregate(1080));
+		TEST_ASSERT(lazyModel.save());
+		TEST_ASSERT(!persistence->stored.contains(1070));
+		TEST_ASSERT(!persistence->stored.contains(1080));
+		TEST_ASSERT(persistence->stored.contains(1081));
+		TEST_ASSERT(lazyModel.getDirtyCount() == 0);
+
+		lazyModel.disableLazyLoading();
+		TEST_ASSERT(lazyModel.getAggregate<Cat>(1099) == nullptr);
+	}
+
+	TEST_FUNCTION(eviction)
+	{
+		TEST_START;
+
+		AnimalModel evictingModel;
+		std::shared_ptr<CatFactory> factory = evictingModel.createFactory<CatFactory>();
+		std::shared_ptr<CatalogPersistence> persistence = evictingModel.attachPersistence<CatalogPersistence>();
+		persistence->model = &evictingModel;
+		persistence->factory = factory;
+		for (DDD::ID id = 2001; id <= 2100; ++id)
+			persistence->stored.insert(id);
+
+		DDD::EvictionPolicy policy;
+		policy.maxCount = 10;
+		policy.targetRatio = 0.5;
+		TEST_ASSERT(!evictingModel.setEvictionPolicy(policy));
+		TEST_ASSERT(evictingModel.enableLazyLoading());
+		TEST_ASSERT(evictingModel.setEvictionPolicy(policy));
+		TEST_ASSERT(evictingModel.isEvictionEnabled());
+
+		for (DDD::ID id = 2001; id <= 2010; ++id)
+			TEST_ASSERT(evictingModel.getAggregate<Cat>(id) != nullptr);
+		TEST_ASSERT(evictingModel.size<Cat>() == 10);
+		TEST_ASSERT(evictingModel.getEvictionStats().passes == 0);
+
+		// The 11th aggregate exceeds the budget, the least recently used ones get evicted down to 5
+		TEST_ASSERT(evictingModel.getAggregate<Cat>(2001) != nullptr);
+		TEST_ASSERT(evictingModel.getAggregate<Cat>(2011) != nullptr);
+		TEST_ASSERT(evictingModel.size<Cat>() == 5);
+		TEST_ASSERT(evictingModel.getEvictionStats().passes == 1);
+		TEST_ASSERT(evictingModel.getEvictionStats().evicted == 6);
+		TEST_ASSERT(evictingModel.contains<Cat>(2001));
+		TEST_ASSERT(evictingModel.contains<Cat>(2011));
+		TEST_ASSERT(!evictingModel.contains<Cat>(2002));
+		TEST_ASSERT(evictingModel.getDirtyCount() == 0);
+		TEST_ASSERT(evictingModel.getLazyLoadStats().catalogued == 95);
+
+		// Evicted aggregates get loaded again
+		const size_t loads = persistence->getLoadCount();
+		TEST_ASSERT(evictingModel.getAggregate<Cat>(2002) != nullptr);
+		TEST_ASSERT(persistence->getLoadCount() == loads + 1);
+
+		// Referenced and locked aggregates stay, dirty ones are saved first
+		std::shared_ptr<Cat> held = evictingModel.getAggregate<Cat>(2008);
+		evictingModel.getAggregate<Cat>(2009)->getEntity<CatLeg>(Cat::LEG1)->walk();
+		TEST_ASSERT(evictingModel.isDirty<Cat>(2009));
+		TEST_ASSERT(evictingModel.lockAggregate(2010));
+		policy.maxCount = 1;
+		policy.targetRatio = 1.0;
+		TEST_ASSERT(evictingModel.setEvictionPolicy(policy));
+		TEST_ASSERT(evictingModel.evict() > 0);
+		TEST_ASSERT(evictingModel.contains<Cat>(2008));
+		TEST_ASSERT(evictingModel.contains<Cat>(2010));
+		TEST_ASSERT(!evictingModel.contains<Cat>(2009));
+		TEST_ASSERT(std::find(persistence->saved.begin(), persistence->saved.end(), 2009) != persistence->saved.end());
+		TEST_ASSERT(evictingModel.getEvictionStats().saved == 1);
+		TEST_ASSERT(evictingModel.getEvictionStats().skipped >= 2);
+		TEST_ASSERT(evictingModel.getDirtyCount() == 0);
+		TEST_ASSERT(evictingModel.unlockAggregate(2010));
+		held.reset();
+
+		// Memory budget
+		const size_t catBytes = sizeof(Cat) + evictingModel.getAggregate<Cat>(2010)->getApproximateHeapSize();
+		policy.maxCount = 0;
+		policy.maxBytes = catBytes * 8;
+		policy.targetRatio = 0.5;
+		TEST_ASSERT(evictingModel.setEvictionPolicy(policy));
+		for (DDD::ID id = 2020; id < 2040; ++id)
+			TEST_ASSERT(evictingModel.getAggregate<Cat>(id) != nullptr);
+		TEST_ASSERT(evictingModel.size<Cat>() <= 8);
+		TEST_ASSERT(evictingModel.contains<Cat>(2039));
+
+		// A list larger than the budget is returned whole, the loaded aggregates stay until they are taken
+		std::vector<DDD::ID> listIDs;
+		for (DDD::ID id = 2050; id < 2062; ++id)
+			listIDs.push_back(id);
+		TEST_ASSERT(evictingModel.getAggregates<Cat>(listIDs).size() == listIDs.size());
+
+		// Concurrent lookups while aggregates get evicted
+		policy.maxBytes = 0;
+		policy.maxCount = 20;
+		TEST_ASSERT(evictingModel.setEvictionPolicy(policy));
+		evictingModel.setThreadSafe(true);
+		std::atomic<size_t> found = 0;
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < 4; ++t)
+			threads.emplace_back([&evictingModel, &found, t]()
+				{
+					for (DDD::ID i = 0; i < 200; ++i)
+						if (evictingModel.getAggregate<Cat>(2001 + (i * 7 + t * 13) % 100))
+							++found;
+				});
+
+		// The evictions read the locks while they change
+		for (DDD::ID i = 0; i < 200; ++i)
+		{
+			TEST_ASSERT(evictingModel.lockAggregate(2001 + i % 100));
+			TEST_ASSERT(evictingModel.unlockAggregate(2001 + i % 100));
+		}
+		for (auto& thread : threads)
+			thread.join();
+		TEST_ASSERT(found == 800);
+		TEST_ASSERT(evictingModel.size<Cat>() <= 20);
+		evictingModel.setThreadSafe(false);
+	}
 };
 
 TEST_INSTANTIATE(TST_simple);
\ No newline at end of file
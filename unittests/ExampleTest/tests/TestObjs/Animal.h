@@ -19,36 +19,35 @@ public:
 	std::string getInfo() const override
 	{
 		std::string msg;
-		std::vector<std::shared_ptr<Entity>> entities = getEntities();
 		msg += "ID: " + getIDString() + "\n";
-		for (const std::shared_ptr<Entity>& e : entities)
-		{
-			const IInfo* ie = dynamic_cast<const IInfo*>(e.get());
-			if (ie)
+		forEachEntity([&msg](const Entity& e)
 			{
-				msg += "Entity[" + std::to_string(e->getID()) + "]: " + ie->getInfo() + "\n";
-				continue;
-			}
-
-			const Leg* leg = dynamic_cast<const Leg*>(e.get());
-			if (leg)
-			{
-				msg += "Entity[" + std::to_string(e->getID()) + "]: " + leg->getInfo() + "\n";
-				continue;
-			}
-			const Body* body = dynamic_cast<const Body*>(e.get());
-			if (body)
-			{
-				msg += "Entity[" + std::to_string(e->getID()) + "]: " + body->getInfo() + "\n";
-				continue;
-			}
-			const Head* head = dynamic_cast<const Head*>(e.get());
-			if (head)
-			{
-				msg += "Entity[" + std::to_string(e->getID()) + "]: " + head->getInfo() + "\n";
-				continue;
-			}
-		}
+				const IInfo* ie = dynamic_cast<const IInfo*>(&e);
+				if (ie)
+				{
+					msg += "Entity[" + std::to_string(e.getID()) + "]: " + ie->getInfo() + "\n";
+					return;
+				}
+
+				const Leg* leg = dynamic_cast<const Leg*>(&e);
+				if (leg)
+				{
+					msg += "Entity[" + std::to_string(e.getID()) + "]: " + leg->getInfo() + "\n";
+					return;
+				}
+				const Body* body = dynamic_cast<const Body*>(&e);
+				if (body)
+				{
+					msg += "Entity[" + std::to_string(e.getID()) + "]: " + body->getInfo() + "\n";
+					return;
+				}
+				const Head* head = dynamic_cast<const Head*>(&e);
+				if (head)
+				{
+					msg += "Entity[" + std::to_string(e.getID()) + "]: " + head->getInfo() + "\n";
+					return;
+				}
+			});
 		return msg;
 	}
 
@@ -91,11 +90,10 @@ public:
 	std::shared_ptr<DDD::ServiceExecutionResult> execute() override
 	{
 		std::cout << "AnimalService::execute " << getRepository()->size() << std::endl;
-		std::vector<std::shared_ptr<Animal>> animals = getAggregates();
-		for (const auto &animal : animals)
-		{
-			std::cout << animal->getInfo() << "\n";
-		}
+		forEachAggregate([](const Animal& animal)
+			{
+				std::cout << animal.getInfo() << "\n";
+			});
 		return std::make_shared<DDD::ServiceExecutionResult>();
 	}
 protected:
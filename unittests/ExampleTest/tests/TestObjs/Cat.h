@@ -56,13 +56,14 @@ public:
 	Cat()
 		: Animal()
 	{
-		legs.push_back(std::make_shared<CatLeg>(LEG1));
-		legs.push_back(std::make_shared<CatLeg>(LEG2));
-		legs.push_back(std::make_shared<CatLeg>(LEG3));
-		legs.push_back(std::make_shared<CatLeg>(LEG4));
+		legs.reserve(4);
+		legs.push_back(DDD::makePooled<CatLeg>(LEG1));
+		legs.push_back(DDD::makePooled<CatLeg>(LEG2));
+		legs.push_back(DDD::makePooled<CatLeg>(LEG3));
+		legs.push_back(DDD::makePooled<CatLeg>(LEG4));
 
-		body = std::make_shared<CatBody>(BODY);
-		head = std::make_shared<CatHead>(HEAD);
+		body = DDD::makePooled<CatBody>(BODY);
+		head = DDD::makePooled<CatHead>(HEAD);
 
 		addEntity(legs[0]);
 		addEntity(legs[1]);
@@ -85,7 +86,7 @@ public:
 
 	std::shared_ptr<Cat> createAggregate()
 	{
-		return std::make_shared<Cat>();
+		return createPooledAggregate();
 	}
 protected:
 
@@ -104,11 +105,10 @@ public:
 	std::shared_ptr<DDD::ServiceExecutionResult> execute() override
 	{
 		std::cout << "CatService::execute " << getRepository()->size() << std::endl;
-		std::vector<std::shared_ptr<Cat>> animals = getAggregates();
-		for (const auto& animal : animals)
-		{
-			std::cout << animal->getInfo() << "\n";
-		}
+		forEachAggregate([](const Cat& animal)
+			{
+				std::cout << animal.getInfo() << "\n";
+			});
 		return std::make_shared<DDD::ServiceExecutionResult>();
 	}
 protected: